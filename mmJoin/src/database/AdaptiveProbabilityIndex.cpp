@@ -2,7 +2,6 @@
 
 #include <random>
 
-#include "../util/StatelessFenwickTree.h"
 
 AdaptiveProbabilityIndex::AdaptiveProbabilityIndex(std::shared_ptr<TableGeneric> Table1, std::shared_ptr<TableGeneric> Table2, std::shared_ptr<TableGeneric> Table3)
 {
@@ -13,7 +12,6 @@ AdaptiveProbabilityIndex::AdaptiveProbabilityIndex(std::shared_ptr<TableGeneric>
     m_data[2] = Table3;
 
     // build the index
-    m_probability_index.resize(3);
     m_data.resize(3);
 
     // we can build everything in reverse, so we can get an idea of how data
@@ -42,10 +40,7 @@ AdaptiveProbabilityIndex::AdaptiveProbabilityIndex(std::shared_ptr<TableGeneric>
     this->initial_AGM = (int64_t)10000 * 10000 * 10000;
 
     //m_probability_index[0].resize(Table1->get_size(), std::min(Table2->get_size(), Table3->get_size()));
-    m_probability_index[0].resize(Table1->get_size(), (int64_t)Table2->get_size() * (int64_t)Table3->get_size());
-
-    // build the stateless Fenwick tree on the initial group
-    StatelessFenwickTree::initialize(&m_probability_index[0][0], m_probability_index[0].size());
+    m_probability_index.assign(Table1->get_size(), (int64_t)Table2->get_size() * (int64_t)Table3->get_size());
 
     //this->default_round2_AGM = std::min(Table2->get_size(), Table3->get_size());
     //this->initial_AGM = this->default_round2_AGM * Table1->get_size();
@@ -77,8 +72,7 @@ SAMPLE_STATUS AdaptiveProbabilityIndex::sample_join(std::vector<int>& table_inde
     SAMPLE_STATUS ret_val = GOOD_S;
 
     // find the index which corresponds to the random int generated
-    auto index1 = StatelessFenwickTree::findG_mod(&m_probability_index[0][0], m_probability_index[0].size(), rvalue);
-    //int64_t frequency1 = StatelessFenwickTree::read_value(&m_probability_index[0][0], index1);
+    auto index1 = m_probability_index.find(rvalue);
 
     table_indexes[0] = index1;
 
@@ -94,14 +88,12 @@ SAMPLE_STATUS AdaptiveProbabilityIndex::sample_join(std::vector<int>& table_inde
 
         new_point.value = value1;
 
-        new_point.m_frequencies.resize(m_data[1]->count_cardinality(value1), this->default_round2_AGM);
-        if(new_point.m_frequencies.size() > 0)
-            StatelessFenwickTree::initialize(&new_point.m_frequencies[0], new_point.m_frequencies.size());
+        new_point.m_frequencies.assign(m_data[1]->count_cardinality(value1), this->default_round2_AGM);
 
         new_point.max_frequency = this->default_round2_AGM * new_point.m_frequencies.size();
 
         //m_maxFrequency.insert_or_assign(value1, new_point);
-        m_maxFrequency[value1] = new_point;
+        m_maxFrequency[value1] = std::move(new_point);
 
         idx_S = m_maxFrequency.find(value1);
     }
@@ -118,8 +110,7 @@ SAMPLE_STATUS AdaptiveProbabilityIndex::sample_join(std::vector<int>& table_inde
     // we can find the tuple in 'S' we will select
     if (!rejected)
     {
-        auto offset2 = StatelessFenwickTree::findG_mod(&idx_S->second.m_frequencies[0], idx_S->second.m_frequencies.size(), rvalue);
-        //int64_t frequency2 = StatelessFenwickTree::read_value(&idx_S->second.m_frequencies[0], offset2);
+        auto offset2 = idx_S->second.m_frequencies.find(rvalue);
 
         //rvalue -= frequency2;
 
@@ -154,38 +145,20 @@ SAMPLE_STATUS AdaptiveProbabilityIndex::sample_join(std::vector<int>& table_inde
 
         // update the frequency for the 'S' table.  Only update if it decreases
         // the weight.
-        // if it is the last element in the array
-        if (offset2 + 1 == idx_S->second.m_frequencies.size())
-        {
-            int64_t last_largest_weight{ 0 };
-            if (idx_S->second.m_frequencies.size() > 1)
-                last_largest_weight = StatelessFenwickTree::read_value(&idx_S->second.m_frequencies[0], idx_S->second.m_frequencies.size() - 1);
-
-            idx_S->second.max_frequency = last_largest_weight + idx_T->second;
-            // since we are using exclusive fenwick tree, we don't need to update the tree
-        }
-        else
-        {
-            int64_t weight2 = StatelessFenwickTree::readSingle_value(&idx_S->second.m_frequencies[0], offset2+1);
-            StatelessFenwickTree::update_add_value(&idx_S->second.m_frequencies[0], idx_S->second.m_frequencies.size(), offset2 + 1, idx_T->second - weight2);
-            idx_S->second.max_frequency += idx_T->second - weight2;
-        }
+        int64_t weight2 = idx_S->second.m_frequencies.set(offset2, idx_T->second);
+        idx_S->second.max_frequency += idx_T->second - weight2;
     }
 
     // next, we need to update the frequency for 'R' table
-    if (index1 + 1== m_probability_index[0].size())
+    int64_t weight1 = m_probability_index.set(index1, idx_S->second.max_frequency);
+    if (index1 + 1 == m_probability_index.size())
     {
-        int64_t last_largest_weight{ 0 };
-        if (m_probability_index[0].size() > 1)
-            last_largest_weight = StatelessFenwickTree::read_value(&m_probability_index[0][0], m_probability_index[0].size() - 1);
-
-        this->initial_AGM = last_largest_weight + idx_S->second.max_frequency;
+        // the bound starts above the sum of the frequencies, until the last
+        // one is set
+        this->initial_AGM = m_probability_index.total();
     }
     else
     {
-        int64_t weight1 = StatelessFenwickTree::readSingle_value(&m_probability_index[0][0], index1+1);
-        StatelessFenwickTree::update_add_value(&m_probability_index[0][0], m_probability_index[0].size(), index1+1, idx_S->second.max_frequency - weight1);
-
         this->initial_AGM += idx_S->second.max_frequency - weight1;
     }
 
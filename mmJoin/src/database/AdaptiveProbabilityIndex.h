@@ -7,6 +7,7 @@
 
 
 #include "TableGeneric.h"
+#include "../util/FenwickTree.h"
 
 enum SAMPLE_STATUS { GOOD_S = 0, FAIL_S = 1, REJECT_S = 2 };
 
@@ -31,9 +32,8 @@ private:
     std::default_random_engine m_rgen;
 
     struct point_information {
-        // the frequency table.  Use a stateless Fenwick tree to interact with
-        // the data here.
-        std::vector<int64_t> m_frequencies;
+        // the frequency table
+        FenwickTree64 m_frequencies;
 
         // max frequency used in the frequency tables.
         // we use this to quickly know if we should reject a sample
@@ -45,7 +45,8 @@ private:
 
 
     std::vector<std::shared_ptr<TableGeneric> > m_data;
-    std::vector<std::vector<int64_t> > m_probability_index;
+    // the frequencies of the 'R' table
+    FenwickTree64 m_probability_index;
 
     // this contains the max frequency for a given value.
     // in our join R--S--T with R(A,B), S(B,C), T(C,D),
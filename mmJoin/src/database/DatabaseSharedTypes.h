@@ -8,6 +8,9 @@
 #include <map>
 #include <cstdint>
 #include <ctime>
+#include <limits>
+#include <stdexcept>
+#include <functional>
 
 enum DATABASE_DATA_TYPES { INT32, INT64, FLOAT, CHAR, STRING, NONEXISTANT, LAST };
 
@@ -22,13 +25,69 @@ typedef int64_t jefastTime_t;
 // for the dynamic programming technique, we will use the following structures for the index:
 typedef jfkey_t jefastKey_t;
 
-#ifdef USE_UINT128_WEIGHT
 #include "../util/int128_support.h"
+#ifdef USE_UINT128_WEIGHT
 typedef uint128_t weight_t;
 #else
 typedef int64_t weight_t;
 #endif
 
+// the weights of an index whose join is too large for weight_t.  The index
+// classes are templates on their weight type, JefastBuilder picks this one
+// only when a bound on the weights of the join does not fit in weight_t.
+typedef uint128_t wide_weight_t;
+
+// convert a weight to a native 64-bit integer for exporting samples.  Throws
+// std::out_of_range if the weight does not fit (the same contract std::stoull
+// gave us when this conversion went through a string).
+template <typename W>
+inline uint64_t weight_to_uint64(W w) {
+    if (w < 0 || (sizeof(W) > sizeof(uint64_t) && w > (W) std::numeric_limits<uint64_t>::max()))
+        throw std::out_of_range("weight does not fit in uint64_t");
+    return static_cast<uint64_t>(w);
+}
+
+// sum and product of non-negative weights which throw std::overflow_error
+// instead of wrapping around if the result does not fit in W.  Used wherever
+// the index adds up join sizes, which can exceed 64 bits on large
+// many-to-many joins.
+template <typename W>
+inline void weight_overflow() {
+    throw std::overflow_error(sizeof(W) > sizeof(uint64_t)
+        ? "join weight does not fit in a 128 bit weight"
+        : "join weight does not fit in a 64 bit weight");
+}
+
+template <typename W>
+inline W weight_add(W a, W b) {
+    W sum;
+    if (__builtin_add_overflow(a, b, &sum))
+        weight_overflow<W>();
+    return sum;
+}
+
+template <typename W>
+inline W weight_mul(W a, W b) {
+    W product;
+    if (__builtin_mul_overflow(a, b, &product))
+        weight_overflow<W>();
+    return product;
+}
+
+// a weight of a wide index as a weight_t, for the parts of the interface
+// which report weight_t.  Throws std::overflow_error if it does not fit.
+template <typename W>
+inline weight_t weight_narrow(W w) {
+    if (sizeof(W) > sizeof(weight_t) && w > (W) std::numeric_limits<weight_t>::max())
+        weight_overflow<weight_t>();
+    return (weight_t) w;
+}
+
+// a non-negative weight for a row id of a table.  Every join result is
+// weighted by the product of the row weights of its records (see
+// JefastBuilder::SetRowWeight()).
+typedef std::function<weight_t(int64_t)> jefastRowWeight_t;
+
 // for this tuple:
 //   0- the number of unique join tuples which can be produced starting at this vertex
 //   1- A list of indexes to tuples in the left table which match this join
@@ -1,9 +1,17 @@
 #pragma once
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
 #include <assert.h>
 
 #include "DynamicLevel.h"
 #include "TableGeneric.h"
+#include "../util/Deadline.h"
 
 class DynamicIndex {
 public:
@@ -16,7 +24,7 @@ public:
         m_levels.resize(join_length);
         m_maxAGM.resize(join_length);
 
-        m_rgen.seed(std::chrono::system_clock::now().time_since_epoch().count());
+        seed(std::chrono::system_clock::now().time_since_epoch().count());
     };
 
     virtual ~DynamicIndex()
@@ -50,191 +58,305 @@ public:
         return 0;
     }
 
-    void warmup()
+    // An estimate of the bytes the vertexes of the levels from `level` on
+    // take once the DP below `level` reached all of them: a vertex per
+    // distinct join value and a weight per record.
+    size_t DP_memory_estimate(int level)
     {
-        this->wander_join_warmup(this->wander_join_level);
+        // the vertex, its two slots in a half full shard table and the
+        // alignment slack of its Fenwick tree
+        typedef DynamicVertex::weight_tree weight_tree;
+        const size_t vertex_bytes = sizeof(DynamicVertex) + 2 * sizeof(void*) + 2 * sizeof(jfkey_t)
+            + (weight_tree::lanes - 1) * sizeof(int64_t);
+        // a weight per record and the inner nodes above them
+        const size_t record_bytes = sizeof(int64_t) * weight_tree::lanes / (weight_tree::lanes - 1);
+
+        size_t bytes = 0;
+        for (size_t i = std::max(level, 1); i < m_tables.size(); ++i)
+            bytes += m_tables[i]->m_uniquecolumn1.size() * vertex_bytes + m_tables[i]->get_size() * record_bytes;
+        return bytes;
     }
-    
-    bool sample_join(std::vector<int> &output)
-    {
-        std::vector<std::unordered_map<jfkey_t, std::shared_ptr<DynamicVertex> >::iterator> search_itr(m_tables.size());
-        std::vector<int64_t> update_id(m_tables.size());
-        std::vector<double> p_value(m_tables.size(), 1.0);
-        //search_itr.resize(m_tables.size());
-        //update_id.resize(m_tables.size());
-        //p_value.resize(m_tables.size(), 1.0);
-
-        //std::uniform_int_distribution<int64_t> dist(0, m_levels[0]->upper_bound() - 1);
-
-        int64_t weight{ 0 };// = dist(m_rgen);
-
-        int64_t value = 0;
-        int64_t next_index = 0;
-
-        WALK_STATUS status = GOOD;
-
-        // we do initial lookup outside the for loop
-        auto start_itr = m_startlevel->GetNextStep(value, weight, next_index, update_id[0], status, p_value[0]);
-        output[0] = next_index;
-        value = m_tables[0]->get_column2_value(next_index);
 
-        if (m_first_selection_set) {
-            if (value < m_first_min_value)
-                status = FAIL;
+    // Pick the DP level instead of passing it to initialize(), then warm up.
+    // The levels whose DP_memory_estimate() fits in memory_budget bytes (0
+    // for no limit, the last level if none fits) are each probed on a copy
+    // of the index without a warmup: trial_seconds of walks, which compute
+    // the DP of the vertexes they reach, and only the second half counts.
+    // The level with the most accepted walks per second wins.  Each copy is
+    // freed before the next one is built, and this index is set up with the
+    // winner (initialize() and warmup(threads)) after the last probe, so at
+    // most one of them is alive at a time and the peak stays within the
+    // largest estimate of a candidate.  Returns the level.
+    int initialize_auto(size_t memory_budget = 0, double trial_seconds = 0.02, unsigned threads = 0)
+    {
+        const int last_level = (int) m_tables.size() - 1;
+        if (last_level < 1) {
+            initialize(1);
+            return 1;
         }
 
-        int i = 1;
-        // fill in the search iterators
-        for ( ; i < search_itr.size() && !(status & FAIL); ++i)
-        {
-            search_itr[i] = m_levels[i]->get_vertex(value);
-
-            // check if we need to do a DP scan of this region
-            if (i == this->wander_join_level)
-            {
-                if (!search_itr[i]->second->is_DPset())
-                {
-                    //std::cout << '.';
-                    this->DP_calculation(i, value);
-                }
+        std::vector<int> candidates;
+        for (int level = 1; level <= last_level; ++level) {
+            if (memory_budget == 0 || DP_memory_estimate(level) <= memory_budget)
+                candidates.push_back(level);
+        }
+        if (candidates.empty())
+            candidates.push_back(last_level);
+
+        // the levels of an earlier initialize() would count towards the peak
+        m_startlevel.reset();
+        for (auto &level : m_levels)
+            level.reset();
+
+        std::vector<std::pair<double, int> > ranking;
+        for (int level : candidates)
+            ranking.emplace_back(-probe_rate(level, trial_seconds), level);
+        std::stable_sort(ranking.begin(), ranking.end());
+
+        // the warmup gives up on a level whose walks keep failing, the
+        // last one left throws
+        for (size_t i = 0; ; ++i) {
+            initialize(ranking[i].second);
+            try {
+                warmup(threads);
+                return ranking[i].second;
             }
-
-            // do a weighted search
-            status |= search_itr[i]->second->get_records_p(weight, next_index, update_id[i], p_value[i]);
-
-            //search_itr[i] = m_levels[i]->GetNextStep(value, weight, next_index, update_id[i], status, p_value[i]);
-
-            // see if the walk is valid
-            if (search_itr[i] == m_levels[i]->m_data.end())
-            {
-                status |= FAIL;
-                // in this case we fail
+            catch (const char*) {
+                if (i + 1 == ranking.size())
+                    throw;
             }
+        }
+    }
 
-            if (status & FAIL)
-            {
-                break;
-            }
+    // Seed the generator of the warmup and of sample_join() without a
+    // generator, so a single threaded run can be replayed exactly.  The
+    // index is seeded from the clock otherwise.
+    void seed(uint64_t seed)
+    {
+        m_seed = seed;
+        m_rgen = CounterRng(seed);
+    }
 
-            // see if we accept or reject the walk
-            //m_home->get_column2_value
-            //output[i] = m_tables[i]->get_column2_value(next_index);
-            output[i] = next_index;
-            value = m_tables[i]->get_column2_value(next_index);
-        }
+    // an independent stream of the seed for walker number `walker`, e.g.
+    // one per thread calling sample_join()
+    CounterRng walker_rng(uint64_t walker) const
+    {
+        return CounterRng(m_seed, walker + 1);
+    }
 
-        // do selection condition, if needed
-        if (m_last_selection_set && ((status & FAIL) == GOOD))
-        {
-            if (value < m_last_min_value)
-                status = FAIL;
+    // threads = 0 uses every core, see wander_join_warmup()
+    void warmup(unsigned threads = 0)
+    {
+        this->wander_join_warmup(this->wander_join_level, threads);
+    }
+
+    // Write what the index learned so far (the weights, DP flags and walk
+    // statistics of every vertex) to a binary checkpoint, which
+    // load_checkpoint() reads into a new index over the same tables instead
+    // of initialize() and warmup().  Other threads may keep sampling, the
+    // vertexes are then saved at slightly different times.  Returns -1 if
+    // the checkpoint could not be written.
+    int save_checkpoint(std::ostream &out)
+    {
+        write_binary(out, checkpoint_magic());
+        write_binary(out, (uint64_t) m_tables.size());
+        write_binary(out, (int32_t) wander_join_level);
+        for (auto &table : m_tables) {
+            write_binary(out, (int64_t) table->get_size());
+            write_binary(out, table->fingerprint());
         }
 
-        i = i == m_levels.size() ? m_levels.size() - 1 : i;
+        m_startlevel->get_vertex()->second->save(out);
+        for (size_t i = 1; i < m_levels.size(); ++i)
+            m_levels[i]->save(out);
 
-        // this is the max value used for i (which would be valid to use i + 1 indexing)
-        int max_i = i - 1;
+        return out ? 0 : -1;
+    }
 
-        // go back through the points to update accepts
-        // we can also use this time to update weights?
-        //if (status & FAIL)
-        //{
-        //    --i;
-        //}
-        //else {
-        //}
+    int save_checkpoint(const std::string &file_name)
+    {
+        std::ofstream out(file_name, std::ios::binary | std::ios::trunc);
+        if (!out || save_checkpoint(out) != 0)
+            return -1;
+        out.close();
+        return out ? 0 : -1;
+    }
 
-        // we can do the first round outside the loop, because it will only happen
-        // up to one times
-        for (int t = p_value.size() - 2; t >= 0; t--) {
-            p_value[t] = p_value[t] * p_value[t + 1];
-        }       
-        
-        // I think we only need to do weight adjustment and reporting for all < wander join limit
+    // Set up the index from a checkpoint written by save_checkpoint(), in
+    // place of initialize() and warmup().  The tables must have been added
+    // with add_Table() and hold the same records as when the checkpoint was
+    // written.  Returns -1, and leaves the index as it was, if the
+    // checkpoint is truncated or was written for other tables: their row
+    // counts and the fingerprint() of their join columns are checked.
+    int load_checkpoint(std::istream &in)
+    {
+        uint64_t magic, table_count;
+        int32_t DP_level;
+        if (!read_binary(in, magic) || magic != checkpoint_magic())
+            return -1;
+        if (!read_binary(in, table_count) || table_count != m_tables.size())
+            return -1;
+        if (!read_binary(in, DP_level))
+            return -1;
+        for (auto &table : m_tables) {
+            int64_t rows;
+            uint64_t fingerprint;
+            if (!read_binary(in, rows) || rows != (int64_t) table->get_size())
+                return -1;
+            if (!read_binary(in, fingerprint) || fingerprint != table->fingerprint())
+                return -1;
+        }
 
-        i = std::min(i, this->wander_join_level - 1);
-        for (; i >= 1; --i)
-        {
-            // this should probably never happen
-            if ((status & FAIL) && max_i == i) {
-                search_itr[i]->second->adjust_weight(0, update_id[i]);
-            }
-            else {
-                search_itr[i]->second->adjust_weight(search_itr[i + 1]->second->get_max_weight(), update_id[i]);
-            }
+        std::shared_ptr<DynamicInitialLevel> startlevel(new DynamicInitialLevel(m_tables[0], m_maxAGM[0]));
+        if (!startlevel->get_vertex()->second->load(in))
+            return -1;
 
-            search_itr[i]->second->report(p_value[i], (status & FAIL) == GOOD);
+        std::vector<std::shared_ptr<DynamicLevel> > levels(m_levels.size());
+        for (size_t i = 1; i < levels.size(); ++i) {
+            levels[i].reset(new DynamicLevel(m_tables[i], m_maxAGM[i]));
+            if (!levels[i]->load(in))
+                return -1;
         }
 
-        //if (i == m_levels.size() - 1
-        //    && search_itr[i] != m_levels[i]->m_data.end()
-        //    && i != 0) {
-        //    search_itr[i]->second->adjust_weight((status & FAIL) == GOOD, update_id[i]);
+        wander_join_level = DP_level;
+        m_startlevel = startlevel;
+        m_levels.swap(levels);
+        return 0;
+    }
 
-        //    search_itr[i]->second->report(p_value[i], (status & FAIL) == GOOD);
-        //}
+    int load_checkpoint(const std::string &file_name)
+    {
+        std::ifstream in(file_name, std::ios::binary);
+        if (!in)
+            return -1;
+        return load_checkpoint(in);
+    }
+    
+    // Draw one walk with the generator of the index, see below.  Only one
+    // thread may use it at a time.
+    bool sample_join(std::vector<int> &output)
+    {
+        return sample_join(output, m_rgen);
+    }
 
+    // Draw one walk and learn from it.  Returns true if the walk was
+    // accepted, output then holds its record ids.  All random numbers of the
+    // walk come from rng.  Several threads may call sample_join() on the
+    // same index at once (after initialize() and warmup()), each with its
+    // own generator (see walker_rng()), they refine and sample from the same
+    // weights.  The other member functions must not run concurrently with
+    // it.
+    bool sample_join(std::vector<int> &output, CounterRng &rng)
+    {
+        walk_t walk;
+        start_walk(walk, output, rng);
+        while (!walk.done) {
+            find_vertex(walk);
+            step_walk(walk, output, rng);
+            if (!walk.done)
+                advance_walk(walk);
+        }
+        return finish_walk(walk);
+    }
 
-        //for (--i /*because we already did first loop above*/; i >= 1; --i) {
-        //    if ((status & FAIL) && max_i == i) {
-        //        search_itr[i]->second->adjust_weight(0, update_id[i]);
-        //    }
-        //    else {
-        //        //if(i==0)
-        //        //    std::cout << search_itr[i + 1]->second->max_weight << '\n';
-        //        search_itr[i]->second->adjust_weight(search_itr[i + 1]->second->get_max_weight(), update_id[i]);
-        //    }
+    // Append accepted walks to output until there are max_samples new ones
+    // or the deadline expires, drawing from rng as sample_join() does.
+    SampleReport sample_until(Deadline deadline, std::vector<std::vector<int> > &output, CounterRng &rng, size_t max_samples = SIZE_MAX)
+    {
+        return sample_until_deadline(deadline, output, max_samples,
+            [this, &rng](std::vector<int> &sample) { return sample_join(sample, rng); },
+            std::vector<int>(m_tables.size()));
+    }
 
-        //    search_itr[i]->second->report(p_value[i], (status & FAIL) == GOOD);
-        //}
+    // with the generator of the index, one thread at a time
+    SampleReport sample_until(Deadline deadline, std::vector<std::vector<int> > &output, size_t max_samples = SIZE_MAX)
+    {
+        return sample_until(deadline, output, m_rgen, max_samples);
+    }
 
-        //////////////////////////////
-        // do initial update by itself
-        if ((status & FAIL) && max_i == 0) {
-            // this should probably never happen with our current setup
-            start_itr->second->adjust_weight(0, update_id[0]);
-        }
-        else {
-            start_itr->second->adjust_weight(search_itr[i + 1]->second->get_max_weight(), update_id[i]);
-        }
+    // Draw `walks` walks like sample_join(), but advance `group` of them at
+    // a time in lockstep: each level first looks up the vertexes of all the
+    // walks and prefetches their Fenwick trees and rows, then samples all of
+    // them, then prefetches and reads all the join values of the next
+    // level.  The cache misses of the walks of a group overlap instead of
+    // being waited for one after the other.  The walks of a group update
+    // the weights together once they all ended, so they don't learn from
+    // each other.  Appends the accepted walks to output and returns how
+    // many there were.
+    size_t sample_join_batch(size_t walks, std::vector<std::vector<int> > &output, CounterRng &rng, size_t group = 16)
+    {
+        std::vector<walk_t> batch(group);
+        std::vector<std::vector<int> > results(group, std::vector<int>(m_tables.size()));
+        size_t accepted = 0;
+
+        for (size_t first = 0; first < walks; first += group) {
+            size_t count = std::min(group, walks - first);
+            for (size_t g = 0; g < count; ++g)
+                start_walk(batch[g], results[g], rng);
+
+            for (size_t i = 1; i < m_tables.size(); ++i) {
+                bool active = false;
+                for (size_t g = 0; g < count; ++g) {
+                    if (batch[g].done)
+                        continue;
+                    find_vertex(batch[g]);
+                    batch[g].search_itr[i]->prefetch();
+                    active = true;
+                }
+                if (!active)
+                    break;
 
-        start_itr->second->report(p_value[i], (status & FAIL) == GOOD);
+                for (size_t g = 0; g < count; ++g) {
+                    if (batch[g].done)
+                        continue;
+                    step_walk(batch[g], results[g], rng);
+                    if (!batch[g].done)
+                        m_tables[i]->prefetch_column2_value(batch[g].next_index);
+                }
 
-        if (status == GOOD)
-            m_stats.good_walks++;
-        if (status &= FAIL)
-            m_stats.failed_walks++;
-        if (status &= REJECT)
-            m_stats.rejected_walks++;
+                for (size_t g = 0; g < count; ++g) {
+                    if (!batch[g].done)
+                        advance_walk(batch[g]);
+                }
+            }
 
-        return status == GOOD;
+            for (size_t g = 0; g < count; ++g) {
+                if (finish_walk(batch[g])) {
+                    output.push_back(results[g]);
+                    ++accepted;
+                }
+            }
+        }
+        return accepted;
     }
 
-    // do recursive calculations to get DP value
+    // do recursive calculations to get DP value.  The weights of a vertex
+    // are computed first and then set at once (see
+    // DynamicVertex::set_DP_weights()), so two walks reaching the same
+    // vertex at the same time compute the same weights and only one of them
+    // sets them.
     int64_t DP_calculation(int level, int64_t key)
     {
         // if we are at the end of the join...
         if (level >= this->m_levels.size())
             return 1;
 
+        std::vector<int64_t> dp_weights;
         if (level != 0) {
 
             auto vertex = m_levels[level]->get_vertex(key);
 
                 // if we already have the DP information for this vertex, just return it.
-            if (vertex->second->is_DPset())
-                return vertex->second->get_weight();
+            if (vertex->is_DPset())
+                return vertex->get_weight();
 
             // otherwise, we need to fill in the DP calculations for the vertex
-            int i = 0;
-            for (auto idx = m_tables[level]->m_column1_fast_index[key].begin();
-                idx != m_tables[level]->m_column1_fast_index[key].end();
-                ++idx)
-            {
-                vertex->second->adjust_DP_weight(DP_calculation(level + 1, m_tables[level]->get_column2_value(*idx)), i++);
+            auto records = m_tables[level]->m_column1_fast_index.find(key);
+            if (records != m_tables[level]->m_column1_fast_index.end()) {
+                for (auto idx = records->second.begin(); idx != records->second.end(); ++idx)
+                    dp_weights.push_back(DP_calculation(level + 1, m_tables[level]->get_column2_value(*idx)));
             }
-            assert(vertex->second->is_DPset());
-            return vertex->second->get_weight();
+            return vertex->set_DP_weights(dp_weights);
 
         }
         else {
@@ -245,37 +367,43 @@ public:
 
             for (auto idx = 0; idx < m_tables[0]->get_size(); ++idx)
             {
-                vertex->second->adjust_DP_weight(DP_calculation(level + 1, m_tables[0]->get_column2_value(idx)), idx);
+                dp_weights.push_back(DP_calculation(level + 1, m_tables[0]->get_column2_value(idx)));
             }
-            assert(vertex->second->is_DPset());
-            return vertex->second->get_weight();
+            return vertex->second->set_DP_weights(dp_weights);
         }
     }
 
-    void wander_join_warmup(int level)
+    // Estimate the weights of the vertexes above `level` with wander join
+    // walks from every vertex of the level, then push them up to the
+    // source.  The vertexes of a level are split among `threads` threads (0
+    // for one per core), each one walking from the vertexes it took, and
+    // the levels are pushed up one after the other.  The walks from a vertex
+    // draw from their own stream of the seed, so the result does not depend
+    // on the number of threads.
+    void wander_join_warmup(int level, unsigned threads = 0)
     {
         // each item will need to run the algorithm.. If we do the same one twice that is okay
         // because it will be detected quickly
-        //for (auto idx = 0; idx < m_tables[level]->get_size(); ++idx)
-        for(auto uniq_itr = m_tables[level]->m_uniquecolumn1.begin(); uniq_itr != (m_tables[level]->m_uniquecolumn1.end()); ++uniq_itr)
-        {
-            do_wanderjoin(m_levels[level]->get_vertex(*uniq_itr)->second, level);
-            // find vertex to run wander join on
-        }
+        const std::vector<jefastKey_t> &starts = m_tables[level]->m_uniquecolumn1;
+        parallel_for(starts.size(), threads, [&](size_t i) {
+            // the streams from 2^63 up are not used by walker_rng()
+            CounterRng rng(m_seed, (uint64_t(1) << 63) + i);
+            do_wanderjoin(m_levels[level]->get_vertex(starts[i]), level, rng);
+        });
 
         // push back the weights to the source
         for (int c_level = level - 1; c_level > 0; --c_level)
         {
-            for (auto uniq_itr = m_tables[c_level]->m_uniquecolumn1.begin(); uniq_itr != (m_tables[c_level]->m_uniquecolumn1.end()); ++uniq_itr)
-            {
+            const std::vector<jefastKey_t> &values = m_tables[c_level]->m_uniquecolumn1;
+            parallel_for(values.size(), threads, [&](size_t i) {
                 // for each item in the vertex, push the estimator and weights up
                 int i_val = 0;
-                auto update_vertex = m_levels[c_level]->get_vertex(*uniq_itr)->second;
-                double fanout = m_tables[c_level]->m_column1_fast_index[*uniq_itr].size();
-                auto end_i = m_tables[c_level]->m_column1_fast_index[*uniq_itr].end();
-                for (auto key = m_tables[c_level]->m_column1_fast_index[*uniq_itr].begin(); key != end_i; ++key)
+                auto update_vertex = m_levels[c_level]->get_vertex(values[i]);
+                const std::vector<jefastKey_t> &keys = m_tables[c_level]->m_column1_fast_index.at(values[i]);
+                double fanout = keys.size();
+                for (auto key = keys.begin(); key != keys.end(); ++key)
                 {
-                    auto trial_vertex = m_levels[c_level + 1]->get_vertex(m_tables[c_level]->get_column2_value(*key))->second;
+                    auto trial_vertex = m_levels[c_level + 1]->get_vertex(m_tables[c_level]->get_column2_value(*key));
 
                     update_vertex->S_sum += (trial_vertex->S_sum * fanout);
                     update_vertex->V_sum += (trial_vertex->V_sum * (fanout * fanout));
@@ -283,10 +411,10 @@ public:
                     update_vertex->walk_count += trial_vertex->walk_count;
 
                     update_vertex->adjust_weight(trial_vertex->get_max_weight(), i_val);
-                    
+
                     ++i_val;
                 }
-            }
+            });
         }
 
         // do source separate
@@ -295,7 +423,7 @@ public:
             double fanout = m_tables[0]->get_size();
             for (auto source_idx = 0; source_idx < m_tables[0]->get_size(); ++source_idx)
             {
-                auto trial_vertex = m_levels[1]->get_vertex(m_tables[0]->get_column2_value(source_idx))->second;
+                auto trial_vertex = m_levels[1]->get_vertex(m_tables[0]->get_column2_value(source_idx));
 
                 update_vertex->S_sum += (trial_vertex->S_sum * fanout);
                 update_vertex->V_sum += (trial_vertex->V_sum * (fanout * fanout));
@@ -307,7 +435,9 @@ public:
         }
     }
 
-    int64_t do_wanderjoin(std::shared_ptr<DynamicVertex> vertex, int starting_level)
+    // walk from vertex until its estimate is good enough.  Only one thread
+    // may walk from a vertex at a time.
+    int64_t do_wanderjoin(DynamicVertex *vertex, int starting_level, CounterRng &rng)
     {
         int loops = 0;
 
@@ -326,8 +456,8 @@ public:
 
             while(current_level < m_tables.size())
             {
-                std::vector<jefastKey_t>* index = &m_tables[current_level]->m_column1_fast_index[value];
-                int degree = index->size();
+                auto index = m_tables[current_level]->find_column1_rows(value);
+                int degree = index == nullptr ? 0 : index->size();
                 //int degree = m_tables[current_level]->count_cardinaltiy_f(value);
                 if (degree == 0)
                 {
@@ -336,7 +466,7 @@ public:
                 }
                 // randomly select which path to go down.
                 std::uniform_int_distribution<int> dist(0, degree - 1);
-                int next_idx = dist(m_rgen);
+                int next_idx = dist(rng);
 
                 value = m_tables[current_level]->get_column2_value((*index)[next_idx]);
                 //value = m_tables[current_level]->get_column2_value(m_tables[current_level]->get_column1_index_offset2(value, next_idx));
@@ -381,6 +511,276 @@ public:
     }
 
 private:
+    // accepted walks per second of a copy of the index with DP level
+    // `level`, counted over the second half of `seconds` of walks from a
+    // cold start.  The copy is freed on return.
+    double probe_rate(int level, double seconds)
+    {
+        std::unique_ptr<DynamicIndex> trial(new DynamicIndex(m_tables.size()));
+        for (size_t i = 0; i < m_tables.size(); ++i)
+            trial->add_Table((int) i, m_tables[i], m_maxAGM[i]);
+        trial->m_first_selection_set = m_first_selection_set;
+        trial->m_first_min_value = m_first_min_value;
+        trial->m_last_selection_set = m_last_selection_set;
+        trial->m_last_min_value = m_last_min_value;
+        trial->seed(m_seed);
+        trial->initialize(level);
+
+        CounterRng rng = trial->walker_rng(0);
+        std::vector<int> sample(m_tables.size());
+        auto half = std::chrono::duration_cast<Deadline::clock::duration>(std::chrono::duration<double>(seconds / 2));
+        for (Deadline cold(half); !cold.expired(); )
+            trial->sample_join(sample, rng);
+
+        Deadline deadline(half);
+        int64_t accepted = 0;
+        while (!deadline.expired()) {
+            if (trial->sample_join(sample, rng))
+                ++accepted;
+        }
+        return accepted / deadline.elapsed();
+    }
+
+    // Call f(i) for every i < n from `threads` threads (0 for one per core).
+    // The threads take the indexes in small blocks as they go, so a few slow
+    // indexes don't hold back the others.  The first exception thrown by f
+    // is thrown again once all threads are done.
+    template<typename F>
+    static void parallel_for(size_t n, unsigned threads, F f)
+    {
+        constexpr size_t block = 16;
+
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        threads = (unsigned) std::min<size_t>(threads, (n + block - 1) / block);
+        if (threads <= 1) {
+            for (size_t i = 0; i < n; ++i)
+                f(i);
+            return;
+        }
+
+        std::atomic<size_t> next{ 0 };
+        std::exception_ptr error;
+        std::mutex error_lock;
+        auto worker = [&]() {
+            try {
+                for (size_t begin = next.fetch_add(block); begin < n; begin = next.fetch_add(block)) {
+                    for (size_t i = begin; i < std::min(n, begin + block); ++i)
+                        f(i);
+                }
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> guard(error_lock);
+                if (!error)
+                    error = std::current_exception();
+                // stop the other threads early
+                next = n;
+            }
+        };
+
+        std::vector<std::thread> thread_list;
+        for (unsigned t = 0; t < threads; ++t)
+            thread_list.emplace_back(worker);
+        for (auto &t : thread_list)
+            t.join();
+
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    // "DYNCKPT3", the first bytes of a checkpoint.  Version 1 wrote the
+    // Fenwick trees of the vertexes rather than their weights, version 2
+    // had no fingerprints of the tables.
+    static uint64_t checkpoint_magic()
+    {
+        return 0x3354504B434E5944ull;
+    }
+
+    // the state of one walk of sample_join()
+    struct walk_t {
+        std::vector<DynamicVertex*> search_itr;
+        std::vector<int64_t> update_id;
+        std::vector<double> p_value;
+        DynamicOriginVertex *start_vertex;
+        int64_t weight;
+        int64_t value;
+        int64_t next_index;
+        WALK_STATUS status;
+        // the level the walk samples next, or where it failed
+        int level;
+        // true once the walk failed or reached the last table
+        bool done;
+    };
+
+    // sample the first table
+    void start_walk(walk_t &walk, std::vector<int> &output, CounterRng &rng)
+    {
+        walk.search_itr.assign(m_tables.size(), nullptr);
+        walk.update_id.assign(m_tables.size(), 0);
+        walk.p_value.assign(m_tables.size(), 1.0);
+        walk.weight = 0;
+        walk.value = 0;
+        walk.next_index = 0;
+        walk.status = GOOD;
+
+        // we do initial lookup outside the for loop
+        auto start_itr = m_startlevel->GetNextStep(walk.value, walk.weight, walk.next_index, walk.update_id[0], walk.status, walk.p_value[0], rng);
+        walk.start_vertex = start_itr->second.get();
+        output[0] = walk.next_index;
+        walk.value = m_tables[0]->get_column2_value(walk.next_index);
+
+        if (m_first_selection_set) {
+            if (walk.value < m_first_min_value)
+                walk.status = FAIL;
+        }
+
+        walk.level = 1;
+        walk.done = (walk.status & FAIL) || walk.level >= (int) m_tables.size();
+    }
+
+    // find (or create) the vertex of the next level of the walk
+    void find_vertex(walk_t &walk)
+    {
+        int i = walk.level;
+        walk.search_itr[i] = m_levels[i]->get_vertex(walk.value);
+
+        // check if we need to do a DP scan of this region
+        if (i == this->wander_join_level)
+        {
+            if (!walk.search_itr[i]->is_DPset())
+            {
+                //std::cout << '.';
+                this->DP_calculation(i, walk.value);
+            }
+        }
+    }
+
+    // pick the record of the vertex found by find_vertex()
+    void step_walk(walk_t &walk, std::vector<int> &output, CounterRng &rng)
+    {
+        int i = walk.level;
+
+        // do a weighted search
+        walk.status |= walk.search_itr[i]->get_records_p(walk.weight, walk.next_index, walk.update_id[i], walk.p_value[i], rng);
+
+        if (walk.status & FAIL)
+        {
+            walk.done = true;
+            return;
+        }
+
+        output[i] = walk.next_index;
+    }
+
+    // read the join value of the record picked by step_walk()
+    void advance_walk(walk_t &walk)
+    {
+        walk.value = m_tables[walk.level]->get_column2_value(walk.next_index);
+        ++walk.level;
+        walk.done = walk.level >= (int) m_tables.size();
+    }
+
+    // update the weights and the statistics along the walk.  Returns true
+    // if the walk is accepted.
+    bool finish_walk(walk_t &walk)
+    {
+        std::vector<DynamicVertex*> &search_itr = walk.search_itr;
+        std::vector<int64_t> &update_id = walk.update_id;
+        std::vector<double> &p_value = walk.p_value;
+        WALK_STATUS &status = walk.status;
+        int64_t value = walk.value;
+        int i = walk.level;
+
+        // do selection condition, if needed
+        if (m_last_selection_set && ((status & FAIL) == GOOD))
+        {
+            if (value < m_last_min_value)
+                status = FAIL;
+        }
+
+        i = i == m_levels.size() ? m_levels.size() - 1 : i;
+
+        // this is the max value used for i (which would be valid to use i + 1 indexing)
+        int max_i = i - 1;
+
+        // a walk which failed before picking a record of level i (a dead
+        // end, which a cold index still has above the DP level) has nothing
+        // to adjust there
+        if ((status & FAIL) && walk.level < (int) m_tables.size())
+            i = max_i;
+
+        // go back through the points to update accepts
+        // we can also use this time to update weights?
+        //if (status & FAIL)
+        //{
+        //    --i;
+        //}
+        //else {
+        //}
+
+        // we can do the first round outside the loop, because it will only happen
+        // up to one times
+        for (int t = p_value.size() - 2; t >= 0; t--) {
+            p_value[t] = p_value[t] * p_value[t + 1];
+        }       
+        
+        // I think we only need to do weight adjustment and reporting for all < wander join limit
+
+        i = std::min(i, this->wander_join_level - 1);
+        for (; i >= 1; --i)
+        {
+            // this should probably never happen
+            int64_t new_weight = 0;
+            if (!((status & FAIL) && max_i == i))
+                new_weight = search_itr[i + 1]->get_max_weight();
+
+            search_itr[i]->adjust_and_report(new_weight, update_id[i], p_value[i], (status & FAIL) == GOOD);
+        }
+
+        //if (i == m_levels.size() - 1
+        //    && search_itr[i] != m_levels[i]->m_data.end()
+        //    && i != 0) {
+        //    search_itr[i]->second->adjust_weight((status & FAIL) == GOOD, update_id[i]);
+
+        //    search_itr[i]->second->report(p_value[i], (status & FAIL) == GOOD);
+        //}
+
+
+        //for (--i /*because we already did first loop above*/; i >= 1; --i) {
+        //    if ((status & FAIL) && max_i == i) {
+        //        search_itr[i]->second->adjust_weight(0, update_id[i]);
+        //    }
+        //    else {
+        //        //if(i==0)
+        //        //    std::cout << search_itr[i + 1]->second->max_weight << '\n';
+        //        search_itr[i]->second->adjust_weight(search_itr[i + 1]->second->get_max_weight(), update_id[i]);
+        //    }
+
+        //    search_itr[i]->second->report(p_value[i], (status & FAIL) == GOOD);
+        //}
+
+        //////////////////////////////
+        // do initial update by itself
+        if ((status & FAIL) && max_i == 0) {
+            // this should probably never happen with our current setup
+            walk.start_vertex->adjust_and_report(0, update_id[0], p_value[i], (status & FAIL) == GOOD);
+        }
+        else {
+            walk.start_vertex->adjust_and_report(search_itr[i + 1]->get_max_weight(), update_id[i], p_value[i], (status & FAIL) == GOOD);
+        }
+
+        bool accepted = status == GOOD;
+        if (accepted)
+            m_stats.good_walks.fetch_add(1, std::memory_order_relaxed);
+        if (status & FAIL)
+            m_stats.failed_walks.fetch_add(1, std::memory_order_relaxed);
+        if (status & REJECT)
+            m_stats.rejected_walks.fetch_add(1, std::memory_order_relaxed);
+
+        return accepted;
+    }
+
+
     std::vector<int64_t> m_maxAGM;
 
     std::vector<std::shared_ptr<TableGenericBase> > m_tables;
@@ -389,7 +789,8 @@ private:
 
     std::shared_ptr<DynamicInitialLevel> m_startlevel;
 
-    std::mt19937_64 m_rgen;
+    uint64_t m_seed;
+    CounterRng m_rgen;
 
     int wander_join_level;
 
@@ -400,9 +801,9 @@ private:
     int64_t m_first_min_value;
 
     struct stats {
-        int good_walks;
-        int rejected_walks;
-        int failed_walks;
+        std::atomic<int64_t> good_walks{ 0 };
+        std::atomic<int64_t> rejected_walks{ 0 };
+        std::atomic<int64_t> failed_walks{ 0 };
     } m_stats;
 
 };
@@ -1,68 +1,150 @@
 #pragma once
+#include <algorithm>
 #include <vector>
 #include <memory>
 #include <map>
+#include <array>
+#include <mutex>
+#include <unordered_map>
 #include <cinttypes>
 
 
 #include "DynamicVertex.h"
 #include "TableGeneric.h"
 
+// The vertexes of a level are created the first time a walk reaches their
+// join value.  Several threads may sample from the same index, so the
+// vertexes are kept in shard_count maps, each with its own mutex, and are
+// created once: a thread which finds the vertex already there uses it.
+// Vertexes are never removed, so the pointers handed out stay valid as long
+// as the level.
+//
+// Each shard is an open addressing table of vertex pointers, and the
+// vertexes and their Fenwick trees are allocated from an arena of the shard,
+// so creating a vertex is a few pointer increments and a probe.
 class DynamicLevel {
 public:
+    static constexpr size_t shard_count = 64;
+
     DynamicLevel(std::shared_ptr<TableGenericBase> rhs_table, int64_t max_AGM)
         : m_max_AGM{ max_AGM }
         , m_rhs_table{ rhs_table }
     {};
 
     virtual ~DynamicLevel()
-    {};
+    {
+        for (shard_t &shard : m_shards) {
+            for (slot_t &slot : shard.slots) {
+                if (slot.vertex != nullptr)
+                    slot.vertex->~DynamicVertex();
+            }
+        }
+    };
 
-    // return an iterator to the node we are pointing to (so we can perform
-    // updates after we finish the search)
-    std::unordered_map<jfkey_t, std::shared_ptr<DynamicVertex> >::iterator
-        GetNextStep(jfkey_t id, weight_t &inout_weight, jfkey_t &out_key, int64_t &update_key, WALK_STATUS &status, double &p)
+    // return the vertex we are pointing to (so we can perform updates after
+    // we finish the search), or nullptr if the walk failed
+    DynamicVertex *GetNextStep(jfkey_t id, weight_t &inout_weight, jfkey_t &out_key, int64_t &update_key, WALK_STATUS &status, double &p, CounterRng &rng)
     {
-        // look for the item to do the join
-        auto ptr = m_data.find(id);
-        if (ptr != m_data.end())
-        { // in this case the mode exists
-            status |= ptr->second->get_records_p(inout_weight, out_key, update_key, p);
+        DynamicVertex *vertex = get_vertex(id);
+        status |= vertex->get_records_p(inout_weight, out_key, update_key, p, rng);
+        if (status & FAIL)
+            return nullptr;
+        return vertex;
+    }
+
+    // return a vertex with a particular key (or creates one if it does not exist)
+    DynamicVertex *get_vertex(jfkey_t id)
+    {
+        uint64_t hash = hash_of(id);
+        shard_t &shard = m_shards[hash % shard_count];
+        std::lock_guard<std::mutex> guard(shard.lock);
+
+        if (shard.slots.empty())
+            grow(shard);
+        size_t i = find_slot(shard, id, hash);
+        if (shard.slots[i].vertex != nullptr)
+            return shard.slots[i].vertex;
+
+        if (2 * (shard.count + 1) > shard.slots.size()) {
+            grow(shard);
+            i = find_slot(shard, id, hash);
         }
-        else {
-            // we need to make it, then pull the record
-            auto count = m_rhs_table->count_cardinaltiy_f(id, 1);
-            std::shared_ptr<DynamicVertex> temp_p(new DynamicVertex(m_max_AGM, count, id, m_rhs_table));
-            std::pair<jfkey_t, std::shared_ptr<DynamicVertex> > temp(id, temp_p);
-            m_data.insert(temp);
-            //m_uniqueKeys.push_back(id);
-
-            ptr = m_data.find(id);
-
-            // if we are in a fail condition
-            status |= ptr->second->get_records_p(inout_weight, out_key, update_key, p);
-            if (status & FAIL)
-                ptr = m_data.end();
+
+        auto rows = m_rhs_table->find_column1_rows(id);
+        int64_t count = rows == nullptr ? 0 : rows->size();
+        void *memory = shard.arena.allocate(sizeof(DynamicVertex), alignof(DynamicVertex));
+        DynamicVertex *vertex = new (memory) DynamicVertex(m_max_AGM, count, id, rows, &shard.arena);
+
+        shard.slots[i] = slot_t{ id, vertex };
+        ++shard.count;
+        return vertex;
+    }
+
+    // the number of vertexes created so far
+    size_t size()
+    {
+        size_t count = 0;
+        for (shard_t &shard : m_shards) {
+            std::lock_guard<std::mutex> guard(shard.lock);
+            count += shard.count;
         }
+        return count;
+    }
 
-        return ptr;
+    // bytes of the vertexes, their weights and the tables
+    size_t memory()
+    {
+        size_t bytes = 0;
+        for (shard_t &shard : m_shards) {
+            std::lock_guard<std::mutex> guard(shard.lock);
+            bytes += shard.arena.reserved() + shard.slots.size() * sizeof(slot_t);
+        }
+        return bytes;
     }
 
-    // return a vertex with a particular key (or creates one if it does not exist)
-    std::unordered_map<jfkey_t, std::shared_ptr<DynamicVertex> >::iterator get_vertex(jfkey_t id)
+    // Write the vertexes created so far, each one as its join value and
+    // its state (see DynamicVertex::save()).  The vertexes are written in
+    // groups, one per shard, so threads may keep sampling.  A group is in
+    // the order of the join values, not of the slots, which depends on the
+    // order the threads created the vertexes in.
+    void save(std::ostream &out)
     {
-        auto ptr = m_data.find(id);
-        if (ptr == m_data.end())
-        {
-            auto count = m_rhs_table->count_cardinaltiy_f(id, 1);
-            std::shared_ptr<DynamicVertex> temp_p(new DynamicVertex(m_max_AGM, count, id, m_rhs_table));
-            std::pair<jfkey_t, std::shared_ptr<DynamicVertex> > temp(id, temp_p);
-            m_data.insert(temp);
-            //m_uniqueKeys.push_back(id);
-
-            ptr = m_data.find(id);
+        write_binary(out, (uint64_t) shard_count);
+        std::vector<slot_t> sorted;
+        for (shard_t &shard : m_shards) {
+            std::lock_guard<std::mutex> guard(shard.lock);
+            write_binary(out, (uint64_t) shard.count);
+            sorted.clear();
+            for (slot_t &slot : shard.slots) {
+                if (slot.vertex != nullptr)
+                    sorted.push_back(slot);
+            }
+            std::sort(sorted.begin(), sorted.end(), [](const slot_t &a, const slot_t &b) { return a.key < b.key; });
+            for (slot_t &slot : sorted) {
+                write_binary(out, slot.key);
+                slot.vertex->save(out);
+            }
         }
-        return ptr;
+    }
+
+    // Read the vertexes written by save() into this level.  Returns false
+    // if the stream ends or does not match the table of the level.
+    bool load(std::istream &in)
+    {
+        uint64_t groups;
+        if (!read_binary(in, groups))
+            return false;
+        for (uint64_t g = 0; g < groups; ++g) {
+            uint64_t count;
+            if (!read_binary(in, count))
+                return false;
+            for (uint64_t i = 0; i < count; ++i) {
+                jfkey_t id;
+                if (!read_binary(in, id) || !get_vertex(id)->load(in))
+                    return false;
+            }
+        }
+        return true;
     }
 
 
@@ -74,11 +156,52 @@ public:
 //protected:
     int64_t m_max_AGM;
 
-    std::unordered_map<jfkey_t, std::shared_ptr<DynamicVertex> > m_data;
+    std::shared_ptr<TableGenericBase> m_rhs_table;
 
-    //std::vector<jfkey_t> m_uniqueKeys;
+private:
+    // an empty slot has no vertex
+    struct slot_t {
+        jfkey_t key;
+        DynamicVertex *vertex;
+    };
 
-    std::shared_ptr<TableGenericBase> m_rhs_table;
+    struct shard_t {
+        std::mutex lock;
+        Arena arena;
+        // a power of two long, at most half full
+        std::vector<slot_t> slots;
+        size_t count = 0;
+    };
+
+    static uint64_t hash_of(jfkey_t id)
+    {
+        // the keys are often consecutive, so spread them first.  The low
+        // bits pick the shard, the high ones the slot.
+        uint64_t z = (uint64_t) id * 0x9E3779B97F4A7C15ull;
+        return z ^ (z >> 31);
+    }
+
+    // the slot of id, or the empty slot where it belongs
+    static size_t find_slot(const shard_t &shard, jfkey_t id, uint64_t hash)
+    {
+        size_t mask = shard.slots.size() - 1;
+        size_t i = (size_t) (hash >> 32) & mask;
+        while (shard.slots[i].vertex != nullptr && shard.slots[i].key != id)
+            i = (i + 1) & mask;
+        return i;
+    }
+
+    static void grow(shard_t &shard)
+    {
+        std::vector<slot_t> old_slots(std::max<size_t>(16, 2 * shard.slots.size()), slot_t{ 0, nullptr });
+        old_slots.swap(shard.slots);
+        for (slot_t &slot : old_slots) {
+            if (slot.vertex != nullptr)
+                shard.slots[find_slot(shard, slot.key, hash_of(slot.key))] = slot;
+        }
+    }
+
+    std::array<shard_t, shard_count> m_shards;
 };
 
 class DynamicInitialLevel /* : public DynamicLevel */ {
@@ -108,13 +231,13 @@ public:
     // return an iterator to the node we are pointing to (so we can perform
     // updates after we finish the search)
     std::unordered_map<jfkey_t, std::shared_ptr<DynamicOriginVertex> >::iterator
-        GetNextStep(jfkey_t id, weight_t &inout_weight, jfkey_t &out_key, int64_t &update_key, WALK_STATUS &status, double &p)
+        GetNextStep(jfkey_t id, weight_t &inout_weight, jfkey_t &out_key, int64_t &update_key, WALK_STATUS &status, double &p, CounterRng &rng)
     {
         // look for the item to do the join
         auto ptr = m_data.find(0);
         if (ptr != m_data.end())
         { // in this case the mode exists
-            status |= ptr->second->get_records_p(inout_weight, out_key, update_key, p);
+            status |= ptr->second->get_records_p(inout_weight, out_key, update_key, p, rng);
         }
 
         return ptr;
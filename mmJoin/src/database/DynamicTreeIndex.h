@@ -0,0 +1,399 @@
+// An adaptive wander join index over an arbitrary join tree.
+//
+// DynamicIndex samples chain joins of two column tables.  This index takes
+// the join tree the way JefastBuilder::AddTableToFork() does: every table
+// after the first joins one earlier table, its parent, so a table may have
+// any number of children.  Cyclic queries are a spanning tree plus closing
+// predicates (e.g. the last table of a triangle joins the first one), which
+// are checked once the walk has picked a record of every table.
+//
+// Every (table, join value) pair is a DynamicVertex whose records carry an
+// upper bound on the number of tree join results below them.  A walk picks
+// the record of the first table proportionally to its weight, then every
+// child table proportionally to the weights of the vertex it joins, and
+// rejects at each record with the probability that the bound of the record
+// is larger than the product of the weights of its child vertexes, so the
+// accepted walks are uniform join results.  On its way back the walk sets
+// the weight of every record it picked to that product, so the bounds
+// tighten as the index is used.
+//
+// The vertexes of the tables at least DP_level joins away from the first
+// table get their exact weights the first time a walk reaches them, like the
+// wander join level of DynamicIndex.  The ones above start at the bound of
+// their table.  Closing predicates are not part of the weights, which stay
+// upper bounds for the cyclic query.
+//
+// One thread at a time.
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <unordered_map>
+#include <assert.h>
+
+#include "DynamicVertex.h"
+#include "Table.h"
+#include "../util/Deadline.h"
+
+class DynamicTreeIndex {
+public:
+    DynamicTreeIndex()
+        : m_DP_level{ 1 }
+    {
+        seed(std::chrono::system_clock::now().time_since_epoch().count());
+    };
+
+    virtual ~DynamicTreeIndex()
+    {};
+
+    // Joins column thisTableJoinColIndex of table with column
+    // prevTableJoinColIndex of table prevTableNumber.  The join columns and
+    // prevTableNumber are ignored for the first table.  max_AGM bounds the
+    // number of join results below a record of the table, 0 derives it from
+    // the largest degrees of the join columns.  Returns the table number,
+    // starting from 0, or -1 if there's an error.
+    int AddTable(std::shared_ptr<Table> table,
+        int thisTableJoinColIndex,
+        int prevTableJoinColIndex,
+        int prevTableNumber,
+        int64_t max_AGM = 0)
+    {
+        if (table == nullptr || max_AGM < 0)
+            return -1;
+
+        table_t t;
+        t.table = table;
+        t.max_AGM = max_AGM;
+        if (!m_tables.empty()) {
+            if (prevTableNumber < 0 || prevTableNumber >= (int) m_tables.size())
+                return -1;
+            if (thisTableJoinColIndex < 0 || thisTableJoinColIndex >= table->column_count())
+                return -1;
+            if (prevTableJoinColIndex < 0 || prevTableJoinColIndex >= m_tables[prevTableNumber].table->column_count())
+                return -1;
+
+            t.parent = prevTableNumber;
+            t.join_column = thisTableJoinColIndex;
+            t.parent_column = prevTableJoinColIndex;
+            t.depth = m_tables[prevTableNumber].depth + 1;
+            m_tables[prevTableNumber].children.push_back((int) m_tables.size());
+        }
+        m_tables.push_back(std::move(t));
+        return (int) m_tables.size() - 1;
+    }
+
+    // A walk is only accepted if column columnA of its record of tableA
+    // equals column columnB of its record of tableB.  Returns -1 if there's
+    // an error.
+    int AddClosingPredicate(int tableA, int columnA, int tableB, int columnB)
+    {
+        if (tableA < 0 || tableA >= (int) m_tables.size() || tableB < 0 || tableB >= (int) m_tables.size())
+            return -1;
+        if (columnA < 0 || columnA >= m_tables[tableA].table->column_count())
+            return -1;
+        if (columnB < 0 || columnB >= m_tables[tableB].table->column_count())
+            return -1;
+
+        m_closing.push_back(predicate_t{ tableA, columnA, tableB, columnB });
+        return 0;
+    }
+
+    // Index the join columns and set up the first table.  The vertexes of
+    // the tables at least DP_level joins away from the first table are
+    // exact (-1 for the default, 1).  Returns -1 if there are no tables.
+    int initialize(int DP_level = -1)
+    {
+        if (m_tables.empty())
+            return -1;
+        if (DP_level == -1)
+            DP_level = 1;
+        m_DP_level = DP_level;
+
+        for (auto &t : m_tables) {
+            t.rows.clear();
+            t.vertexes.clear();
+            if (t.parent < 0)
+                continue;
+
+            auto keys = t.table->get_key_iterator(t.join_column);
+            for (int64_t row = 0; row < t.table->row_count(); ++row)
+                t.rows[keys[row]].push_back(row);
+
+            t.max_degree = 0;
+            for (auto &r : t.rows)
+                t.max_degree = std::max(t.max_degree, (int64_t) r.second.size());
+        }
+
+        // the default bounds, from the leaves up
+        for (int i = (int) m_tables.size() - 1; i >= 0; --i) {
+            table_t &t = m_tables[i];
+            if (t.max_AGM != 0)
+                continue;
+            t.max_AGM = 1;
+            for (int c : t.children)
+                t.max_AGM = checked_mul(t.max_AGM, checked_mul(m_tables[c].max_degree, m_tables[c].max_AGM));
+        }
+
+        table_t &root = m_tables[0];
+        checked_mul(root.max_AGM, root.table->row_count());
+        m_origin.reset(new DynamicOriginVertex(root.max_AGM, root.table->row_count()));
+        return 0;
+    }
+
+    // Make every weight exact, so later walks are never rejected.  Without
+    // it the index learns the weights while it samples.
+    void warmup()
+    {
+        DP_calculation(0, 0);
+    }
+
+    // Seed the generator of sample_join() without a generator, so a run can
+    // be replayed exactly.  The index is seeded from the clock otherwise.
+    void seed(uint64_t seed)
+    {
+        m_rgen = CounterRng(seed);
+    }
+
+    bool sample_join(std::vector<int64_t> &output)
+    {
+        return sample_join(output, m_rgen);
+    }
+
+    // Draw one walk and learn from it.  Returns true if the walk was
+    // accepted, output[t] then holds its record of table t.
+    bool sample_join(std::vector<int64_t> &output, CounterRng &rng)
+    {
+        const size_t n = m_tables.size();
+        output.assign(n, -1);
+        std::vector<DynamicVertex*> vertexes(n, nullptr);
+        std::vector<int64_t> update_id(n, 0);
+        std::vector<int64_t> record_weight(n, 0);
+        std::vector<double> p_value(n, 1.0);
+        std::vector<char> sampled(n, 0);
+        // the table whose record joins nothing in a child table
+        int dead_end = -1;
+        WALK_STATUS status = GOOD;
+
+        // the join is empty
+        if (m_origin->get_weight() == 0)
+            return false;
+
+        vertexes[0] = m_origin.get();
+        for (size_t t = 0; t < n && !(status & FAIL); ++t) {
+            // the parent made sure the vertex has records and weight
+            int64_t max_prev = 0;
+            if (t == 0)
+                status |= m_origin->get_records_p(max_prev, output[t], update_id[t], p_value[t], rng);
+            else
+                status |= vertexes[t]->get_records_p(max_prev, output[t], update_id[t], p_value[t], rng);
+            if (status & FAIL)
+                break;
+            record_weight[t] = max_prev;
+            sampled[t] = 1;
+
+            // a leaf record is one result below its parent, so its product
+            // is 1 and it is still accepted with probability 1 / its bound
+            int64_t product = 1;
+            for (int c : m_tables[t].children) {
+                vertexes[c] = get_vertex(c, child_key(c, output[t]));
+                product = checked_mul(product, vertexes[c]->get_weight());
+            }
+
+            if (product == 0) {
+                status |= FAIL;
+                dead_end = (int) t;
+                break;
+            }
+
+            // accept the record with probability product / its bound
+            std::uniform_int_distribution<int64_t> dist(0, std::max(record_weight[t], product) - 1);
+            if (dist(rng) >= product)
+                status |= REJECT;
+        }
+
+        if (!(status & FAIL)) {
+            for (auto &pred : m_closing) {
+                if (m_tables[pred.tableA].table->get_key_iterator(pred.columnA)[output[pred.tableA]]
+                    != m_tables[pred.tableB].table->get_key_iterator(pred.columnB)[output[pred.tableB]])
+                    status |= FAIL;
+            }
+        }
+
+        // the probability of the part of the walk below each table, and the
+        // new weights on the way back
+        for (int t = (int) n - 1; t >= 0; --t) {
+            if (!sampled[t])
+                continue;
+
+            int64_t new_weight = 1;
+            if (t == dead_end)
+                new_weight = 0;
+            for (int c : m_tables[t].children) {
+                if (sampled[c])
+                    p_value[t] *= p_value[c];
+                if (t != dead_end)
+                    new_weight = checked_mul(new_weight, vertexes[c]->get_weight());
+            }
+
+            if (is_exact(t))
+                continue;
+
+            // a rejected walk still learned the weight of the record
+            if (vertexes[t]->is_DPset())
+                vertexes[t]->report(p_value[t], (status & FAIL) == GOOD);
+            else
+                vertexes[t]->adjust_and_report(new_weight, update_id[t], p_value[t], (status & FAIL) == GOOD);
+        }
+
+        return status == GOOD;
+    }
+
+    // Append accepted walks to output until there are max_samples new ones
+    // or the deadline expires.
+    SampleReport sample_until(Deadline deadline, std::vector<std::vector<int64_t> > &output, size_t max_samples = SIZE_MAX)
+    {
+        return sample_until_deadline(deadline, output, max_samples,
+            [this](std::vector<int64_t> &sample) { return sample_join(sample); });
+    }
+
+    int GetNumberOfTables() const
+    {
+        return (int) m_tables.size();
+    }
+
+    // the current bound on the number of join results
+    int64_t initial_upper_bound()
+    {
+        return m_origin->get_weight();
+    }
+
+    // the wander join estimate of the number of join results, counting the
+    // closing predicates
+    int64_t size_est()
+    {
+        return int64_t(m_origin->est_size());
+    }
+
+private:
+    struct table_t {
+        std::shared_ptr<Table> table;
+        int parent = -1;
+        // the join column of this table and of its parent
+        int join_column = -1;
+        int parent_column = -1;
+        // the number of joins between the first table and this one
+        int depth = 0;
+        std::vector<int> children;
+
+        int64_t max_AGM = 0;
+        int64_t max_degree = 0;
+
+        // the row ids by join value.  The vertexes point to these lists.
+        std::unordered_map<jfkey_t, std::vector<jefastKey_t> > rows;
+        std::unordered_map<jfkey_t, std::unique_ptr<DynamicVertex> > vertexes;
+    };
+
+    struct predicate_t {
+        int tableA;
+        int columnA;
+        int tableB;
+        int columnB;
+    };
+
+    static int64_t checked_add(int64_t a, int64_t b)
+    {
+        int64_t result;
+        if (__builtin_add_overflow(a, b, &result))
+            throw std::overflow_error("join weight does not fit in the 64 bit weights of DynamicTreeIndex");
+        return result;
+    }
+
+    static int64_t checked_mul(int64_t a, int64_t b)
+    {
+        int64_t result;
+        if (__builtin_mul_overflow(a, b, &result))
+            throw std::overflow_error("join weight does not fit in the 64 bit weights of DynamicTreeIndex");
+        return result;
+    }
+
+    bool is_exact(int table) const
+    {
+        return table != 0 && m_tables[table].depth >= m_DP_level;
+    }
+
+    // the join value of table `table` with the record `row` of its parent
+    jfkey_t child_key(int table, int64_t row)
+    {
+        const table_t &t = m_tables[table];
+        return m_tables[t.parent].table->get_key_iterator(t.parent_column)[row];
+    }
+
+    // return the vertex of a table with a particular key (or creates one if
+    // it does not exist)
+    DynamicVertex *find_vertex(int table, jfkey_t key)
+    {
+        if (table == 0)
+            return m_origin.get();
+
+        table_t &t = m_tables[table];
+        auto ptr = t.vertexes.find(key);
+        if (ptr == t.vertexes.end()) {
+            auto records = t.rows.find(key);
+            const std::vector<jefastKey_t> *rows = records == t.rows.end() ? nullptr : &records->second;
+            int64_t count = rows == nullptr ? 0 : rows->size();
+            checked_mul(t.max_AGM, count);
+
+            std::unique_ptr<DynamicVertex> temp_p(new DynamicVertex(t.max_AGM, count, key, rows));
+            ptr = t.vertexes.emplace(key, std::move(temp_p)).first;
+        }
+        return ptr->second.get();
+    }
+
+    // find_vertex(), and make the vertexes at the DP level and below exact
+    DynamicVertex *get_vertex(int table, jfkey_t key)
+    {
+        DynamicVertex *vertex = find_vertex(table, key);
+        if (is_exact(table) && !vertex->is_DPset())
+            DP_calculation(table, key);
+        return vertex;
+    }
+
+    // do recursive calculations to get the exact weight of a vertex
+    int64_t DP_calculation(int table, jfkey_t key)
+    {
+        DynamicVertex *vertex = find_vertex(table, key);
+        if (vertex->is_DPset())
+            return vertex->get_weight();
+
+        table_t &t = m_tables[table];
+        const std::vector<jefastKey_t> *rows = nullptr;
+        int64_t row_count = t.table->row_count();
+        if (table != 0) {
+            auto records = t.rows.find(key);
+            rows = records == t.rows.end() ? nullptr : &records->second;
+            row_count = rows == nullptr ? 0 : rows->size();
+        }
+
+        std::vector<int64_t> dp_weights(row_count, 1);
+        int64_t total = 0;
+        for (int64_t i = 0; i < row_count; ++i) {
+            int64_t row = rows == nullptr ? i : (*rows)[i];
+            for (int c : t.children) {
+                dp_weights[i] = checked_mul(dp_weights[i], DP_calculation(c, child_key(c, row)));
+                if (dp_weights[i] == 0)
+                    break;
+            }
+            total = checked_add(total, dp_weights[i]);
+        }
+        return vertex->set_DP_weights(dp_weights);
+    }
+
+    std::vector<table_t> m_tables;
+    std::vector<predicate_t> m_closing;
+
+    std::unique_ptr<DynamicOriginVertex> m_origin;
+
+    int m_DP_level;
+
+    CounterRng m_rgen;
+};
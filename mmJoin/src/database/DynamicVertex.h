@@ -4,9 +4,16 @@
 #include <vector>
 #include <assert.h>
 #include <random>
+#include <atomic>
+#include <mutex>
+#include <thread>
 
 #include "../database/TableGeneric.h"
-#include "../util/StatelessFenwickTree.h"
+#include "../util/FenwickTree.h"
+#include "../util/CounterRng.h"
+#include "../util/BinaryStream.h"
+#include "../util/Arena.h"
+#include "../util/cpp_macros.h"
 
 //enum WALK_STATUS { GOOD = 0b0, REJECT = 0b1, FAIL = 0b10, REJECTAFAIL = 0b11 };
 typedef int WALK_STATUS;
@@ -15,11 +22,31 @@ constexpr int REJECT = 1;
 constexpr int FAIL = 2;
 constexpr int REJECTAFAIL = REJECT | FAIL;
 
-static std::mt19937_64 gen{ (unsigned)std::chrono::system_clock::now().time_since_epoch().count() };
+// A vertex is shared by all threads sampling from the same DynamicIndex.
+// Every public member function which reads or changes the weights or the
+// walk statistics holds the lock of the vertex, a spinlock since the
+// critical sections are a few Fenwick tree steps long.  The warmup reads and
+// adds up the public statistics directly, without the lock: it splits the
+// vertexes of a level between its threads, so each vertex is warmed by one
+// thread only, and the vertexes of the level below which it reads from are
+// no longer changed by then (see DynamicIndex::wander_join_warmup()).
 
 class DynamicVertex {
 public:
-    DynamicVertex(int64_t max_wgt, int64_t cardinality, int64_t value, std::shared_ptr<TableGenericBase> home)
+    // The weight of every record, in a Fenwick tree to sample records by
+    // weight.  The tree is allocated from arena if there is one, which must
+    // then outlive the vertex.
+    typedef FenwickTree<int64_t, ArenaAllocator<int64_t> > weight_tree;
+
+    DynamicVertex(int64_t max_wgt, int64_t cardinality, int64_t value, std::shared_ptr<TableGenericBase> home, Arena *arena = nullptr)
+        : DynamicVertex(max_wgt, cardinality, value, home->find_column1_rows(value), arena)
+    {
+        m_home = home;
+    }
+
+    // a vertex over the records `rows`, which must outlive it.  rows may be
+    // nullptr for the origin vertex.
+    DynamicVertex(int64_t max_wgt, int64_t cardinality, int64_t value, const std::vector<jefastKey_t> *rows, Arena *arena = nullptr)
         : walk_count{ 0 }
         , successful_walks{ 0 }
         , m_value{ value }
@@ -27,11 +54,11 @@ public:
         , V_sum{ 0.0 }
         , m_DPset{ 0 }
         , max_weight{ max_wgt * cardinality }
-        , m_home{ home }
+        , weights(ArenaAllocator<int64_t>(arena))
+        , m_rows{ rows }
     {
-        weights.resize(cardinality, max_wgt);
-        if(weights.size() > 0)
-            StatelessFenwickTree::initialize(&weights[0], cardinality);
+        m_lock.clear();
+        weights.assign(cardinality, max_wgt);
     }
 
     virtual ~DynamicVertex()
@@ -50,12 +77,39 @@ protected:
 public:
 
 
-    std::vector<int64_t> weights;
+    weight_tree weights;
     std::shared_ptr<TableGenericBase> m_home;
 
+    // hint that the vertex is about to be sampled from: fetch the root of the
+    // Fenwick tree, where find() starts, and the row ids
+    void prefetch()
+    {
+        if (weights.empty())
+            return;
+        weights.prefetch();
+        if (m_rows != nullptr)
+            prefetch_for_read(m_rows->data());
+    }
+
+    // BasicLockable, for std::lock_guard
+    void lock()
+    {
+        // give up the time slice if the holder has been descheduled
+        for (int spins = 0; m_lock.test_and_set(std::memory_order_acquire); ++spins) {
+            if (spins >= 64)
+                std::this_thread::yield();
+        }
+    }
+
+    void unlock()
+    {
+        m_lock.clear(std::memory_order_release);
+    }
+
     int64_t get_max_weight()
     {
-        if (is_DPset() == true)
+        std::lock_guard<DynamicVertex> guard(*this);
+        if (m_DPset == weights.size())
             return max_weight;
 
         // if DP is set, we return the max weight.  Otherwise, return the WJ estimation.
@@ -66,14 +120,16 @@ public:
 
     bool WJ_stats_good()
     {
+        std::lock_guard<DynamicVertex> guard(*this);
         // it is good is we have at least 10 successful walks and at least 30 walks.
         // if none are successful, we just say it is good if we have at least 1000 walks (in that case we just say the weight is really small)
         return ((successful_walks > 10) && (walk_count > 30)) || (walk_count > 1000);
     }
 
     // return false if it fails
-    WALK_STATUS get_records(int64_t &inout_weight_condition, int64_t &out_record_id, int64_t &update_key, double &p)
+    WALK_STATUS get_records(int64_t &inout_weight_condition, int64_t &out_record_id, int64_t &update_key, double &p, CounterRng &rng)
     {
+        std::lock_guard<DynamicVertex> guard(*this);
         if (weights.size() == 0 || max_weight == 0)
             return FAIL;
 
@@ -88,39 +144,26 @@ public:
             // adjust the weights so we can continue the walk (even though we failed to sample)
             std::uniform_int_distribution<int64_t> dist(0, max_weight - 1);
 
-            inout_weight_condition = dist(gen);
+            inout_weight_condition = dist(rng);
         }
 
-        update_key = StatelessFenwickTree::findG_mod(&weights[0], weights.size(), inout_weight_condition);
+        update_key = weights.find(inout_weight_condition);
         //out_record_id = m_home->get_column2_value(m_home->get_column1_index_offset(m_value, update_key));
-        out_record_id = m_home->get_column1_index_offset(m_value, update_key);
-
-        double pre_p = p;
+        out_record_id = (*m_rows)[update_key];
 
         // we have to say p = 1 * weight.  each p value is calculated independent of
         // each other and will be combined later when doing updates
-        if (weights.size() != 1)
-        {
-            if (update_key != weights.size() - 1)
-            {
-                p = ((double)StatelessFenwickTree::readSingle_value(&weights[0], update_key + 1) / max_weight);
-            }
-            else
-            {
-                p = ((max_weight - ((double)StatelessFenwickTree::read_value(&weights[0], update_key))) / max_weight);
-            }
-        }
-        else {
-            p = 1.0;
-        }
+        p = (double)weights.get(update_key) / max_weight;
 
         assert(p != 0);
         return ret_val;
     }
 
-    // we change the value of max_prev to be a new value for max_prev
-    WALK_STATUS get_records_p(int64_t &max_prev, int64_t &out_record_id, int64_t &update_key, double &p)
+    // we change the value of max_prev to be a new value for max_prev.  The
+    // random numbers come from rng, the generator of the walk.
+    WALK_STATUS get_records_p(int64_t &max_prev, int64_t &out_record_id, int64_t &update_key, double &p, CounterRng &rng)
     {
+        std::lock_guard<DynamicVertex> guard(*this);
         if (weights.size() == 0 || max_weight == 0)
             return FAIL;
 
@@ -130,7 +173,7 @@ public:
         WALK_STATUS ret_val = GOOD;
 
         std::uniform_int_distribution<int64_t> i_dist(0, std::max(max_prev, max_weight) - 1);
-        int64_t weight{ i_dist(gen) };
+        int64_t weight{ i_dist(rng) };
 
         if (weight >= max_weight) {
             ret_val = REJECT;
@@ -139,36 +182,16 @@ public:
             //std::default_random_engine gen(std::chrono::system_clock::now().time_since_epoch().count());
             std::uniform_int_distribution<int64_t> dist(0, max_weight - 1);
 
-            weight = dist(gen);
+            weight = dist(rng);
         }
 
-        update_key = StatelessFenwickTree::findG_mod(&weights[0], weights.size(), weight);
+        update_key = weights.find(weight);
         //out_record_id = m_home->get_column2_value(m_home->get_column1_index_offset(m_value, update_key));
-        out_record_id = m_home->get_column1_index_offset(m_value, update_key);
-
-        double pre_p = p;
+        out_record_id = (*m_rows)[update_key];
 
         // we have to say p = 1 * weight.  each p value is calculated independent of
         // each other and will be combined later when doing updates
-        if (weights.size() != 1)
-        {
-            if (update_key != weights.size() - 1)
-            {
-                max_prev = StatelessFenwickTree::readSingle_value(&weights[0], update_key + 1);
-                //p = ((double)StatelessFenwickTree::readSingle_value(&weights[0], update_key + 1) / max_weight);
-            }
-            else
-            {
-                max_prev = max_weight - StatelessFenwickTree::read_value(&weights[0], update_key);
-                //p = ((max_weight - ((double)StatelessFenwickTree::read_value(&weights[0], update_key))) / max_weight);
-            }
-
-
-        }
-        else {
-            max_prev = max_weight;
-        }
-
+        max_prev = weights.get(update_key);
         p = (double)max_prev / max_weight;
 
         assert(p != 0);
@@ -177,61 +200,63 @@ public:
 
     void adjust_weight(int64_t new_weight, int64_t update_key)
     {
-        if (update_key >= weights.size()) {
-            assert(false);
-        }
-
-        if (update_key == weights.size() - 1)
-        {
-            int64_t last_largest_weight{ 0 };
-            if (weights.size() > 1)
-                last_largest_weight = StatelessFenwickTree::read_value(&weights[0], weights.size() - 1);
-
-            max_weight = last_largest_weight + new_weight;
-        }
-        else {
-            int64_t current_weight = StatelessFenwickTree::readSingle_value(&weights[0], update_key + 1);
-            StatelessFenwickTree::update_add_value(&weights[0], weights.size(), update_key + 1, new_weight - current_weight);
-            max_weight += new_weight - current_weight;
-        }
-        
-        assert(!(max_weight == 0 && (successful_walks > 0)));
+        std::lock_guard<DynamicVertex> guard(*this);
+        adjust_weight_locked(new_weight, update_key);
     }
 
     void adjust_DP_weight(int64_t new_weight, int64_t update_key)
     {
-        adjust_weight(new_weight, update_key);
+        std::lock_guard<DynamicVertex> guard(*this);
+        adjust_weight_locked(new_weight, update_key);
 
         ++m_DPset;
     }
 
+    // Set the DP weight of every record at once, unless another thread
+    // already did.  dp_weights holds one weight per record.  Returns the
+    // weight of the vertex.
+    int64_t set_DP_weights(const std::vector<int64_t> &dp_weights)
+    {
+        std::lock_guard<DynamicVertex> guard(*this);
+        if (m_DPset != weights.size()) {
+            assert(dp_weights.size() == weights.size());
+            // one linear build rather than an update per record
+            weights.assign(dp_weights.data(), dp_weights.size());
+            max_weight = weights.total();
+            m_DPset = (int) weights.size();
+        }
+        return max_weight;
+    }
+
     bool is_DPset()
     {
+        std::lock_guard<DynamicVertex> guard(*this);
         return m_DPset == weights.size();
     }
 
     int64_t get_weight()
     {
+        std::lock_guard<DynamicVertex> guard(*this);
         return max_weight;
     }
 
-    void report(double p, bool success)
+    // adjust_weight() and report() under one lock, what a walk does on its
+    // way back
+    void adjust_and_report(int64_t new_weight, int64_t update_key, double p, bool success)
     {
         assert(p != 0);
 
-        ++walk_count;
-        if (success)
-        {
-            ++successful_walks;
-            S_sum += 1 / p;
-            V_sum += (1 / p) * (1 / p);
-        }
-        // if it was not successful, only walk count it updated.
-        //if (walk_count % 100000 == 99999)
-        //this->calculate_b();
+        std::lock_guard<DynamicVertex> guard(*this);
+        adjust_weight_locked(new_weight, update_key);
+        report_locked(p, success);
+    }
 
-        //std::cout << "id= " << this->m_value << "est= " << (S_sum / walk_count) << " bound: +" << calculate_b() << " max weight: " << this->get_max_weight() << '\n';
+    void report(double p, bool success)
+    {
+        assert(p != 0);
 
+        std::lock_guard<DynamicVertex> guard(*this);
+        report_locked(p, success);
     }
 
     double calculate_b()
@@ -257,8 +282,78 @@ public:
 
     double est_size()
     {
+        std::lock_guard<DynamicVertex> guard(*this);
         return (S_sum / walk_count);
     }
+
+    // Write what the vertex learned: the walk statistics, the DP flag and
+    // the weights.
+    void save(std::ostream &out)
+    {
+        std::lock_guard<DynamicVertex> guard(*this);
+        write_binary(out, walk_count);
+        write_binary(out, successful_walks);
+        write_binary(out, S_sum);
+        write_binary(out, V_sum);
+        write_binary(out, (int32_t) m_DPset);
+        write_binary(out, max_weight);
+        write_binary(out, weights.values());
+    }
+
+    // Read the state written by save().  Returns false if the stream ends
+    // or was saved from a vertex with a different number of records, the
+    // vertex is then only partly loaded.
+    bool load(std::istream &in)
+    {
+        std::lock_guard<DynamicVertex> guard(*this);
+        int32_t DPset;
+        std::vector<int64_t> saved_weights;
+        if (!read_binary(in, walk_count) || !read_binary(in, successful_walks)
+            || !read_binary(in, S_sum) || !read_binary(in, V_sum)
+            || !read_binary(in, DPset) || !read_binary(in, max_weight)
+            || !read_binary(in, saved_weights, weights.size())
+            || saved_weights.size() != weights.size())
+            return false;
+
+        m_DPset = DPset;
+        weights.assign(saved_weights.data(), saved_weights.size());
+        return true;
+    }
+
+protected:
+    void report_locked(double p, bool success)
+    {
+        ++walk_count;
+        if (success)
+        {
+            ++successful_walks;
+            S_sum += 1 / p;
+            V_sum += (1 / p) * (1 / p);
+        }
+        // if it was not successful, only walk count it updated.
+        //if (walk_count % 100000 == 99999)
+        //this->calculate_b();
+
+        //std::cout << "id= " << this->m_value << "est= " << (S_sum / walk_count) << " bound: +" << calculate_b() << " max weight: " << this->get_max_weight() << '\n';
+    }
+
+    void adjust_weight_locked(int64_t new_weight, int64_t update_key)
+    {
+        if (update_key >= weights.size()) {
+            assert(false);
+        }
+
+        int64_t current_weight = weights.set(update_key, new_weight);
+        max_weight += new_weight - current_weight;
+
+        assert(!(max_weight == 0 && (successful_walks > 0)));
+    }
+
+    std::atomic_flag m_lock;
+
+    // the row ids of m_home joining this vertex, looked up once instead of
+    // for every walk.  Not used by the origin vertex.
+    const std::vector<jefastKey_t> *m_rows;
 };
 
 class DynamicOriginVertex : public DynamicVertex
@@ -268,70 +363,54 @@ public:
         : DynamicVertex(max_wgt, table->get_size(), 0, table)
     {};
 
+    // an origin vertex over the rows 0 .. row_count - 1 of a table
+    DynamicOriginVertex(int64_t max_wgt, int64_t row_count)
+        : DynamicVertex(max_wgt, row_count, 0, nullptr)
+    {};
+
     virtual ~DynamicOriginVertex()
     {};
 
     // we change the query to use the column rather then column + offset
-    WALK_STATUS get_records(int64_t &inout_weight_condition, int64_t &out_record_id, int64_t &update_key, double &p)
+    WALK_STATUS get_records(int64_t &inout_weight_condition, int64_t &out_record_id, int64_t &update_key, double &p, CounterRng &rng)
     {
+        std::lock_guard<DynamicVertex> guard(*this);
         //++walk_count;
 
         if (inout_weight_condition >= max_weight)
             return REJECT;
 
-        update_key = StatelessFenwickTree::findG_mod(&weights[0], weights.size(), inout_weight_condition);
+        update_key = weights.find(inout_weight_condition);
 
         // for this one, we just join with all other items.
         //out_record_id = m_home->get_column2_value(update_key);
         out_record_id = update_key;
 
-        if (update_key != weights.size() - 1)
-        {
-            p = ((double)StatelessFenwickTree::readSingle_value(&weights[0], update_key + 1) / max_weight);
-        }
-        else
-        {
-            p = ((max_weight - ((double)StatelessFenwickTree::read_value(&weights[0], update_key))) / max_weight);
-        }
+        p = (double)weights.get(update_key) / max_weight;
 
         assert(p != 0);
 
         return GOOD;
     }
 
-    WALK_STATUS get_records_p(int64_t &max_prev, int64_t &out_record_id, int64_t &update_key, double &p)
+    WALK_STATUS get_records_p(int64_t &max_prev, int64_t &out_record_id, int64_t &update_key, double &p, CounterRng &rng)
     {
+        std::lock_guard<DynamicVertex> guard(*this);
         //++walk_count;
 
         //if (max_prev >= max_weight)
         //    return REJECT;
         std::uniform_int_distribution<int64_t> i_dist(0, std::max(max_prev, max_weight) - 1);
-        int64_t weight{ i_dist(gen) };
+        int64_t weight{ i_dist(rng) };
 
 
-        update_key = StatelessFenwickTree::findG_mod(&weights[0], weights.size(), weight);
+        update_key = weights.find(weight);
 
         // for this one, we just join with all other items.
         //out_record_id = m_home->get_column2_value(update_key);
         out_record_id = update_key;
 
-        if (weights.size() != 1)
-        {
-            if (update_key != weights.size() - 1)
-            {
-                max_prev = StatelessFenwickTree::readSingle_value(&weights[0], update_key + 1);
-                //p = ((double)StatelessFenwickTree::readSingle_value(&weights[0], update_key + 1) / max_weight);
-            }
-            else
-            {
-                max_prev = max_weight - StatelessFenwickTree::read_value(&weights[0], update_key);
-                //p = ((max_weight - ((double)StatelessFenwickTree::read_value(&weights[0], update_key))) / max_weight);
-            }
-        }
-        else {
-            max_prev = max_weight;
-        }
-
+        max_prev = weights.get(update_key);
         p = (double)max_prev / max_weight;
 
         assert(p != 0);
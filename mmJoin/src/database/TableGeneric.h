@@ -14,6 +14,7 @@
 
 #include "Table.h"
 #include "ColumnExtractor.h"
+#include "../util/cpp_macros.h"
 
 using EmptyAugmenter = ColumnExtractor<>;
 
@@ -151,6 +152,21 @@ public:
         return std::max(this->m_column1.size(), this->m_column2.size());
     }
 
+    // a hash of both columns, which changes with any value or its row.  One
+    // pass over the columns, much cheaper than building the indexes.
+    uint64_t fingerprint() const
+    {
+        uint64_t h = 0;
+        for (const std::vector<jefastKey_t> *column : { &m_column1, &m_column2 }) {
+            h = (h + column->size()) * 0x9E3779B97F4A7C15ull;
+            for (jefastKey_t value : *column) {
+                h = (h ^ (uint64_t) value) * 0x9E3779B97F4A7C15ull;
+                h ^= h >> 29;
+            }
+        }
+        return h;
+    }
+
     // given a value, it will return the number of times that value appears in
     // the column
     int count_cardinality(int value, int column = 1) {
@@ -174,16 +190,20 @@ public:
         }
     }
 
+    // Does not change the table, so several threads can call it (and
+    // get_column1_index_offset()) at once.
     int count_cardinaltiy_f(int value, int column = 1) {
         switch (column) {
         case 1:
         {
-            return m_column1_fast_index[value].size();
+            auto search = m_column1_fast_index.find(value);
+            return search == m_column1_fast_index.end() ? 0 : (int) search->second.size();
         }
         break;
         case 2:
         {
-            return m_column2_fast_index[value].size();
+            auto search = m_column2_fast_index.find(value);
+            return search == m_column2_fast_index.end() ? 0 : (int) search->second.size();
         }
         break;
         default:
@@ -202,9 +222,22 @@ public:
         return m_column2[index];
     };
 
+    // hint that get_column2_value(index) will be called soon
+    void prefetch_column2_value(int index)
+    {
+        prefetch_for_read(&m_column2[index]);
+    }
+
+    // the row ids whose column 1 is value, or nullptr if there are none
+    const std::vector<jefastKey_t> *find_column1_rows(jefastKey_t value)
+    {
+        auto search = m_column1_fast_index.find(value);
+        return search == m_column1_fast_index.end() ? nullptr : &search->second;
+    }
+
     int get_column1_index_offset(int value, int offset = 0)
     {
-        return m_column1_fast_index[value].at(offset);
+        return m_column1_fast_index.at(value).at(offset);
 
         //auto start_idx = std::lower_bound(m_column1_index.begin(), m_column1_index.end(), value, [](auto &a, auto b) {return a.value < b;});
         // check to make sure the value we are finding is actually in the data
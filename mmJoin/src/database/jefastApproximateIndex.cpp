@@ -0,0 +1,45 @@
+// Implements the approximate jefast index
+
+#include "jefastApproximateIndex.h"
+
+#include <algorithm>
+
+void jefastApproximateIndex::GetRandomJoin(std::vector<int64_t> &out)
+{
+    out.clear();
+    if (GetTotal() <= 0)
+        return;
+
+    out.resize(m_tables.size());
+    for (size_t t = 0; t < m_tables.size(); ++t) {
+        const table_t &table = m_tables[t];
+        const vertex_t *vertex;
+        if (t == 0) {
+            vertex = &table.vertexes.begin()->second;
+        } else {
+            // every record with a weight joins a vertex of each child
+            jfkey_t key = table.parent_keys[out[table.parent]];
+            vertex = &table.vertexes.find(key)->second;
+        }
+
+        std::uniform_real_distribution<double> distribution(0.0, table.vertex_weight(*vertex));
+        double x = distribution(m_generator);
+        auto first = table.prefix.begin() + vertex->begin;
+        auto last = table.prefix.begin() + vertex->end;
+        auto itr = std::upper_bound(first, last, x);
+        // the distribution may round up to the weight of the vertex
+        if (itr == last)
+            --itr;
+        out[t] = table.records[itr - table.prefix.begin()];
+    }
+}
+
+size_t jefastApproximateIndex::memory() const
+{
+    size_t bytes = 0;
+    for (const table_t &table : m_tables) {
+        bytes += table.records.size() * (sizeof(int64_t) + sizeof(double));
+        bytes += table.vertexes.size() * (sizeof(std::pair<jfkey_t, vertex_t>) + 2 * sizeof(void*));
+    }
+    return bytes;
+}
@@ -0,0 +1,88 @@
+// An approximate jefast index with double precision weights.
+//
+// The weights of the exact index are integers of at most wide_weight_t, so a
+// join which is larger than 128 bits can't be indexed at all and the wide
+// weights need a 128 bit division at every fork.  This index keeps the same join tree but
+// stores the weights as doubles, which reach about 1e308, and samples every
+// table independently given its parent: it draws a uniform double below the
+// weight of the vertex and binary searches the prefix sums of its records.
+// There is no join number, so it only supports random sampling.
+//
+// Rounding makes the samples slightly non-uniform.  GetUniformityBound()
+// reports how far from the exact distribution they can be.  Built with
+// JefastBuilder::BuildApproximate().
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <random>
+#include <unordered_map>
+
+#include "Table.h"
+#include "DatabaseSharedTypes.h"
+
+class jefastApproximateIndex {
+public:
+    // the (approximate) number of join results, or their total row weight
+    double GetTotal() const {
+        if (m_tables.empty() || m_tables[0].vertexes.empty())
+            return 0.0;
+        return m_tables[0].vertex_weight(m_tables[0].vertexes.begin()->second);
+    }
+
+    // one record per table, in the order of the builder's table numbers
+    int GetNumberOfLevels() const {
+        return (int) m_tables.size();
+    }
+
+    // Draw one join result with replacement.  out[t] is the record id of
+    // table t.  out is left empty if the join is empty.
+    void GetRandomJoin(std::vector<int64_t> &out);
+
+    // An upper bound, to first order in the unit roundoff of double, on the
+    // total variation distance between the distribution GetRandomJoin()
+    // samples from and the exact one.  The probability of any set of join
+    // results is off by at most this much.
+    double GetUniformityBound() const {
+        return m_uniformity_bound;
+    }
+
+    // bytes used by the records, prefix sums and vertexes
+    size_t memory() const;
+
+private:
+    jefastApproximateIndex()
+    {};
+
+    struct vertex_t {
+        size_t begin;
+        size_t end;
+    };
+
+    struct table_t {
+        int parent = -1;
+        // the join column of the parent with this table.  The table is
+        // kept so the iterator stays valid.
+        std::shared_ptr<Table> parent_table;
+        std::vector<jfkey_t>::iterator parent_keys;
+
+        // vertexes by join value, each one a range of records.  The first
+        // table has a single vertex with all its records.
+        std::unordered_map<jfkey_t, vertex_t> vertexes;
+        std::vector<int64_t> records;
+        // prefix[i] is the weight of the records of its vertex up to and
+        // including records[i]
+        std::vector<double> prefix;
+
+        double vertex_weight(const vertex_t &v) const {
+            return prefix[v.end - 1];
+        }
+    };
+
+    std::vector<table_t> m_tables;
+    double m_uniformity_bound = 0;
+
+    std::default_random_engine m_generator;
+
+    friend class JefastBuilder;
+};
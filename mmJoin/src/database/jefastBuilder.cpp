@@ -10,9 +10,16 @@
 #include <chrono>
 #include <iostream>
 #include <algorithm>
+#include <unordered_set>
+#include <unordered_map>
+#include <limits>
+#include <cmath>
 
 JefastBuilder::JefastBuilder():
-    m_has_fork(false)
+    m_has_fork(false),
+    m_semiJoinReduction(false),
+    m_detectPrimaryKeys(false),
+    m_wideWeights(-1)
 {
 }
 
@@ -66,12 +73,164 @@ int JefastBuilder::AddTableToFork(
     return thisTableNumber;
 }
 
+void JefastBuilder::SetLevelCache(std::shared_ptr<JefastLevelCache> cache)
+{
+    m_levelCache = cache;
+}
+
+bool JefastBuilder::level_cache_usable() const
+{
+    // the reduction makes a level depend on more than the subtree below it.
+    return m_levelCache && !m_semiJoinReduction;
+}
+
+bool JefastBuilder::row_weighted(size_t tableNumber) const
+{
+    return tableNumber < m_rowWeights.size() && bool(m_rowWeights[tableNumber]);
+}
+
+// level i joins table i with table i + 1 and is weighted by the tables
+// after it, so its signature covers the whole suffix of the chain.  Level 0
+// is the start level, which also holds the LHS records ("S"), the other
+// levels may be primary key levels without vertexes ("P"), so neither can
+// stand in for the other.  A level with a row weighted table after it is
+// not cached (empty signature), one with a row weighted LHS table only
+// divides differently ("W").
+std::vector<std::string> JefastBuilder::linear_level_signatures()
+{
+    std::vector<std::string> signatures;
+    if (!level_cache_usable())
+        return signatures;
+
+    signatures.resize(m_joinedTables.size() - 1);
+    bool weighted = false;
+    for (size_t i = signatures.size(); i-- > 0;) {
+        weighted = weighted || row_weighted(i + 1);
+        if (weighted)
+            continue;
+        signatures[i] = "L" + JefastLevelCache::column_signature(m_joinedTables[i], m_LHSJoinIndex[i])
+            + "|" + JefastLevelCache::column_signature(m_joinedTables[i + 1], m_RHSJoinIndex[i + 1]);
+        if (i == 0)
+            signatures[i] += "S";
+        else if (primary_key_level(int(i) + 1))
+            signatures[i] += "P";
+        if (row_weighted(i))
+            signatures[i] += "W";
+        if (i + 1 < signatures.size())
+            signatures[i] += "(" + signatures[i + 1] + ")";
+    }
+    return signatures;
+}
+
+// level i holds table i keyed by its join column with its parent and is
+// weighted by the subtree of table i.  Level 1 is also the start level if
+// there is no virtual level, which adds the LHS records ("S"); the other
+// levels may be primary key levels ("P").  Like a linear level, a level
+// with a row weighted table in its subtree is not cached and one with a row
+// weighted parent table is marked "W".
+std::vector<std::string> JefastBuilder::fork_level_signatures(
+    const std::vector<std::vector<int> > &child_table_numbers,
+    bool has_virtual_level)
+{
+    std::vector<std::string> signatures;
+    if (!level_cache_usable())
+        return signatures;
+
+    signatures.resize(m_joinedTables.size());
+    std::vector<bool> weighted(m_joinedTables.size(), false);
+    for (size_t i = m_joinedTables.size(); i-- > 0;) {
+        std::string children;
+        weighted[i] = row_weighted(i);
+        for (int child : child_table_numbers[i]) {
+            children += "(" + signatures[child] + ")";
+            weighted[i] = weighted[i] || weighted[child];
+        }
+        if (weighted[i])
+            continue;
+
+        if (i == 0) {
+            if (has_virtual_level)
+                signatures[0] = "V" + JefastLevelCache::column_signature(m_joinedTables[0], -1) + children;
+            continue;
+        }
+        signatures[i] = "F" + JefastLevelCache::column_signature(m_joinedTables[m_parentTableNumber[i]], m_LHSJoinIndex[i])
+            + "|" + JefastLevelCache::column_signature(m_joinedTables[i], m_RHSJoinIndex[i])
+            + ((i == 1 && !has_virtual_level) ? "S" : primary_key_level(int(i)) ? "P" : "")
+            + (row_weighted(m_parentTableNumber[i]) ? "W" : "") + children;
+    }
+    return signatures;
+}
+
+void JefastBuilder::SetSemiJoinReduction(bool value)
+{
+    m_semiJoinReduction = value;
+}
+
 int JefastBuilder::AddFilter(std::shared_ptr<jefastFilter> filter, int tableNumber)
 {
     m_filters.at(tableNumber).push_back(filter);
     return int(m_filters.at(tableNumber).size());
 }
 
+int JefastBuilder::SetPrimaryKey(int tableNumber)
+{
+    if (tableNumber < 0 || tableNumber >= int(m_joinedTables.size()))
+        return -1;
+    m_primaryKeys.resize(m_joinedTables.size(), false);
+    m_primaryKeys[tableNumber] = true;
+    return 0;
+}
+
+void JefastBuilder::SetPrimaryKeyDetection(bool value)
+{
+    m_detectPrimaryKeys = value;
+}
+
+// the join column of table i with its parent is m_RHSJoinIndex[i] for both
+// linear and fork joins.  The level signatures and the levels both ask for
+// every table, so a column is only scanned once per build.
+bool JefastBuilder::primary_key_level(int tableNumber)
+{
+    if (tableNumber < int(m_primaryKeys.size()) && m_primaryKeys[tableNumber])
+        return true;
+    if (!m_detectPrimaryKeys)
+        return false;
+
+    int &detected = m_detectedPrimaryKeys[tableNumber];
+    if (detected != -1)
+        return detected == 1;
+
+    detected = 1;
+    int64_t row_count = m_joinedTables[tableNumber]->row_count();
+    auto column_itr = m_joinedTables[tableNumber]->get_key_iterator(m_RHSJoinIndex[tableNumber]);
+    std::unordered_set<jfkey_t> values;
+    values.reserve(row_count);
+    for (int64_t t = 0; t < row_count; ++t) {
+        if (!values.insert(column_itr[t]).second) {
+            detected = 0;
+            break;
+        }
+    }
+    return detected == 1;
+}
+
+int JefastBuilder::SetRowWeight(int tableNumber, jefastRowWeight_t row_weight)
+{
+    if (tableNumber < 0 || tableNumber >= int(m_joinedTables.size()))
+        return -1;
+    m_rowWeights.resize(m_joinedTables.size());
+    m_rowWeights[tableNumber] = std::move(row_weight);
+    return 0;
+}
+
+int JefastBuilder::AddAggregate(int tableNumber, jefastRowValue_t value)
+{
+    if (tableNumber < 0 || tableNumber >= int(m_joinedTables.size()))
+        return -1;
+    m_aggregates.emplace_back(tableNumber, std::move(value));
+    return int(m_aggregates.size()) - 1;
+}
+
 int JefastBuilder::AppendBuildSuggestion(int table, BuilderSuggestion::side buildSide)
 {
     m_buildOrder.emplace_back(table, buildSide);
@@ -82,22 +241,55 @@ std::shared_ptr<jefastIndexLinear> JefastBuilder::Build()
 {
     if (m_has_fork) return nullptr; 
 
-    std::shared_ptr<jefastIndexLinear> builder{ new jefastIndexLinear() };
+    m_rowWeights.resize(m_joinedTables.size());
+    if (m_rowWeights[0])
+        throw "Row weights on the first table are only supported by BuildFork()";
+    // the tables may have changed since the last build
+    m_detectedPrimaryKeys.assign(m_joinedTables.size(), -1);
+
+    if (wide_weights())
+        return build_linear<wide_weight_t>();
+    return build_linear<weight_t>();
+}
+
+template <typename W>
+std::shared_ptr<jefastIndexLinear> JefastBuilder::build_linear()
+{
+    std::shared_ptr<jefastIndexLinearT<W> > builder{ new jefastIndexLinearT<W>() };
+    builder->m_row_weights = m_rowWeights;
     // this will track which tables we have scanned and submitted to the builder.
     std::vector<bool> scanned_table;
     scanned_table.resize(m_joinedTables.size());
 
+    // levels found in the level cache are shared as they are, they are
+    // not filled or weighted again.
+    std::vector<std::string> signatures = linear_level_signatures();
+    std::vector<bool> cached(m_joinedTables.size() - 1, false);
+
     // build the level graph.
     for (int i = 0; i < m_joinedTables.size() - 1; i++) {
-        std::shared_ptr<JefastLevel<jfkey_t> > value(new JefastLevel<jfkey_t>(m_joinedTables.at(i), m_joinedTables.at(i + 1), (i == m_joinedTables.size()-2)));
+        if (!signatures.empty() && !signatures[i].empty()) {
+            auto level = m_levelCache->Find<W>(signatures[i]);
+            if (level) {
+                cached[i] = true;
+                builder->m_levels.push_back(level);
+                continue;
+            }
+        }
+
+        std::shared_ptr<JefastLevel<jfkey_t, W> > value(new JefastLevel<jfkey_t, W>(m_joinedTables.at(i), m_joinedTables.at(i + 1), (i == m_joinedTables.size()-2) && !m_rowWeights[i + 1]));
 
         
         value->set_LHS_table_index(m_LHSJoinIndex[i]);
         //if (i > 0)
         value->set_RHS_table_index(m_RHSJoinIndex[i + 1]);
+        value->set_LHS_row_weighted(bool(m_rowWeights[i]));
+        // level 0 is the start level, which needs its vertexes
+        if (i > 0)
+            value->set_primary_key(primary_key_level(i + 1));
             //value->set_RHS_table_index(m_RHSJoinIndex[i - 1]);
 
-        //std::shared_ptr<JefastLevel<jfkey_t> > value(new JefastLevel<jfkey_t>());
+        //std::shared_ptr<JefastLevel<jfkey_t, W> > value(new JefastLevel<jfkey_t, W>());
         builder->m_levels.push_back(value);
     }
 
@@ -185,6 +377,7 @@ std::shared_ptr<jefastIndexLinear> JefastBuilder::Build()
     //        builder->m_levels[table_id - 1]->LockNewVertex();
     //}
 
+    auto reduced = semi_join_reduce();
 
     // build the remaining links
     // TODO: We need to determine the best way to scan the table (using an index or
@@ -207,6 +400,11 @@ std::shared_ptr<jefastIndexLinear> JefastBuilder::Build()
         auto LHS_column_itr = LHS_column != -1 ? m_joinedTables.at(i)->get_key_iterator(m_LHSJoinIndex[i]) : std::vector<jfkey_t>::iterator();
         auto RHS_column_itr = RHS_column != -1 ? m_joinedTables.at(i)->get_key_iterator(m_RHSJoinIndex[i]) : std::vector<jfkey_t>::iterator();
 
+        if (LHS_column != -1 && cached[i])
+            LHS_column = -1;
+        if (RHS_column != -1 && cached[i - 1])
+            RHS_column = -1;
+
         bool RHS_locked = true;
         bool LHS_locked = true;
         if (LHS_column != -1)
@@ -218,18 +416,21 @@ std::shared_ptr<jefastIndexLinear> JefastBuilder::Build()
         for (int64_t t = 0; t < row_count; ++t) {
             int64_t LHS_value = 0;
             int64_t RHS_value = 0;
+            bool keep = keep_row(reduced, i, t);
 
             if (RHS_column != -1) {
                 RHS_value = *RHS_column_itr;
 
-                builder->m_levels[i - 1]->InsertRHSRecord(RHS_value, t);
+                if (keep)
+                    builder->m_levels[i - 1]->InsertRHSRecord(RHS_value, t);
                 ++RHS_column_itr; 
             }
 
             if (LHS_column != -1) {
                 LHS_value = *LHS_column_itr;
 
-                builder->m_levels[i]->InsertLHSRecord(LHS_value, t);
+                if (keep)
+                    builder->m_levels[i]->InsertLHSRecord(LHS_value, t);
                 ++LHS_column_itr;
             }
         }
@@ -239,31 +440,64 @@ std::shared_ptr<jefastIndexLinear> JefastBuilder::Build()
             builder->m_levels[i - 1]->LockNewVertex();
     }
 
+    // the last level only has weights of its own if its table is weighted
+    if (m_rowWeights.back())
+        builder->m_levels.back()->fill_weight_fork({}, {}, m_rowWeights.back());
+
     for (size_t level_i = builder->m_levels.size() - 1; level_i > 0; --level_i)
     {
-        builder->m_levels.at(level_i - 1)->fill_weight(builder->m_levels.at(level_i), builder->m_levels.at(level_i)->get_LHS_table_index());
+        if (cached[level_i - 1])
+            continue;
+        builder->m_levels.at(level_i - 1)->fill_weight(builder->m_levels.at(level_i), builder->m_levels.at(level_i)->get_LHS_table_index(), m_rowWeights[level_i]);
     }
 
-    // do an optimize phase
-    for (int level_i = 0; level_i < builder->m_levels.size() - 1; level_i++)
+    // do an optimize phase (levels with default weights are left alone)
+    for (int level_i = 0; level_i < builder->m_levels.size(); level_i++)
     {
-        builder->m_levels.at(level_i)->optimize();
+        if (!cached[level_i])
+            builder->m_levels.at(level_i)->optimize();
     }
 
     builder->start_weight = builder->m_levels[0]->GetLevelWeight();
-    builder->m_distribution = std::uniform_int_distribution<weight_t>(0, builder->start_weight - 1);
+    builder->m_distribution = std::uniform_int_distribution<W>(0, builder->start_weight - 1);
     std::chrono::high_resolution_clock::duration d = std::chrono::high_resolution_clock::now().time_since_epoch();
     builder->m_generator.seed(d.count());
 
-    builder->m_levels.front()->build_starting();
+    if (!cached[0])
+        builder->m_levels.front()->build_starting();
+
+    // the start level and the row weighted levels divide by their vertex
+    // weights when sampling
+    for (size_t level_i = 0; level_i < builder->m_levels.size(); ++level_i) {
+        if (level_i == 0 || builder->m_levels[level_i]->is_LHS_row_weighted())
+            builder->m_levels[level_i]->prepare_division();
+    }
+
+    for (size_t level_i = 0; level_i < signatures.size(); ++level_i) {
+        if (!signatures[level_i].empty() && !cached[level_i])
+            m_levelCache->Insert(signatures[level_i], builder->m_levels[level_i]);
+    }
+
+    for (auto &aggregate : m_aggregates) {
+        builder->m_aggregates.push_back(builder->ComputeAggregate(aggregate.first, aggregate.second));
+    }
 
     return builder;
 }
 
 std::shared_ptr<jefastIndexFork> JefastBuilder::BuildFork() {
     if (!m_has_fork) return nullptr;
-    
-    auto index = std::make_shared<jefastIndexFork>();
+
+    m_rowWeights.resize(m_joinedTables.size());
+    m_detectedPrimaryKeys.assign(m_joinedTables.size(), -1);
+    if (wide_weights())
+        return build_fork<wide_weight_t>();
+    return build_fork<weight_t>();
+}
+
+template <typename W>
+std::shared_ptr<jefastIndexFork> JefastBuilder::build_fork() {
+    std::shared_ptr<jefastIndexForkT<W> > index{ new jefastIndexForkT<W>() };
     
     // TODO filters are not supported yet
     if (std::any_of(m_filters.begin(),m_filters.end(),
@@ -288,36 +522,65 @@ std::shared_ptr<jefastIndexFork> JefastBuilder::BuildFork() {
     // the number of tables in the query and call
     // JefastLevel::GetStartPairStep() to set up the first
     // two records at once.
-    bool has_virtual_level = child_table_numbers[0].size() > 1;
+    //
+    // A row weight on the first table also needs the virtual level, since
+    // GetStartPairStep() can't weight the LHS records individually.
+    m_rowWeights.resize(m_joinedTables.size());
+    bool has_virtual_level = child_table_numbers[0].size() > 1 || m_rowWeights[0];
     
+    std::vector<std::string> signatures = fork_level_signatures(child_table_numbers, has_virtual_level);
+    std::vector<bool> cached(m_joinedTables.size(), false);
+    auto find_cached = [&](size_t i) -> std::shared_ptr<JefastLevel<jfkey_t, W> > {
+        if (signatures.empty() || signatures[i].empty())
+            return nullptr;
+        auto level = m_levelCache->Find<W>(signatures[i]);
+        cached[i] = level != nullptr;
+        return level;
+    };
+
     // create the level graphs
-    if (has_virtual_level) {
-        auto level = std::make_shared<JefastLevel<jfkey_t>>(
+    auto cached_virtual_level = has_virtual_level ? find_cached(0) : nullptr;
+    if (cached_virtual_level) {
+        index->m_levels.push_back(cached_virtual_level);
+    } else if (has_virtual_level) {
+        auto level = std::make_shared<JefastLevel<jfkey_t, W>>(
             nullptr,
             m_joinedTables[0],
-            child_table_numbers[0].empty());
+            child_table_numbers[0].empty() && !m_rowWeights[0]);
         index->m_levels.push_back(level);
     } else {
         index->m_levels.push_back(nullptr);
     }
     //std::cerr << "[builer] m_levels.size()=" << index->m_levels.size() << std::endl;
     for (unsigned i = 1; i < m_joinedTables.size(); ++i) {
+        auto cached_level = find_cached(i);
+        if (cached_level) {
+            index->m_levels.push_back(cached_level);
+            continue;
+        }
+
         int lhs_table_number = m_parentTableNumber[i];
-        auto level = std::make_shared<JefastLevel<jfkey_t>>(
+        auto level = std::make_shared<JefastLevel<jfkey_t, W>>(
             m_joinedTables[lhs_table_number], /* LHS_table */
             m_joinedTables[i], /* RHS_table */
-            child_table_numbers[i].empty() /* useDefaultWeigtht */ );
+            child_table_numbers[i].empty() && !m_rowWeights[i] /* useDefaultWeigtht */ );
         level->set_LHS_table_index(m_LHSJoinIndex[i]);
         level->set_RHS_table_index(m_RHSJoinIndex[i]);
+        level->set_LHS_row_weighted(bool(m_rowWeights[lhs_table_number]));
+        // level 1 is the start level if there is no virtual level
+        if (i > 1 || has_virtual_level)
+            level->set_primary_key(primary_key_level(i));
 
         index->m_levels.push_back(level);
         //std::cerr << "[builder] i=" << i << " m_levels.size()=" << index->m_levels.size() << std::endl;
     }
 
+    auto reduced = semi_join_reduce();
+
     // insert the records into the levels
     // We only insert the rhs into the levels as we don't
     // need to handle insert/delete in the index.
-    if (has_virtual_level) {
+    if (has_virtual_level && !cached[0]) {
         auto level = index->m_levels[0];
         assert(level.get());
 
@@ -325,13 +588,17 @@ std::shared_ptr<jefastIndexFork> JefastBuilder::BuildFork() {
         for (int64_t t = 0; t < row_count; ++t) {
             // We use the same key in the virtual level because
             // there is not an actual join pred for the virutal level.
-            level->InsertRHSRecord(virtual_key, t);
+            if (keep_row(reduced, 0, t))
+                level->InsertRHSRecord(virtual_key, t);
         }
         // Add this fake record to ensure GetLevelWeight() works
         // correctly.
         level->InsertLHSRecord(virtual_key, 0);
     }
     for (unsigned i = 1; i < m_joinedTables.size(); ++i) {
+        if (cached[i])
+            continue;
+
         auto level = index->m_levels[i];
         int64_t rhs_index = m_RHSJoinIndex[i];
         int rhs_table_number = i;
@@ -340,7 +607,8 @@ std::shared_ptr<jefastIndexFork> JefastBuilder::BuildFork() {
         
         int64_t row_count = m_joinedTables[rhs_table_number]->row_count();
         for (int64_t t = 0; t < row_count; ++t) {
-            level->InsertRHSRecord(*rhs_column_iter, t);
+            if (keep_row(reduced, i, t))
+                level->InsertRHSRecord(*rhs_column_iter, t);
             ++rhs_column_iter;
         }
         
@@ -356,7 +624,8 @@ std::shared_ptr<jefastIndexFork> JefastBuilder::BuildFork() {
 
             int64_t row_count = m_joinedTables[lhs_table_number]->row_count();
             for (int64_t t = 0; t < row_count; ++t) {
-                level->InsertLHSRecord(*lhs_column_iter, t);
+                if (keep_row(reduced, 0, t))
+                    level->InsertLHSRecord(*lhs_column_iter, t);
                 ++lhs_column_iter;
             }
         }
@@ -369,12 +638,14 @@ std::shared_ptr<jefastIndexFork> JefastBuilder::BuildFork() {
             // and i == 0
             continue;
         }
-        if (child_table_numbers[i].size() == 0) {
+        if (child_table_numbers[i].size() == 0 && !m_rowWeights[i]) {
             // a leaf in the query graph, which has default weights
             continue;
         }
+        if (cached[i])
+            continue;
         
-        std::vector<std::shared_ptr<JefastLevel<jfkey_t>>> nextLevels;
+        std::vector<std::shared_ptr<JefastLevel<jfkey_t, W>>> nextLevels;
         std::vector<int> nextLevelIndexes;
         nextLevels.reserve(child_table_numbers.size());
         nextLevelIndexes.reserve(child_table_numbers.size());
@@ -385,24 +656,26 @@ std::shared_ptr<jefastIndexFork> JefastBuilder::BuildFork() {
         
         index->m_levels[i]->fill_weight_fork(
             nextLevels,
-            nextLevelIndexes);
+            nextLevelIndexes,
+            m_rowWeights[i]);
     }
     
     // optimize phase.
     //
     // Those with default weights shouldn't (and can't) be optimized
     // and that condition is now added in JefastLevel.
-    if (has_virtual_level) {
-        index->m_levels[0]->optimize<false>();
+    if (has_virtual_level && !cached[0]) {
+        index->m_levels[0]->template optimize<false>();
     }
     for (size_t i = 1; i < m_joinedTables.size(); ++i) {
+        if (!cached[i])
             index->m_levels[i]->optimize();
     }
     
     index->m_start_weight =
         index->m_levels[(has_virtual_level) ? 0 : 1]
             ->GetLevelWeight();
-    index->m_distribution = std::uniform_int_distribution<weight_t>(
+    index->m_distribution = std::uniform_int_distribution<W>(
             0, index->m_start_weight - 1);
     std::chrono::high_resolution_clock::duration d =
         std::chrono::high_resolution_clock::now().time_since_epoch();
@@ -412,16 +685,335 @@ std::shared_ptr<jefastIndexFork> JefastBuilder::BuildFork() {
     // index->m_is_last_child[0] will never be referenced so we
     // don't bother to set it.
     index->m_is_last_child.resize(m_joinedTables.size(), false);
+    index->m_child_slot.resize(m_joinedTables.size(), 0);
     for (size_t i = 1; i < m_joinedTables.size(); ++i) {
-        if (child_table_numbers[m_parentTableNumber[i]].back() == i) {
+        auto &siblings = child_table_numbers[m_parentTableNumber[i]];
+        if (siblings.back() == i) {
             index->m_is_last_child[i] = true; 
         }
+        index->m_child_slot[i] = int(std::find(siblings.begin(), siblings.end(), int(i)) - siblings.begin());
     }
 
-    if (!has_virtual_level) {
+    // every level sampled with a division by its vertex weights: the
+    // non-last children of a fork, the row weighted levels and the start
+    // level
+    for (size_t i = 1; i < m_joinedTables.size(); ++i) {
+        if (!index->m_is_last_child[i] || index->m_levels[i]->is_LHS_row_weighted() || (i == 1 && !has_virtual_level))
+            index->m_levels[i]->prepare_division();
+    }
+
+    if (!has_virtual_level && !cached[1]) {
         index->m_levels[1]->build_starting();
     }
 
+    for (size_t i = 0; i < signatures.size(); ++i) {
+        if (!signatures[i].empty() && !cached[i])
+            m_levelCache->Insert(signatures[i], index->m_levels[i]);
+    }
+
+    for (auto &aggregate : m_aggregates) {
+        index->m_aggregates.push_back(index->ComputeAggregate(aggregate.first, aggregate.second));
+    }
+
+    return index;
+}
+
+std::shared_ptr<jefastStratifiedIndex> JefastBuilder::BuildStratified(int tableNumber, jefastRowKey_t stratum)
+{
+    if (tableNumber < 0 || tableNumber >= int(m_joinedTables.size()))
+        return nullptr;
+
+    std::shared_ptr<jefastStratifiedIndex> index{ new jefastStratifiedIndex() };
+
+    int64_t row_count = m_joinedTables[tableNumber]->row_count();
+    for (int64_t t = 0; t < row_count; ++t)
+        index->m_keys.push_back(stratum(t));
+    std::sort(index->m_keys.begin(), index->m_keys.end());
+    index->m_keys.erase(std::unique(index->m_keys.begin(), index->m_keys.end()), index->m_keys.end());
+
+    // Only the levels from the grouping table up to the start level depend
+    // on the stratum.  The levels below it are built by the first stratum
+    // and shared by the others through the level cache, a private one if
+    // none was set.  Without the cache (the semi-join reduction is on) every
+    // stratum builds all of its levels.
+    m_rowWeights.resize(m_joinedTables.size());
+    jefastRowWeight_t row_weight = m_rowWeights[tableNumber];
+    JefastBuilder strata(*this);
+    if (!strata.m_levelCache)
+        strata.m_levelCache = std::make_shared<JefastLevelCache>();
+    // a stratum only has part of the join results, so the weight type of the
+    // whole join fits every stratum, and they all share levels of one type.
+    strata.m_wideWeights = wide_weights() ? 1 : 0;
+    for (int64_t key : index->m_keys) {
+        JefastBuilder builder(strata);
+        builder.m_rowWeights[tableNumber] = [key, stratum, row_weight](int64_t row) -> weight_t {
+            if (stratum(row) != key)
+                return 0;
+            return row_weight ? row_weight(row) : 1;
+        };
+
+        if (m_has_fork)
+            index->m_indexes.push_back(builder.BuildFork());
+        else
+            index->m_indexes.push_back(builder.Build());
+    }
+
+    return index;
+}
+
+// The weights are filled bottom-up like BuildFork() does, from the last table
+// to the first.  The uniformity bound adds up, for every table, the relative
+// error of its record weights (one rounding per product, plus the error of
+// the child vertex weights) and the error of the prefix sums of its largest
+// vertex (k roundings of up to k * u each for k records).
+std::shared_ptr<jefastApproximateIndex> JefastBuilder::BuildApproximate()
+{
+    const size_t tables = m_joinedTables.size();
+    if (tables == 0)
+        return nullptr;
+
+    if (std::any_of(m_filters.begin(), m_filters.end(),
+        [](const std::vector<std::shared_ptr<jefastFilter>> &v) -> bool {
+            return !v.empty();
+        })) {
+        throw "Filtering on initial build unsupported";
+    }
+
+    m_rowWeights.resize(tables);
+    std::vector<std::vector<bool> > keep = semi_join_reduce();
+
+    std::vector<int> parent;
+    std::vector<int> parent_column;
+    std::vector<std::vector<int> > children;
+    join_tree(parent, parent_column, children);
+
+    std::shared_ptr<jefastApproximateIndex> index{ new jefastApproximateIndex() };
+    index->m_tables.resize(tables);
+
+    const double u = std::numeric_limits<double>::epsilon() / 2;
+    std::vector<double> vertex_error(tables, 0.0);
+    double bound = 0;
+    for (size_t i = tables; i-- > 0;) {
+        jefastApproximateIndex::table_t &table = index->m_tables[i];
+        const int64_t row_count = m_joinedTables[i]->row_count();
+        const jefastRowWeight_t &row_weight = m_rowWeights[i];
+
+        std::vector<std::vector<jfkey_t>::iterator> child_keys;
+        double weight_error = (children[i].size() + (row_weight ? 1 : 0)) * u;
+        for (int c : children[i]) {
+            child_keys.push_back(m_joinedTables[i]->get_key_iterator(parent_column[c]));
+            weight_error += vertex_error[c];
+        }
+
+        std::vector<double> weights(row_count, 0.0);
+        for (int64_t t = 0; t < row_count; ++t) {
+            if (!keep_row(keep, i, t))
+                continue;
+            double w = row_weight ? (double) row_weight(t) : 1.0;
+            for (size_t c = 0; c < children[i].size() && w != 0; ++c) {
+                const jefastApproximateIndex::table_t &child = index->m_tables[children[i][c]];
+                auto vertex = child.vertexes.find(child_keys[c][t]);
+                w = vertex == child.vertexes.end() ? 0.0 : w * child.vertex_weight(vertex->second);
+            }
+            weights[t] = w;
+        }
+
+        // group the records with a weight by their join value with the
+        // parent, the first table is a single vertex
+        std::vector<jfkey_t>::iterator keys;
+        if (i > 0)
+            keys = m_joinedTables[i]->get_key_iterator(m_RHSJoinIndex[i]);
+        auto key_of = [&](int64_t t) -> jfkey_t {
+            return i > 0 ? keys[t] : virtual_key;
+        };
+
+        for (int64_t t = 0; t < row_count; ++t) {
+            if (weights[t] > 0)
+                ++table.vertexes[key_of(t)].end;
+        }
+        size_t offset = 0;
+        size_t max_degree = 1;
+        for (auto &vertex : table.vertexes) {
+            size_t degree = vertex.second.end;
+            max_degree = std::max(max_degree, degree);
+            vertex.second.begin = offset;
+            vertex.second.end = offset;
+            offset += degree;
+        }
+
+        table.records.resize(offset);
+        table.prefix.resize(offset);
+        for (int64_t t = 0; t < row_count; ++t) {
+            if (weights[t] <= 0)
+                continue;
+            jefastApproximateIndex::vertex_t &vertex = table.vertexes[key_of(t)];
+            table.records[vertex.end] = t;
+            table.prefix[vertex.end] = weights[t] + (vertex.end > vertex.begin ? table.prefix[vertex.end - 1] : 0.0);
+            ++vertex.end;
+        }
+
+        for (auto &vertex : table.vertexes) {
+            if (!std::isfinite(table.vertex_weight(vertex.second)))
+                throw std::overflow_error("join weight does not fit in a double");
+        }
+
+        if (i > 0) {
+            table.parent = parent[i];
+            table.parent_table = m_joinedTables[parent[i]];
+            table.parent_keys = table.parent_table->get_key_iterator(parent_column[i]);
+        }
+
+        double gamma = max_degree * u;
+        vertex_error[i] = weight_error + gamma;
+        // the uniform double is rounded too
+        bound += weight_error + (max_degree + 1) * gamma + 2 * u;
+    }
+    index->m_uniformity_bound = bound;
+
+    std::chrono::high_resolution_clock::duration d = std::chrono::high_resolution_clock::now().time_since_epoch();
+    index->m_generator.seed(d.count());
+
     return index;
 }
 
+// table i joins its parent on parent_column = m_RHSJoinIndex[i], for linear
+// joins the parent of table i is table i - 1.
+void JefastBuilder::join_tree(std::vector<int> &parent, std::vector<int> &parent_column, std::vector<std::vector<int> > &children) const
+{
+    const size_t tables = m_joinedTables.size();
+    parent.assign(tables, -1);
+    parent_column.assign(tables, -1);
+    children.assign(tables, std::vector<int>());
+    for (size_t i = 1; i < tables; ++i) {
+        parent[i] = m_has_fork ? m_parentTableNumber[i] : int(i) - 1;
+        parent_column[i] = m_has_fork ? m_LHSJoinIndex[i] : m_LHSJoinIndex[i - 1];
+        children[parent[i]].push_back(int(i));
+    }
+}
+
+bool JefastBuilder::wide_weights()
+{
+    if (m_wideWeights >= 0)
+        return m_wideWeights == 1;
+    if (sizeof(weight_t) >= sizeof(wide_weight_t))
+        return false;
+
+    // leaves the bound a factor of two of room for its rounding
+    const double limit = std::ldexp(1.0, std::numeric_limits<weight_t>::digits - 1);
+
+    // without row weights no weight is larger than the cross product of the
+    // tables, which saves the pass over the join for most queries.
+    if (std::none_of(m_rowWeights.begin(), m_rowWeights.end(), [](const jefastRowWeight_t &w) { return bool(w); })) {
+        double cross_product = 1;
+        for (auto &table : m_joinedTables)
+            cross_product *= (double) table->row_count();
+        if (cross_product < limit)
+            return false;
+    }
+    return weight_bound() >= limit;
+}
+
+// The same bottom-up pass as BuildApproximate() in double precision, without
+// the semi-join reduction, which only removes weight.  A record weight is
+// multiplied up from its row weight and child vertex weights until one of
+// them is 0, so the products of the non-zero factors are bounded as well as
+// the sums of the record weights of every table, which cover the vertex
+// weights, the prefix sums and the start weights.
+double JefastBuilder::weight_bound()
+{
+    const size_t tables = m_joinedTables.size();
+    std::vector<int> parent;
+    std::vector<int> parent_column;
+    std::vector<std::vector<int> > children;
+    join_tree(parent, parent_column, children);
+
+    // the vertex weights of each table by its join value with the parent
+    std::vector<std::unordered_map<jfkey_t, double> > vertexes(tables);
+    double bound = 0;
+    for (size_t i = tables; i-- > 0;) {
+        const int64_t row_count = m_joinedTables[i]->row_count();
+        const jefastRowWeight_t &row_weight = m_rowWeights[i];
+
+        std::vector<std::vector<jfkey_t>::iterator> child_keys;
+        for (int c : children[i])
+            child_keys.push_back(m_joinedTables[i]->get_key_iterator(parent_column[c]));
+        std::vector<jfkey_t>::iterator keys;
+        if (i > 0)
+            keys = m_joinedTables[i]->get_key_iterator(m_RHSJoinIndex[i]);
+
+        double sum = 0;
+        for (int64_t t = 0; t < row_count; ++t) {
+            double w = row_weight ? (double) row_weight(t) : 1.0;
+            double product = std::max(w, 1.0);
+            for (size_t c = 0; c < children[i].size(); ++c) {
+                auto &child = vertexes[children[i][c]];
+                auto vertex = child.find(child_keys[c][t]);
+                double v = vertex == child.end() ? 0.0 : vertex->second;
+                w *= v;
+                product *= std::max(v, 1.0);
+            }
+            bound = std::max(bound, product);
+            sum += w;
+            if (i > 0 && w > 0)
+                vertexes[i][keys[t]] += w;
+        }
+        bound = std::max(bound, sum);
+
+        for (int c : children[i])
+            std::unordered_map<jfkey_t, double>().swap(vertexes[c]);
+    }
+    return bound;
+}
+
+// Yannakakis' full reducer.  Children always have larger table numbers than
+// their parents, so one pass from the last table to the first keeps the rows
+// with a match in every child subtree, and a second pass from the first table
+// to the last keeps the rows with a match in their parent.  Afterwards every
+// kept row is part of at least one join result.
+std::vector<std::vector<bool> > JefastBuilder::semi_join_reduce()
+{
+    std::vector<std::vector<bool> > keep;
+    if (!m_semiJoinReduction)
+        return keep;
+
+    const size_t tables = m_joinedTables.size();
+    keep.resize(tables);
+    for (size_t i = 0; i < tables; ++i) {
+        int64_t row_count = m_joinedTables[i]->row_count();
+        keep[i].resize(row_count, true);
+        // rows with a zero row weight can't be part of any join result
+        if (i < m_rowWeights.size() && m_rowWeights[i]) {
+            for (int64_t t = 0; t < row_count; ++t)
+                keep[i][t] = m_rowWeights[i](t) != 0;
+        }
+    }
+
+    std::vector<int> parent;
+    std::vector<int> parent_column;
+    std::vector<std::vector<int> > children;
+    join_tree(parent, parent_column, children);
+
+    // keep the rows of `to` whose value in to_column is one of the kept
+    // values of `from` in from_column.
+    auto semi_join = [&](int to, int to_column, int from, int from_column) {
+        std::unordered_set<jfkey_t> values;
+        auto from_itr = m_joinedTables[from]->get_key_iterator(from_column);
+        for (size_t t = 0; t < keep[from].size(); ++t) {
+            if (keep[from][t])
+                values.insert(from_itr[t]);
+        }
+
+        auto to_itr = m_joinedTables[to]->get_key_iterator(to_column);
+        for (size_t t = 0; t < keep[to].size(); ++t) {
+            if (keep[to][t] && values.count(to_itr[t]) == 0)
+                keep[to][t] = false;
+        }
+    };
+
+    for (size_t i = tables; i-- > 1;)
+        semi_join(parent[i], parent_column[i], int(i), m_RHSJoinIndex[i]);
+    for (size_t i = 1; i < tables; ++i)
+        semi_join(int(i), m_RHSJoinIndex[i], parent[i], parent_column[i]);
+
+    return keep;
+}
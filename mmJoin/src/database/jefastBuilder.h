@@ -9,6 +9,9 @@
 #include <random>
 
 #include "jefastIndex.h"
+#include "jefastStratifiedIndex.h"
+#include "jefastApproximateIndex.h"
+#include "jefastLevelCache.h"
 #include "jefastVertex.h"
 #include "jefastLevel.h"
 #include "jefastFilter.h"
@@ -67,6 +70,67 @@ public:
         side build_side;
     };
 
+    // Reuse levels of earlier builds from `cache` (see JefastLevelCache)
+    // and add the levels of this build to it.  A level is reused if its
+    // tables, join columns and the whole subtree of the join below it are
+    // the same.  Levels with a row weighted table below them are not
+    // cached, and the cache is not used at all when the semi-join reduction
+    // is on, since it makes a level depend on the rest of the query.  An
+    // index with cached levels does not support Insert() or Delete().
+    void SetLevelCache(std::shared_ptr<JefastLevelCache> cache);
+
+    // Remove dangling rows with a full semi-join reduction over the join
+    // tree before anything is inserted into the levels, so the index only
+    // stores rows which are part of at least one join result.  Costs one
+    // hash set of join values per join edge and pass.  Off by default.
+    //
+    // Insert() on a linear index can't add a row whose join value was
+    // removed by the reduction.
+    void SetSemiJoinReduction(bool value = true);
+
+    // Declare that the join column of table ``tableNumber'' with its parent
+    // table is unique (a primary key joined with a foreign key).  The level
+    // holding the table then maps each key straight to its row instead of
+    // keeping a vertex with record and weight lists per key (see
+    // JefastLevel::set_primary_key()).  The hint is ignored for the first
+    // table and for the table selected by GetStartPairStep() (table 1 of a
+    // linear join, or of a fork without a virtual level).  Build() throws
+    // if the column turns out to have duplicates.
+    //
+    // An index with primary key levels does not support Insert() or
+    // Delete().
+    //
+    // Returns 0, or -1 if tableNumber has not been added yet.
+    int SetPrimaryKey(int tableNumber);
+
+    // Find the unique join columns by scanning them when building, in
+    // addition to the ones given to SetPrimaryKey().  Off by default.
+    void SetPrimaryKeyDetection(bool value = true);
+
+    // Weight every join result by row_weight(row) of its record in table
+    // ``tableNumber'' (multiplied over all tables with a row weight), so
+    // GetRandomJoin() samples proportionally to the product of the row
+    // weights instead of uniformly.  GetTotal() becomes the total weight and
+    // a join result covers as many join numbers as its weight, which
+    // GetRandomJoinsWithoutReplacement() draws without replacement.  Row
+    // weights must be non-negative integers, rows with weight 0 are never
+    // sampled.
+    //
+    // Build() does not support a row weight on the first table, since its
+    // records are not weighted individually.  BuildFork() does.
+    //
+    // Returns 0, or -1 if tableNumber has not been added yet.
+    int SetRowWeight(int tableNumber, jefastRowWeight_t row_weight);
+
+    // Request the exact aggregate (see jefastIndexBase::ComputeAggregate())
+    // of value(row) over the rows of table ``tableNumber'' in all join
+    // results.  It is computed at the end of Build() or BuildFork() and
+    // can be read with GetAggregate() on the index.
+    //
+    // Returns the aggregate id, which starts from 0. Or returns -1 if
+    // tableNumber has not been added yet.
+    int AddAggregate(int tableNumber, jefastRowValue_t value);
+
     // the builder suggestions will be used in the order they are inserted.
     // if a suggestion has been made but the table has already been scanned, the suggestion
     // will be ignored.
@@ -76,14 +140,88 @@ public:
     
     // Can only be called if AddTableToFork is never called, or
     // it returns nullptr.
+    //
+    // The index keeps its weights in weight_t unless a bound on the weights
+    // of the join (computed in double precision, see weight_bound()) does
+    // not fit, then it uses wide_weight_t.  The methods reporting weight_t
+    // throw std::overflow_error on such an index if their result does not
+    // fit, GetWideTotal() does not.  Insert() can't grow the join past the
+    // weight type chosen here.
     std::shared_ptr<jefastIndexLinear> Build();
     
     // Can only be called if AddTableToFork is called at least once,
-    // or it returns nullptr.
+    // or it returns nullptr.  Picks the weight type like Build().
     std::shared_ptr<jefastIndexFork> BuildFork();
 
+    // Build one index per distinct stratum(row) of table ``tableNumber''
+    // (see jefastStratifiedIndex).  Uses Build() or BuildFork(), whichever
+    // applies, with a row weight masking out the rows of the other strata.
+    // The levels below table ``tableNumber'' are built once and shared by
+    // all strata (through the level cache), so each stratum only adds the
+    // levels from that table up to the start level: stratifying on the
+    // first table of a fork adds one virtual level per stratum.  Like any
+    // index sharing cached levels, the strata don't support Insert() or
+    // Delete().  Row weights and aggregates apply to every stratum.  Like SetRowWeight(),
+    // a linear join can't be stratified on its first table.
+    //
+    // Returns nullptr if tableNumber has not been added yet.
+    std::shared_ptr<jefastStratifiedIndex> BuildStratified(int tableNumber, jefastRowKey_t stratum);
+
+    // Build an approximate index with double weights (see
+    // jefastApproximateIndex) for joins whose size does not fit in
+    // wide_weight_t.  Works for linear and fork joins.  Row weights and the semi-join
+    // reduction apply, the level cache and primary key hints are not used.
+    // Throws std::overflow_error if the join is larger than a double.
+    //
+    // Returns nullptr if no table has been added.
+    std::shared_ptr<jefastApproximateIndex> BuildApproximate();
+
 private:
+    // Build() and BuildFork() with weights of type W
+    template <typename W>
+    std::shared_ptr<jefastIndexLinear> build_linear();
+    template <typename W>
+    std::shared_ptr<jefastIndexFork> build_fork();
+
+    // true if the weights of the join may not fit in weight_t
+    bool wide_weights();
+
+    // an upper bound of every weight the index adds up or multiplies
+    double weight_bound();
+
+    // the parent table, its join column with the table and the child
+    // tables of every table
+    void join_tree(std::vector<int> &parent, std::vector<int> &parent_column, std::vector<std::vector<int> > &children) const;
+
+    // returns, for every table, which rows to insert.  Empty if the
+    // semi-join reduction is off.
+    std::vector<std::vector<bool> > semi_join_reduce();
+
+    static bool keep_row(const std::vector<std::vector<bool> > &keep, size_t table, int64_t row) {
+        return keep.empty() || keep[table][row];
+    }
+
+    bool level_cache_usable() const;
+
+    bool row_weighted(size_t tableNumber) const;
+
+    // true if table ``tableNumber'' goes into a primary key level
+    bool primary_key_level(int tableNumber);
+
+    // the level cache signature of every level, or an empty vector if the
+    // cache is not used.
+    std::vector<std::string> linear_level_signatures();
+    std::vector<std::string> fork_level_signatures(
+        const std::vector<std::vector<int> > &child_table_numbers,
+        bool has_virtual_level);
+
     bool m_has_fork;
+    bool m_semiJoinReduction;
+    bool m_detectPrimaryKeys;
+    // 1 or 0 to build with wide weights or not, -1 to decide from the
+    // weights (see wide_weights())
+    int m_wideWeights;
+    std::shared_ptr<JefastLevelCache> m_levelCache;
 
     std::vector<std::shared_ptr<Table> > m_joinedTables;
     std::vector<int> m_parentTableNumber;
@@ -92,4 +230,10 @@ private:
 
     std::vector<std::vector<std::shared_ptr<jefastFilter> > > m_filters;
     std::vector<BuilderSuggestion> m_buildOrder;
+    std::vector<std::pair<int, jefastRowValue_t> > m_aggregates;
+    std::vector<jefastRowWeight_t> m_rowWeights;
+    std::vector<bool> m_primaryKeys;
+    // per table, 1 or 0 once primary_key_level() scanned its join column
+    // in this build, -1 before
+    std::vector<int> m_detectedPrimaryKeys;
 };
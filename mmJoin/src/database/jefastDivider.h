@@ -0,0 +1,99 @@
+// Division by a run-time invariant divisor with a multiply and shifts.
+//
+// Granlund and Montgomery, "Division by Invariant Integers using
+// Multiplication", figure 4.1: with l = ceil(log2(d)) and
+// m = floor(2^N * (2^l - d) / d) + 1 for N bit words,
+//
+//     t = mulhi(m, n)
+//     q = (t + ((n - t) >> min(l, 1))) >> max(l - 1, 0)
+//
+// is n / d for every N bit n and every divisor d > 0, including 1 and the
+// powers of two, so there is no branch.  The 128 bit weights pay a library
+// call for every / and %, which this replaces by four 64 bit multiplies.
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+
+#include "DatabaseSharedTypes.h"
+#include "../util/int128_support.h"
+
+template<typename U>
+class jefastDivider {
+public:
+    static constexpr unsigned word_bits = sizeof(U) * 8;
+
+    jefastDivider()
+        : m_divisor{ 0 }
+        , m_magic{ 0 }
+        , m_shift1{ 0 }
+        , m_shift2{ 0 }
+    {}
+
+    explicit jefastDivider(U d)
+        : m_divisor{ d }
+        , m_magic{ 0 }
+        , m_shift1{ 0 }
+        , m_shift2{ 0 }
+    {
+        if (d == 0)
+            return;
+
+        unsigned l = 0;
+        while (l < word_bits && (U(1) << l) < d)
+            ++l;
+        m_shift1 = l < 1 ? l : 1;
+        m_shift2 = l > 1 ? l - 1 : 0;
+
+        // floor(2^N * r / d) for r = 2^l - d < d, by long division
+        U rem = (l == word_bits ? U(0) : U(1) << l) - d;
+        U q = 0;
+        for (unsigned i = 0; i < word_bits; ++i) {
+            bool carry = (rem >> (word_bits - 1)) != 0;
+            rem <<= 1;
+            q <<= 1;
+            if (carry || rem >= d) {
+                rem -= d;
+                q |= 1;
+            }
+        }
+        m_magic = q + 1;
+    }
+
+    // 0 if the divider has not been set up
+    U divisor() const {
+        return m_divisor;
+    }
+
+    U divide(U n) const {
+        U t = mulhi(m_magic, n);
+        return (t + ((n - t) >> m_shift1)) >> m_shift2;
+    }
+
+private:
+    static uint64_t mulhi(uint64_t a, uint64_t b) {
+        return (uint64_t) (((uint128_t) a * b) >> 64);
+    }
+
+    static uint128_t mulhi(uint128_t a, uint128_t b) {
+        uint64_t a0 = (uint64_t) a, a1 = (uint64_t) (a >> 64);
+        uint64_t b0 = (uint64_t) b, b1 = (uint64_t) (b >> 64);
+        uint128_t p00 = (uint128_t) a0 * b0;
+        uint128_t p01 = (uint128_t) a0 * b1;
+        uint128_t p10 = (uint128_t) a1 * b0;
+        uint128_t p11 = (uint128_t) a1 * b1;
+        uint128_t mid = (p00 >> 64) + (uint64_t) p01 + (uint64_t) p10;
+        return p11 + (p01 >> 64) + (p10 >> 64) + (mid >> 64);
+    }
+
+    U m_divisor;
+    U m_magic;
+    uint8_t m_shift1;
+    uint8_t m_shift2;
+};
+
+// divides weights of type W, which are never negative
+template <typename W>
+using jefastWeightDividerT = jefastDivider<typename std::conditional<(sizeof(W) > sizeof(uint64_t)), uint128_t, uint64_t>::type>;
+
+typedef jefastWeightDividerT<weight_t> jefastWeightDivider;
@@ -4,18 +4,30 @@
 
 #include "jefastIndex.h"
 #include "jefastLevel.h"
+#include "../util/DistinctSampler.h"
 
 #include <iostream>
 #include <fstream>
 #include <algorithm>
 #include <random>
 #include <queue>
+#include <unordered_map>
+#include <stdexcept>
+
+// the weights of a join result as weight_t (see weight_narrow())
+template <typename W>
+static std::vector<weight_t> narrow_weights(const std::vector<W> &weights) {
+    std::vector<weight_t> narrow(weights.size());
+    std::transform(weights.begin(), weights.end(), narrow.begin(), weight_narrow<W>);
+    return narrow;
+}
 
-weight_t jefastIndexLinear::GetTotal() {
-    return start_weight;
+static std::vector<weight_t> narrow_weights(std::vector<weight_t> &&weights) {
+    return std::move(weights);
 }
 
-void jefastIndexLinear::GetJoinNumber(weight_t joinNumber, std::vector<int64_t> &out) {
+template <typename W>
+void jefastIndexLinearT<W>::get_join_number(W joinNumber, std::vector<int64_t> &out) {
     // check if it is out of bounds?
     //if (joinNumber < start_weight)
     //    throw "Out of bounds";
@@ -24,7 +36,7 @@ void jefastIndexLinear::GetJoinNumber(weight_t joinNumber, std::vector<int64_t>
     out.resize(this->GetNumberOfLevels());
 
     // find the first level item
-    weight_t current_weight = joinNumber;
+    W current_weight = joinNumber;
     //auto first_phase = this->m_levels.at(0)->GetLHSEnumerator();
     //first_phase->Step();
     //while (current_weight >= first_phase->getWeight()) {
@@ -32,107 +44,117 @@ void jefastIndexLinear::GetJoinNumber(weight_t joinNumber, std::vector<int64_t>
     //    first_phase->Step();
     //}
 
-    this->m_levels.at(0)->GetStartPairStep(current_weight, out[0], out[1]);
+    const link_t *links = this->m_levels.at(0)->GetStartPairStep(current_weight, out[0], out[1]);
 
     //out.at(0) = first_phase->getRecordId();
     //auto value = first_phase->getVertexValue();
 
-    // in this case, we already have selected the items needed.
-    if (this->m_levels.size() == 1)
-        return;
-
-
-    auto value = this->m_levels.at(0)->get_RHS_Table()->get_int64(out[1], this->m_levels.at(1)->get_LHS_table_index());
-
     // step though each other point.
     for (int i = 1; i < this->m_levels.size(); ++i) {
         //this->m_levels.at(i)->GetNextStep(value, current_weight, out[i + 1], value);
-        this->m_levels.at(i)->GetNextStep(value, current_weight, out[i + 1]);
-        if(i+1 < this->m_levels.size())
-            value = this->m_levels.at(i)->get_RHS_Table()->get_int64(out[i + 1], this->m_levels.at(i + 1)->get_LHS_table_index());
+        links = this->m_levels[i]->GetNextStep(next_vertex(i, out[i], links), current_weight, out[i + 1]);
     }
 }
 
-std::vector<weight_t> jefastIndexLinear::GetJoinNumberWithWeights(weight_t joinNumber, std::vector<int64_t> &out) {
-    // check if it is out of bounds?
-    //if (joinNumber < start_weight)
-    //    throw "Out of bounds";
-    assert(joinNumber < start_weight);
+// the vertex of level i the record of table i joins with
+template <typename W>
+jefastChildLinkT<W> jefastIndexLinearT<W>::next_vertex(int i, int64_t record, const link_t *links) {
+    if (links)
+        return links[0];
+    jfkey_t value = m_levels[i - 1]->get_RHS_Table()->get_int64(record, m_levels[i]->get_LHS_table_index());
+    return m_levels[i]->FindLink(value);
+}
 
-    //std::cerr << "[jefastIndexLinear] #levels=" << this->GetNumberOfLevels() << std::endl;
+template <typename W>
+void jefastIndexLinearT<W>::LinkChildren() {
+    for (size_t i = 0; i + 1 < m_levels.size(); ++i)
+        m_levels[i]->link_children({ m_levels[i + 1].get() }, { m_levels[i + 1]->get_LHS_table_index() });
+}
 
-    out.resize(this->GetNumberOfLevels());
-    std::vector<weight_t> join_weights(this->GetNumberOfLevels());
+template <typename W>
+void jefastIndexLinearT<W>::CompressRecords(size_t minRecords) {
+    for (auto &level : m_levels)
+        level->pack_records(minRecords);
+}
 
-    // find the first level item
-    weight_t current_weight = joinNumber;
-    //auto first_phase = this->m_levels.at(0)->GetLHSEnumerator();
-    //first_phase->Step();
-    //while (current_weight >= first_phase->getWeight()) {
-    //    current_weight -= first_phase->getWeight();
-    //    first_phase->Step();
-    //}
+template <typename W>
+std::vector<weight_t> jefastIndexLinearT<W>::GetJoinNumberWithWeights(weight_t joinNumber, std::vector<int64_t> &out) {
+    return narrow_weights(get_join_number_with_weights(joinNumber, out));
+}
 
-    this->m_levels.at(0)->GetStartPairStep(current_weight, out[0], out[1], {&join_weights[0], &join_weights[1]});
+template <typename W>
+std::vector<W> jefastIndexLinearT<W>::get_join_number_with_weights(W joinNumber, std::vector<int64_t> &out) {
+    out.resize(this->GetNumberOfLevels());
+    std::vector<W> join_weights(this->GetNumberOfLevels());
 
-    //out.at(0) = first_phase->getRecordId();
-    //auto value = first_phase->getVertexValue();
+    this->FillJoinNumberWithWeights(joinNumber, out.data(), join_weights.data());
+    return join_weights;
+}
 
-    // in this case, we already have selected the items needed.
-    if (this->m_levels.size() == 1)
-        return join_weights;
+template <typename W>
+void jefastIndexLinearT<W>::FillJoinNumberWithWeights(W joinNumber, int64_t *out, W *join_weights) {
+    // check if it is out of bounds?
+    //if (joinNumber < start_weight)
+    //    throw "Out of bounds";
+    assert(joinNumber < start_weight);
 
+    // find the first level item
+    W current_weight = joinNumber;
 
-    auto value = this->m_levels.at(0)->get_RHS_Table()->get_int64(out[1], this->m_levels.at(1)->get_LHS_table_index());
+    const link_t *links = this->m_levels.at(0)->GetStartPairStep(current_weight, out[0], out[1], {&join_weights[0], &join_weights[1]});
 
     // step though each other point.
     for (int i = 1; i < this->m_levels.size(); ++i) {
-        //this->m_levels.at(i)->GetNextStep(value, current_weight, out[i + 1], value);
         // TODO: test whether `join_weights[i + 1]` makes sense!
-        this->m_levels.at(i)->GetNextStep(value, current_weight, out[i + 1], &join_weights[i + 1]);
-        if(i+1 < this->m_levels.size())
-            value = this->m_levels.at(i)->get_RHS_Table()->get_int64(out[i + 1], this->m_levels.at(i + 1)->get_LHS_table_index());
+        links = this->m_levels[i]->GetNextStep(next_vertex(i, out[i], links), current_weight, out[i + 1], &join_weights[i + 1]);
     }
-    return join_weights;
 }
 
-void jefastIndexLinear::GetRandomJoin(std::vector<int64_t> &out) {
-    weight_t random_join_number = m_distribution(m_generator);
+template <typename W>
+void jefastIndexLinearT<W>::GetRandomJoin(std::vector<int64_t> &out) {
+    W random_join_number = m_distribution(m_generator);
 
-    return this->GetJoinNumber(random_join_number, out);
+    return this->get_join_number(random_join_number, out);
 }
 
-std::vector<weight_t> jefastIndexLinear::GetRandomJoinWithWeights(std::vector<int64_t> &out) {
-    weight_t random_join_number = m_distribution(m_generator);
+template <typename W>
+std::vector<weight_t> jefastIndexLinearT<W>::GetRandomJoinWithWeights(std::vector<int64_t> &out) {
+    W random_join_number = m_distribution(m_generator);
     //std::cerr << "inside linear!!!!" << std::endl;
-    return this->GetJoinNumberWithWeights(random_join_number, out);
+    return narrow_weights(this->get_join_number_with_weights(random_join_number, out));
+}
+
+template <typename W>
+void jefastIndexLinearT<W>::GetRandomJoinsWithoutReplacement(size_t count, std::vector<std::vector<int64_t> > &out) {
+    auto join_numbers = DistinctSampler::sample(start_weight, count, m_generator);
+
+    out.resize(join_numbers.size());
+    for (size_t i = 0; i < join_numbers.size(); ++i) {
+        this->get_join_number(join_numbers[i], out[i]);
+    }
 }
 
-std::pair<int64_t, uint64_t> jefastIndexLinear::GenerateFirstEntry(uint64_t tupleIndex)
+template <typename W>
+std::pair<int64_t, uint64_t> jefastIndexLinearT<W>::GenerateFirstEntry(uint64_t tupleIndex)
 {
     // TODO
     return {0, 0};
 }
 
-std::pair<std::vector<int64_t>, std::vector<uint64_t>> jefastIndexLinear::GenerateSampleData()
+template <typename W>
+std::pair<std::vector<int64_t>, std::vector<uint64_t>> jefastIndexLinearT<W>::GenerateSampleData()
 // Generate a sample.
 {
-    // Convert `weight_t` to `uint64_t`.
-    auto convert = [&](std::vector<weight_t>& ws) {
-        std::vector<uint64_t> transformed;
-        std::transform(ws.begin(), ws.end(), std::back_inserter(transformed), [](auto w) {
-            std::ostringstream stream; stream << w;
-            return static_cast<uint64_t>(std::stoull(stream.str())); 
-        });
-        return std::move(transformed);
-    };
-
     std::vector<int64_t> out;
-    auto ws = GetRandomJoinWithWeights(out);
-    return {std::move(out), convert(ws)};
+    auto ws = get_join_number_with_weights(m_distribution(m_generator), out);
+
+    std::vector<uint64_t> transformed(ws.size());
+    std::transform(ws.begin(), ws.end(), transformed.begin(), weight_to_uint64<W>);
+    return {std::move(out), std::move(transformed)};
 }
 
-std::pair<std::vector<std::vector<int64_t>>, std::vector<std::vector<uint64_t>>> jefastIndexLinear::GenerateData(size_t count)
+template <typename W>
+std::pair<std::vector<std::vector<int64_t>>, std::vector<std::vector<uint64_t>>> jefastIndexLinearT<W>::GenerateData(size_t count)
 // Generate `count` samples, along with the weights of the tuples.
 {
     // And sample.
@@ -143,31 +165,128 @@ std::pair<std::vector<std::vector<int64_t>>, std::vector<std::vector<uint64_t>>>
         sampled[index] = std::move(ss);
         weights[index] = std::move(ws);
     }
-    return {sampled, weights};
+    return {std::move(sampled), std::move(weights)};
+}
+
+template <typename W>
+void jefastIndexLinearT<W>::GenerateColumnarData(size_t count, int64_t *out_records, uint64_t *out_weights)
+// Generate `count` samples straight into the caller's column buffers.
+{
+    const int levels = GetNumberOfLevels();
+    std::vector<int64_t> out(levels);
+    std::vector<W> ws(levels);
+
+    for (size_t index = 0; index != count; ++index) {
+        FillJoinNumberWithWeights(m_distribution(m_generator), out.data(), ws.data());
+        for (int level = 0; level != levels; ++level) {
+            out_records[level * count + index] = out[level];
+            out_weights[level * count + index] = weight_to_uint64(ws[level]);
+        }
+    }
 }
 
-int jefastIndexLinear::GetNumberOfLevels()
+// SUM and SUM of squares over the join results below each vertex of a level,
+// by the key of the vertex
+typedef std::unordered_map<jfkey_t, std::pair<double, double> > vertex_sums_t;
+
+template <typename W>
+jefastAggregate jefastIndexLinearT<W>::ComputeAggregate(int tableNumber, const jefastRowValue_t &value)
+{
+    if (tableNumber < 0 || tableNumber > (int) m_levels.size())
+        throw std::out_of_range("no such table in the join");
+
+    // table i + 1 is the RHS of level i.  Levels below the aggregated table
+    // don't contribute to the sums, levels above it pass up the sums of the
+    // vertex each record leads to.
+    vertex_sums_t below;
+    for (int level_i = tableNumber - 1; level_i >= 0; --level_i) {
+        auto &level = m_levels[level_i];
+        Table *rhs_table = level->get_RHS_Table().get();
+        vertex_sums_t current;
+        level->for_each_rhs_record([&](jfkey_t vertex_key, int64_t record, W w) {
+            auto &sums = current[vertex_key];
+            if (level_i + 1 == tableNumber) {
+                double x = value(record);
+                sums.first += x * (double) w;
+                sums.second += x * x * (double) w;
+            }
+            else {
+                // w is the weight of the next vertex times the row
+                // weight of this record, if any.  Delete() may have left
+                // the next vertex without records, which adds nothing.
+                auto &next_level = m_levels[level_i + 1];
+                jfkey_t key = rhs_table->get_int64(record, next_level->get_LHS_table_index());
+                auto s = below.find(key);
+                W next_weight = next_level->GetVertexWeight(key);
+                if (s == below.end() || next_weight == 0)
+                    return;
+                double copies = (double) (w / next_weight);
+                sums.first += s->second.first * copies;
+                sums.second += s->second.second * copies;
+            }
+        });
+        below.swap(current);
+    }
+
+    // table 0 is the LHS of level 0, every LHS record of a vertex is joined
+    // with all the join results below it.
+    jefastAggregate result;
+    result.count = start_weight;
+    for (auto &entry : m_levels[0]->m_data) {
+        const JefastVertexT<W> *vertex = entry.second.get();
+        W w = entry.second->getWeight();
+        if (w == 0)
+            continue;
+        for (size_t l = 0; l < vertex->get_LHS_outdegree(); ++l) {
+            if (tableNumber == 0) {
+                double x = value(vertex->get_lhs_record_id(l));
+                result.sum += x * (double) w;
+                result.sum_of_squares += x * x * (double) w;
+            }
+            else {
+                auto s = below.find(entry.first);
+                if (s == below.end())
+                    continue;
+                result.sum += s->second.first;
+                result.sum_of_squares += s->second.second;
+            }
+        }
+    }
+    return result;
+}
+
+template <typename W>
+int jefastIndexLinearT<W>::GetNumberOfLevels()
 {
     return int(this->m_levels.size()) + 1;
 }
 
-void jefastIndexLinear::Insert(int table_id, jefastKey_t record_id)
+template <typename W>
+void jefastIndexLinearT<W>::Insert(int table_id, jefastKey_t record_id)
 {
+    if (has_primary_key_level())
+        throw "Insert() is not supported with primary key levels";
+    if (is_packed())
+        throw "Insert() is not supported on a compressed index";
+    if (has_shared_level())
+        throw "Insert() is not supported on an index sharing cached levels";
+    clear_child_links();
+
     // find the last level which we will need to adjust
     // the table will be the same as the table_id
     int level_to_edit = table_id;
 
-    weight_t new_weight = 1;
+    W new_weight = 1;
 
     struct work_item
     {
-        work_item(jfkey_t id, weight_t weight)
+        work_item(jfkey_t id, W weight)
             : next_id{ id }
             , new_weight{ weight }
         {};
         //jfkey_t vertex_label;
         jfkey_t next_id;
-        weight_t new_weight;
+        W new_weight;
     };
 
     // setup work queues
@@ -187,7 +306,7 @@ void jefastIndexLinear::Insert(int table_id, jefastKey_t record_id)
     {
         jfkey_t RHS_value = m_levels.at(level_to_edit - 1)->get_RHS_Table()->get_int64(record_id, m_levels.at(level_to_edit-1)->get_RHS_table_index());
         auto vtx = m_levels.at(level_to_edit - 1)->getVertex(RHS_value);
-        weight_t next_weight = vtx->insert_rhs_record_weight_with_sum(record_id, new_weight);
+        W next_weight = vtx->insert_rhs_record_weight_with_sum(record_id, apply_row_weight(table_id, record_id, new_weight));
         auto enu = vtx->getLHSEnumerator();
         while (enu->Step())
         {
@@ -204,7 +323,7 @@ void jefastIndexLinear::Insert(int table_id, jefastKey_t record_id)
 
             jfkey_t RHS_value = m_levels.at(i)->get_RHS_Table()->get_int64(current_item.next_id, m_levels.at(i)->get_RHS_table_index());
             auto vtx = m_levels.at(i)->getVertex(RHS_value);
-            weight_t next_weight = vtx->adjust_rhs_record_weight_with_sum(current_item.next_id, current_item.new_weight);
+            W next_weight = vtx->adjust_rhs_record_weight_with_sum(current_item.next_id, apply_row_weight(i + 1, current_item.next_id, current_item.new_weight));
             auto enu = vtx->getLHSEnumerator();
             while (enu->Step())
             {
@@ -213,23 +332,25 @@ void jefastIndexLinear::Insert(int table_id, jefastKey_t record_id)
         }
     }
 
-    // update the initial search index
-    if (!postpone_rebuild) {
-        std::swap(current_work, next_work);
-        while (!current_work->empty()) {
-            work_item current_item = current_work->front();
-            current_work->pop();
-
-            m_levels.at(0)->update_search_weight(current_item.next_id, current_item.new_weight);
-        }
-
-        start_weight = m_levels[0]->GetLevelWeight();
-    }
+    // update the initial search index.  It is kept by the join value of
+    // the first level, not by the records of the first table, so it is
+    // rebuilt.
+    if (!postpone_rebuild)
+        rebuild_initial();
     // and we are done!
 }
 
-void jefastIndexLinear::Delete(int table_id, jefastKey_t record_id)
+template <typename W>
+void jefastIndexLinearT<W>::Delete(int table_id, jefastKey_t record_id)
 {
+    if (has_primary_key_level())
+        throw "Delete() is not supported with primary key levels";
+    if (is_packed())
+        throw "Delete() is not supported on a compressed index";
+    if (has_shared_level())
+        throw "Delete() is not supported on an index sharing cached levels";
+    clear_child_links();
+
     {
         // find the last level which we will need to adjust
         // the table will be the same as the table_id
@@ -237,36 +358,44 @@ void jefastIndexLinear::Delete(int table_id, jefastKey_t record_id)
 
         struct work_item
         {
-            work_item(jfkey_t id, weight_t weight)
+            work_item(jfkey_t id, W weight)
                 : next_id{ id }
                 , new_weight{ weight }
             {};
             //jfkey_t vertex_label;
             jfkey_t next_id;
-            weight_t new_weight;
+            W new_weight;
         };
 
         // setup work queues
         std::unique_ptr<std::queue<work_item> > current_work(new std::queue<work_item>());
         std::unique_ptr<std::queue<work_item> > next_work(new std::queue<work_item>());
 
+        // The build purges the vertexes of weight zero (see
+        // JefastLevel::optimize()).  Deleting can't make their weight grow,
+        // so the records of a purged vertex are skipped.
+
         // we have to check to make sure a level exists to insert the LHS edge
         if (level_to_edit < m_levels.size())
         {
             jfkey_t LHS_value = m_levels.at(level_to_edit)->get_LHS_Table()->get_int64(record_id, m_levels.at(level_to_edit)->get_LHS_table_index());
-            std::shared_ptr<JefastVertex> vtx = m_levels.at(level_to_edit)->getVertex(LHS_value);
-            vtx->delete_lhs_record_ids(record_id);
+            if (m_levels.at(level_to_edit)->DoesVertexExist(LHS_value)) {
+                std::shared_ptr<JefastVertexT<W>> vtx = m_levels.at(level_to_edit)->getVertex(LHS_value);
+                vtx->delete_lhs_record_ids(record_id);
+            }
         }
         // insert the new RHS edge and a new LHS edge between the correct levels
         if (level_to_edit > 0)
         {
             jfkey_t RHS_value = m_levels.at(level_to_edit - 1)->get_RHS_Table()->get_int64(record_id, m_levels.at(level_to_edit - 1)->get_RHS_table_index());
-            auto vtx = m_levels.at(level_to_edit - 1)->getVertex(RHS_value);
-            weight_t next_weight = vtx->delete_rhs_record_weight_with_sum(record_id);
-            auto enu = vtx->getLHSEnumerator();
-            while (enu->Step())
-            {
-                next_work->emplace(enu->getRecordId(), next_weight);
+            if (m_levels.at(level_to_edit - 1)->DoesVertexExist(RHS_value)) {
+                auto vtx = m_levels.at(level_to_edit - 1)->getVertex(RHS_value);
+                W next_weight = vtx->delete_rhs_record_weight_with_sum(record_id);
+                auto enu = vtx->getLHSEnumerator();
+                while (enu->Step())
+                {
+                    next_work->emplace(enu->getRecordId(), next_weight);
+                }
             }
         }
 
@@ -278,8 +407,10 @@ void jefastIndexLinear::Delete(int table_id, jefastKey_t record_id)
                 current_work->pop();
 
                 jfkey_t RHS_value = m_levels.at(i)->get_RHS_Table()->get_int64(current_item.next_id, m_levels.at(i)->get_RHS_table_index());
+                if (!m_levels.at(i)->DoesVertexExist(RHS_value))
+                    continue;
                 auto vtx = m_levels.at(i)->getVertex(RHS_value);
-                weight_t next_weight = vtx->adjust_rhs_record_weight_with_sum(current_item.next_id, current_item.new_weight);
+                W next_weight = vtx->adjust_rhs_record_weight_with_sum(current_item.next_id, apply_row_weight(i + 1, current_item.next_id, current_item.new_weight));
                 auto enu = vtx->getLHSEnumerator();
                 while (enu->Step())
                 {
@@ -288,28 +419,20 @@ void jefastIndexLinear::Delete(int table_id, jefastKey_t record_id)
             }
         }
 
-        // update the initial search index
-        if (!postpone_rebuild) {
-            std::swap(current_work, next_work);
-            while (!current_work->empty()) {
-                work_item current_item = current_work->front();
-                current_work->pop();
-
-                m_levels.at(0)->update_search_weight(current_item.next_id, current_item.new_weight);
-            }
-
-            start_weight = m_levels[0]->GetLevelWeight();
-        }
+        // update the initial search index (see Insert())
+        if (!postpone_rebuild)
+            rebuild_initial();
         // and we are done!
     }
 }
 
-std::vector<weight_t> jefastIndexLinear::MaxOutdegree()
+template <typename W>
+std::vector<weight_t> jefastIndexLinearT<W>::MaxOutdegree()
 {
     std::vector<weight_t> to_return;
     to_return.resize(this->m_levels.size());
 
-    std::transform(this->m_levels.begin(), this->m_levels.end(), to_return.begin(), [](std::shared_ptr<JefastLevel<jfkey_t> > lvl) { return lvl->getMaxOutdegree();});
+    std::transform(this->m_levels.begin(), this->m_levels.end(), to_return.begin(), [](std::shared_ptr<level_t> lvl) { return lvl->getMaxOutdegree();});
 
     //for (auto i : to_return)
     //    std::cout << i << std::endl;
@@ -317,197 +440,183 @@ std::vector<weight_t> jefastIndexLinear::MaxOutdegree()
     return to_return;
 }
 
-void jefastIndexLinear::rebuild_initial()
+template <typename W>
+void jefastIndexLinearT<W>::clear_child_links()
+{
+    for (auto &level : m_levels)
+        level->clear_child_links();
+}
+
+template <typename W>
+void jefastIndexLinearT<W>::rebuild_initial()
 {
     start_weight = m_levels[0]->GetLevelWeight();
     m_levels[0]->build_starting();
+    m_distribution = std::uniform_int_distribution<W>(0, start_weight == 0 ? 0 : start_weight - 1);
 }
 
 //////////////////////////////////////////////////////
 //// BELOW are implementation for jefastIndexFork ////
 //////////////////////////////////////////////////////
 
-void jefastIndexFork::GetJoinNumber(
-    weight_t joinNumber,
-    std::vector<int64_t> &out) {
-    
-    assert(joinNumber < m_start_weight);
-    out.resize(GetNumberOfLevels());
+// the vertex of level i the record of its parent table joins with
+template <typename W>
+jefastChildLinkT<W> jefastIndexForkT<W>::next_vertex(size_t i, const int64_t *out, const link_t * const *links) {
+    int lhs_table_number = m_parent_tables[i];
+    if (links[lhs_table_number])
+        return links[lhs_table_number][m_child_slot[i]];
+
+    int lhs_column = m_levels[i]->get_LHS_table_index();
+    jfkey_t value = m_levels[lhs_table_number]->get_RHS_Table()
+        ->get_int64(out[lhs_table_number], lhs_column);
+    return m_levels[i]->FindLink(value);
+}
 
-    // Stores the remaining weights to be used in the subsequent levels
-    // after we traverse through a fork.
-    std::vector<weight_t> rem_weights(m_levels.size());
-    
-    // i is the next table to be sampled, set after the following
-    // if.
-    size_t i;
-    if (m_levels[0].get()) {
-        // We have a virtual level where there is just one
-        // (virtual) key in it and the vertex contains all records
-        // in table[0].
-        rem_weights[0] = joinNumber;
-        m_levels[0]->GetNextStep(
-            virtual_key,
-            rem_weights[0],
-            out[0]);
-        i = 1;
-    } else {
-        // We don't have a virtual level. Just use
-        // GetStartPairStep() to set up the first two
-        // rows simultaneously.
-        rem_weights[1] = joinNumber;
-        m_levels[1]->GetStartPairStep(
-            rem_weights[1],
-            out[0],
-            out[1]);
-        i = 2;
+template <typename W>
+void jefastIndexForkT<W>::LinkChildren() {
+    std::vector<std::vector<level_t*> > children(m_levels.size());
+    std::vector<std::vector<int> > child_indexes(m_levels.size());
+    for (size_t i = 1; i < m_levels.size(); ++i) {
+        children[m_parent_tables[i]].push_back(m_levels[i].get());
+        child_indexes[m_parent_tables[i]].push_back(m_levels[i]->get_LHS_table_index());
     }
 
-    // continue through all the remaining tables
-    for (; i < m_levels.size(); ++i) {
-        int lhs_table_number = m_parent_tables[i];
-        int lhs_column = m_levels[i]->get_LHS_table_index();
-        jfkey_t value = m_levels[lhs_table_number]->get_RHS_Table()
-            ->get_int64(out[lhs_table_number], lhs_column);
-        if (m_is_last_child[i]) {
-            // This is either a linear child or the last
-            // child in a fork. Use GetNextStep() as usual,
-            // which saves a modulo op.
-            rem_weights[i] = rem_weights[lhs_table_number];
-            m_levels[i]->GetNextStep(value, rem_weights[i], out[i]);
-        } else {
-            // This is some child other than the last in a fork.
-            // Use GetNextStepThroughFork() to correctly set
-            // the rem_weight of the parent table and the child table.
-            m_levels[i]->GetNextStepThroughFork(
-                value,
-                rem_weights[lhs_table_number], /* parent_weight */
-                rem_weights[i], /* my_weight */
-                out[i]);
-        }
+    // without a virtual level, the children of table 0 are reached
+    // through GetStartPairStep() of level 1
+    for (size_t i = 0; i < m_levels.size(); ++i) {
+        if (m_levels[i].get())
+            m_levels[i]->link_children(children[i], child_indexes[i]);
     }
 }
 
-std::vector<weight_t> jefastIndexFork::GetJoinNumberWithWeights(
-    weight_t joinNumber,
+template <typename W>
+void jefastIndexForkT<W>::CompressRecords(size_t minRecords) {
+    for (auto &level : m_levels) {
+        if (level.get())
+            level->pack_records(minRecords);
+    }
+}
+
+template <typename W>
+std::vector<weight_t> jefastIndexForkT<W>::GetJoinNumberWithWeights(weight_t joinNumber, std::vector<int64_t> &out) {
+    return narrow_weights(get_join_number_with_weights(joinNumber, out));
+}
+
+template <typename W>
+std::vector<W> jefastIndexForkT<W>::get_join_number_with_weights(
+    W joinNumber,
     std::vector<int64_t> &out) {
-    
-    //std::cerr << "#levels=" << GetNumberOfLevels() << std::endl;
 
-    assert(joinNumber < m_start_weight);
     out.resize(GetNumberOfLevels());
-    std::vector<weight_t> join_weights(GetNumberOfLevels());
-    //std::cerr << "[GetJoinNumberWithWeights] join_weights.size()=" << join_weights.size() << std::endl;
+    std::vector<W> join_weights(GetNumberOfLevels());
 
     // Stores the remaining weights to be used in the subsequent levels
     // after we traverse through a fork.
-    std::vector<weight_t> rem_weights(m_levels.size());
-    
+    std::vector<W> rem_weights(m_levels.size());
+    std::vector<const link_t*> links(m_levels.size());
+
+    FillJoinNumberWithWeights(joinNumber, out.data(), join_weights.data(), rem_weights.data(), links.data());
+    return join_weights;
+}
+
+template <typename W>
+void jefastIndexForkT<W>::FillJoinNumberWithWeights(
+    W joinNumber,
+    int64_t *out,
+    W *join_weights,
+    W *rem_weights,
+    const link_t **links) {
+
+    assert(joinNumber < m_start_weight);
+
     // i is the next table to be sampled, set after the following
     // if.
     size_t i;
     // TODO: what to do with weight(0)? Or is the entire vector shifted by one?
     if (m_levels[0].get()) {
-        //std::cerr << "first case" << std::endl;
         // We have a virtual level where there is just one
         // (virtual) key in it and the vertex contains all records
         // in table[0].
         rem_weights[0] = joinNumber;
-        m_levels[0]->GetNextStep(
+        links[0] = m_levels[0]->GetNextStep(
             virtual_key,
             rem_weights[0],
             out[0],
             &join_weights[0]);
         i = 1;
     } else {
-        //std::cerr << "second case" << std::endl;
         // We don't have a virtual level. Just use
         // GetStartPairStep() to set up the first two
         // rows simultaneously.
         rem_weights[1] = joinNumber;
-        m_levels[1]->GetStartPairStep(
+        links[0] = nullptr;
+        links[1] = m_levels[1]->GetStartPairStep(
             rem_weights[1],
             out[0],
             out[1],
             {&join_weights[0], &join_weights[1]});
         i = 2;
     }
-    //std::cerr << "i=" << i << " size=" << m_levels.size() << std::endl;
-#if 1
+
     // continue through all the remaining tables
     for (; i < m_levels.size(); ++i) {
-        //std::cerr << "[GetJoinNumberWithWeights] main loop i=" << i << std::endl;
-        //std::cerr << "!!!!!!!!!!!!!!!!! insideeeee" << std::endl;
         int lhs_table_number = m_parent_tables[i];
-        int lhs_column = m_levels[i]->get_LHS_table_index();
-        jfkey_t value = m_levels[lhs_table_number]->get_RHS_Table()
-            ->get_int64(out[lhs_table_number], lhs_column);
+        link_t vertex = next_vertex(i, out, links);
         if (m_is_last_child[i]) {
-            //std::cerr << "\t [Main Loop] first branch!" << std::endl;
             // This is either a linear child or the last
             // child in a fork. Use GetNextStep() as usual,
             // which saves a modulo op.
             rem_weights[i] = rem_weights[lhs_table_number];
-            // std::cerr << "\t[before GetNextStep]" << std::endl;
-            m_levels[i]->GetNextStep(value, rem_weights[i], out[i], &join_weights[i]);
-            // std::cerr << "\t[after GetNextStep] i=" << i << " weight=" << join_weights[i] << std::endl;
-            //std::cerr << "i=" << i << " w=" << rem_weights[i] << std::endl;
-        
-            // TODO: is this the correct weight?
-            // TODO: is it before `GetNextStep`?
-            //join_weights[i] = rem_weights[i];
+            links[i] = m_levels[i]->GetNextStep(vertex, rem_weights[i], out[i], &join_weights[i]);
         } else {
-            // std::cerr << "\t [Main Loop] second branch!" << std::endl;
             // This is some child other than the last in a fork.
             // Use GetNextStepThroughFork() to correctly set
             // the rem_weight of the parent table and the child table.
-            m_levels[i]->GetNextStepThroughFork(
-                value,
+            links[i] = m_levels[i]->GetNextStepThroughFork(
+                vertex,
                 rem_weights[lhs_table_number], /* parent_weight */
                 rem_weights[i], /* my_weight */
                 out[i],
                 &join_weights[i]);
-            // std::cerr << "\t[after GetNextStepThroughFork] i=" << i << " weight=" << join_weights[i] << std::endl;
-            
-            //std::cerr << "i=" << i << " w=" << rem_weights[i] << std::endl;
-            // TODO: is this the correct weight?
-            //join_weights[i] = rem_weights[i];
         }
     }
-#endif
-    //std::cerr << "[final return] join_weights.size()=" << join_weights.size() << std::endl;
-    //std::cerr << "pointer=" << &join_weights << std::endl;
-    return join_weights;
 }
 
-void jefastIndexFork::GetRandomJoin(std::vector<int64_t> &out) {
-    weight_t random_join_number = m_distribution(m_generator);
-    return this->GetJoinNumber(random_join_number, out);
+template <typename W>
+void jefastIndexForkT<W>::GetRandomJoin(std::vector<int64_t> &out) {
+    W random_join_number = m_distribution(m_generator);
+    this->get_join_number_with_weights(random_join_number, out);
 }
 
-std::vector<weight_t> jefastIndexFork::GetRandomJoinWithWeights(std::vector<int64_t> &out) {
-    weight_t random_join_number = m_distribution(m_generator);
-    return this->GetJoinNumberWithWeights(random_join_number, out);
+template <typename W>
+std::vector<weight_t> jefastIndexForkT<W>::GetRandomJoinWithWeights(std::vector<int64_t> &out) {
+    W random_join_number = m_distribution(m_generator);
+    return narrow_weights(this->get_join_number_with_weights(random_join_number, out));
 }
 
-static uint64_t weight_to_uint64_t(weight_t w) {
-    std::ostringstream stream; stream << w;
-    return static_cast<uint64_t>(std::stoull(stream.str()));
+template <typename W>
+void jefastIndexForkT<W>::GetRandomJoinsWithoutReplacement(size_t count, std::vector<std::vector<int64_t> > &out) {
+    auto join_numbers = DistinctSampler::sample(m_start_weight, count, m_generator);
+
+    out.resize(join_numbers.size());
+    for (size_t i = 0; i < join_numbers.size(); ++i) {
+        this->get_join_number_with_weights(join_numbers[i], out[i]);
+    }
 }
 
 static std::string debugWeight(weight_t w) {
-    std::ostringstream stream; stream << w;
-    return std::to_string(std::stoull(stream.str()));
+    return std::to_string(weight_to_uint64(w));
 }
 
-std::pair<int64_t, uint64_t> jefastIndexFork::GenerateFirstEntry(uint64_t tupleIndex)
+template <typename W>
+std::pair<int64_t, uint64_t> jefastIndexForkT<W>::GenerateFirstEntry(uint64_t tupleIndex)
 // Generate only the first entry of the tuple, which corresponds to the tuple of the root table.
 {
-    weight_t joinNumber = static_cast<weight_t>(tupleIndex);
+    W joinNumber = static_cast<W>(tupleIndex);
     assert(joinNumber < m_start_weight);
     
     int64_t out0, out1;
-    weight_t w0, w1, rem;
+    W w0, w1, rem;
     if (m_levels[0].get()) {
         // We have a virtual level where there is just one
         // (virtual) key in it and the vertex contains all records
@@ -530,29 +639,23 @@ std::pair<int64_t, uint64_t> jefastIndexFork::GenerateFirstEntry(uint64_t tupleI
             {&w0, &w1});
     }
 
-    std::ostringstream stream; stream << w0;
-    return {out0, static_cast<uint64_t>(std::stoull(stream.str()))};
+    return {out0, weight_to_uint64(w0)};
 }
 
-std::pair<std::vector<int64_t>, std::vector<uint64_t>> jefastIndexFork::GenerateSampleData()
+template <typename W>
+std::pair<std::vector<int64_t>, std::vector<uint64_t>> jefastIndexForkT<W>::GenerateSampleData()
 // Generate a sample.
 {
-    // Convert `weight_t` to `uint64_t`.
-    auto convert = [&](std::vector<weight_t>& ws) {
-        std::vector<uint64_t> transformed;
-        std::transform(ws.begin(), ws.end(), std::back_inserter(transformed), [](auto w) {
-            std::ostringstream stream; stream << w;
-            return static_cast<uint64_t>(std::stoull(stream.str())); 
-        });
-        return std::move(transformed);
-    };
-
     std::vector<int64_t> out;
-    auto ws = GetRandomJoinWithWeights(out);
-    return {std::move(out), convert(ws)};
+    auto ws = get_join_number_with_weights(m_distribution(m_generator), out);
+
+    std::vector<uint64_t> transformed(ws.size());
+    std::transform(ws.begin(), ws.end(), transformed.begin(), weight_to_uint64<W>);
+    return {std::move(out), std::move(transformed)};
 }
 
-std::pair<std::vector<std::vector<int64_t>>, std::vector<std::vector<uint64_t>>> jefastIndexFork::GenerateData(size_t count)
+template <typename W>
+std::pair<std::vector<std::vector<int64_t>>, std::vector<std::vector<uint64_t>>> jefastIndexForkT<W>::GenerateData(size_t count)
 // Generate `count` samples, along with the weights of the tuples.
 {
     // And sample.
@@ -563,5 +666,118 @@ std::pair<std::vector<std::vector<int64_t>>, std::vector<std::vector<uint64_t>>>
         sampled[index] = std::move(ss);
         weights[index] = std::move(ws);
     }
-    return {sampled, weights};}
+    return {std::move(sampled), std::move(weights)};
+}
+
+template <typename W>
+void jefastIndexForkT<W>::GenerateColumnarData(size_t count, int64_t *out_records, uint64_t *out_weights)
+// Generate `count` samples straight into the caller's column buffers.
+{
+    const int levels = GetNumberOfLevels();
+    std::vector<int64_t> out(levels);
+    std::vector<W> ws(levels);
+    std::vector<W> rem_weights(m_levels.size());
+    std::vector<const link_t*> links(m_levels.size());
+
+    for (size_t index = 0; index != count; ++index) {
+        FillJoinNumberWithWeights(m_distribution(m_generator), out.data(), ws.data(), rem_weights.data(), links.data());
+        for (int level = 0; level != levels; ++level) {
+            out_records[level * count + index] = out[level];
+            out_weights[level * count + index] = weight_to_uint64(ws[level]);
+        }
+    }
+}
+
+template <typename W>
+jefastAggregate jefastIndexForkT<W>::ComputeAggregate(int tableNumber, const jefastRowValue_t &value)
+{
+    const int tables = (int) m_levels.size();
+    if (tableNumber < 0 || tableNumber >= tables)
+        throw std::out_of_range("no such table in the join");
+
+    // only the tables on the path from the root to the aggregated table
+    // have sums, the other subtrees only multiply them.
+    std::vector<bool> on_path(tables, false);
+    for (int t = tableNumber; t > 0; t = m_parent_tables[t])
+        on_path[t] = true;
+    on_path[0] = true;
+
+    std::vector<int> path_child(tables, -1);
+    for (int t = 1; t < tables; ++t) {
+        if (on_path[t])
+            path_child[m_parent_tables[t]] = t;
+    }
 
+    // table t is the RHS of level t, children have larger table numbers
+    const bool has_virtual_level = m_levels[0].get() != nullptr;
+    std::vector<vertex_sums_t> sums(tables);
+    for (int t = tables - 1; t >= (has_virtual_level ? 0 : 1); --t) {
+        if (!on_path[t])
+            continue;
+
+        auto &level = m_levels[t];
+        Table *table = level->get_RHS_Table().get();
+        int c = path_child[t];
+        level->for_each_rhs_record([&](jfkey_t vertex_key, int64_t record, W w) {
+            auto &vertex_sums = sums[t][vertex_key];
+            if (t == tableNumber) {
+                double x = value(record);
+                vertex_sums.first += x * (double) w;
+                vertex_sums.second += x * x * (double) w;
+            }
+            else {
+                // the record weight is the product of the child weights,
+                // so every join result below child c is repeated
+                // w / weight(c) times by the other subtrees.
+                auto &child_level = m_levels[c];
+                jfkey_t key = table->get_int64(record, child_level->get_LHS_table_index());
+                auto s = sums[c].find(key);
+                W child_weight = child_level->GetVertexWeight(key);
+                if (s == sums[c].end() || child_weight == 0)
+                    return;
+                double others = (double) (w / child_weight);
+                vertex_sums.first += s->second.first * others;
+                vertex_sums.second += s->second.second * others;
+            }
+        });
+    }
+
+    jefastAggregate result;
+    result.count = m_start_weight;
+    if (has_virtual_level) {
+        auto &s = sums[0][virtual_key];
+        result.sum = s.first;
+        result.sum_of_squares = s.second;
+        return result;
+    }
+
+    // table 0 is the LHS of level 1 (see GetStartPairStep())
+    for (auto &entry : m_levels[1]->m_data) {
+        const JefastVertexT<W> *vertex = entry.second.get();
+        W w = entry.second->getWeight();
+        if (w == 0)
+            continue;
+        for (size_t l = 0; l < vertex->get_LHS_outdegree(); ++l) {
+            if (tableNumber == 0) {
+                double x = value(vertex->get_lhs_record_id(l));
+                result.sum += x * (double) w;
+                result.sum_of_squares += x * x * (double) w;
+            }
+            else {
+                auto s = sums[1].find(entry.first);
+                if (s == sums[1].end())
+                    continue;
+                result.sum += s->second.first;
+                result.sum_of_squares += s->second.second;
+            }
+        }
+    }
+    return result;
+}
+
+template class jefastIndexLinearT<weight_t>;
+template class jefastIndexForkT<weight_t>;
+#ifndef USE_UINT128_WEIGHT
+template class jefastIndexLinearT<wide_weight_t>;
+template class jefastIndexForkT<wide_weight_t>;
+#endif
@@ -10,64 +10,226 @@
 #include <tuple>
 #include <sstream>
 #include <random>
+#include <functional>
 
 #include "Table.h"
 #include "DatabaseSharedTypes.h"
 #include "jefastLevel.h"
+#include "../util/Deadline.h"
 
 static constexpr const jfkey_t virtual_key = 0;
 
+// A batch of samples stored column by column.  Each column is one level of the
+// join (see jefastIndexBase::GetNumberOfLevels()), so the record id of level j
+// for sample i is records[j * count + i].  The buffers are reused when the
+// same batch is passed to GenerateBatch() again.
+struct jefastSampleBatch {
+    size_t count = 0;
+    int levels = 0;
+    std::vector<int64_t> records;
+    std::vector<uint64_t> weights;
+
+    int64_t record(size_t sample, int level) const {
+        return records[level * count + sample];
+    }
+
+    uint64_t weight(size_t sample, int level) const {
+        return weights[level * count + sample];
+    }
+};
+
+// the value of an aggregated column for a row id of one of the joined tables
+typedef std::function<double(int64_t)> jefastRowValue_t;
+
+// COUNT, SUM and SUM of squares of one column over all join results.  The
+// sums are accumulated in double precision.
+struct jefastAggregate {
+    wide_weight_t count = 0;
+    double sum = 0;
+    double sum_of_squares = 0;
+
+    double average() const {
+        return count == 0 ? 0.0 : sum / (double) count;
+    }
+
+    double variance() const {
+        if (count == 0)
+            return 0.0;
+        double avg = average();
+        return sum_of_squares / (double) count - avg * avg;
+    }
+};
+
 class jefastIndexBase {
 public:
     virtual ~jefastIndexBase()
     {};
 
-    // get the total number of join possibilities.
+    // get the total number of join possibilities.  Throws
+    // std::overflow_error if the index has wide weights (see
+    // JefastBuilder::Build()) and the total does not fit in weight_t, like
+    // every other method reporting weight_t.
     virtual weight_t GetTotal() = 0;
     virtual uint64_t GetTransformedTotal() = 0;
 
+    // the total of an index with either weight type
+    virtual wide_weight_t GetWideTotal() = 0;
+
     virtual void GetJoinNumber(weight_t joinNumber, std::vector<int64_t> &out)= 0;
     virtual std::vector<weight_t> GetJoinNumberWithWeights(weight_t joinNumber, std::vector<int64_t> &out)= 0;
 
     virtual void GetRandomJoin(std::vector<int64_t> &out) = 0;
     virtual std::vector<weight_t> GetRandomJoinWithWeights(std::vector<int64_t> &out) = 0;
 
+    // Draw min(count, GetTotal()) distinct join numbers (sampling without
+    // replacement) and fill in each out[i] as by GetJoinNumber().  With row
+    // weights (see JefastBuilder::SetRowWeight()) a join result covers as
+    // many join numbers as its weight, so it may be drawn up to that many
+    // times.  The join results are distinct if every row weight is 0 or 1,
+    // as in the strata of a jefastStratifiedIndex.
+    virtual void GetRandomJoinsWithoutReplacement(size_t count, std::vector<std::vector<int64_t> > &out) = 0;
+
     virtual std::pair<std::vector<std::vector<int64_t>>, std::vector<std::vector<uint64_t>>> GenerateData(size_t count) = 0;
     virtual std::pair<std::vector<int64_t>, std::vector<uint64_t>> GenerateSampleData() = 0;
     virtual std::pair<int64_t, uint64_t> GenerateFirstEntry(uint64_t tupleIndex) = 0;
 
+    // Draw `count` random join results and write them column-wise into
+    // caller-provided buffers of count * GetNumberOfLevels() elements each.
+    // The record id of level j for sample i is written to
+    // out_records[j * count + i] and its weight to out_weights[j * count + i].
+    virtual void GenerateColumnarData(size_t count, int64_t *out_records, uint64_t *out_weights) = 0;
+
+    // Compute the exact aggregate of value(row) over all join results, where
+    // row is the record of table `tableNumber` in the join result.  With row
+    // weights every join result counts as often as its weight.  The sums
+    // are propagated bottom-up the same way as the weights, so this visits
+    // every vertex of the index once and does not enumerate the join.
+    // Throws std::out_of_range if tableNumber is not a table of the join.
+    virtual jefastAggregate ComputeAggregate(int tableNumber, const jefastRowValue_t &value) = 0;
+
+    // Link every record to the vertexes it joins with in the child levels
+    // (see JefastLevel::link_children()), so sampling follows pointers
+    // instead of hashing the join value at every level.  Optional, done
+    // once after the index is built.  Insert() and Delete() drop the links.
+    virtual void LinkChildren() = 0;
+
+    // Store the record id lists of the vertexes with at least minRecords
+    // records bit packed (see jefastPackedIds), which takes a fraction of
+    // the memory of the 64 bit ids.  Shorter lists are left alone, since
+    // the packed form has a fixed overhead.  Optional, done once after the
+    // index is built.  Insert() and Delete() are not supported afterwards.
+    virtual void CompressRecords(size_t minRecords = 64) = 0;
+
+    // an aggregate requested through JefastBuilder::AddAggregate()
+    const jefastAggregate &GetAggregate(int aggregateId) const {
+        return m_aggregates.at(aggregateId);
+    }
+
+    // same as GenerateColumnarData(), but sizes the buffers of `batch`
+    // (one allocation per buffer, none if the batch is already large enough).
+    void GenerateBatch(size_t count, jefastSampleBatch &batch) {
+        batch.count = count;
+        batch.levels = GetNumberOfLevels();
+        batch.records.resize(count * batch.levels);
+        batch.weights.resize(count * batch.levels);
+        GenerateColumnarData(count, batch.records.data(), batch.weights.data());
+    }
+
+    // Append random join results (with replacement, as GetRandomJoin()) to
+    // out until there are max_count new ones or the deadline expires.
+    // Every attempt is accepted, the index does not reject.  An empty join
+    // returns at once.
+    SampleReport GetRandomJoinsUntil(Deadline deadline, std::vector<std::vector<int64_t> > &out, size_t max_count = SIZE_MAX) {
+        if (GetWideTotal() == 0)
+            max_count = 0;
+        return sample_until_deadline(deadline, out, max_count,
+            [this](std::vector<int64_t> &sample) { GetRandomJoin(sample); return true; });
+    }
+
     // return the number of levels in this jefastIndex
     // (how large a vector will be if a join value is reported)
     virtual int GetNumberOfLevels() = 0;
+
+protected:
+    std::vector<jefastAggregate> m_aggregates;
+
+    friend class JefastBuilder;
 };
 
+// A linear join index, a chain of levels with one table per level.  Built
+// with JefastBuilder::Build(), which picks the weight type of the
+// jefastIndexLinearT it returns.
 class jefastIndexLinear : public jefastIndexBase {
 public:
     virtual ~jefastIndexLinear()
     {};
 
+    // insert a new item into the index.  Insert() and Delete() throw if
+    // the index has primary key levels (see JefastBuilder::SetPrimaryKey()),
+    // is compressed (see CompressRecords()) or shares levels through a
+    // JefastLevelCache (see JefastBuilder::SetLevelCache()).
+    virtual void Insert(int table_id, jefastKey_t record_id) = 0;
+
+    virtual void Delete(int table_id, jefastKey_t record_id) = 0;
+
+    virtual std::vector<weight_t> MaxOutdegree() = 0;
+
+    virtual void print_search_weights() = 0;
+
+    // Insert() and Delete() rebuild the start of the index (its total and
+    // the search over the first level) after every call unless
+    // set_postponeRebuild() is on.  Then sampling is only valid again
+    // after rebuild_initial().
+    virtual void rebuild_initial() = 0;
+    virtual void set_postponeRebuild(bool value = true) = 0;
+};
+
+// A join index over a tree of tables.  Built with JefastBuilder::BuildFork().
+class jefastIndexFork : public jefastIndexBase {
+public:
+    virtual ~jefastIndexFork()
+    {};
+};
+
+// W is the weight type, weight_t or wide_weight_t
+template <typename W>
+class jefastIndexLinearT : public jefastIndexLinear {
+public:
+    virtual ~jefastIndexLinearT()
+    {};
+
     // get the total number of join possibilities.
-    weight_t GetTotal();
+    weight_t GetTotal() {
+        return weight_narrow(start_weight);
+    }
     uint64_t GetTransformedTotal() {
-        // TODO
-        return 0;
+        return weight_to_uint64(start_weight);
+    }
+    wide_weight_t GetWideTotal() {
+        return start_weight;
     }
 
-    void GetJoinNumber(weight_t joinNumber, std::vector<int64_t> &out);
+    void GetJoinNumber(weight_t joinNumber, std::vector<int64_t> &out) {
+        get_join_number(joinNumber, out);
+    }
     std::vector<weight_t> GetJoinNumberWithWeights(weight_t joinNumber, std::vector<int64_t> &out);
     
     void GetRandomJoin(std::vector<int64_t> &out);
     std::vector<weight_t> GetRandomJoinWithWeights(std::vector<int64_t> &out);
+    void GetRandomJoinsWithoutReplacement(size_t count, std::vector<std::vector<int64_t> > &out);
 
     std::pair<std::vector<std::vector<int64_t>>, std::vector<std::vector<uint64_t>>> GenerateData(size_t count);
     std::pair<std::vector<int64_t>, std::vector<uint64_t>> GenerateSampleData();
     std::pair<int64_t, uint64_t> GenerateFirstEntry(uint64_t tupleIndex);
+    void GenerateColumnarData(size_t count, int64_t *out_records, uint64_t *out_weights);
+    jefastAggregate ComputeAggregate(int tableNumber, const jefastRowValue_t &value);
+    void LinkChildren();
+    void CompressRecords(size_t minRecords = 64);
 
     // return the number of levels in this jefastIndex
     // (how large a vector will be if a join value is reported)
     virtual int GetNumberOfLevels();
 
-    // insert a new item into the index
     void Insert(int table_id, jefastKey_t record_id);
 
     void Delete(int table_id, jefastKey_t record_id);
@@ -87,60 +249,143 @@ public:
         postpone_rebuild = value;
     }
 private:
-    jefastIndexLinear()
+    typedef JefastLevel<jfkey_t, W> level_t;
+    typedef jefastChildLinkT<W> link_t;
+
+    jefastIndexLinearT()
         : postpone_rebuild{ false }
     {};
 
-    std::vector<std::shared_ptr<JefastLevel<jfkey_t> > > m_levels;
-    weight_t start_weight;
+    // GetJoinNumber() and GetJoinNumberWithWeights() for any join number
+    void get_join_number(W joinNumber, std::vector<int64_t> &out);
+    std::vector<W> get_join_number_with_weights(W joinNumber, std::vector<int64_t> &out);
+
+    // the allocation free part of GetJoinNumberWithWeights().  Both out and
+    // join_weights must have room for GetNumberOfLevels() elements.
+    void FillJoinNumberWithWeights(W joinNumber, int64_t *out, W *join_weights);
+
+    // the vertex of level i for `record` of table i, taken from the child
+    // links of the record if there are any
+    link_t next_vertex(int i, int64_t record, const link_t *links);
+
+    void clear_child_links();
+
+    std::vector<std::shared_ptr<level_t> > m_levels;
+    W start_weight;
 
     // random number stuff for reporting random results of the join
     std::default_random_engine m_generator;
-    std::uniform_int_distribution<weight_t> m_distribution;
+    std::uniform_int_distribution<W> m_distribution;
 
     bool postpone_rebuild;
 
+    // the row weight of each table, if any (see JefastBuilder::SetRowWeight())
+    std::vector<jefastRowWeight_t> m_row_weights;
+
+    bool has_primary_key_level() const {
+        return std::any_of(m_levels.begin(), m_levels.end(), [](const std::shared_ptr<level_t> &level) {
+            return level->is_primary_key();
+        });
+    }
+
+    bool is_packed() const {
+        return std::any_of(m_levels.begin(), m_levels.end(), [](const std::shared_ptr<level_t> &level) {
+            return level->is_packed();
+        });
+    }
+
+    bool has_shared_level() const {
+        return std::any_of(m_levels.begin(), m_levels.end(), [](const std::shared_ptr<level_t> &level) {
+            return level->is_shared();
+        });
+    }
+
+    // the weight of a RHS record whose join results below it weigh `weight`
+    W apply_row_weight(int table_id, jefastKey_t record_id, W weight) {
+        if (table_id < (int) m_row_weights.size() && m_row_weights[table_id])
+            return weight_mul<W>(weight, m_row_weights[table_id](record_id));
+        return weight;
+    }
+
     friend class JefastBuilder;
     friend class jefastBuilderWJoinAttribSelection;
     friend class jefastBuilderWNonJoinAttribSelection;
+    friend class JefastRangeEnumerator;
 };
 
-class jefastIndexFork: public jefastIndexBase {
+// W is the weight type, weight_t or wide_weight_t
+template <typename W>
+class jefastIndexForkT : public jefastIndexFork {
 public:
-    ~jefastIndexFork() {}
+    ~jefastIndexForkT() {}
 
     weight_t GetTotal() {
-        return m_start_weight;
+        return weight_narrow(m_start_weight);
     }
 
     uint64_t GetTransformedTotal() {
-        std::ostringstream stream; stream << m_start_weight;
-        return static_cast<uint64_t>(std::stoull(stream.str()));
+        return weight_to_uint64(m_start_weight);
     }
 
-    void GetJoinNumber(weight_t joinNumber, std::vector<int64_t> &out);
+    wide_weight_t GetWideTotal() {
+        return m_start_weight;
+    }
+
+    void GetJoinNumber(weight_t joinNumber, std::vector<int64_t> &out) {
+        get_join_number_with_weights(joinNumber, out);
+    }
     std::vector<weight_t> GetJoinNumberWithWeights(weight_t joinNumber, std::vector<int64_t> &out);
 
     void GetRandomJoin(std::vector<int64_t> &out);
     std::vector<weight_t> GetRandomJoinWithWeights(std::vector<int64_t> &out);
+    void GetRandomJoinsWithoutReplacement(size_t count, std::vector<std::vector<int64_t> > &out);
 
     std::pair<std::vector<std::vector<int64_t>>, std::vector<std::vector<uint64_t>>> GenerateData(size_t count);
     std::pair<std::vector<int64_t>, std::vector<uint64_t>> GenerateSampleData();
     std::pair<int64_t, uint64_t> GenerateFirstEntry(uint64_t tupleIndex);
+    void GenerateColumnarData(size_t count, int64_t *out_records, uint64_t *out_weights);
+    jefastAggregate ComputeAggregate(int tableNumber, const jefastRowValue_t &value);
+    void LinkChildren();
+    void CompressRecords(size_t minRecords = 64);
 
     int GetNumberOfLevels() {
         return (int) m_levels.size() + 1;
     }
 
 private:
-    std::vector<std::shared_ptr<JefastLevel<jfkey_t> > > m_levels;
+    typedef JefastLevel<jfkey_t, W> level_t;
+    typedef jefastChildLinkT<W> link_t;
+
+    // GetJoinNumberWithWeights() for any join number
+    std::vector<W> get_join_number_with_weights(W joinNumber, std::vector<int64_t> &out);
+
+    // the allocation free part of GetJoinNumberWithWeights().  out and
+    // join_weights must have room for GetNumberOfLevels() elements and
+    // rem_weights and links for m_levels.size() elements.
+    void FillJoinNumberWithWeights(W joinNumber, int64_t *out, W *join_weights, W *rem_weights, const link_t **links);
+
+    // the vertex of level i for the record of its parent table in `out`,
+    // taken from the child links of that record if there are any
+    link_t next_vertex(size_t i, const int64_t *out, const link_t * const *links);
+
+    std::vector<std::shared_ptr<level_t> > m_levels;
     std::vector<int> m_parent_tables;
     std::vector<bool> m_is_last_child;
-    weight_t m_start_weight;
+    // the position of each table among the children of its parent
+    std::vector<int> m_child_slot;
+    W m_start_weight;
 
     std::default_random_engine m_generator;
-    std::uniform_int_distribution<weight_t> m_distribution;
+    std::uniform_int_distribution<W> m_distribution;
 
     friend class JefastBuilder;
+    friend class JefastRangeEnumerator;
 };
 
+// instantiated in jefastIndex.cpp
+extern template class jefastIndexLinearT<weight_t>;
+extern template class jefastIndexForkT<weight_t>;
+#ifndef USE_UINT128_WEIGHT
+extern template class jefastIndexLinearT<wide_weight_t>;
+extern template class jefastIndexForkT<wide_weight_t>;
+#endif
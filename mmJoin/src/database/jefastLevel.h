@@ -21,14 +21,26 @@
 
 //typedef std::map<jfkey_t, std::shared_ptr<JefastVertex> > internal_map;
 //typedef btree::btree_map<jfkey_t, std::shared_ptr<JefastVertex> > internal_map;
+template <typename W>
+using internal_map_t = std::unordered_map<jfkey_t, std::shared_ptr<JefastVertexT<W> > >;
 typedef std::pair<jfkey_t, std::shared_ptr<JefastVertex> > map_pair_t;
-typedef std::unordered_map<jfkey_t, std::shared_ptr<JefastVertex> > internal_map;
-
+typedef internal_map_t<weight_t> internal_map;
+
+// the only RHS record of a key in a primary key level (see
+// JefastLevel::set_primary_key())
+template <typename W>
+struct jefastPKRecordT {
+    jfkey_t record_id;
+    W weight;
+};
+typedef jefastPKRecordT<weight_t> jefastPKRecord;
+typedef std::unordered_map<jfkey_t, jefastPKRecord> pk_map;
 
-class JefastLevelEnumerator {
+template <typename W>
+class JefastLevelEnumeratorT {
 public:
     
-    virtual ~JefastLevelEnumerator()
+    virtual ~JefastLevelEnumeratorT()
     {};
 
     // return true if we make a step
@@ -36,14 +48,18 @@ public:
 
     virtual int64_t getValue() = 0;
     virtual int64_t getRecordId() = 0;
-    virtual weight_t getWeight() = 0;
+    virtual W getWeight() = 0;
     virtual int64_t getVertexValue() = 0;
 };
+typedef JefastLevelEnumeratorT<weight_t> JefastLevelEnumerator;
 
+template <typename W>
 class JefastLevelEnumeratorValue : public jefastEnumerator {
 public:
-    JefastLevelEnumeratorValue(internal_map::iterator start
-        , internal_map::iterator end)
+    typedef internal_map_t<W> map_t;
+
+    JefastLevelEnumeratorValue(typename map_t::iterator start
+        , typename map_t::iterator end)
         : m_current{ start }
         , m_end{ end }
         , m_currentState{ STATE::STARTING }
@@ -83,17 +99,17 @@ public:
     };
 
 private:
-    internal_map::iterator m_current;
-    internal_map::iterator m_end;
+    typename map_t::iterator m_current;
+    typename map_t::iterator m_end;
     enum STATE { STARTING, RUNNING, ENDED };
     STATE m_currentState;
 };
 
 // JefastVertex<jfkey_t>
-template <typename VertexType_t>
-class JefastLevelEnumeratorLHS : public JefastLevelEnumerator {
+template <typename VertexType_t, typename W = weight_t>
+class JefastLevelEnumeratorLHS : public JefastLevelEnumeratorT<W> {
 public:
-    typedef internal_map map_t;
+    typedef internal_map_t<W> map_t;
 
     JefastLevelEnumeratorLHS(typename map_t::iterator start
         , typename map_t::iterator end)
@@ -156,23 +172,23 @@ public:
     {
         return m_observer->getRecordId();
     }
-    weight_t getWeight()
+    W getWeight()
     {
         return m_currWeight;
     }
 private:
     typename map_t::iterator m_current;
     typename map_t::iterator m_end;
-    std::unique_ptr<JefastVertexEnumerator> m_observer;
-    weight_t m_currWeight;
+    std::unique_ptr<JefastVertexEnumeratorT<W> > m_observer;
+    W m_currWeight;
     enum STATE { STARTING, RUNNING, ENDED };
     STATE m_currentState;
 };
 
-template <typename VertexType_t>
-class JefastLevelEnumeratorRHS : public JefastLevelEnumerator {
+template <typename VertexType_t, typename W = weight_t>
+class JefastLevelEnumeratorRHS : public JefastLevelEnumeratorT<W> {
 public:
-    typedef internal_map map_t;
+    typedef internal_map_t<W> map_t;
 
     JefastLevelEnumeratorRHS(typename map_t::iterator start
         , typename map_t::iterator end)
@@ -235,27 +251,35 @@ public:
     {
         return m_observer->getRecordId();
     }
-    weight_t getWeight()
+    W getWeight()
     {
         return m_currWeight;
     }
-    void setWeight(weight_t w)
+    void setWeight(W w)
     {
         m_observer->setWeight(w);
     }
 private:
     typename map_t::iterator m_current;
     typename map_t::iterator m_end;
-    std::unique_ptr<JefastVertexEnumerator> m_observer;
-    weight_t m_currWeight;
+    std::unique_ptr<JefastVertexEnumeratorT<W> > m_observer;
+    W m_currWeight;
     enum STATE { STARTING, RUNNING, ENDED };
     STATE m_currentState;
 };
 
 //template <typename pointer_t>
-template <class next_value_t>
+// W is the weight type (see JefastBuilder::Build())
+template <class next_value_t, typename W = weight_t>
 class JefastLevel {
 public:
+    typedef JefastVertexT<W> vertex_t;
+    typedef jefastChildLinkT<W> link_t;
+    typedef jefastPKRecordT<W> pk_record_t;
+    typedef internal_map_t<W> map_t;
+    typedef std::pair<jfkey_t, std::shared_ptr<vertex_t> > map_pair_t;
+    typedef std::unordered_map<jfkey_t, pk_record_t> pk_map_t;
+
     JefastLevel(std::shared_ptr<Table> LHS_table, std::shared_ptr<Table> RHS_table, bool useDefaultWeight)
         : m_NewVertexLocked{ false }
         , mp_LHS_Table{LHS_table}
@@ -264,6 +288,11 @@ public:
         , m_LHS_Table_index{ -1 }
         , m_RHS_Table_index{ -1 }
         , m_optimized{ false }
+        , m_LHS_row_weighted{ false }
+        , m_primary_key{ false }
+        , m_linked_children{ 0 }
+        , m_packed{ false }
+        , m_shared{ false }
     { }
 
     // adds a new filter to the jefast level
@@ -321,13 +350,84 @@ public:
         m_RHS_Table_index = value;
     }
 
+    // the LHS table has a row weight, so the parent level's record weights
+    // are a multiple of the vertex weights in this level.  The extra factor
+    // only picks a copy of the same join result, so the weight passed down
+    // is reduced modulo the vertex weight.
+    void set_LHS_row_weighted(bool value = true) {
+        m_LHS_row_weighted = value;
+    }
+
+    bool is_LHS_row_weighted() const {
+        return m_LHS_row_weighted;
+    }
+
+    // the RHS join column is unique, so every key has a single RHS record.
+    // The level then maps each key straight to its record and weight instead
+    // of a vertex, and does not store LHS records at all: it can't be the
+    // start level and doesn't support Insert() or Delete() on the index.
+    // Must be set before any record is inserted.
+    void set_primary_key(bool value = true) {
+        m_primary_key = value;
+    }
+
+    bool is_primary_key() const {
+        return m_primary_key;
+    }
+
+    // the total weight of the vertex for this key, or 0 if there is none
+    W GetVertexWeight(jfkey_t value) {
+        if (m_primary_key) {
+            auto search = m_pk_data.find(value);
+            return search == m_pk_data.end() ? 0 : search->second.weight;
+        }
+        auto search = m_data.find(value);
+        return search == m_data.end() ? 0 : search->second->getWeight();
+    }
+
+    // the vertex (or primary key record) of a key, both are null if the key
+    // is not in this level
+    link_t FindLink(jfkey_t value) {
+        link_t link{ nullptr, nullptr };
+        if (m_primary_key) {
+            auto search = m_pk_data.find(value);
+            if (search != m_pk_data.end())
+                link.pk = &search->second;
+        }
+        else {
+            auto search = m_data.find(value);
+            if (search != m_data.end())
+                link.vertex = search->second.get();
+        }
+        return link;
+    }
+
     // used when traversing the level to lookup a join result.
     // id - the input value for the current level
     // inout_weight - a counter to indicate which path to go down.  will be updated on return
     // out_key - the key of the LHS item in the join
     // out_next - the value of the next level to traverse.
-    void GetNextStep(jfkey_t id, weight_t &inout_weight, jfkey_t &out_key, weight_t* record_weight=nullptr) {
-        m_data.find(id)->second->get_records(inout_weight, out_key, record_weight);
+    // Returns the child links of the selected record, or nullptr if the
+    // level is not linked (see link_children()).
+    const link_t *GetNextStep(jfkey_t id, W &inout_weight, jfkey_t &out_key, W* record_weight=nullptr) {
+        return GetNextStep(FindLink(id), inout_weight, out_key, record_weight);
+    }
+
+    // the same as above for a vertex we already have a link to
+    const link_t *GetNextStep(const link_t &link, W &inout_weight, jfkey_t &out_key, W* record_weight=nullptr) {
+        if (link.pk) {
+            // the single record takes the whole weight
+            if (m_LHS_row_weighted)
+                inout_weight %= link.pk->weight;
+            out_key = link.pk->record_id;
+            if (record_weight) (*record_weight) = link.pk->weight;
+            return nullptr;
+        }
+        if (m_LHS_row_weighted) {
+            W quotient = inout_weight;
+            link.vertex->divide_by_weight(quotient, inout_weight, m_dividers);
+        }
+        return select_record(link.vertex, inout_weight, out_key, record_weight);
     }
     
     // the same as GetNextStep() except that we need to first
@@ -336,16 +436,23 @@ public:
     //
     // Note: parent_weight and my_weight must not point to the same
     // variable
-    void GetNextStepThroughFork(jfkey_t id, weight_t &parent_weight, weight_t &my_weight, jfkey_t &out_key, weight_t* record_weight=nullptr) {
-        auto vertex = m_data.find(id)->second;
-        //std::cerr << "[throughFork] ---- " << vertex->getWeight() << std::endl;
-        weight_t tot_weight = vertex->getWeight();
-        my_weight = parent_weight % tot_weight;
-        parent_weight /= tot_weight;
-        vertex->get_records(my_weight, out_key, record_weight);
+    const link_t *GetNextStepThroughFork(jfkey_t id, W &parent_weight, W &my_weight, jfkey_t &out_key, W* record_weight=nullptr) {
+        return GetNextStepThroughFork(FindLink(id), parent_weight, my_weight, out_key, record_weight);
     }
 
-    void GetStartPairStep(weight_t &inout_weight, jfkey_t &out_key1, jfkey_t &out_key2, std::pair<weight_t*, weight_t*> record_info = {nullptr, nullptr}) {
+    const link_t *GetNextStepThroughFork(const link_t &link, W &parent_weight, W &my_weight, jfkey_t &out_key, W* record_weight=nullptr) {
+        if (link.pk) {
+            my_weight = parent_weight % link.pk->weight;
+            parent_weight /= link.pk->weight;
+            out_key = link.pk->record_id;
+            if (record_weight) (*record_weight) = link.pk->weight;
+            return nullptr;
+        }
+        link.vertex->divide_by_weight(parent_weight, my_weight, m_dividers);
+        return select_record(link.vertex, my_weight, out_key, record_weight);
+    }
+
+    const link_t *GetStartPairStep(W &inout_weight, jfkey_t &out_key1, jfkey_t &out_key2, std::pair<W*, W*> record_info = {nullptr, nullptr}) {
         // find the pair for the weight
         auto w_itr = std::upper_bound(m_searchWeights.begin(), m_searchWeights.end(), inout_weight);
         
@@ -366,19 +473,109 @@ public:
         // correct if there are multiple possible starting values
         if (record_info.first) (*record_info.first) = record->second->getWeight();
         //(*record_info.second) = record->second->getWeight();
-        size_t LHS_record = inout_weight / record->second->getWeight();
-        inout_weight -= (LHS_record) * record->second->getWeight();
+        W LHS_record = inout_weight;
+        record->second->divide_by_weight(LHS_record, inout_weight, m_dividers);
     
         auto temp = record->second->getLHSEnumerator();
         // TODO: what's the role of this `Step`, as it only returns bool.
         temp->Step(LHS_record + 1);
 
         out_key1 = temp->getRecordId();
-        record->second->get_records(inout_weight, out_key2, record_info.second);
+        return select_record(record->second.get(), inout_weight, out_key2, record_info.second);
+    }
+
+    // Store with every RHS record a direct link to the vertex it joins with
+    // in each of the child levels, so the traversal does not have to read
+    // the join value and look it up (see GetNextStep()).  Costs one
+    // jefastChildLink per record and child.  The links are only valid as
+    // long as no record is inserted or deleted.  Primary key levels are not
+    // linked, their children are still looked up.
+    void link_children(const std::vector<JefastLevel<next_value_t, W>*> &children, const std::vector<int> &childIndexes) {
+        if (m_linked_children != 0 || children.empty() || m_primary_key)
+            return;
+
+        std::vector<std::vector<jfkey_t>::iterator> tables;
+        for (int index : childIndexes)
+            tables.push_back(mp_RHS_Table->get_key_iterator(index));
+
+        for (auto &entry : m_data) {
+            vertex_t *vertex = entry.second.get();
+            if (vertex->getWeight() == 0)
+                continue;
+            auto &links = vertex->rhs_child_links();
+            links.resize(vertex->get_RHS_outdegree() * children.size());
+            for (size_t j = 0; j < vertex->get_RHS_outdegree(); ++j) {
+                // deleted records are left with a zero weight and no record id
+                if (vertex->get_rhs_record_weight(j) == 0)
+                    continue;
+                jfkey_t record = vertex->get_rhs_record_id(j);
+                for (size_t c = 0; c < children.size(); ++c)
+                    links[j * children.size() + c] = children[c]->FindLink(tables[c][record]);
+            }
+        }
+        m_linked_children = children.size();
+    }
+
+    void clear_child_links() {
+        for (auto &entry : m_data) {
+            std::vector<link_t>().swap(entry.second->rhs_child_links());
+        }
+        m_linked_children = 0;
+    }
+
+    bool is_linked() const {
+        return m_linked_children != 0;
+    }
+
+    // pack the record id lists of every vertex with at least min_records
+    // records (see JefastVertex::pack_records()).  Records can't be
+    // inserted or deleted afterwards.
+    void pack_records(size_t min_records) {
+        for (auto &entry : m_data)
+            entry.second->pack_records(min_records);
+        m_packed = true;
+    }
+
+    bool is_packed() const {
+        return m_packed;
+    }
+
+    // mark a level which a JefastLevelCache shares between indexes.  Its
+    // records can't be inserted or deleted, since that would change every
+    // index sharing it.
+    void set_shared() {
+        m_shared = true;
+    }
+
+    bool is_shared() const {
+        return m_shared;
+    }
+
+    // precompute the divider (see jefastDivider) of the weight of every
+    // vertex for a level which divides by the vertex weights, i.e. the start
+    // level, a non-last child of a fork or a level with LHS row weights.
+    // The dividers live in a table of the level rather than in the vertexes,
+    // so the other levels don't pay for them.  A vertex whose weight changes
+    // later falls back to the division operators.
+    void prepare_division() {
+        m_dividers.clear();
+        m_dividers.reserve(m_data.size());
+        for (auto &entry : m_data) {
+            uint32_t slot = vertex_t::no_divider;
+            if (m_dividers.size() < vertex_t::no_divider) {
+                slot = (uint32_t) m_dividers.size();
+                m_dividers.emplace_back(entry.second->getWeight());
+            }
+            entry.second->set_divider_slot(slot);
+        }
     }
 
     // inert a new item on the LHS of the join level.  Return true if we created something.
     bool InsertLHSRecord(jfkey_t value, jfkey_t LHS_recordId) {
+        // primary key levels don't keep LHS records
+        if (m_primary_key)
+            return false;
+
         //auto search = m_data.lower_bound(value);
         auto search = m_data.find(value);
         //if (search!= m_data.end() && search->first == value) {
@@ -388,7 +585,7 @@ public:
         }
         else if (!m_NewVertexLocked) {
             // otherwise, we need to insert a new value using a hint.
-            std::shared_ptr<JefastVertex> tmp(new JefastVertex(m_useDefaultVertexWeight));
+            std::shared_ptr<vertex_t> tmp(new vertex_t(m_useDefaultVertexWeight));
             map_pair_t t_pair(value, std::move(tmp));
             //auto insertedValue = m_data.insert(search, t_pair);
             auto insertedValue = m_data.insert(t_pair);
@@ -401,6 +598,15 @@ public:
     }
 
     bool InsertRHSRecord(jfkey_t value, jfkey_t RHS_recordId) {
+        if (m_primary_key) {
+            // the records of a key are only reached through an LHS record,
+            // so the new vertex lock does not apply.
+            pk_record_t record{ RHS_recordId, W(m_useDefaultVertexWeight ? 1 : 0) };
+            if (!m_pk_data.emplace(value, record).second)
+                throw "Duplicate key in a primary key level";
+            return true;
+        }
+
         //auto search = m_data.lower_bound(value);
         auto search = m_data.find(value);
         //if (search != m_data.end() && search->first == value) {
@@ -411,7 +617,7 @@ public:
         }
         else if (!m_NewVertexLocked) {
             // otherwise, we need to insert a new value using a hint.
-            std::shared_ptr<JefastVertex> tmp(new JefastVertex(m_useDefaultVertexWeight));
+            std::shared_ptr<vertex_t> tmp(new vertex_t(m_useDefaultVertexWeight));
             map_pair_t t_pair(value, std::move(tmp));
             //auto insertedValue = m_data.insert(search, t_pair);
             auto insertedValue = m_data.insert(t_pair);
@@ -423,7 +629,7 @@ public:
         }
     }
 
-    bool AdjustRHSRecordWeight(jfkey_t value, jfkey_t RHS_recordId, weight_t weight) {
+    bool AdjustRHSRecordWeight(jfkey_t value, jfkey_t RHS_recordId, W weight) {
         auto search = m_data.find(value);
         if (search != m_data.end()) {
             search->second->adjust_rhs_record_weight(RHS_recordId, weight);
@@ -434,17 +640,17 @@ public:
         return false;
     }
 
-    weight_t GetLevelWeight() {
+    W GetLevelWeight() {
         auto start = m_data.begin();
         auto end = m_data.end();
-        weight_t weight_counter = 0;
+        W weight_counter = 0;
 
         while (start != end)
         {
             // for the level weight, we should adjust the total weight by the indegree.
             // this number will give you what you would use to query this level if you were starting here.
             //std::cout << start->second->getWeight() << std::endl;
-            weight_counter += start->second->getWeight() * start->second->get_LHS_outdegree();
+            weight_counter = weight_add<W>(weight_counter, weight_mul<W>(start->second->getWeight(), start->second->get_LHS_outdegree()));
             ++start;
         }
 
@@ -456,35 +662,69 @@ public:
         return m_data.count(value) > 0;
     };
 
-    std::shared_ptr<JefastVertex> getVertex(jfkey_t value)
+    std::shared_ptr<vertex_t> getVertex(jfkey_t value)
     {
         return m_data.find(value)->second;
     }
 
-    std::unique_ptr<JefastLevelEnumerator> GetLHSEnumerator()
+    std::unique_ptr<JefastLevelEnumeratorT<W>> GetLHSEnumerator()
     {
-        return std::unique_ptr<JefastLevelEnumerator>(new JefastLevelEnumeratorLHS<next_value_t>(this->m_data.begin(), this->m_data.end()));
+        return std::unique_ptr<JefastLevelEnumeratorT<W>>(new JefastLevelEnumeratorLHS<next_value_t, W>(this->m_data.begin(), this->m_data.end()));
     }
 
     std::unique_ptr<jefastEnumerator> GetVertexValueEnumerator()
     {
-        return std::unique_ptr<jefastEnumerator>(new JefastLevelEnumeratorValue(this->m_data.begin(), this->m_data.end()));
+        return std::unique_ptr<jefastEnumerator>(new JefastLevelEnumeratorValue<W>(this->m_data.begin(), this->m_data.end()));
     }
 
-    std::unique_ptr<JefastLevelEnumeratorRHS<next_value_t> > GetRHSEnumerator()
+    std::unique_ptr<JefastLevelEnumeratorRHS<next_value_t, W> > GetRHSEnumerator()
     {
-        return std::unique_ptr<JefastLevelEnumeratorRHS<next_value_t> >(new JefastLevelEnumeratorRHS<next_value_t>(this->m_data.begin(), this->m_data.end()));
+        return std::unique_ptr<JefastLevelEnumeratorRHS<next_value_t, W> >(new JefastLevelEnumeratorRHS<next_value_t, W>(this->m_data.begin(), this->m_data.end()));
     }
 
-    weight_t fill_weight(std::shared_ptr<JefastLevel<next_value_t> > nextLevel, int nextLevelIndex)
-    {
-        // iterate though all RHS items in this level
-        auto iter = std::unique_ptr<JefastLevelEnumeratorRHS<next_value_t> >(new JefastLevelEnumeratorRHS<next_value_t>(this->m_data.begin(), this->m_data.end()));
+    // calls f(key, record_id, weight) for every RHS record with a non-zero
+    // weight.  Only valid once the weights are set up (see optimize()).
+    template <typename F>
+    void for_each_rhs_record(F f) {
+        if (m_primary_key) {
+            for (auto &entry : m_pk_data) {
+                if (entry.second.weight != 0)
+                    f(entry.first, entry.second.record_id, entry.second.weight);
+            }
+            return;
+        }
+        for (auto &entry : m_data) {
+            const vertex_t *vertex = entry.second.get();
+            for (size_t j = 0; j < vertex->get_RHS_outdegree(); ++j) {
+                W w = vertex->get_rhs_record_weight(j);
+                if (w != 0)
+                    f(entry.first, vertex->get_rhs_record_id(j), w);
+            }
+        }
+    }
 
-        weight_t counter = 0;
+    // row_weight, if set, is multiplied into the weight of every RHS record.
+    W fill_weight(std::shared_ptr<JefastLevel<next_value_t, W> > nextLevel, int nextLevelIndex, const jefastRowWeight_t &row_weight = nullptr)
+    {
+        W counter = 0;
 
         auto table = mp_RHS_Table->get_key_iterator(nextLevelIndex);
 
+        if (m_primary_key) {
+            for (auto &entry : m_pk_data) {
+                pk_record_t &record = entry.second;
+                W w = nextLevel->GetVertexWeight(*(table + record.record_id));
+                if (row_weight && w != 0)
+                    w = weight_mul<W>(w, row_weight(record.record_id));
+                record.weight = w;
+                counter = weight_add<W>(counter, w);
+            }
+            return counter;
+        }
+
+        // iterate though all RHS items in this level
+        auto iter = std::unique_ptr<JefastLevelEnumeratorRHS<next_value_t, W> >(new JefastLevelEnumeratorRHS<next_value_t, W>(this->m_data.begin(), this->m_data.end()));
+
         while (iter->Step())
         {
             // what is the current index I am looking at
@@ -496,29 +736,29 @@ public:
 
             // find the vertex in the next level with that value and pull the weight
             // from that value.
-            auto i = nextLevel->m_data.find(recordValue);
-            if (i == nextLevel->m_data.end())
+            W w = nextLevel->GetVertexWeight(recordValue);
+            if (w == 0)
                 continue;
 
-            weight_t w = i->second->getWeight();
+            if (row_weight)
+                w = weight_mul<W>(w, row_weight(recordId));
             iter->setWeight(w);
-            counter += w;
+            counter = weight_add<W>(counter, w);
         }
 
         return counter;
         //return 0;
     }
 
-    weight_t fill_weight_fork(
-        const std::vector<std::shared_ptr<JefastLevel<next_value_t>>> &nextLevels,
-        const std::vector<int> &nextLevelIndexes) {
+    // same as fill_weight() for any number of child levels.  With no child
+    // levels the weight of a record is its row weight.
+    W fill_weight_fork(
+        const std::vector<std::shared_ptr<JefastLevel<next_value_t, W>>> &nextLevels,
+        const std::vector<int> &nextLevelIndexes,
+        const jefastRowWeight_t &row_weight = nullptr) {
         assert(nextLevels.size() == nextLevelIndexes.size());
 
-        auto iter =
-            std::make_unique<JefastLevelEnumeratorRHS<next_value_t>>(
-                    m_data.begin(), m_data.end());
-
-        weight_t counter = 0;
+        W counter = 0;
           
         std::vector<std::vector<jfkey_t>::iterator> tables;
         tables.reserve(nextLevels.size());
@@ -527,25 +767,30 @@ public:
                 nextLevelIndexes[i]));
         }
 
-        while (iter->Step()) {
-            jfkey_t recordId = iter->getRecordId();
+        auto record_weight = [&](jfkey_t recordId) -> W {
+            W w = row_weight ? row_weight(recordId) : 1;
+            for (size_t i = 0; i < nextLevels.size() && w != 0; ++i)
+                w = weight_mul<W>(w, nextLevels[i]->GetVertexWeight(tables[i][recordId]));
+            return w;
+        };
 
-            weight_t w = 1;
-            for (size_t i = 0; i < nextLevels.size(); ++i) {
-                jfkey_t recordValue = tables[i][recordId];
+        if (m_primary_key) {
+            for (auto &entry : m_pk_data) {
+                entry.second.weight = record_weight(entry.second.record_id);
+                counter = weight_add<W>(counter, entry.second.weight);
+            }
+            return counter;
+        }
 
-                auto iter2 = nextLevels[i]->m_data.find(recordValue);
-                if (iter2 == nextLevels[i]->m_data.end()) {
-                    w = 0;
-                    break;
-                }
+        auto iter =
+            std::make_unique<JefastLevelEnumeratorRHS<next_value_t, W>>(
+                    m_data.begin(), m_data.end());
 
-                w *= iter2->second->getWeight();
-            }
-            
+        while (iter->Step()) {
+            W w = record_weight(iter->getRecordId());
             if (w == 0) continue;
             iter->setWeight(w);
-            counter += w;
+            counter = weight_add<W>(counter, w);
         }
     
         return counter;
@@ -559,6 +804,20 @@ public:
         // std::cerr << "[optimize] enters in optimize!" << std::endl;
         if (m_optimized)
             throw "already optimized!";
+
+        if (m_primary_key) {
+            // nothing to sort, a key has a single record
+            if_constexpr (purge_zero_weights) {
+                for (auto itr = m_pk_data.begin(); itr != m_pk_data.end();) {
+                    if (itr->second.weight == 0)
+                        itr = m_pk_data.erase(itr);
+                    else
+                        ++itr;
+                }
+            }
+            m_optimized = true;
+            return;
+        }
         
         if (!m_useDefaultVertexWeight) {
             // For those that use default weight (i.e. equal weights
@@ -592,6 +851,8 @@ public:
 
     size_t getMaxOutdegree() {
         size_t max = 0;
+        if (m_primary_key)
+            return m_pk_data.empty() ? 0 : 1;
 
         //max = std::max_element(m_data.begin(), m_data.end(),
         //    [](std::pair<jfkey_t, JefastVertex> &x, std::pair<jfkey_t, JefastVertex> &y)
@@ -608,7 +869,7 @@ public:
         //    return;
 
         struct key_itr_pair {
-            weight_t weight;
+            W weight;
             //internal_map::iterator itr;
             jefastKey_t value;
         };
@@ -618,7 +879,7 @@ public:
 
         auto temp_data_i = temp_data.begin();
         for (auto i = m_data.begin(); i != m_data.end(); ++i, ++temp_data_i) {
-            temp_data_i->weight = i->second->getWeight() * i->second->get_LHS_outdegree();
+            temp_data_i->weight = weight_mul<W>(i->second->getWeight(), i->second->get_LHS_outdegree());
             temp_data_i->value = i->first;
         }
 
@@ -629,13 +890,13 @@ public:
         {
             m_searchWeights.resize(temp_data.size());
             m_indexes.resize(temp_data.size());
-            weight_t sum = 0;
+            W sum = 0;
             auto weights_i = m_searchWeights.begin();
             auto indexes_i = m_indexes.begin();
             for (auto i = temp_data.begin(); i != temp_data.end(); ++i, ++weights_i, ++indexes_i) {
                 *weights_i = sum;
                 *indexes_i = i->value;
-                sum += i->weight;
+                sum = weight_add<W>(sum, i->weight);
             }
         }
     }
@@ -648,27 +909,39 @@ public:
         std::cout.flush();
     }
 
-    void update_search_weight(jefastKey_t key, weight_t new_weight) {
-        auto index = std::find(m_indexes.begin(), m_indexes.end(), key);
-        if (index + 1 == m_indexes.end())
-            return;
+private:
+    // pick the RHS record of vertex for inout_weight and start loading the
+    // child vertexes it links to, since they are read next.
+    const link_t *select_record(vertex_t *vertex, W &inout_weight, jfkey_t &out_key, W *record_weight) {
+        size_t index = vertex->find_rhs_record(inout_weight);
+        out_key = vertex->get_rhs_record_id(index);
+        if (record_weight) (*record_weight) = vertex->get_rhs_record_weight(index);
+
+        const link_t *links = vertex->get_rhs_child_links(index, m_linked_children);
+        if (links) {
+            for (size_t c = 0; c < m_linked_children; ++c)
+                prefetch_for_read(links[c].vertex ? (const void *) links[c].vertex : (const void *) links[c].pk);
+        }
+        return links;
+    }
 
-        weight_t current_weight = *(index + 1) - *index;
-        weight_t weight_adjust = current_weight - new_weight;
+    // true if we don't allow for new vertexes
+    bool m_optimized;
 
-        auto i_val = index - m_indexes.begin();
+    // see set_LHS_row_weighted()
+    bool m_LHS_row_weighted;
 
-        std::transform(m_searchWeights.begin() + i_val
-            , m_searchWeights.end()
-            , m_searchWeights.begin() + i_val
-            , [weight_adjust](weight_t t) {return t + weight_adjust;});
-    }
+    // see set_primary_key()
+    bool m_primary_key;
 
-private:
+    // the number of child links per RHS record, 0 if not linked
+    size_t m_linked_children;
 
+    // see pack_records()
+    bool m_packed;
 
-    // true if we don't allow for new vertexes
-    bool m_optimized;
+    // see set_shared()
+    bool m_shared;
 
     bool m_NewVertexLocked;
     bool m_useDefaultVertexWeight;
@@ -679,7 +952,7 @@ private:
     int m_LHS_Table_index;
     int m_RHS_Table_index;
 
-    std::vector<weight_t> m_searchWeights;
+    std::vector<W> m_searchWeights;
     //std::vector<std::map<jfkey_t, JefastVertex>::iterator> m_indexes;
     std::vector<jfkey_t> m_indexes;
 
@@ -687,8 +960,17 @@ private:
     std::vector<std::shared_ptr<jefastFilter> > m_LHS_filters;
     std::vector<std::shared_ptr<jefastFilter> > m_RHS_filters;
 
-    internal_map m_data;
+    map_t m_data;
+    // replaces m_data in a primary key level
+    pk_map_t m_pk_data;
+
+    // the dividers of the vertexes of m_data, empty unless the level
+    // divides by its vertex weights (see prepare_division())
+    std::vector<jefastWeightDividerT<W> > m_dividers;
 
     friend class jefastBuilderWJoinAttribSelection;
     friend class jefastBuilderWNonJoinAttribSelection;
+    friend class JefastRangeEnumerator;
+    template <typename> friend class jefastIndexLinearT;
+    template <typename> friend class jefastIndexForkT;
 };
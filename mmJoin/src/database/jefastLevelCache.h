@@ -0,0 +1,74 @@
+// A cache of weighted jefast levels shared between indexes.
+//
+// The content of a level only depends on its two tables, their join columns
+// and the subtree of the join below it, so queries which share a join suffix
+// can share those levels by shared_ptr instead of rebuilding them.  The
+// builder describes each level by a signature string (see
+// JefastBuilder::SetLevelCache()) and only builds the levels it can't find.
+//
+// The cache is not thread safe.  Levels are only read once they are cached:
+// Insert() marks them shared (see JefastLevel::set_shared()), and Insert()
+// and Delete() of an index with a shared level throw.
+#pragma once
+
+#include <string>
+#include <memory>
+#include <unordered_map>
+#include <cstdint>
+
+#include "Table.h"
+#include "jefastLevel.h"
+
+class JefastLevelCache {
+public:
+    template <typename W = weight_t>
+    using level_ptr = std::shared_ptr<JefastLevel<jfkey_t, W> >;
+
+    // returns nullptr if there is no level with this signature and weight
+    // type.  A level is only shared with indexes of its own weight type
+    // (see JefastBuilder::Build()).
+    template <typename W = weight_t>
+    level_ptr<W> Find(const std::string &signature) {
+        auto search = m_levels.find(weight_signature<W>(signature));
+        if (search == m_levels.end())
+            return nullptr;
+        ++m_hits;
+        return std::static_pointer_cast<JefastLevel<jfkey_t, W> >(search->second);
+    }
+
+    template <typename W>
+    void Insert(const std::string &signature, level_ptr<W> level) {
+        level->set_shared();
+        m_levels.emplace(weight_signature<W>(signature), std::move(level));
+    }
+
+    size_t size() const {
+        return m_levels.size();
+    }
+
+    // the number of levels reused so far
+    size_t GetHits() const {
+        return m_hits;
+    }
+
+    void clear() {
+        m_levels.clear();
+    }
+
+    // identifies a join column.  Cached levels hold a shared_ptr to both of
+    // their tables, so the address of a table can't be reused while it is
+    // part of a signature in the cache.
+    static std::string column_signature(const std::shared_ptr<Table> &table, int column) {
+        return std::to_string((uintptr_t) table.get()) + ":" + std::to_string(column);
+    }
+
+private:
+    template <typename W>
+    static std::string weight_signature(const std::string &signature) {
+        return std::to_string(sizeof(W) * 8) + "/" + signature;
+    }
+
+    // the levels of every weight type, see weight_signature()
+    std::unordered_map<std::string, std::shared_ptr<void> > m_levels;
+    size_t m_hits = 0;
+};
@@ -0,0 +1,108 @@
+// A frozen, bit packed list of record ids.
+//
+// The ids are split into blocks of 128.  Each block stores its smallest id
+// (the frame of reference) and the number of bits needed for the largest
+// difference to it, and every id of the block is stored as that difference
+// in exactly that many bits.  The block headers double as the skip array, so
+// reading the i-th id touches one header and at most two words and does not
+// decode the rest of its block.  Record ids of a vertex are usually close to
+// each other (the tables are scanned in order), which makes the differences
+// small.
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "DatabaseSharedTypes.h"
+
+class jefastPackedIds {
+public:
+    static constexpr size_t block_size = 128;
+
+    jefastPackedIds()
+        : m_size{ 0 }
+    {}
+
+    explicit jefastPackedIds(const std::vector<jfkey_t> &ids)
+        : m_size{ ids.size() }
+    {
+        m_blocks.reserve((ids.size() + block_size - 1) / block_size);
+        uint64_t bit = 0;
+        for (size_t start = 0; start < ids.size(); start += block_size) {
+            size_t end = std::min(ids.size(), start + block_size);
+            auto minmax = std::minmax_element(ids.begin() + start, ids.begin() + end);
+
+            block_t block;
+            block.base = *minmax.first;
+            block.bits = bits_for((uint64_t) (*minmax.second - *minmax.first));
+            block.bit_offset = bit;
+            m_blocks.push_back(block);
+            bit += (uint64_t) block.bits * (end - start);
+        }
+
+        // one extra word, so a read never has to check for the last word
+        m_words.resize(bit / 64 + 2, 0);
+        for (size_t i = 0; i < ids.size(); ++i) {
+            const block_t &block = m_blocks[i / block_size];
+            write_bits(block.bit_offset + (i % block_size) * block.bits, block.bits, (uint64_t) (ids[i] - block.base));
+        }
+    }
+
+    size_t size() const {
+        return m_size;
+    }
+
+    jfkey_t operator[](size_t i) const {
+        const block_t &block = m_blocks[i / block_size];
+        return block.base + (jfkey_t) read_bits(block.bit_offset + (i % block_size) * block.bits, block.bits);
+    }
+
+    // bytes used by the packed ids
+    size_t memory() const {
+        return m_blocks.size() * sizeof(block_t) + m_words.size() * sizeof(uint64_t);
+    }
+
+private:
+    struct block_t {
+        jfkey_t base;
+        uint64_t bit_offset : 56;
+        uint64_t bits : 8;
+    };
+
+    static unsigned bits_for(uint64_t value) {
+        unsigned bits = 0;
+        while (bits < 64 && (value >> bits) != 0)
+            ++bits;
+        return bits;
+    }
+
+    static uint64_t mask(unsigned bits) {
+        return bits == 64 ? ~uint64_t(0) : (uint64_t(1) << bits) - 1;
+    }
+
+    uint64_t read_bits(uint64_t bit, unsigned bits) const {
+        if (bits == 0)
+            return 0;
+        size_t word = bit / 64;
+        unsigned shift = bit % 64;
+        uint64_t value = m_words[word] >> shift;
+        if (shift + bits > 64)
+            value |= m_words[word + 1] << (64 - shift);
+        return value & mask(bits);
+    }
+
+    void write_bits(uint64_t bit, unsigned bits, uint64_t value) {
+        if (bits == 0)
+            return;
+        size_t word = bit / 64;
+        unsigned shift = bit % 64;
+        m_words[word] |= value << shift;
+        if (shift + bits > 64)
+            m_words[word + 1] |= value >> (64 - shift);
+    }
+
+    std::vector<block_t> m_blocks;
+    std::vector<uint64_t> m_words;
+    size_t m_size;
+};
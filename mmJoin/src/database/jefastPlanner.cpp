@@ -0,0 +1,269 @@
+// Implements the join tree planner for the jefast index
+
+#include "jefastPlanner.h"
+#include "jefastLevel.h"
+#include "jefastVertex.h"
+
+#include <algorithm>
+#include <limits>
+#include <queue>
+#include <set>
+#include <unordered_set>
+
+JefastPlanner::JefastPlanner()
+    : m_planned{ false }
+    , m_root{ -1 }
+{
+}
+
+int JefastPlanner::AddTable(std::shared_ptr<Table> table)
+{
+    m_tables.push_back(table);
+    m_planned = false;
+    return int(m_tables.size()) - 1;
+}
+
+int JefastPlanner::AddJoinPredicate(int table1, int column1, int table2, int column2)
+{
+    if (table1 < 0 || table1 >= int(m_tables.size()) || table2 < 0 || table2 >= int(m_tables.size()))
+        return -1;
+
+    m_predicates_lhs.push_back({ table1, column1 });
+    m_predicates_rhs.push_back({ table2, column2 });
+    m_planned = false;
+    return int(m_predicates_lhs.size()) - 1;
+}
+
+int JefastPlanner::column_node(int table, int column)
+{
+    auto search = m_column_nodes.find({ table, column });
+    if (search != m_column_nodes.end())
+        return search->second;
+
+    int node = int(m_node_columns.size());
+    m_column_nodes.emplace(std::make_pair(table, column), node);
+    m_node_columns.push_back({ table, column });
+    m_class_parent.push_back(node);
+    return node;
+}
+
+int JefastPlanner::find_class(int node)
+{
+    while (m_class_parent[node] != node) {
+        m_class_parent[node] = m_class_parent[m_class_parent[node]];
+        node = m_class_parent[node];
+    }
+    return node;
+}
+
+size_t JefastPlanner::distinct_values(int table, int column)
+{
+    auto search = m_distinct.find({ table, column });
+    if (search != m_distinct.end())
+        return search->second;
+
+    int64_t row_count = m_tables[table]->row_count();
+    auto column_itr = m_tables[table]->get_key_iterator(column);
+    std::unordered_set<jfkey_t> values(column_itr, column_itr + row_count);
+    m_distinct.emplace(std::make_pair(table, column), values.size());
+    return values.size();
+}
+
+bool JefastPlanner::Plan()
+{
+    m_planned = false;
+    const int tables = int(m_tables.size());
+    if (tables == 0)
+        return false;
+
+    // join attributes are the equivalence classes of the join columns
+    m_column_nodes.clear();
+    m_node_columns.clear();
+    m_class_parent.clear();
+    for (size_t i = 0; i < m_predicates_lhs.size(); ++i) {
+        int a = find_class(column_node(m_predicates_lhs[i].table, m_predicates_lhs[i].column));
+        int b = find_class(column_node(m_predicates_rhs[i].table, m_predicates_rhs[i].column));
+        m_class_parent[a] = b;
+    }
+
+    // the column of each table in each join attribute
+    std::vector<std::map<int, int> > table_classes(tables);
+    std::map<int, std::set<int> > class_tables;
+    for (size_t node = 0; node < m_node_columns.size(); ++node) {
+        int c = find_class(int(node));
+        const column_t &col = m_node_columns[node];
+        table_classes[col.table].emplace(c, col.column);
+        class_tables[c].insert(col.table);
+    }
+
+    // GYO reduction.  An ear is a table whose join attributes shared with
+    // the remaining tables are all in one other table, its parent in the
+    // join tree.  The query is acyclic iff we can remove ears until a
+    // single table is left.
+    m_tree.assign(tables, std::vector<tree_edge_t>());
+    std::vector<bool> alive(tables, true);
+    for (int remaining = tables; remaining > 1; --remaining) {
+        bool found_ear = false;
+        for (int e = 0; e < tables && !found_ear; ++e) {
+            if (!alive[e])
+                continue;
+
+            std::vector<int> shared;
+            for (auto &tc : table_classes[e]) {
+                for (int other : class_tables[tc.first]) {
+                    if (other != e && alive[other]) {
+                        shared.push_back(tc.first);
+                        break;
+                    }
+                }
+            }
+            // not connected to the rest of the join
+            if (shared.empty())
+                return false;
+
+            for (int w = 0; w < tables && !found_ear; ++w) {
+                if (w == e || !alive[w])
+                    continue;
+                bool covers = std::all_of(shared.begin(), shared.end(), [&](int c) {
+                    return table_classes[w].count(c) > 0;
+                });
+                if (!covers)
+                    continue;
+
+                // the builder joins two tables on a single column
+                if (shared.size() > 1)
+                    return false;
+
+                int c = shared.front();
+                m_tree[e].push_back({ w, table_classes[e][c], table_classes[w][c] });
+                m_tree[w].push_back({ e, table_classes[w][c], table_classes[e][c] });
+                alive[e] = false;
+                found_ear = true;
+            }
+        }
+        if (!found_ear)
+            return false;
+    }
+
+    // pick the root with the smallest index
+    double best = std::numeric_limits<double>::max();
+    for (int root = 0; root < tables; ++root) {
+        double memory = EstimateIndexMemory(root);
+        if (memory < best) {
+            best = memory;
+            m_root = root;
+        }
+    }
+
+    orient(m_root, m_order, m_parent, m_parent_edge);
+    m_table_numbers.assign(tables, -1);
+    for (size_t i = 0; i < m_order.size(); ++i)
+        m_table_numbers[m_order[i]] = int(i);
+
+    m_planned = true;
+    return true;
+}
+
+// breadth first order of the join tree rooted at root, so every parent comes
+// before its children.
+void JefastPlanner::orient(int root, std::vector<int> &order, std::vector<int> &parent, std::vector<int> &parent_edge)
+{
+    order.clear();
+    parent.assign(m_tables.size(), -1);
+    parent_edge.assign(m_tables.size(), -1);
+
+    std::queue<int> work;
+    work.push(root);
+    while (!work.empty()) {
+        int t = work.front();
+        work.pop();
+        order.push_back(t);
+        for (size_t i = 0; i < m_tree[t].size(); ++i) {
+            int child = m_tree[t][i].other_table;
+            if (child == root || parent[child] != -1)
+                continue;
+            parent[child] = t;
+            // find the same edge seen from the child
+            for (size_t j = 0; j < m_tree[child].size(); ++j) {
+                if (m_tree[child][j].other_table == t)
+                    parent_edge[child] = int(j);
+            }
+            work.push(child);
+        }
+    }
+}
+
+// Follows what BuildFork() stores: every row of a non-root table is a RHS
+// record of its level, with a weight unless the table is a leaf (which uses
+// default weights), and every distinct join value is a vertex.  The root
+// rows go into the virtual level if the root has several children, or are
+// the LHS records of the first level with its search weights otherwise.
+// A table whose join column with its parent is unique gets a primary key
+// level (see Configure()) unless it is the start level.
+double JefastPlanner::EstimateIndexMemory(int root)
+{
+    const double vertex_bytes = sizeof(JefastVertex) + sizeof(map_pair_t) + 4 * sizeof(void*);
+
+    std::vector<int> order, parent, parent_edge;
+    orient(root, order, parent, parent_edge);
+
+    std::vector<int> children(m_tables.size(), 0);
+    for (int t : order) {
+        if (t != root)
+            ++children[parent[t]];
+    }
+
+    double memory = 0;
+    for (int t : order) {
+        double rows = (double) m_tables[t]->row_count();
+        if (t == root) {
+            if (children[t] > 1 || children[t] == 0)
+                memory += rows * (sizeof(jfkey_t) + (children[t] ? sizeof(weight_t) : 0)) + vertex_bytes;
+            else
+                memory += rows * sizeof(jfkey_t);
+            continue;
+        }
+
+        const tree_edge_t &edge = m_tree[t][parent_edge[t]];
+        double vertexes = (double) distinct_values(t, edge.my_column);
+        bool start_level = parent[t] == root && children[root] == 1;
+        if (vertexes == rows && !start_level) {
+            memory += rows * (sizeof(jfkey_t) + sizeof(jefastPKRecord) + 2 * sizeof(void*));
+            continue;
+        }
+        memory += rows * (sizeof(jfkey_t) + (children[t] ? sizeof(weight_t) : 0));
+        memory += vertexes * vertex_bytes;
+        if (start_level) {
+            // m_searchWeights and m_indexes of build_starting()
+            memory += vertexes * (sizeof(weight_t) + sizeof(jfkey_t));
+        }
+    }
+    return memory;
+}
+
+bool JefastPlanner::Configure(JefastBuilder &builder)
+{
+    if (!m_planned && !Plan())
+        return false;
+
+    for (int t : m_order) {
+        if (t == m_root) {
+            builder.AddTableToFork(m_tables[t], -1, -1, -1);
+            continue;
+        }
+        const tree_edge_t &edge = m_tree[t][m_parent_edge[t]];
+        int table_number = builder.AddTableToFork(m_tables[t], edge.my_column, edge.other_column, m_table_numbers[m_parent[t]]);
+        // the distinct counts are already known from planning
+        if (distinct_values(t, edge.my_column) == (size_t) m_tables[t]->row_count())
+            builder.SetPrimaryKey(table_number);
+    }
+    return true;
+}
+
+std::shared_ptr<jefastIndexFork> JefastPlanner::Build()
+{
+    JefastBuilder builder;
+    if (!Configure(builder))
+        return nullptr;
+    return builder.BuildFork();
+}
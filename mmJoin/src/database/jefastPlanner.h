@@ -0,0 +1,98 @@
+// Plans the join tree of an acyclic equi-join and configures a JefastBuilder.
+//
+// The drivers pick the join order and the root by hand through
+// AppendTable()/AddTableToFork().  The planner takes the tables and the join
+// predicates instead, finds a join tree with a GYO reduction (repeatedly
+// removing an ear, i.e. a table whose join columns are all covered by one
+// other table) and then roots that tree at the table which gives the
+// smallest estimated index.
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <map>
+
+#include "Table.h"
+#include "jefastBuilder.h"
+#include "jefastIndex.h"
+
+class JefastPlanner {
+public:
+    JefastPlanner();
+
+    // Returns the table id, which starts from 0.
+    int AddTable(std::shared_ptr<Table> table);
+
+    // Adds the predicate table1.column1 = table2.column2.
+    // Returns the predicate number, which starts from 0.  Or returns -1
+    // if one of the tables has not been added.
+    int AddJoinPredicate(int table1, int column1, int table2, int column2);
+
+    // Finds the join tree and its root.  Returns false if the join graph is
+    // cyclic, not connected, or two tables join on more than one column
+    // (composite keys are not supported by the builder).
+    bool Plan();
+
+    // The following are only valid after Plan() returned true.
+
+    int GetRoot() const {
+        return m_root;
+    }
+
+    // the table number the builder (and the join results of the index) use
+    // for a table id
+    int GetTableNumber(int table) const {
+        return m_table_numbers.at(table);
+    }
+
+    // estimated size of the index in bytes if the tree is rooted at `root`
+    double EstimateIndexMemory(int root);
+
+    // Adds the tables to an empty `builder` with AddTableToFork() in an
+    // order where every parent comes before its children, and marks the
+    // tables with a unique join column with JefastBuilder::SetPrimaryKey().
+    // Returns false if there is no plan.
+    bool Configure(JefastBuilder &builder);
+
+    // Plan() if needed, then build the index.  Returns nullptr if there is
+    // no plan.
+    std::shared_ptr<jefastIndexFork> Build();
+
+private:
+    struct column_t {
+        int table;
+        int column;
+    };
+
+    // an edge of the join tree, seen from one of its tables
+    struct tree_edge_t {
+        int other_table;
+        int my_column;
+        int other_column;
+    };
+
+    int find_class(int node);
+    int column_node(int table, int column);
+    size_t distinct_values(int table, int column);
+    void orient(int root, std::vector<int> &order, std::vector<int> &parent, std::vector<int> &parent_edge);
+
+    std::vector<std::shared_ptr<Table> > m_tables;
+    std::vector<column_t> m_predicates_lhs;
+    std::vector<column_t> m_predicates_rhs;
+
+    // union-find over the join columns, every class is one join attribute
+    std::map<std::pair<int, int>, int> m_column_nodes;
+    std::vector<column_t> m_node_columns;
+    std::vector<int> m_class_parent;
+
+    // distinct value counts, the degree statistics of the join columns
+    std::map<std::pair<int, int>, size_t> m_distinct;
+
+    std::vector<std::vector<tree_edge_t> > m_tree;
+    bool m_planned;
+    int m_root;
+    std::vector<int> m_order;
+    std::vector<int> m_parent;
+    std::vector<int> m_parent_edge;
+    std::vector<int> m_table_numbers;
+};
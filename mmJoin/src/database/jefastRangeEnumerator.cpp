@@ -0,0 +1,213 @@
+// Implements the range enumerator for the jefast index
+
+#include "jefastRangeEnumerator.h"
+
+#include <cassert>
+#include <stdexcept>
+
+// the enumerator walks the levels of an index with weight_t weights.  An
+// index only has wide weights if its join is far too large to enumerate.
+template <typename Index, typename Base>
+static Index &narrow_index(Base &index)
+{
+    Index *narrow = dynamic_cast<Index *>(&index);
+    if (narrow == nullptr)
+        throw std::overflow_error("JefastRangeEnumerator does not support an index with wide weights");
+    return *narrow;
+}
+
+JefastRangeEnumerator::JefastRangeEnumerator(jefastIndexLinear &base)
+    : m_start_pos{ 0 }
+    , m_start_lhs{ 0 }
+{
+    auto &index = narrow_index<jefastIndexLinearT<weight_t> >(base);
+    m_start_level = index.m_levels.front().get();
+    m_total = index.GetTotal();
+
+    // table i is the RHS of level i - 1, table 0 is the LHS of level 0
+    size_t tables = index.m_levels.size() + 1;
+    m_nodes.resize(tables);
+    m_nodes[0].level = nullptr;
+    m_nodes[0].table = index.m_levels[0]->get_LHS_Table().get();
+    for (size_t t = 1; t < tables; ++t) {
+        m_nodes[t].level = index.m_levels[t - 1].get();
+        m_nodes[t].table = index.m_levels[t - 1]->get_RHS_Table().get();
+        if (t + 1 < tables)
+            m_nodes[t].children.push_back((int) t + 1);
+    }
+    m_out.resize(index.GetNumberOfLevels());
+}
+
+JefastRangeEnumerator::JefastRangeEnumerator(jefastIndexFork &base)
+    : m_start_level{ nullptr }
+    , m_start_pos{ 0 }
+    , m_start_lhs{ 0 }
+{
+    auto &index = narrow_index<jefastIndexForkT<weight_t> >(base);
+    m_total = index.GetTotal();
+
+    size_t tables = index.m_levels.size();
+    m_nodes.resize(tables);
+    for (size_t t = 1; t < tables; ++t) {
+        m_nodes[t].level = index.m_levels[t].get();
+        m_nodes[t].table = index.m_levels[t]->get_RHS_Table().get();
+        m_nodes[index.m_parent_tables[t]].children.push_back((int) t);
+    }
+
+    if (index.m_levels[0].get()) {
+        // the first table is the RHS of the virtual level
+        m_nodes[0].level = index.m_levels[0].get();
+        m_nodes[0].table = index.m_levels[0]->get_RHS_Table().get();
+    }
+    else {
+        m_start_level = index.m_levels[1].get();
+        m_nodes[0].level = nullptr;
+        m_nodes[0].table = index.m_levels[1]->get_LHS_Table().get();
+    }
+    m_out.resize(index.GetNumberOfLevels());
+}
+
+void JefastRangeEnumerator::find_child(int parent, int child)
+{
+    node_t &n = m_nodes[child];
+    jfkey_t value = m_nodes[parent].table->get_int64(m_out[parent], n.level->get_LHS_table_index());
+    if (n.level->is_primary_key()) {
+        n.pk = &n.level->m_pk_data.find(value)->second;
+        return;
+    }
+    // we only read the index, so we don't need to touch the shared_ptr count
+    n.vertex = n.level->m_data.find(value)->second.get();
+}
+
+void JefastRangeEnumerator::Seek(weight_t joinNumber)
+{
+    assert(joinNumber < m_total);
+
+    if (m_start_level == nullptr) {
+        m_nodes[0].vertex = m_nodes[0].level->m_data.find(virtual_key)->second.get();
+        seek_node(0, joinNumber);
+        return;
+    }
+
+    // the same search as JefastLevel::GetStartPairStep()
+    auto &search_weights = m_start_level->m_searchWeights;
+    auto w_itr = std::upper_bound(search_weights.begin(), search_weights.end(), joinNumber);
+    --w_itr;
+    m_start_pos = w_itr - search_weights.begin();
+    joinNumber -= *w_itr;
+
+    JefastVertex *vertex = m_start_level->m_data.find(m_start_level->m_indexes[m_start_pos])->second.get();
+    m_start_lhs = (size_t) (joinNumber / vertex->getWeight());
+    joinNumber -= m_start_lhs * vertex->getWeight();
+    m_out[0] = vertex->get_lhs_record_id(m_start_lhs);
+
+    m_nodes[1].vertex = vertex;
+    seek_node(1, joinNumber);
+}
+
+void JefastRangeEnumerator::seek_node(int t, weight_t weight)
+{
+    node_t &n = m_nodes[t];
+    if (n.pk) {
+        // the single record takes the whole weight
+        n.record = 0;
+        m_out[t] = n.pk->record_id;
+    }
+    else {
+        n.record = n.vertex->find_rhs_record(weight);
+        m_out[t] = n.vertex->get_rhs_record_id(n.record);
+    }
+
+    for (int c : n.children) {
+        find_child(t, c);
+        if (c != n.children.back()) {
+            // same as JefastLevel::GetNextStepThroughFork()
+            weight_t tot_weight = m_nodes[c].weight();
+            seek_node(c, weight % tot_weight);
+            weight /= tot_weight;
+        }
+        else {
+            // drop the copy number of a row weighted record (see
+            // JefastLevel::set_LHS_row_weighted())
+            if (m_nodes[c].level->is_LHS_row_weighted())
+                weight %= m_nodes[c].weight();
+            seek_node(c, weight);
+        }
+    }
+}
+
+// move every table below t to its first record, given the record of t.
+void JefastRangeEnumerator::descend(int t)
+{
+    for (int c : m_nodes[t].children) {
+        find_child(t, c);
+        reset_node(c);
+    }
+}
+
+void JefastRangeEnumerator::reset_node(int t)
+{
+    node_t &n = m_nodes[t];
+    n.record = 0;
+    m_out[t] = n.pk ? n.pk->record_id : n.vertex->get_rhs_record_id(0);
+    descend(t);
+}
+
+// returns false if the subtree of t wrapped around.  In that case the subtree
+// is left on its last join result and the caller has to reset it.
+bool JefastRangeEnumerator::advance_node(int t)
+{
+    node_t &n = m_nodes[t];
+    for (size_t i = 0; i < n.children.size(); ++i) {
+        if (advance_node(n.children[i])) {
+            // the less significant children wrapped around
+            for (size_t k = 0; k < i; ++k)
+                reset_node(n.children[k]);
+            return true;
+        }
+    }
+
+    if (n.pk)
+        return false;
+
+    // records are sorted by weight, so zero weight records (which are not
+    // purged from the virtual level) can only be at the end.
+    size_t next = n.record + 1;
+    if (next < n.vertex->get_RHS_outdegree() && n.vertex->get_rhs_record_weight(next) != 0) {
+        n.record = next;
+        m_out[t] = n.vertex->get_rhs_record_id(next);
+        descend(t);
+        return true;
+    }
+    return false;
+}
+
+bool JefastRangeEnumerator::Step()
+{
+    if (m_start_level == nullptr)
+        return advance_node(0);
+
+    if (advance_node(1))
+        return true;
+
+    JefastVertex *vertex = m_nodes[1].vertex;
+    if (++m_start_lhs < vertex->get_LHS_outdegree()) {
+        m_out[0] = vertex->get_lhs_record_id(m_start_lhs);
+        reset_node(1);
+        return true;
+    }
+
+    // move on to the next starting vertex (vertexes without any join result
+    // are sorted to the end)
+    if (++m_start_pos >= m_start_level->m_indexes.size())
+        return false;
+    vertex = m_start_level->m_data.find(m_start_level->m_indexes[m_start_pos])->second.get();
+    if (vertex->getWeight() * vertex->get_LHS_outdegree() == 0)
+        return false;
+
+    m_start_lhs = 0;
+    m_out[0] = vertex->get_lhs_record_id(0);
+    m_nodes[1].vertex = vertex;
+    reset_node(1);
+    return true;
+}
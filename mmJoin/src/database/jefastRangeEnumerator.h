@@ -0,0 +1,132 @@
+// Enumerates the join results of a jefast index in join number order.
+//
+// GetJoinNumber() walks from the root of the index for every join number.
+// The range enumerator only does that walk once (Seek()) and then steps to the
+// next join number like an odometer: the record list of the deepest vertex is
+// advanced first, and only when it runs out do we carry into the parent and
+// look up new vertices for the subtree below it.  The join number space can
+// therefore be split into ranges which are enumerated independently (see
+// EnumerateJoinParallel()).
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <thread>
+#include <algorithm>
+
+#include "DatabaseSharedTypes.h"
+#include "jefastIndex.h"
+#include "jefastLevel.h"
+#include "jefastVertex.h"
+
+class JefastRangeEnumerator {
+public:
+    // throws std::overflow_error if the index has wide weights (see
+    // JefastBuilder::Build())
+    JefastRangeEnumerator(jefastIndexLinear &index);
+    JefastRangeEnumerator(jefastIndexFork &index);
+
+    weight_t GetTotal() {
+        return m_total;
+    }
+
+    // the size of the vector returned by getRecord(), which matches
+    // GetNumberOfLevels() of the index.
+    int GetNumberOfLevels() {
+        return (int) m_out.size();
+    }
+
+    // position the enumerator on the join result GetJoinNumber(joinNumber)
+    // would report.  joinNumber must be less than GetTotal().
+    void Seek(weight_t joinNumber);
+
+    // move to the next join number.  Returns false if we were on the last
+    // join result.
+    bool Step();
+
+    // the record ids of the current join result
+    const std::vector<int64_t> &getRecord() const {
+        return m_out;
+    }
+
+private:
+    struct node_t {
+        // the level which stores the records of this table on its RHS
+        JefastLevel<jfkey_t> *level;
+        // this table, used to find the vertexes of the child tables
+        Table *table;
+        // child tables, the first child is the least significant
+        std::vector<int> children;
+
+        // the vertex of the current record, or its only record if the
+        // level is a primary key level
+        JefastVertex *vertex;
+        const jefastPKRecord *pk;
+        size_t record;
+
+        weight_t weight() const {
+            return pk ? pk->weight : vertex->getWeight();
+        }
+    };
+
+    void seek_node(int t, weight_t weight);
+    bool advance_node(int t);
+    void reset_node(int t);
+    void descend(int t);
+
+    // look up the vertex (or primary key record) of child for the current
+    // record of parent
+    void find_child(int parent, int child);
+
+    // the level the first two tables are selected from (see
+    // JefastLevel::GetStartPairStep()), or nullptr if the first table is
+    // the RHS of a virtual level.
+    JefastLevel<jfkey_t> *m_start_level;
+    size_t m_start_pos;
+    size_t m_start_lhs;
+
+    std::vector<node_t> m_nodes;
+    std::vector<int64_t> m_out;
+    weight_t m_total;
+};
+
+// Enumerate all join results of `index` using `threads` threads.  The join
+// number range [0, GetTotal()) is split into one contiguous range per thread.
+// The index must not have row weights (JefastBuilder::SetRowWeight()), since
+// Step() visits every join result once whatever its weight.
+// visit(thread_id, record) is called once for every join result, where record
+// is the vector reported by GetJoinNumber().  Calls from one thread are in
+// join number order.
+template <typename Index, typename Visitor>
+void EnumerateJoinParallel(Index &index, int threads, Visitor visit)
+{
+    weight_t total = index.GetTotal();
+    if (threads < 1)
+        threads = 1;
+
+    weight_t chunk = total / threads;
+    weight_t extra = total % threads;
+
+    auto worker = [&index, &visit](int thread_id, weight_t begin, weight_t end) {
+        if (begin >= end)
+            return;
+        JefastRangeEnumerator enumerator(index);
+        enumerator.Seek(begin);
+        for (weight_t i = begin; i < end; ++i) {
+            visit(thread_id, enumerator.getRecord());
+            if (i + 1 < end)
+                enumerator.Step();
+        }
+    };
+
+    std::vector<std::thread> thread_list;
+    weight_t begin = 0;
+    for (int t = 0; t < threads; ++t) {
+        weight_t end = begin + chunk + (weight_t(t) < extra ? 1 : 0);
+        thread_list.emplace_back(worker, t, begin, end);
+        begin = end;
+    }
+
+    for (auto &t : thread_list)
+        t.join();
+}
@@ -0,0 +1,83 @@
+// Implements the stratified jefast index
+
+#include "jefastStratifiedIndex.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+int jefastStratifiedIndex::GetStratum(int64_t key) const
+{
+    auto itr = std::lower_bound(m_keys.begin(), m_keys.end(), key);
+    if (itr == m_keys.end() || *itr != key)
+        return -1;
+    return int(itr - m_keys.begin());
+}
+
+weight_t jefastStratifiedIndex::GetTotal() const
+{
+    weight_t total = 0;
+    for (auto &index : m_indexes)
+        total += index->GetTotal();
+    return total;
+}
+
+void jefastStratifiedIndex::GetRandomJoins(size_t stratum, size_t count, std::vector<std::vector<int64_t> > &out)
+{
+    auto &index = m_indexes.at(stratum);
+    if (index->GetWideTotal() == 0)
+        count = 0;
+
+    out.resize(count);
+    for (size_t i = 0; i < count; ++i)
+        index->GetRandomJoin(out[i]);
+}
+
+void jefastStratifiedIndex::Sample(const std::vector<size_t> &allocation, std::vector<std::vector<std::vector<int64_t> > > &out)
+{
+    out.resize(m_indexes.size());
+    for (size_t h = 0; h < m_indexes.size(); ++h)
+        GetRandomJoins(h, h < allocation.size() ? allocation[h] : 0, out[h]);
+}
+
+std::vector<size_t> jefastStratifiedIndex::NeymanAllocation(size_t count, const std::vector<double> &stddevs) const
+{
+    std::vector<double> share(m_indexes.size(), 0.0);
+    for (size_t h = 0; h < m_indexes.size() && h < stddevs.size(); ++h)
+        share[h] = (double) m_indexes[h]->GetWideTotal() * stddevs[h];
+
+    std::vector<size_t> allocation(m_indexes.size(), 0);
+    double sum = std::accumulate(share.begin(), share.end(), 0.0);
+    if (!(sum > 0))
+        return allocation;
+
+    // round down, then hand out what is left by the largest remainder
+    std::vector<std::pair<double, size_t> > remainders;
+    size_t assigned = 0;
+    for (size_t h = 0; h < share.size(); ++h) {
+        double exact = (double) count * share[h] / sum;
+        allocation[h] = (size_t) std::floor(exact);
+        assigned += allocation[h];
+        if (share[h] > 0)
+            remainders.emplace_back(exact - std::floor(exact), h);
+    }
+    std::sort(remainders.begin(), remainders.end(), [](const std::pair<double, size_t> &a, const std::pair<double, size_t> &b) {
+        return a.first > b.first;
+    });
+    for (size_t i = 0; assigned < count && !remainders.empty(); ++assigned, ++i)
+        ++allocation[remainders[i % remainders.size()].second];
+
+    return allocation;
+}
+
+std::vector<double> jefastStratifiedIndex::GetStratumStdDev(int tableNumber, const jefastRowValue_t &value) const
+{
+    std::vector<double> stddevs;
+    stddevs.reserve(m_indexes.size());
+    for (auto &index : m_indexes) {
+        double variance = index->ComputeAggregate(tableNumber, value).variance();
+        // guard against rounding below zero
+        stddevs.push_back(variance > 0 ? std::sqrt(variance) : 0.0);
+    }
+    return stddevs;
+}
@@ -0,0 +1,71 @@
+// A jefast index partitioned by a grouping column (stratified sampling).
+//
+// Each stratum has its own index over the join results whose row of the
+// grouping table falls in that stratum, so every group can be sampled
+// directly no matter how small its share of the join is.  Built with
+// JefastBuilder::BuildStratified().
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <functional>
+
+#include "DatabaseSharedTypes.h"
+#include "jefastIndex.h"
+
+// the stratum (group) key of a row id of the grouping table
+typedef std::function<int64_t(int64_t)> jefastRowKey_t;
+
+class jefastStratifiedIndex {
+public:
+    size_t GetNumberOfStrata() const {
+        return m_keys.size();
+    }
+
+    // strata are numbered in increasing order of their key
+    int64_t GetStratumKey(size_t stratum) const {
+        return m_keys.at(stratum);
+    }
+
+    // returns the stratum with this key, or -1 if there is none
+    int GetStratum(int64_t key) const;
+
+    // the number of join results (or their total row weight) in a stratum
+    weight_t GetStratumTotal(size_t stratum) const {
+        return m_indexes.at(stratum)->GetTotal();
+    }
+
+    weight_t GetTotal() const;
+
+    std::shared_ptr<jefastIndexBase> GetStratumIndex(size_t stratum) const {
+        return m_indexes.at(stratum);
+    }
+
+    // Draw `count` join results of one stratum (with replacement).  Each
+    // out[i] is filled in as by GetJoinNumber().  Nothing is drawn from an
+    // empty stratum.
+    void GetRandomJoins(size_t stratum, size_t count, std::vector<std::vector<int64_t> > &out);
+
+    // Draw allocation[h] join results from stratum h.  out[h] holds the
+    // samples of stratum h.
+    void Sample(const std::vector<size_t> &allocation, std::vector<std::vector<std::vector<int64_t> > > &out);
+
+    // Split `count` samples across the strata proportionally to
+    // total(h) * stddevs[h] (Neyman allocation).  The allocation adds up to
+    // `count` unless no stratum has a positive share.
+    std::vector<size_t> NeymanAllocation(size_t count, const std::vector<double> &stddevs) const;
+
+    // the exact standard deviation of value(row) over the join results of
+    // each stratum (see jefastIndexBase::ComputeAggregate()), for use with
+    // NeymanAllocation().
+    std::vector<double> GetStratumStdDev(int tableNumber, const jefastRowValue_t &value) const;
+
+private:
+    jefastStratifiedIndex()
+    {};
+
+    std::vector<int64_t> m_keys;
+    std::vector<std::shared_ptr<jefastIndexBase> > m_indexes;
+
+    friend class JefastBuilder;
+};
@@ -4,16 +4,20 @@
 #pragma once
 
 #include <vector>
+#include <cstdint>
 #include <assert.h>
 #include <memory>
 #include <iterator>
 #include <algorithm>
 #include <iostream>
 #include "DatabaseSharedTypes.h"
+#include "jefastPackedIds.h"
+#include "jefastDivider.h"
 
-class JefastVertexEnumerator {
+template <typename W>
+class JefastVertexEnumeratorT {
 public:
-    virtual ~JefastVertexEnumerator()
+    virtual ~JefastVertexEnumeratorT()
     {};
 
     // return true if we make a step
@@ -26,44 +30,68 @@ public:
     virtual int64_t getRecordId() = 0;
 
     // set the weight of the record currently being observed
-    virtual void setWeight(weight_t w) = 0;
-    virtual weight_t getWeight() = 0;
+    virtual void setWeight(W w) = 0;
+    virtual W getWeight() = 0;
 };
+typedef JefastVertexEnumeratorT<weight_t> JefastVertexEnumerator;
 
 
-class JefastVertex
+template <typename W>
+class JefastVertexT;
+template <typename W>
+struct jefastPKRecordT;
+
+// the vertex (or, in a primary key level, the record) a RHS record joins
+// with in a child level.  See JefastLevel::link_children().
+template <typename W>
+struct jefastChildLinkT {
+    JefastVertexT<W> *vertex;
+    const jefastPKRecordT<W> *pk;
+};
+typedef jefastChildLinkT<weight_t> jefastChildLink;
+
+// W is the weight type (see JefastBuilder::Build())
+template <typename W>
+class JefastVertexT
 {
 public:
-    JefastVertex()
+    JefastVertexT()
         : m_weight{ 0 }
-        , mp_matching_rhs_record_weight{ new std::vector<weight_t> }
+        , mp_matching_rhs_record_weight{ new std::vector<W> }
+        , m_divider_slot{ no_divider }
     {  
         /* no other setup needed */  
     }
 
-    ~JefastVertex()
+    ~JefastVertexT()
     {};
     
-    JefastVertex(const JefastVertex& other){
+    JefastVertexT(const JefastVertexT& other){
         this->m_weight = other.m_weight;
         this->m_matching_lhs_record_ids = other.m_matching_lhs_record_ids;
         this->m_matching_rhs_record_ids = other.m_matching_rhs_record_ids;
+        this->m_rhs_child_links = other.m_rhs_child_links;
+        // the slot belongs to the divider table of the other vertex's level
+        this->m_divider_slot = no_divider;
+        if (other.mp_packed != nullptr)
+            mp_packed.reset(new packed_records_t(*other.mp_packed));
         if(other.mp_matching_rhs_record_weight != nullptr) {
-            mp_matching_rhs_record_weight.reset(new std::vector<weight_t>(*other.mp_matching_rhs_record_weight));
+            mp_matching_rhs_record_weight.reset(new std::vector<W>(*other.mp_matching_rhs_record_weight));
         }
         std::cout << '.';
     };
 
-    JefastVertex(bool useDefaultWeight)
+    JefastVertexT(bool useDefaultWeight)
         : m_weight{ 0 }
         , mp_matching_rhs_record_weight{ nullptr }
+        , m_divider_slot{ no_divider }
     {
         if (!useDefaultWeight) {
-            mp_matching_rhs_record_weight.reset(new std::vector<weight_t>);
+            mp_matching_rhs_record_weight.reset(new std::vector<W>);
         }
     }
 
-    weight_t getWeight() {
+    W getWeight() {
         if (mp_matching_rhs_record_weight == nullptr)
             return get_RHS_outdegree();
         else
@@ -71,28 +99,81 @@ public:
     }
 
     size_t get_LHS_outdegree() const {
+        if (mp_packed != nullptr)
+            return mp_packed->lhs.size();
         return m_matching_lhs_record_ids.size();
     }
 
     size_t get_RHS_outdegree() const {
+        if (mp_packed != nullptr)
+            return mp_packed->rhs.size();
         return m_matching_rhs_record_ids.size();
     }
 
+    // Replace the record id lists with bit packed copies (see
+    // jefastPackedIds) if they are long enough for that to pay off.
+    // Afterwards the records can only be read.
+    void pack_records(size_t min_records) {
+        if (mp_packed != nullptr || get_LHS_outdegree() + get_RHS_outdegree() < min_records)
+            return;
+        mp_packed.reset(new packed_records_t{ jefastPackedIds(m_matching_lhs_record_ids), jefastPackedIds(m_matching_rhs_record_ids) });
+        std::vector<jfkey_t>().swap(m_matching_lhs_record_ids);
+        std::vector<jfkey_t>().swap(m_matching_rhs_record_ids);
+    }
+
+    bool is_packed() const {
+        return mp_packed != nullptr;
+    }
+
+    static constexpr uint32_t no_divider = UINT32_MAX;
+
+    // The index of the divider of this vertex (see jefastDivider) in the
+    // divider table of its level, which only the levels dividing by their
+    // vertex weights keep (see JefastLevel::prepare_division()).
+    // no_divider if there is none.
+    uint32_t divider_slot() const {
+        return m_divider_slot;
+    }
+
+    void set_divider_slot(uint32_t slot) {
+        m_divider_slot = slot;
+    }
+
+    // inout_n becomes inout_n / getWeight() and out_rem inout_n % getWeight().
+    // Uses the divider of the vertex in `dividers`, the divider table of its
+    // level, if the weight has not changed since it was made, and the
+    // division operators otherwise.
+    void divide_by_weight(W &inout_n, W &out_rem, const std::vector<jefastWeightDividerT<W> > &dividers) {
+        W w = getWeight();
+        if (m_divider_slot < dividers.size() && (W) dividers[m_divider_slot].divisor() == w) {
+            W q = dividers[m_divider_slot].divide(inout_n);
+            out_rem = inout_n - q * w;
+            inout_n = q;
+        } else {
+            out_rem = inout_n % w;
+            inout_n /= w;
+        }
+    }
+
     void insert_lhs_record_ids(jfkey_t record_id) {
+        check_not_packed();
         m_matching_lhs_record_ids.push_back(record_id);
     }
 
     void delete_lhs_record_ids(jfkey_t record_id) {
+        check_not_packed();
         auto itr = std::find(m_matching_lhs_record_ids.begin(), m_matching_lhs_record_ids.end(), record_id);
         if(itr != m_matching_lhs_record_ids.end())
             m_matching_lhs_record_ids.erase(itr);
     }
 
     void insert_rhs_record_ids(jfkey_t record_id) {
+        check_not_packed();
         m_matching_rhs_record_ids.push_back(record_id);
     }
 
-    void adjust_rhs_record_weight(jfkey_t record_id, weight_t weight) {
+    void adjust_rhs_record_weight(jfkey_t record_id, W weight) {
+        check_not_packed();
         // verify the weight vector is the right size
         mp_matching_rhs_record_weight->resize(get_RHS_outdegree());
 
@@ -107,25 +188,27 @@ public:
         // if we get to this point we could not find the element in the vertex.
     }
 
-    weight_t insert_rhs_record_weight_with_sum(jfkey_t record_id, weight_t new_weight) {
-        // insert at the end of the list
+    W insert_rhs_record_weight_with_sum(jfkey_t record_id, W new_weight) {
+        check_not_packed();
+        // insert at the end of the list, the prefix sums start every
+        // record at the weight of the records before it
         m_matching_rhs_record_ids.push_back(record_id);
         if (mp_matching_rhs_record_weight != nullptr) {
-            mp_matching_rhs_record_weight->push_back(new_weight + mp_matching_rhs_record_weight->back());
+            mp_matching_rhs_record_weight->push_back(this->m_weight);
             this->m_weight += new_weight;
         }
 
-        return this->m_weight;
+        return getWeight();
     }
 
     // for delete we will place a tombstone value and mark it with 0 weight.
-    weight_t delete_rhs_record_weight_with_sum(jfkey_t record_id) {
+    W delete_rhs_record_weight_with_sum(jfkey_t record_id) {
+        check_not_packed();
         auto itr = std::find(m_matching_rhs_record_ids.begin(), m_matching_rhs_record_ids.end(), record_id);
         // if the record weight pointer is null, we must remove the value
         if (mp_matching_rhs_record_weight == nullptr) {
             m_matching_rhs_record_ids.erase(itr);
-            --this->m_weight;
-            return this->m_weight;
+            return getWeight();
         }
         else {
             adjust_rhs_record_weight_with_sum(record_id, 0);
@@ -135,7 +218,8 @@ public:
     }
     
     // returns the new total weight of this vertex
-    weight_t adjust_rhs_record_weight_with_sum(jfkey_t record_id, weight_t new_weight) {
+    W adjust_rhs_record_weight_with_sum(jfkey_t record_id, W new_weight) {
+        check_not_packed();
         // we assume the weight vector is the correct size
 
         for (size_t i = 0; i < m_matching_rhs_record_ids.size(); ++i) {
@@ -144,20 +228,20 @@ public:
 
                 // special case where i==size
                 if (i == m_matching_rhs_record_ids.size() - 1) {
-                    weight_t weight_value = this->m_weight - mp_matching_rhs_record_weight->at(i);
-                    weight_t weight_diff = new_weight - weight_value;
+                    W weight_value = this->m_weight - mp_matching_rhs_record_weight->at(i);
+                    W weight_diff = new_weight - weight_value;
                     this->m_weight += weight_diff;
                     return this->m_weight;
                 }
                 else { // regular case
-                    weight_t weight_value = mp_matching_rhs_record_weight->at(i + 1) - mp_matching_rhs_record_weight->at(i);
-                    weight_t weight_diff = new_weight - weight_value;
+                    W weight_value = mp_matching_rhs_record_weight->at(i + 1) - mp_matching_rhs_record_weight->at(i);
+                    W weight_diff = new_weight - weight_value;
                     //std::cout << "total weight=" << this->m_weight << " weight=" << weight_value << " weight_diff=" << weight_diff << std::endl;
                     // adjust the prefix sum for all future values
                     std::transform(mp_matching_rhs_record_weight->begin() + i + 1
                         , mp_matching_rhs_record_weight->end()
                         , mp_matching_rhs_record_weight->begin() + i + 1
-                        , [weight_diff](weight_t t) {return t + weight_diff;}
+                        , [weight_diff](W t) {return t + weight_diff;}
                     );
                     this->m_weight += weight_diff;
                     return this->m_weight;
@@ -167,65 +251,78 @@ public:
         return this->m_weight;
     }
 
-    void get_records(weight_t &inout_weight_condition, jfkey_t &out_record_id, weight_t* record_weight=nullptr) {
-        //weight_t counter = inout_weight_condition;
-
-        //assert(counter < m_weight);
+    jfkey_t get_lhs_record_id(size_t idx) const {
+        if (mp_packed != nullptr)
+            return mp_packed->lhs[idx];
+        return m_matching_lhs_record_ids[idx];
+    }
 
-        //std::cerr << "[get_records] start" << std::endl; 
+    jfkey_t get_rhs_record_id(size_t idx) const {
+        if (mp_packed != nullptr)
+            return mp_packed->rhs[idx];
+        return m_matching_rhs_record_ids[idx];
+    }
 
-        if (mp_matching_rhs_record_weight != nullptr) {
+    // the weight of a single RHS record.  Only valid once the prefix sum is
+    // set up (or if the vertex uses the default weights)
+    W get_rhs_record_weight(size_t idx) const {
+        if (mp_matching_rhs_record_weight == nullptr)
+            return 1;
+        // the last record takes whatever is left of the total weight (acc. `e-mail/record_weight.txt`)
+        if (idx + 1 == mp_matching_rhs_record_weight->size())
+            return m_weight - mp_matching_rhs_record_weight->back();
+        return (*mp_matching_rhs_record_weight)[idx + 1] - (*mp_matching_rhs_record_weight)[idx];
+    }
 
-            //std::cerr << "[get_records] first branch mp_matching_rhs.size()=" << mp_matching_rhs_record_weight->size() << std::endl;
-            // special case
-            if (mp_matching_rhs_record_weight->size() == 1) {
-                //std::cerr << "SPEEEEEEEEEEEEEEEEEEECIAL CASE!!!" << " result=" << m_weight - mp_matching_rhs_record_weight->back() << std::endl;
-                // Fetch the weight (acc. `e-mail/record_weight.txt`)
-                if (record_weight) (*record_weight) = m_weight - mp_matching_rhs_record_weight->back();
-                out_record_id = m_matching_rhs_record_ids[0];
-                return;
-            }
+    // find the index of the RHS record selected by inout_weight_condition.  The
+    // weight is reduced to the offset inside the selected record.
+    size_t find_rhs_record(W &inout_weight_condition) const {
+        if (mp_matching_rhs_record_weight == nullptr) {
+            // if we are using default weights we do not need to search though the lists
+            size_t index = (size_t) inout_weight_condition;
+            inout_weight_condition = 0;
+            return index;
+        }
 
-            auto w_itr = std::upper_bound(mp_matching_rhs_record_weight->begin(), mp_matching_rhs_record_weight->end(), inout_weight_condition);
-            --w_itr;  // we will find the weight we need, but the index will be one less
-            size_t index = w_itr - mp_matching_rhs_record_weight->begin();
+        // special case
+        if (mp_matching_rhs_record_weight->size() == 1)
+            return 0;
 
-            // Set the weight (acc. `e-mail/record_weight.txt`)
+        auto w_itr = std::upper_bound(mp_matching_rhs_record_weight->begin(), mp_matching_rhs_record_weight->end(), inout_weight_condition);
+        --w_itr;  // we will find the weight we need, but the index will be one less
+        inout_weight_condition -= *w_itr;
+        return w_itr - mp_matching_rhs_record_weight->begin();
+    }
 
-            //std::cerr << "[get_records] index=" << index << " size=" << mp_matching_rhs_record_weight->size() << std::endl;
-            if (index == mp_matching_rhs_record_weight->size() - 1) {
-                if (record_weight) (*record_weight) = m_weight - mp_matching_rhs_record_weight->back();
-            } else {
-                if (record_weight) (*record_weight) = mp_matching_rhs_record_weight->at(index + 1) - mp_matching_rhs_record_weight->at(index);
-            }
+    void get_records(W &inout_weight_condition, jfkey_t &out_record_id, W* record_weight=nullptr) {
+        size_t index = find_rhs_record(inout_weight_condition);
 
-            inout_weight_condition -= *w_itr;
-            out_record_id = m_matching_rhs_record_ids[index];
-            return;
-        }
-        else {
+        out_record_id = get_rhs_record_id(index);
+        if (record_weight) (*record_weight) = get_rhs_record_weight(index);
+    }
 
-            //std::cerr << "[get_records] second branch" << std::endl;
-            // if we are using default weights we do not need to search though the lists
-            out_record_id = m_matching_rhs_record_ids[inout_weight_condition];
-            inout_weight_condition -= inout_weight_condition;
+    // the child links of a RHS record, `children` per record, or nullptr if
+    // the vertex is not linked.
+    const jefastChildLinkT<W> *get_rhs_child_links(size_t idx, size_t children) const {
+        if (m_rhs_child_links.empty())
+            return nullptr;
+        return &m_rhs_child_links[idx * children];
+    }
 
-            // Set the weight (acc. `e-mail/record_weight.txt`)
-            if (record_weight) (*record_weight) = 1;
-            return;
-        }
+    std::vector<jefastChildLinkT<W>> &rhs_child_links() {
+        return m_rhs_child_links;
     }
 
-    std::unique_ptr<JefastVertexEnumerator> getLHSEnumerator()
+    std::unique_ptr<JefastVertexEnumeratorT<W>> getLHSEnumerator()
     {
-        std::unique_ptr<JefastVertexEnumerator> toRet;
+        std::unique_ptr<JefastVertexEnumeratorT<W>> toRet;
         toRet.reset(new JefastVertexEnumeratorLHS(this));
         return toRet;
     }
 
-    std::unique_ptr<JefastVertexEnumerator> getRHSEnumerator()
+    std::unique_ptr<JefastVertexEnumeratorT<W>> getRHSEnumerator()
     {
-        std::unique_ptr<JefastVertexEnumerator> toRet;
+        std::unique_ptr<JefastVertexEnumeratorT<W>> toRet;
         toRet.reset(new JefastVertexEnumeratorRHS(this));
         return toRet;
     }
@@ -238,6 +335,7 @@ public:
     // Note that the weight vector may be shorter than the record id
     // vector because of zero weights.
     void purge_zero_weights() {
+        check_not_packed();
         assert(mp_matching_rhs_record_weight->size() <=
             m_matching_rhs_record_ids.size());
         size_t itr_pos = 0;
@@ -271,6 +369,7 @@ public:
     // other abstraction to do the sort.
     void sort()
     {
+        check_not_packed();
         std::vector<key_weight_pair> data;
         //std::cerr << "size=" << m_matching_rhs_record_ids.size() << std::endl;
         data.resize(m_matching_rhs_record_ids.size());
@@ -328,8 +427,8 @@ public:
     void SetupPrefixSum()
     {
         auto weight_itr = mp_matching_rhs_record_weight->begin();
-        weight_t sum = 0;
-        weight_t tmp;
+        W sum = 0;
+        W tmp;
         while (weight_itr != mp_matching_rhs_record_weight->end()) {
             tmp = *weight_itr;
             *weight_itr = sum;
@@ -338,23 +437,41 @@ public:
         }
     }
 
-    std::unique_ptr<std::vector<weight_t>>& getter() {
+    std::unique_ptr<std::vector<W>>& getter() {
         return mp_matching_rhs_record_weight;
     }
 
 private:
+    void check_not_packed() const {
+        if (mp_packed != nullptr)
+            throw "The records of a packed vertex can't be changed";
+    }
 
-    weight_t m_weight;
+    struct packed_records_t {
+        jefastPackedIds lhs;
+        jefastPackedIds rhs;
+    };
+
+    W m_weight;
 
     std::vector<jfkey_t> m_matching_lhs_record_ids;
 
     std::vector<jfkey_t> m_matching_rhs_record_ids;
 
-    std::unique_ptr<std::vector<weight_t> > mp_matching_rhs_record_weight;
+    std::unique_ptr<std::vector<W> > mp_matching_rhs_record_weight;
+
+    // parallel to m_matching_rhs_record_ids, empty unless linked
+    std::vector<jefastChildLinkT<W>> m_rhs_child_links;
+
+    // replaces both record id lists once packed (see pack_records())
+    std::unique_ptr<packed_records_t> mp_packed;
 
-    class JefastVertexEnumeratorRHS : public JefastVertexEnumerator {
+    // see divider_slot()
+    uint32_t m_divider_slot;
+
+    class JefastVertexEnumeratorRHS : public JefastVertexEnumeratorT<W> {
     public:
-        JefastVertexEnumeratorRHS(JefastVertex *vtx)
+        JefastVertexEnumeratorRHS(JefastVertexT *vtx)
             : mp_vtx{ vtx }
             , m_idx(-1)
         { }
@@ -363,13 +480,13 @@ private:
         bool Step()
         {
             ++m_idx;
-            return (m_idx < mp_vtx->m_matching_rhs_record_ids.size());
+            return (m_idx < mp_vtx->get_RHS_outdegree());
         }
 
         bool Step(size_t s)
         {
             m_idx += s;
-            return (m_idx < mp_vtx->m_matching_rhs_record_ids.size());
+            return (m_idx < mp_vtx->get_RHS_outdegree());
         }
 
         int64_t getValue()
@@ -379,10 +496,11 @@ private:
         }
         int64_t getRecordId()
         {
-            return mp_vtx->m_matching_rhs_record_ids.at(m_idx);
+            assert(m_idx < mp_vtx->get_RHS_outdegree());
+            return mp_vtx->get_rhs_record_id(m_idx);
         }
 
-        void setWeight(weight_t w)
+        void setWeight(W w)
         {
             // verify the weight list is the correct size
             mp_vtx->mp_matching_rhs_record_weight->resize(mp_vtx->get_RHS_outdegree());
@@ -391,18 +509,18 @@ private:
             mp_vtx->mp_matching_rhs_record_weight->at(m_idx) = w;
         }
 
-        weight_t getWeight()
+        W getWeight()
         {
             return mp_vtx->mp_matching_rhs_record_weight->at(m_idx);
         }
     private:
-        JefastVertex *mp_vtx;
+        JefastVertexT *mp_vtx;
         int m_idx;
     };
 
-    class JefastVertexEnumeratorLHS : public JefastVertexEnumerator {
+    class JefastVertexEnumeratorLHS : public JefastVertexEnumeratorT<W> {
     public:
-        JefastVertexEnumeratorLHS(JefastVertex *vtx)
+        JefastVertexEnumeratorLHS(JefastVertexT *vtx)
             : mp_vtx{ vtx }
             , m_idx( -1 )
         { }
@@ -411,13 +529,13 @@ private:
         bool Step()
         {
             ++m_idx;
-            return (m_idx < mp_vtx->m_matching_lhs_record_ids.size());
+            return (m_idx < mp_vtx->get_LHS_outdegree());
         }
 
         bool Step(size_t s)
         {
             m_idx += s;
-            return (m_idx < mp_vtx->m_matching_lhs_record_ids.size());
+            return (m_idx < mp_vtx->get_LHS_outdegree());
         }
 
         int64_t getValue()
@@ -427,25 +545,28 @@ private:
         }
         int64_t getRecordId()
         {
-            return mp_vtx->m_matching_lhs_record_ids.at(m_idx);
+            assert(m_idx < mp_vtx->get_LHS_outdegree());
+            return mp_vtx->get_lhs_record_id(m_idx);
         }
 
-        void setWeight(weight_t w)
+        void setWeight(W w)
         {
             throw "not implemented";
         }
 
-        weight_t getWeight()
+        W getWeight()
         {
             throw "not implemented";
         }
     private:
-        JefastVertex *mp_vtx;
+        JefastVertexT *mp_vtx;
         int m_idx;
     };
 
     struct key_weight_pair {
         jfkey_t key;
-        weight_t weight;
+        W weight;
     };
 };
+
+typedef JefastVertexT<weight_t> JefastVertex;
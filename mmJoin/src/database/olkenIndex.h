@@ -7,6 +7,7 @@
 #include <chrono>
 
 #include "TableGeneric.h"
+#include "../util/Deadline.h"
 
 class olkenIndex {
 public:
@@ -87,6 +88,14 @@ public:
         return dist_p(r_gen) < p;
     }
 
+    // Append accepted samples to output until there are max_samples new ones
+    // or the deadline expires.
+    SampleReport sample_until(Deadline deadline, std::vector<std::vector<jefastKey_t> > &output, size_t max_samples = SIZE_MAX)
+    {
+        return sample_until_deadline(deadline, output, max_samples,
+            [this](std::vector<jefastKey_t> &sample) { return sample_join(sample); });
+    }
+
 
 private:
     std::vector<std::shared_ptr<TableGeneric> > m_tables;
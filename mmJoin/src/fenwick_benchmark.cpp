@@ -0,0 +1,156 @@
+// Microbenchmark of the Fenwick trees: the binary StatelessFenwickTree
+// against the cache line blocked FenwickTree, for int64_t and int32_t
+// weights.  For each tree size it times the build, weighted searches with
+// random targets, weight updates at random records, searches interleaved
+// with updates (what a sampling walk does) and scaling all weights.
+//
+// usage: fenwick_benchmark [operations per test] [largest tree size]
+// Configure with -DNATIVE_ARCH=ON for the AVX2 node search.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "util/CounterRng.h"
+#include "util/FenwickTree.h"
+#include "util/StatelessFenwickTree.h"
+
+// keeps the results of the timed loops alive
+static volatile int64_t sink;
+
+// times a test, in nanoseconds per operation
+class OpTimer {
+public:
+    void start() {
+        m_start = std::chrono::steady_clock::now();
+    }
+
+    double stop(size_t operations) const {
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - m_start).count() / operations;
+    }
+
+private:
+    std::chrono::steady_clock::time_point m_start;
+};
+
+static void print_row(const char *tree, size_t size, const char *test, double ns)
+{
+    printf("%-16s %10zu  %-14s %10.1f ns/op\n", tree, size, test, ns);
+}
+
+static void bench_stateless(size_t size, size_t operations, const std::vector<size_t> &records, const std::vector<int64_t> &targets)
+{
+    std::vector<int64_t> data(size, 1000);
+    OpTimer timer;
+
+    timer.start();
+    StatelessFenwickTree::initialize(&data[0], data.size());
+    print_row("stateless int64", size, "build", timer.stop(size));
+
+    int64_t sum = 0;
+    timer.start();
+    for (size_t i = 0; i < operations; ++i) {
+        int64_t target = targets[i];
+        sum += StatelessFenwickTree::findG_mod(&data[0], data.size(), target);
+    }
+    print_row("stateless int64", size, "find", timer.stop(operations));
+
+    // the tree keeps the records 0 .. size - 2 at 1 .. size - 1
+    timer.start();
+    for (size_t i = 0; i < operations; ++i) {
+        size_t idx = records[i] % (size - 1) + 1;
+        int64_t old = StatelessFenwickTree::readSingle_value(&data[0], idx);
+        StatelessFenwickTree::update_add_value(&data[0], data.size(), idx, 999 - old);
+    }
+    print_row("stateless int64", size, "update", timer.stop(operations));
+
+    timer.start();
+    for (size_t i = 0; i < operations; ++i) {
+        int64_t target = targets[i] / 2;
+        size_t idx = StatelessFenwickTree::findG_mod(&data[0], data.size(), target);
+        if (idx + 1 < data.size()) {
+            int64_t old = StatelessFenwickTree::readSingle_value(&data[0], idx + 1);
+            StatelessFenwickTree::update_add_value(&data[0], data.size(), idx + 1, old > 1 ? -1 : 0);
+        }
+        sum += idx;
+    }
+    print_row("stateless int64", size, "find+update", timer.stop(operations));
+
+    timer.start();
+    StatelessFenwickTree::scale_up(&data[0], data.size(), 2);
+    print_row("stateless int64", size, "scale", timer.stop(size));
+
+    sink = sum;
+}
+
+template<typename T>
+static void bench_blocked(const char *name, size_t size, size_t operations, const std::vector<size_t> &records, const std::vector<int64_t> &targets)
+{
+    FenwickTree<T> tree;
+    OpTimer timer;
+
+    timer.start();
+    tree.assign(size, 1000);
+    print_row(name, size, "build", timer.stop(size));
+
+    int64_t sum = 0;
+    timer.start();
+    for (size_t i = 0; i < operations; ++i) {
+        T target = (T) targets[i];
+        sum += tree.find(target);
+    }
+    print_row(name, size, "find", timer.stop(operations));
+
+    timer.start();
+    for (size_t i = 0; i < operations; ++i)
+        tree.set(records[i] % size, 999);
+    print_row(name, size, "update", timer.stop(operations));
+
+    timer.start();
+    for (size_t i = 0; i < operations; ++i) {
+        T target = (T) (targets[i] / 2);
+        size_t idx = tree.find(target);
+        tree.add(idx, tree.get(idx) > 1 ? -1 : 0);
+        sum += idx;
+    }
+    print_row(name, size, "find+update", timer.stop(operations));
+
+    timer.start();
+    tree.divide(2);
+    print_row(name, size, "scale", timer.stop(size));
+
+    sink = sum;
+}
+
+int main(int argc, char **argv)
+{
+    size_t operations = argc > 1 ? strtoull(argv[1], nullptr, 10) : 2000000;
+    size_t largest = argc > 2 ? strtoull(argv[2], nullptr, 10) : 16 * 1024 * 1024;
+
+#if defined(__AVX2__)
+    printf("FenwickTree node search: AVX2\n");
+#else
+    printf("FenwickTree node search: generic\n");
+#endif
+
+    CounterRng rng(1);
+    for (size_t size = 1024; size <= largest; size *= 8) {
+        // the same records and targets for every tree, drawn up front
+        std::vector<size_t> records(operations);
+        std::vector<int64_t> targets(operations);
+        for (size_t i = 0; i < operations; ++i) {
+            records[i] = rng() % size;
+            targets[i] = rng() % (size * 1000);
+        }
+
+        bench_stateless(size, operations, records, targets);
+        bench_blocked<int64_t>("blocked int64", size, operations, records, targets);
+        // the weights of the largest trees overflow int32_t
+        if (size * 1000 <= INT32_MAX)
+            bench_blocked<int32_t>("blocked int32", size, operations, records, targets);
+        printf("\n");
+    }
+    return 0;
+}
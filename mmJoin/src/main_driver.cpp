@@ -12,6 +12,7 @@
 #include "database/TableLineitem.h"
 
 #include "database/jefastBuilder.h"
+#include "database/jefastRangeEnumerator.h"
 
 int main() {
     std::cout << "starting to load data into tables" << std::endl;
@@ -65,12 +66,18 @@ int main() {
 
     auto test_built = test1.Build();
 
-    int64_t count = test_built->GetTotal();
-    std::vector<int64_t> results;
-    for (int i = 0; i < count; ++i)
+    // walk the join in join number order without going back to the root for
+    // every result
+    JefastRangeEnumerator enumerator(*test_built);
+    if (test_built->GetTotal() > 0)
     {
-        test_built->GetJoinNumber(i, results);
-        std::cout << i << ":" << results.at(0) << ' ' << results.at(1) << ' ' << results.at(2) << ' ' << results.at(3) << '\n';
+        enumerator.Seek(0);
+        int64_t i = 0;
+        do
+        {
+            const std::vector<int64_t> &results = enumerator.getRecord();
+            std::cout << i++ << ":" << results.at(0) << ' ' << results.at(1) << ' ' << results.at(2) << ' ' << results.at(3) << '\n';
+        } while (enumerator.Step());
     }
 
 
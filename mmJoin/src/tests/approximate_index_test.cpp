@@ -0,0 +1,132 @@
+// JefastBuilder::BuildApproximate() builds an index with double weights for
+// joins too large for wide_weight_t.  Its total must match the exact one,
+// its samples must be join results drawn uniformly up to
+// GetUniformityBound(), and it must index joins which the exact builder
+// rejects with std::overflow_error.
+
+#include <cmath>
+#include <stdexcept>
+
+#include "test_util.h"
+#include "database/jefastBuilder.h"
+#include "database/jefastIndex.h"
+#include "database/jefastApproximateIndex.h"
+
+int main()
+{
+    const int rows = 30;
+    std::vector<std::shared_ptr<Int64CSVTable> > T;
+    for (int t = 0; t < 3; ++t)
+        T.push_back(random_table(rows, 2, 5, 151 + t));
+
+    // T0(x, y) - T1(y, z) - T2(z, w), and the fork with T2 on T0.x.  A
+    // zero row weight on T1 drops its rows.
+    for (int fork = 0; fork < 2; ++fork) {
+        for (int weighted = 0; weighted < 2; ++weighted) {
+            JefastBuilder builder;
+            if (fork) {
+                builder.AddTableToFork(T[0], -1, -1, -1);
+                builder.AddTableToFork(T[1], 0, 1, 0);
+                builder.AddTableToFork(T[2], 0, 0, 0);
+            } else {
+                builder.AppendTable(T[0], -1, 1, 0);
+                builder.AppendTable(T[1], 0, 1, 1);
+                builder.AppendTable(T[2], 0, -1, 2);
+            }
+            if (weighted)
+                builder.SetRowWeight(1, [](int64_t row) -> weight_t { return row % 2; });
+
+            auto approximate = builder.BuildApproximate();
+            std::shared_ptr<jefastIndexBase> exact;
+            if (fork)
+                exact = builder.BuildFork();
+            else
+                exact = builder.Build();
+            TEST_CHECK(approximate != nullptr && exact != nullptr);
+            TEST_CHECK(approximate->GetNumberOfLevels() == 3);
+            TEST_CHECK(approximate->GetTotal() == (double) exact->GetTotal());
+            TEST_CHECK(approximate->GetUniformityBound() > 0 && approximate->GetUniformityBound() < 1e-9);
+
+            std::map<std::vector<int64_t>, int64_t> counts;
+            std::vector<int64_t> out;
+            for (weight_t i = 0; i < exact->GetTotal(); ++i) {
+                exact->GetJoinNumber(i, out);
+                counts[std::vector<int64_t>(out.begin(), out.begin() + 3)] = 0;
+            }
+            const size_t results = counts.size();
+            TEST_CHECK(results > 1);
+            for (size_t i = 0; i < 100 * results; ++i) {
+                approximate->GetRandomJoin(out);
+                auto it = counts.find(out);
+                TEST_CHECK(it != counts.end());
+                TEST_CHECK(!weighted || out[1] % 2 == 1);
+                ++it->second;
+            }
+
+            // every row weight is 0 or 1, so the results are uniform.
+            // About 5 standard deviations above the mean of the chi-square
+            // distribution with results - 1 degrees of freedom.
+            double df = results - 1;
+            double chi2 = chi_square_uniform(counts, results);
+            TEST_CHECK(chi2 < df + 5 * std::sqrt(2 * df));
+        }
+    }
+
+    // 16 tables of 500 rows which all join: 500^16 ~ 1.5e43 results do not
+    // fit in 128 bits
+    {
+        const int tables = 16;
+        std::vector<std::vector<double> > data(500, std::vector<double>(2, 0.0));
+        auto zeros = std::make_shared<Int64CSVTable>();
+        zeros->load(data, 2);
+
+        JefastBuilder builder;
+        builder.AppendTable(zeros, -1, 1, 0);
+        for (int t = 1; t < tables; ++t)
+            builder.AppendTable(zeros, 0, t + 1 < tables ? 1 : -1, t);
+
+        bool overflow = false;
+        try {
+            builder.Build();
+        } catch (const std::overflow_error &) {
+            overflow = true;
+        }
+        TEST_CHECK(overflow);
+
+        auto approximate = builder.BuildApproximate();
+        TEST_CHECK(approximate != nullptr);
+        double total = std::pow(500.0, tables);
+        TEST_CHECK(std::abs(approximate->GetTotal() - total) <= 1e-12 * total);
+        std::vector<int64_t> out;
+        std::vector<int64_t> first(tables, 0);
+        for (int i = 0; i < 100; ++i) {
+            approximate->GetRandomJoin(out);
+            TEST_CHECK(out.size() == (size_t) tables);
+            for (int t = 0; t < tables; ++t) {
+                TEST_CHECK(out[t] >= 0 && out[t] < 500);
+                first[t] += out[t] == 0;
+            }
+        }
+        // not stuck on the first record
+        for (int t = 0; t < tables; ++t)
+            TEST_CHECK(first[t] < 10);
+    }
+
+    // an empty join, T0.x is below 5
+    {
+        std::vector<std::vector<double> > data(5, std::vector<double>(2, 9.0));
+        auto nines = std::make_shared<Int64CSVTable>();
+        nines->load(data, 2);
+        JefastBuilder builder;
+        builder.AppendTable(nines, -1, 1, 0);
+        builder.AppendTable(T[0], 0, -1, 1);
+        auto approximate = builder.BuildApproximate();
+        TEST_CHECK(approximate != nullptr && approximate->GetTotal() == 0);
+        std::vector<int64_t> out(2, 1);
+        approximate->GetRandomJoin(out);
+        TEST_CHECK(out.empty());
+    }
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
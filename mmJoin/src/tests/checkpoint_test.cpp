@@ -0,0 +1,117 @@
+// DynamicIndex::save_checkpoint() writes what a warmed index learned and
+// load_checkpoint() sets up a new index over the same tables from it.  The
+// new index must write the same checkpoint and draw the same walks as the
+// old one.  A truncated checkpoint, or one of other tables, even with the
+// same row counts, must be rejected with -1.
+
+#include <sstream>
+
+#include "test_util.h"
+#include "database/DynamicIndex.h"
+
+typedef std::vector<std::pair<int64_t, int64_t> > rows_t;
+
+static std::vector<std::shared_ptr<TableGeneric> > tables(const std::string &name, const rows_t &a, const rows_t &b, const rows_t &c)
+{
+    return {
+        generic_table(name + "_a", a, 2, 2),
+        generic_table(name + "_b", b, 1, 2),
+        generic_table(name + "_c", c, 1, 1),
+    };
+}
+
+static std::shared_ptr<DynamicIndex> index_of(const std::vector<std::shared_ptr<TableGeneric> > &tables)
+{
+    auto index = std::make_shared<DynamicIndex>(tables.size());
+    for (size_t i = 0; i < tables.size(); ++i)
+        index->add_Table(i, tables[i], 100);
+    index->seed(41);
+    return index;
+}
+
+static std::string checkpoint(DynamicIndex &index)
+{
+    std::ostringstream out;
+    TEST_CHECK(index.save_checkpoint(out) == 0);
+    return out.str();
+}
+
+static std::vector<std::vector<int> > draw(DynamicIndex &index, int walks)
+{
+    CounterRng rng = index.walker_rng(0);
+    std::vector<std::vector<int> > out;
+    std::vector<int> sample(3);
+    for (int i = 0; i < walks; ++i) {
+        std::fill(sample.begin(), sample.end(), -1);
+        bool accepted = index.sample_join(sample, rng);
+        out.push_back(sample);
+        out.back().push_back(accepted);
+    }
+    return out;
+}
+
+int main()
+{
+    // A(y) - B(y, z) - C(z)
+    std::mt19937 gen(51);
+    rows_t a(40), b(40), c(40);
+    for (auto &row : a)
+        row = { 0, gen() % 8 };
+    for (auto &row : b)
+        row = { gen() % 8, gen() % 8 };
+    for (auto &row : c)
+        row = { gen() % 8, 0 };
+    auto T = tables("checkpoint", a, b, c);
+
+    auto warmed = index_of(T);
+    TEST_CHECK(warmed->initialize(2) == 0);
+    warmed->warmup(1);
+    const std::string saved = checkpoint(*warmed);
+
+    // a truncated checkpoint leaves the index as it was
+    auto loaded = index_of(T);
+    for (size_t length : { (size_t) 0, (size_t) 8, saved.size() / 2, saved.size() - 1 }) {
+        std::istringstream in(saved.substr(0, length));
+        TEST_CHECK(loaded->load_checkpoint(in) == -1);
+    }
+
+    {
+        std::istringstream in(saved);
+        TEST_CHECK(loaded->load_checkpoint(in) == 0);
+    }
+    TEST_CHECK(checkpoint(*loaded) == saved);
+    TEST_CHECK(draw(*loaded, 500) == draw(*warmed, 500));
+    TEST_CHECK(checkpoint(*loaded) == checkpoint(*warmed));
+
+    // through a file as well
+    TEST_CHECK(warmed->save_checkpoint(std::string("checkpoint_file")) == 0);
+    auto from_file = index_of(T);
+    TEST_CHECK(from_file->load_checkpoint(std::string("checkpoint_file")) == 0);
+    TEST_CHECK(checkpoint(*from_file) == checkpoint(*warmed));
+    TEST_CHECK(index_of(T)->load_checkpoint(std::string("checkpoint_missing_file")) == -1);
+
+    // another row count, another join value with the same row counts and
+    // fewer tables
+    {
+        rows_t longer = b;
+        longer.push_back({ 1, 1 });
+        std::istringstream in(saved);
+        TEST_CHECK(index_of(tables("checkpoint_longer", a, longer, c))->load_checkpoint(in) == -1);
+    }
+    {
+        rows_t changed = c;
+        changed[7].first = 100;
+        std::istringstream in(saved);
+        TEST_CHECK(index_of(tables("checkpoint_changed", a, b, changed))->load_checkpoint(in) == -1);
+    }
+    {
+        DynamicIndex shorter(2);
+        shorter.add_Table(0, T[0], 100);
+        shorter.add_Table(1, T[1], 100);
+        std::istringstream in(saved);
+        TEST_CHECK(shorter.load_checkpoint(in) == -1);
+    }
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,100 @@
+// LinkChildren() lets the walks follow a pointer from each record to its
+// child vertex instead of hashing the join value.  A linked index must
+// report the same join results and weights as an unlinked one, for linear
+// and fork indexes and with primary key levels, and Insert() and Delete()
+// must drop the links they would leave dangling.
+
+#include <algorithm>
+
+#include "test_util.h"
+#include "database/jefastBuilder.h"
+#include "database/jefastIndex.h"
+
+typedef std::vector<std::pair<std::vector<int64_t>, std::vector<weight_t> > > results_t;
+
+static results_t enumerate(jefastIndexBase &index)
+{
+    results_t results;
+    std::vector<int64_t> out;
+    for (weight_t i = 0; i < index.GetTotal(); ++i) {
+        auto weights = index.GetJoinNumberWithWeights(i, out);
+        results.emplace_back(out, weights);
+    }
+    return results;
+}
+
+int main()
+{
+    const int rows = 25;
+    // T0(x, y) - T1(y, z) - T2(z, w) - T3(w, v), the fork has T3 below T1.
+    // T3.w is unique.
+    std::vector<std::shared_ptr<Int64CSVTable> > T;
+    for (int t = 0; t < 3; ++t)
+        T.push_back(random_table(rows, 2, 5, 121 + t));
+    {
+        std::vector<std::vector<double> > data;
+        for (int i = 0; i < 5; ++i)
+            data.push_back({ double(i), double(i * 3 % 5) });
+        T.push_back(std::make_shared<Int64CSVTable>());
+        T.back()->load(data, 2);
+    }
+
+    auto build = [&](bool fork, bool detect) -> std::shared_ptr<jefastIndexBase> {
+        JefastBuilder builder;
+        builder.SetPrimaryKeyDetection(detect);
+        builder.SetRowWeight(2, [](int64_t row) -> weight_t { return row % 4; });
+        if (fork) {
+            builder.AddTableToFork(T[0], -1, -1, -1);
+            builder.AddTableToFork(T[1], 0, 1, 0);
+            builder.AddTableToFork(T[2], 0, 1, 1);
+            builder.AddTableToFork(T[3], 0, 0, 1);
+            return builder.BuildFork();
+        }
+        builder.AppendTable(T[0], -1, 1, 0);
+        builder.AppendTable(T[1], 0, 1, 1);
+        builder.AppendTable(T[2], 0, 1, 2);
+        builder.AppendTable(T[3], 0, -1, 3);
+        return builder.Build();
+    };
+
+    for (int fork = 0; fork < 2; ++fork) {
+        for (int detect = 0; detect < 2; ++detect) {
+            auto plain = build(fork == 1, detect == 1);
+            auto linked = build(fork == 1, detect == 1);
+            TEST_CHECK(plain && linked && plain->GetTotal() > 0);
+            linked->LinkChildren();
+            const results_t truth = enumerate(*plain);
+            TEST_CHECK(enumerate(*linked) == truth);
+
+            // random joins follow the links as well
+            std::vector<int64_t> out;
+            for (int i = 0; i < 200; ++i) {
+                auto weights = linked->GetRandomJoinWithWeights(out);
+                TEST_CHECK(std::find(truth.begin(), truth.end(), std::make_pair(out, weights)) != truth.end());
+            }
+        }
+
+        // updates of the linear index without primary key levels
+        if (!fork) {
+            auto plain = std::dynamic_pointer_cast<jefastIndexLinear>(build(false, false));
+            auto linked = std::dynamic_pointer_cast<jefastIndexLinear>(build(false, false));
+            TEST_CHECK(plain && linked);
+            linked->LinkChildren();
+            for (int64_t row = 0; row < rows; row += 3) {
+                plain->Delete(1, row);
+                linked->Delete(1, row);
+                TEST_CHECK(enumerate(*linked) == enumerate(*plain));
+                linked->LinkChildren();
+                TEST_CHECK(enumerate(*linked) == enumerate(*plain));
+            }
+            for (int64_t row = 0; row < rows; row += 3) {
+                plain->Insert(1, row);
+                linked->Insert(1, row);
+                TEST_CHECK(enumerate(*linked) == enumerate(*plain));
+            }
+        }
+    }
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
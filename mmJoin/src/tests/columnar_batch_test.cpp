@@ -0,0 +1,82 @@
+// GenerateBatch() and GenerateColumnarData() write the samples column by
+// column into flat buffers, with the weights converted by
+// weight_to_uint64() instead of going through a stringstream.  Every
+// sample must be a join result with the weights GetJoinNumberWithWeights()
+// reports for it, also when a batch is reused with another count.
+
+#include "test_util.h"
+#include "database/jefastBuilder.h"
+#include "database/jefastIndex.h"
+
+int main()
+{
+    const int tables = 3;
+    const int rows = 40;
+    std::vector<std::shared_ptr<Int64CSVTable> > T;
+    for (int t = 0; t < tables; ++t)
+        T.push_back(random_table(rows, 2, 6, 91 + t));
+
+    // T0(x, y) - T1(y, z) - T2(z, w), T1 row weighted
+    auto build = [&](bool fork) -> std::shared_ptr<jefastIndexBase> {
+        JefastBuilder builder;
+        if (fork) {
+            builder.AddTableToFork(T[0], -1, -1, -1);
+            builder.AddTableToFork(T[1], 0, 1, 0);
+            builder.AddTableToFork(T[2], 0, 1, 1);
+            builder.SetRowWeight(1, [](int64_t row) -> weight_t { return row % 3; });
+            return builder.BuildFork();
+        }
+        builder.AppendTable(T[0], -1, 1, 0);
+        builder.AppendTable(T[1], 0, 1, 1);
+        builder.AppendTable(T[2], 0, -1, 2);
+        builder.SetRowWeight(1, [](int64_t row) -> weight_t { return row % 3; });
+        return builder.Build();
+    };
+
+    for (int fork = 0; fork < 2; ++fork) {
+        auto index = build(fork == 1);
+        TEST_CHECK(index && index->GetTotal() > 0);
+        // a fork index has one more level than tables, which is not filled
+        const int levels = index->GetNumberOfLevels();
+        TEST_CHECK(levels >= tables);
+
+        // the weights of every join result
+        std::map<std::vector<int64_t>, std::vector<uint64_t> > weights;
+        std::vector<int64_t> out;
+        for (weight_t i = 0; i < index->GetTotal(); ++i) {
+            auto ws = index->GetJoinNumberWithWeights(i, out);
+            weights[std::vector<int64_t>(out.begin(), out.begin() + tables)] = std::vector<uint64_t>(ws.begin(), ws.begin() + tables);
+        }
+
+        jefastSampleBatch batch;
+        for (size_t count : { 100, 7, 0, 250 }) {
+            index->GenerateBatch(count, batch);
+            TEST_CHECK(batch.count == count && batch.levels == levels);
+            TEST_CHECK(batch.records.size() == count * levels && batch.weights.size() == count * levels);
+
+            for (size_t i = 0; i < count; ++i) {
+                std::vector<int64_t> result;
+                std::vector<uint64_t> result_weights;
+                for (int level = 0; level < tables; ++level) {
+                    result.push_back(batch.record(i, level));
+                    result_weights.push_back(batch.weight(i, level));
+                }
+                auto itr = weights.find(result);
+                TEST_CHECK(itr != weights.end());
+                TEST_CHECK(itr->second == result_weights);
+            }
+        }
+    }
+
+    // weights that don't fit in uint64_t are not wrapped around
+    bool thrown = false;
+    try {
+        weight_to_uint64<weight_t>(-1);
+    } catch (const std::out_of_range &) {
+        thrown = true;
+    }
+    TEST_CHECK(thrown);
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,80 @@
+// Several threads may call DynamicIndex::sample_join() on one index at
+// once, each with its own walker_rng(), while the walks refine the shared
+// weights.  Every accepted walk must be a join result, and the results of
+// all the threads together must be uniform.
+
+#include <cmath>
+#include <thread>
+
+#include "test_util.h"
+#include "database/DynamicIndex.h"
+
+int main()
+{
+    // A(y) - B(y, z) - C(z), the values of B.y and C.z are skewed
+    std::mt19937 gen(21);
+    auto skewed = [&gen](int domain) -> int64_t {
+        int64_t v = gen() % domain;
+        return v * v / domain;
+    };
+    std::vector<std::pair<int64_t, int64_t> > a(60), b(60), c(60);
+    for (auto &row : a)
+        row = { 0, gen() % 12 };
+    for (auto &row : b)
+        row = { skewed(12), gen() % 12 };
+    for (auto &row : c)
+        row = { skewed(12), 0 };
+
+    std::map<std::vector<int>, int64_t> counts;
+    for (int i = 0; i < (int) a.size(); ++i)
+        for (int j = 0; j < (int) b.size(); ++j)
+            for (int k = 0; a[i].second == b[j].first && k < (int) c.size(); ++k)
+                if (b[j].second == c[k].first)
+                    counts[{ i, j, k }] = 0;
+    const size_t results = counts.size();
+    TEST_CHECK(results > 0);
+
+    DynamicIndex index(3);
+    index.add_Table(0, generic_table("concurrent_sampling_a", a, 2, 2), 1000000);
+    index.add_Table(1, generic_table("concurrent_sampling_b", b, 1, 2), 1000);
+    index.add_Table(2, generic_table("concurrent_sampling_c", c, 1, 1), 100);
+    index.seed(5);
+    TEST_CHECK(index.initialize(2) == 0);
+    index.warmup(1);
+
+    // each thread keeps its own samples, they are only merged after the join
+    const int threads = 4;
+    const size_t samples = 100 * results / threads;
+    std::vector<std::vector<std::vector<int> > > output(threads);
+    std::vector<std::thread> thread_list;
+    for (int t = 0; t < threads; ++t) {
+        thread_list.emplace_back([&index, &output, samples, t]() {
+            CounterRng rng = index.walker_rng(t);
+            std::vector<int> sample(3);
+            while (output[t].size() < samples) {
+                if (index.sample_join(sample, rng))
+                    output[t].push_back(sample);
+            }
+        });
+    }
+    for (auto &thread : thread_list)
+        thread.join();
+
+    for (auto &samples_of_thread : output) {
+        for (auto &sample : samples_of_thread) {
+            auto it = counts.find(sample);
+            TEST_CHECK(it != counts.end());
+            ++it->second;
+        }
+    }
+
+    // about 5 standard deviations above the mean of the chi-square
+    // distribution with results - 1 degrees of freedom
+    double df = results - 1;
+    double chi2 = chi_square_uniform(counts, results);
+    std::cout << "results " << results << " chi2 " << chi2 << " df " << df << std::endl;
+    TEST_CHECK(chi2 < df + 5 * std::sqrt(2 * df));
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
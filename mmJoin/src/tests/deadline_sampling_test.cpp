@@ -0,0 +1,115 @@
+// The samplers have sample_until() calls bounded by a Deadline and a
+// sample count.  A call must stop at whichever comes first, keep the
+// samples already in the output, and report the attempts, the accepted
+// samples and whether the deadline stopped it.  A deadline in the past
+// stops a call before its first sample.
+
+#include <cmath>
+#include <thread>
+
+#include "test_util.h"
+#include "database/DynamicIndex.h"
+#include "database/jefastBuilder.h"
+#include "database/jefastIndex.h"
+#include "util/Deadline.h"
+
+int main()
+{
+    // the clock is read every check_every calls, the first call included
+    {
+        Deadline past(Deadline::clock::now() - std::chrono::seconds(1), 8);
+        TEST_CHECK(past.expired());
+        Deadline future(std::chrono::seconds(60), 8);
+        for (int i = 0; i < 100; ++i)
+            TEST_CHECK(!future.expired());
+    }
+
+    // the count stops first, every other draw is rejected
+    {
+        std::vector<int> output = { -1 };
+        int next = 0;
+        Deadline deadline(std::chrono::seconds(60));
+        SampleReport report = sample_until_deadline(deadline, output, 50,
+            [&next](int &sample) { sample = next++; return sample % 2 == 0; });
+        TEST_CHECK(!report.expired);
+        TEST_CHECK(report.accepted == 50 && report.attempts == 99);
+        TEST_CHECK(output.size() == 51 && output[0] == -1 && output.back() == 98);
+        TEST_CHECK(std::abs(report.acceptance_rate() - 50.0 / 99) < 1e-12);
+    }
+
+    // the deadline stops first
+    {
+        std::vector<int> output;
+        Deadline deadline(std::chrono::milliseconds(20), 1);
+        SampleReport report = sample_until_deadline(deadline, output, SIZE_MAX, [](int &) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            return true;
+        });
+        TEST_CHECK(report.expired);
+        TEST_CHECK(report.accepted == output.size() && report.attempts == report.accepted);
+        TEST_CHECK(report.accepted > 0 && report.accepted <= 20);
+        TEST_CHECK(report.seconds >= 0.02 && report.seconds < 10);
+    }
+
+    // T0(x, y) - T1(y, z)
+    auto T0 = random_table(30, 2, 5, 191);
+    auto T1 = random_table(30, 2, 5, 192);
+    {
+        JefastBuilder builder;
+        builder.AppendTable(T0, -1, 1, 0);
+        builder.AppendTable(T1, 0, -1, 1);
+        auto index = builder.Build();
+        TEST_CHECK(index != nullptr && index->GetTotal() > 0);
+
+        std::vector<std::vector<int64_t> > output;
+        SampleReport report = index->GetRandomJoinsUntil(Deadline(std::chrono::seconds(60)), output, 100);
+        TEST_CHECK(!report.expired && report.accepted == 100 && report.attempts == 100);
+        TEST_CHECK(output.size() == 100);
+        for (auto &sample : output)
+            TEST_CHECK(T0->get_int64(sample[0], 1) == T1->get_int64(sample[1], 0));
+
+        report = index->GetRandomJoinsUntil(Deadline(std::chrono::seconds(0)), output, 100);
+        TEST_CHECK(report.expired && report.attempts == 0 && output.size() == 100);
+    }
+
+    // an empty join returns at once
+    {
+        std::vector<std::vector<double> > data(5, std::vector<double>(2, 9.0));
+        auto nines = std::make_shared<Int64CSVTable>();
+        nines->load(data, 2);
+        JefastBuilder builder;
+        builder.AppendTable(nines, -1, 1, 0);
+        builder.AppendTable(T1, 0, -1, 1);
+        auto index = builder.Build();
+        std::vector<std::vector<int64_t> > output;
+        SampleReport report = index->GetRandomJoinsUntil(Deadline(std::chrono::seconds(60)), output);
+        TEST_CHECK(!report.expired && report.attempts == 0 && output.empty());
+    }
+
+    // the walks of DynamicIndex
+    {
+        std::vector<std::pair<int64_t, int64_t> > a, b;
+        for (int i = 0; i < 20; ++i) {
+            a.push_back({ 0, i % 4 });
+            b.push_back({ i % 5, 0 });
+        }
+        DynamicIndex index(2);
+        index.add_Table(0, generic_table("deadline_sampling_a", a, 2, 2), 100);
+        index.add_Table(1, generic_table("deadline_sampling_b", b, 1, 1), 100);
+        index.seed(9);
+        TEST_CHECK(index.initialize(1) == 0);
+        index.warmup(1);
+
+        std::vector<std::vector<int> > output;
+        SampleReport report = index.sample_until(Deadline(std::chrono::seconds(60)), output, 200);
+        TEST_CHECK(!report.expired && report.accepted == 200 && report.attempts >= 200);
+        for (auto &sample : output)
+            TEST_CHECK(a[sample[0]].second == b[sample[1]].first);
+
+        report = index.sample_until(Deadline(std::chrono::seconds(0)), output, 200);
+        TEST_CHECK(report.expired && report.attempts == 0 && output.size() == 200);
+    }
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
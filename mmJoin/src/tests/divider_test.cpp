@@ -0,0 +1,68 @@
+// jefastDivider replaces the division of a weight by a vertex weight with a
+// multiply and shifts.  It must give the exact quotient for every divisor,
+// including 1, the powers of two and the largest ones, and every
+// numerator, for both 64 and 128 bit words.
+
+#include <limits>
+
+#include "test_util.h"
+#include "database/jefastDivider.h"
+
+template <typename U>
+static void check(U d, U n)
+{
+    jefastDivider<U> divider(d);
+    TEST_CHECK(divider.divisor() == d);
+    TEST_CHECK(divider.divide(n) == n / d);
+}
+
+template <typename U>
+static void check_all(std::mt19937_64 &gen)
+{
+    const unsigned bits = sizeof(U) * 8;
+    const U largest = std::numeric_limits<U>::max();
+    // a random word, 64 bits at a time
+    auto random = [&gen]() {
+        U r = 0;
+        for (unsigned i = 0; i < sizeof(U) / sizeof(uint64_t); ++i)
+            r = (r << 32 << 32) | gen();
+        return r;
+    };
+
+    std::vector<U> divisors = { 1, 2, 3, 5, 7, 10, 641, largest, largest - 1, largest / 2, largest / 2 + 1 };
+    for (unsigned k = 1; k < bits; ++k) {
+        divisors.push_back(U(1) << k);
+        divisors.push_back((U(1) << k) - 1);
+        divisors.push_back((U(1) << k) + 1);
+    }
+    for (int i = 0; i < 200; ++i) {
+        U d = random() >> (gen() % bits);
+        divisors.push_back(d == 0 ? 1 : d);
+    }
+
+    for (U d : divisors) {
+        std::vector<U> numerators = { 0, 1, d - 1, d, d + 1, largest, largest - 1, largest - d + 1 };
+        if (d <= largest / 2)
+            numerators.push_back(2 * d - 1);
+        for (int i = 0; i < 50; ++i) {
+            numerators.push_back(random());
+            numerators.push_back(random() >> (gen() % bits));
+        }
+        for (U n : numerators)
+            check<U>(d, n);
+    }
+}
+
+int main()
+{
+    std::mt19937_64 gen(161);
+    check_all<uint64_t>(gen);
+    check_all<uint128_t>(gen);
+
+    // the divider of the index weights has a word as wide as weight_t
+    TEST_CHECK(sizeof(jefastWeightDivider().divisor()) >= sizeof(weight_t));
+    TEST_CHECK(jefastDivider<uint64_t>().divisor() == 0);
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,43 @@
+// DynamicIndex::initialize_auto() ranks the DP levels by accepted walks per
+// second.  The probes counted every walk as accepted (finish_walk() always
+// returned true), so they ranked the levels by walks per second and picked
+// a level whose walks were quick because most of them failed.
+//
+// Here most records of B are dead ends.  DP level 1 computes the weights of
+// B once and then accepts every walk through all the tables.  The higher
+// DP levels learn the dead ends of B one walk at a time, and their failed
+// walks end at C, so they draw more walks per second.
+
+#include "test_util.h"
+#include "database/DynamicIndex.h"
+
+int main()
+{
+    // A(y) - B(y, z) - C(z, u) - D(u, v) - E(v): every row of A joins every
+    // row of B, one row of B in 10 joins a row of C, which joins D and E
+    const int tables = 5;
+    const int64_t rows = 100000;
+    std::vector<std::vector<std::pair<int64_t, int64_t> > > data(tables);
+    data[0].assign(10, { 0, 0 });
+    for (int64_t i = 0; i < rows; ++i)
+        data[1].push_back({ 0, i });
+    for (int64_t i = 0; i < rows; i += 10)
+        data[2].push_back({ i, 0 });
+    for (int t = 3; t < tables; ++t)
+        data[t].push_back({ 0, 0 });
+
+    std::vector<std::shared_ptr<TableGeneric> > T;
+    for (int t = 0; t < tables; ++t)
+        T.push_back(generic_table("dynamic_auto_level_" + std::to_string(t), data[t], t == 0 ? 2 : 1, t + 1 < tables ? 2 : 1));
+
+    DynamicIndex index(tables);
+    for (int t = 0; t < tables; ++t)
+        index.add_Table(t, T[t], t == 1 ? rows : 100);
+    index.seed(1);
+    int picked = index.initialize_auto(0, 0.05, 1);
+    std::cout << "picked DP level " << picked << std::endl;
+    TEST_CHECK(picked == 1);
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
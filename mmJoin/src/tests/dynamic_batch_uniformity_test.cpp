@@ -0,0 +1,72 @@
+// DynamicIndex::sample_join_batch() must only keep the accepted walks.  It
+// relied on finish_walk(), which accepted every walk, so the failed and
+// rejected walks of a skewed join were kept and the samples were not
+// uniform.  Samples a cold index with DP level 2, which rejects walks above
+// the DP level until it learned the weights.
+
+#include <cmath>
+
+#include "test_util.h"
+#include "database/DynamicIndex.h"
+
+int main()
+{
+    // A(y) - B(y, z) - C(z), the values of B.y and C.z are skewed
+    std::mt19937 gen(11);
+    auto skewed = [&gen](int domain) -> int64_t {
+        int64_t v = gen() % domain;
+        return v * v / domain;
+    };
+    std::vector<std::pair<int64_t, int64_t> > a(60), b(60), c(60);
+    for (auto &row : a)
+        row = { 0, gen() % 12 };
+    for (auto &row : b)
+        row = { skewed(12), gen() % 12 };
+    for (auto &row : c)
+        row = { skewed(12), 0 };
+
+    std::map<std::vector<int>, int64_t> counts;
+    for (int i = 0; i < (int) a.size(); ++i)
+        for (int j = 0; j < (int) b.size(); ++j)
+            for (int k = 0; a[i].second == b[j].first && k < (int) c.size(); ++k)
+                if (b[j].second == c[k].first)
+                    counts[{ i, j, k }] = 0;
+    const size_t results = counts.size();
+    TEST_CHECK(results > 0);
+
+    DynamicIndex index(3);
+    index.add_Table(0, generic_table("dynamic_batch_a", a, 2, 2), 1000000);
+    index.add_Table(1, generic_table("dynamic_batch_b", b, 1, 2), 1000);
+    index.add_Table(2, generic_table("dynamic_batch_c", c, 1, 1), 100);
+    index.seed(3);
+    TEST_CHECK(index.initialize(2) == 0);
+
+    std::vector<std::vector<int> > output;
+    CounterRng rng = index.walker_rng(0);
+    const size_t samples = 100 * results;
+    size_t walks = 0;
+    while (output.size() < samples) {
+        size_t before = output.size();
+        size_t accepted = index.sample_join_batch(1024, output, rng);
+        TEST_CHECK(output.size() == before + accepted);
+        walks += 1024;
+    }
+    std::cout << "walks " << walks << " accepted " << output.size() << std::endl;
+    TEST_CHECK(output.size() < walks);
+
+    for (auto &sample : output) {
+        auto it = counts.find(sample);
+        TEST_CHECK(it != counts.end());
+        ++it->second;
+    }
+
+    // about 5 standard deviations above the mean of the chi-square
+    // distribution with results - 1 degrees of freedom
+    double df = results - 1;
+    double chi2 = chi_square_uniform(counts, results);
+    std::cout << "results " << results << " chi2 " << chi2 << " df " << df << std::endl;
+    TEST_CHECK(chi2 < df + 5 * std::sqrt(2 * df));
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
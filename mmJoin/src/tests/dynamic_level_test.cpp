@@ -0,0 +1,88 @@
+// DynamicLevel keeps its vertexes in open addressing tables, one per shard,
+// and allocates them and their Fenwick trees from an Arena of the shard.
+// The arena must hand out aligned, disjoint memory, and the level must
+// find the same vertex for a join value however many vertexes were added
+// since, from several threads at once, with the records of the value.
+
+#include <algorithm>
+#include <thread>
+
+#include "test_util.h"
+#include "database/DynamicLevel.h"
+#include "util/Arena.h"
+
+int main()
+{
+    // disjoint and aligned allocations, small and large
+    {
+        std::mt19937 gen(171);
+        Arena arena(4096);
+        std::vector<std::pair<unsigned char *, size_t> > blocks;
+        size_t bytes = 0;
+        for (int i = 0; i < 2000; ++i) {
+            size_t size = i % 100 == 0 ? 10000 : 1 + gen() % 300;
+            size_t alignment = size_t(1) << (gen() % 7);
+            auto p = (unsigned char *) arena.allocate(size, alignment);
+            TEST_CHECK((uintptr_t) p % alignment == 0);
+            std::fill(p, p + size, (unsigned char) i);
+            blocks.emplace_back(p, size);
+            bytes += size;
+        }
+        for (size_t i = 0; i < blocks.size(); ++i)
+            for (size_t j = 0; j < blocks[i].second; ++j)
+                TEST_CHECK(blocks[i].first[j] == (unsigned char) i);
+        TEST_CHECK(arena.allocated() == bytes);
+        TEST_CHECK(arena.reserved() >= bytes);
+
+        // containers work with and without an arena
+        std::vector<int64_t, ArenaAllocator<int64_t> > in_arena{ ArenaAllocator<int64_t>(&arena) };
+        std::vector<int64_t, ArenaAllocator<int64_t> > on_heap;
+        for (int64_t i = 0; i < 10000; ++i) {
+            in_arena.push_back(i);
+            on_heap.push_back(i);
+        }
+        for (int64_t i = 0; i < 10000; ++i)
+            TEST_CHECK(in_arena[i] == i && on_heap[i] == i);
+        TEST_CHECK(arena.allocated() > bytes);
+    }
+
+    // 5000 join values with 3 records each, looked up by 4 threads at once
+    const int64_t values = 5000;
+    const int64_t max_AGM = 7;
+    std::vector<std::pair<int64_t, int64_t> > rows;
+    for (int64_t i = 0; i < 3 * values; ++i)
+        rows.push_back({ i % values, i });
+    DynamicLevel level(generic_table("dynamic_level", rows, 1, 2), max_AGM);
+
+    const int threads = 4;
+    std::vector<std::vector<DynamicVertex *> > found(threads, std::vector<DynamicVertex *>(values + 10));
+    std::vector<std::thread> thread_list;
+    for (int t = 0; t < threads; ++t) {
+        thread_list.emplace_back([&level, &found, t]() {
+            // each thread in its own order, 10 values without records
+            std::vector<int64_t> order(values + 10);
+            for (int64_t i = 0; i < values + 10; ++i)
+                order[i] = i;
+            std::shuffle(order.begin(), order.end(), std::mt19937(t));
+            for (int64_t v : order)
+                found[t][v] = level.get_vertex(v);
+        });
+    }
+    for (auto &thread : thread_list)
+        thread.join();
+
+    TEST_CHECK(level.size() == (size_t) values + 10);
+    TEST_CHECK(level.memory() > (size_t) values * sizeof(DynamicVertex));
+    for (int64_t v = 0; v < values + 10; ++v) {
+        DynamicVertex *vertex = found[0][v];
+        TEST_CHECK(vertex != nullptr && vertex->m_value == v);
+        for (int t = 1; t < threads; ++t)
+            TEST_CHECK(found[t][v] == vertex);
+        TEST_CHECK(level.get_vertex(v) == vertex);
+        TEST_CHECK(vertex->get_weight() == (v < values ? 3 * max_AGM : 0));
+        TEST_CHECK(vertex->weights.size() == (v < values ? 3u : 0u));
+    }
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
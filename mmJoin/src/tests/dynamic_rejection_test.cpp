@@ -0,0 +1,49 @@
+// DynamicIndex::finish_walk() cleared the status of a walk before it
+// compared it with GOOD, so every failed or rejected walk was accepted and
+// sample_until() returned partial walks.  A cold index with a DP level
+// above 1 fails and rejects walks at the levels above the DP level.
+
+#include <set>
+
+#include "test_util.h"
+#include "database/DynamicIndex.h"
+
+int main()
+{
+    // A(y) - B(y, z) - C(z): B only has half of the values of A.y
+    std::mt19937 gen(7);
+    std::vector<std::pair<int64_t, int64_t> > a(200), b(200), c(200);
+    for (auto &row : a)
+        row = { 0, gen() % 20 };
+    for (auto &row : b)
+        row = { 2 * (gen() % 10), gen() % 20 };
+    for (auto &row : c)
+        row = { gen() % 20, 0 };
+
+    std::set<std::vector<int> > truth;
+    for (int i = 0; i < (int) a.size(); ++i)
+        for (int j = 0; j < (int) b.size(); ++j)
+            for (int k = 0; a[i].second == b[j].first && k < (int) c.size(); ++k)
+                if (b[j].second == c[k].first)
+                    truth.insert({ i, j, k });
+    TEST_CHECK(!truth.empty());
+
+    DynamicIndex index(3);
+    index.add_Table(0, generic_table("dynamic_rejection_a", a, 2, 2), 1000000);
+    index.add_Table(1, generic_table("dynamic_rejection_b", b, 1, 2), 1000);
+    index.add_Table(2, generic_table("dynamic_rejection_c", c, 1, 1), 100);
+    index.seed(1);
+    TEST_CHECK(index.initialize(2) == 0);
+
+    std::vector<std::vector<int> > output;
+    SampleReport report = index.sample_until(Deadline(std::chrono::seconds(60)), output, 2000);
+    std::cout << "attempts " << report.attempts << " accepted " << report.accepted << std::endl;
+    TEST_CHECK(report.accepted == 2000 && !report.expired);
+    TEST_CHECK(report.accepted < report.attempts);
+    TEST_CHECK(output.size() == report.accepted);
+    for (auto &sample : output)
+        TEST_CHECK(truth.count(sample) == 1);
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,58 @@
+// The walks of DynamicTreeIndex must be uniform while the bounds are still
+// loose.  A leaf record used to be accepted whatever its bound, so once a
+// walk had tightened one record of a leaf vertex to 1 the records left at
+// max_AGM were drawn more often.  Every fresh index starts from the bounds,
+// so the first samples of many indexes show the bias.
+
+#include <cmath>
+
+#include "test_util.h"
+#include "database/DynamicTreeIndex.h"
+
+int main()
+{
+    // A(x, y) joins B(x, u) on x and C(y, v) on y, B and C are leaves
+    auto A = random_table(30, 2, 4, 11);
+    auto B = random_table(12, 2, 4, 12);
+    auto C = random_table(12, 2, 4, 13);
+
+    std::map<std::vector<int64_t>, int64_t> counts;
+    for (int a = 0; a < A->row_count(); ++a)
+        for (int b = 0; b < B->row_count(); ++b)
+            for (int c = 0; c < C->row_count(); ++c)
+                if (A->get_int64(a, 0) == B->get_int64(b, 0) && A->get_int64(a, 1) == C->get_int64(c, 0))
+                    counts[{ a, b, c }] = 0;
+    const size_t results = counts.size();
+    TEST_CHECK(results > 0);
+
+    const int indexes = 4000;
+    const int samples_per_index = 3;
+    std::vector<int64_t> out;
+    for (int i = 0; i < indexes; ++i) {
+        DynamicTreeIndex index;
+        index.seed(i);
+        TEST_CHECK(index.AddTable(A, 0, 0, 0) == 0);
+        TEST_CHECK(index.AddTable(B, 0, 0, 0, 5) == 1);
+        TEST_CHECK(index.AddTable(C, 0, 1, 0, 5) == 2);
+        TEST_CHECK(index.initialize(10) == 0);
+
+        for (int accepted = 0; accepted < samples_per_index; ) {
+            if (!index.sample_join(out))
+                continue;
+            auto it = counts.find(out);
+            TEST_CHECK(it != counts.end());
+            ++it->second;
+            ++accepted;
+        }
+    }
+
+    // about 5 standard deviations above the mean of the chi-square
+    // distribution with results - 1 degrees of freedom
+    double df = results - 1;
+    double chi2 = chi_square_uniform(counts, results);
+    std::cout << "results " << results << " chi2 " << chi2 << " df " << df << std::endl;
+    TEST_CHECK(chi2 < df + 5 * std::sqrt(2 * df));
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,101 @@
+// FenwickTree keeps the prefix sums of its weights in nodes of a cache
+// line, with SIMD searches and updates when AVX2 is available.  For every
+// size around the node boundaries, with zero weights among them, get(),
+// prefix(), total() and find() must agree with a plain array of the
+// weights after building, updates, multiply() and divide(), copies and
+// moves, and with the weights in an arena.
+
+#include "test_util.h"
+#include "util/Arena.h"
+#include "util/FenwickTree.h"
+
+template <typename Tree>
+static void check(const Tree &tree, const std::vector<typename Tree::value_type> &weights)
+{
+    typedef typename Tree::value_type T;
+    TEST_CHECK(tree.size() == weights.size());
+    TEST_CHECK(tree.values() == weights);
+    std::vector<T> prefix(weights.size() + 1, 0);
+    for (size_t i = 0; i < weights.size(); ++i) {
+        prefix[i + 1] = prefix[i] + weights[i];
+        TEST_CHECK(tree.get(i) == weights[i]);
+        TEST_CHECK(tree.prefix(i) == prefix[i]);
+    }
+    TEST_CHECK(tree.total() == prefix.back());
+    if (weights.empty())
+        return;
+
+    // every offset into the weights and a few past the total: the largest
+    // idx with prefix(idx) <= cumFreq
+    for (T cumFreq = 0; cumFreq < prefix.back() + 3; ++cumFreq) {
+        size_t expected = std::upper_bound(prefix.begin() + 1, prefix.end() - 1, cumFreq) - (prefix.begin() + 1);
+        T offset = cumFreq;
+        TEST_CHECK(tree.find(offset) == expected);
+        TEST_CHECK(offset == cumFreq - prefix[expected]);
+    }
+}
+
+template <typename Tree>
+static void check_all(std::mt19937_64 &gen, Tree empty)
+{
+    typedef typename Tree::value_type T;
+    const size_t lanes = Tree::lanes;
+    for (size_t size : { (size_t) 0, (size_t) 1, lanes - 1, lanes, lanes + 1, lanes * lanes - 1, lanes * lanes,
+             lanes * lanes + 1, 3 * lanes * lanes + 5, (size_t) 1500 }) {
+        // a third of the weights are 0
+        std::vector<T> weights(size);
+        for (auto &w : weights)
+            w = gen() % 3 == 0 ? 0 : (T) (gen() % 5);
+
+        Tree tree = empty;
+        tree.assign(weights.data(), weights.size());
+        check(tree, weights);
+
+        for (int i = 0; size > 0 && i < 100; ++i) {
+            size_t idx = gen() % size;
+            T value = (T) (gen() % 7);
+            if (i % 2 == 0) {
+                TEST_CHECK(tree.set(idx, value) == weights[idx]);
+                weights[idx] = value;
+            } else {
+                tree.add(idx, value);
+                weights[idx] += value;
+            }
+        }
+        check(tree, weights);
+
+        tree.multiply(6);
+        for (auto &w : weights)
+            w *= 6;
+        check(tree, weights);
+        tree.divide(4);
+        for (auto &w : weights)
+            w /= 4;
+        check(tree, weights);
+
+        Tree copy(tree);
+        check(copy, weights);
+        Tree moved(std::move(copy));
+        check(moved, weights);
+        TEST_CHECK(copy.empty());
+        copy = moved;
+        check(copy, weights);
+
+        tree.assign(size, 2);
+        check(tree, std::vector<T>(size, 2));
+    }
+}
+
+int main()
+{
+    std::mt19937_64 gen(181);
+    check_all(gen, FenwickTree64());
+    check_all(gen, FenwickTree32());
+
+    Arena arena(4096);
+    check_all(gen, FenwickTree<int64_t, ArenaAllocator<int64_t> >(ArenaAllocator<int64_t>(&arena)));
+    TEST_CHECK(arena.allocated() > 0);
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
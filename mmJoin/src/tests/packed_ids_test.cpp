@@ -0,0 +1,107 @@
+// CompressRecords() replaces the record id lists of the larger vertexes by
+// a jefastPackedIds.  Every id must read back as it was, for any length
+// and spread of the ids, and a compressed index must report the same join
+// results as an uncompressed one and reject Insert() and Delete().
+
+#include <limits>
+
+#include "test_util.h"
+#include "database/jefastBuilder.h"
+#include "database/jefastIndex.h"
+#include "database/jefastPackedIds.h"
+
+typedef std::vector<std::pair<std::vector<int64_t>, std::vector<weight_t> > > results_t;
+
+static results_t enumerate(jefastIndexBase &index)
+{
+    results_t results;
+    std::vector<int64_t> out;
+    for (weight_t i = 0; i < index.GetTotal(); ++i) {
+        auto weights = index.GetJoinNumberWithWeights(i, out);
+        results.emplace_back(out, weights);
+    }
+    return results;
+}
+
+// true if f() throws a message, as the index does for unsupported calls
+template <typename F>
+static bool throws(F f)
+{
+    try {
+        f();
+    } catch (const char *) {
+        return true;
+    }
+    return false;
+}
+
+int main()
+{
+    std::mt19937_64 gen(131);
+    const jfkey_t largest = std::numeric_limits<jfkey_t>::max();
+    for (size_t size : { 0, 1, 127, 128, 129, 1000 }) {
+        // no spread, small, 40 bits and the whole range of jfkey_t
+        for (jfkey_t spread : { jfkey_t(0), jfkey_t(100), jfkey_t(1) << 40, largest }) {
+            std::vector<jfkey_t> ids(size);
+            for (size_t i = 0; i < size; ++i)
+                ids[i] = spread == largest ? (jfkey_t) (gen() >> 1) : 5000 + (jfkey_t) (gen() % (uint64_t(spread) + 1));
+            if (size > 2 && spread == largest) {
+                ids[1] = 0;
+                ids[2] = largest;
+            }
+
+            jefastPackedIds packed(ids);
+            TEST_CHECK(packed.size() == size);
+            for (size_t i = 0; i < size; ++i)
+                TEST_CHECK(packed[i] == ids[i]);
+            if (size == 1000 && spread == 100)
+                TEST_CHECK(packed.memory() < size * sizeof(jfkey_t) / 4);
+        }
+    }
+
+    // T0(x, y) - T1(y, z) - T2(z, w), few join values so the vertexes
+    // have many records
+    const int rows = 60;
+    std::vector<std::shared_ptr<Int64CSVTable> > T;
+    for (int t = 0; t < 3; ++t)
+        T.push_back(random_table(rows, 2, 3, 141 + t));
+    for (int fork = 0; fork < 2; ++fork) {
+        std::shared_ptr<jefastIndexBase> plain, packed;
+        for (int compress = 0; compress < 2; ++compress) {
+            JefastBuilder builder;
+            builder.SetRowWeight(1, [](int64_t row) -> weight_t { return row % 3; });
+            std::shared_ptr<jefastIndexBase> index;
+            if (fork) {
+                builder.AddTableToFork(T[0], -1, -1, -1);
+                builder.AddTableToFork(T[1], 0, 1, 0);
+                builder.AddTableToFork(T[2], 0, 1, 1);
+                index = builder.BuildFork();
+            } else {
+                builder.AppendTable(T[0], -1, 1, 0);
+                builder.AppendTable(T[1], 0, 1, 1);
+                builder.AppendTable(T[2], 0, -1, 2);
+                index = builder.Build();
+            }
+            TEST_CHECK(index != nullptr);
+            if (compress)
+                index->CompressRecords(8);
+            (compress ? packed : plain) = index;
+        }
+        const results_t truth = enumerate(*plain);
+        TEST_CHECK(!truth.empty());
+        TEST_CHECK(enumerate(*packed) == truth);
+
+        // linked as well
+        packed->LinkChildren();
+        TEST_CHECK(enumerate(*packed) == truth);
+
+        if (!fork) {
+            auto linear = std::dynamic_pointer_cast<jefastIndexLinear>(packed);
+            TEST_CHECK(throws([&] { linear->Delete(1, 0); }));
+            TEST_CHECK(throws([&] { linear->Insert(1, 0); }));
+        }
+    }
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
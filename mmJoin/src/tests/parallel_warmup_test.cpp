@@ -0,0 +1,51 @@
+// DynamicIndex::warmup() splits the walks of the warmup among threads, and
+// the walks from each vertex draw from their own stream of the seed.  The
+// weights it learns, and so the checkpoint of the index, must not depend
+// on the number of threads, for any DP level.
+
+#include <sstream>
+
+#include "test_util.h"
+#include "database/DynamicIndex.h"
+
+int main()
+{
+    // A(y) - B(y, z) - C(z, w) - D(w), with many join values so that every
+    // thread gets vertexes
+    std::mt19937 gen(61);
+    std::vector<std::pair<int64_t, int64_t> > a(300), b(300), c(300), d(300);
+    for (auto &row : a)
+        row = { 0, gen() % 100 };
+    for (auto &row : b)
+        row = { gen() % 100, gen() % 100 };
+    for (auto &row : c)
+        row = { gen() % 100, gen() % 100 };
+    for (auto &row : d)
+        row = { gen() % 100, 0 };
+    std::vector<std::shared_ptr<TableGeneric> > tables = {
+        generic_table("parallel_warmup_a", a, 2, 2),
+        generic_table("parallel_warmup_b", b, 1, 2),
+        generic_table("parallel_warmup_c", c, 1, 2),
+        generic_table("parallel_warmup_d", d, 1, 1),
+    };
+
+    for (int level = 1; level <= 3; ++level) {
+        std::vector<std::string> checkpoints;
+        for (unsigned threads : { 1, 2, 4, 7 }) {
+            DynamicIndex index(tables.size());
+            for (size_t i = 0; i < tables.size(); ++i)
+                index.add_Table(i, tables[i], 1000);
+            index.seed(71);
+            TEST_CHECK(index.initialize(level) == 0);
+            index.warmup(threads);
+            std::ostringstream out;
+            TEST_CHECK(index.save_checkpoint(out) == 0);
+            checkpoints.push_back(out.str());
+        }
+        for (auto &checkpoint : checkpoints)
+            TEST_CHECK(checkpoint == checkpoints[0]);
+    }
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,104 @@
+// JefastPlanner finds the join tree of an acyclic join from its join
+// predicates and roots it at the table with the smallest estimated index.
+// The index it builds must hold exactly the join results, whatever order
+// the tables and predicates were given in, and cyclic, disconnected or
+// composite key joins must not be planned.
+
+#include "test_util.h"
+#include "database/jefastPlanner.h"
+
+int main()
+{
+    const int rows = 12;
+    // A(a, b), B(b, c), C(b, d), D(c, e): B, C and A join on b, B and D on c
+    std::vector<std::shared_ptr<Int64CSVTable> > T;
+    for (int t = 0; t < 4; ++t)
+        T.push_back(random_table(rows, 2, 4, 111 + t));
+
+    std::map<std::vector<int64_t>, int64_t> truth;
+    std::vector<int64_t> r(4);
+    for (r[0] = 0; r[0] < rows; ++r[0])
+        for (r[1] = 0; r[1] < rows; ++r[1])
+            for (r[2] = 0; r[2] < rows; ++r[2])
+                for (r[3] = 0; r[3] < rows; ++r[3]) {
+                    int64_t b = T[1]->get_int64(r[1], 0);
+                    if (T[0]->get_int64(r[0], 1) == b && T[2]->get_int64(r[2], 0) == b
+                        && T[1]->get_int64(r[1], 1) == T[3]->get_int64(r[3], 0))
+                        truth[r] = 1;
+                }
+    TEST_CHECK(!truth.empty());
+
+    // the tables in two orders, with the b predicates chained differently
+    for (int order = 0; order < 2; ++order) {
+        JefastPlanner planner;
+        std::vector<int> id(4);
+        for (int i = 0; i < 4; ++i) {
+            int t = order ? 3 - i : i;
+            id[t] = planner.AddTable(T[t]);
+        }
+        if (order) {
+            TEST_CHECK(planner.AddJoinPredicate(id[3], 0, id[1], 1) >= 0);
+            TEST_CHECK(planner.AddJoinPredicate(id[2], 0, id[0], 1) >= 0);
+            TEST_CHECK(planner.AddJoinPredicate(id[0], 1, id[1], 0) >= 0);
+        } else {
+            TEST_CHECK(planner.AddJoinPredicate(id[0], 1, id[1], 0) >= 0);
+            TEST_CHECK(planner.AddJoinPredicate(id[1], 0, id[2], 0) >= 0);
+            TEST_CHECK(planner.AddJoinPredicate(id[1], 1, id[3], 0) >= 0);
+        }
+        TEST_CHECK(planner.AddJoinPredicate(id[0], 0, 4, 0) == -1);
+        TEST_CHECK(planner.Plan());
+
+        // the root has the smallest estimate
+        double smallest = planner.EstimateIndexMemory(planner.GetRoot());
+        for (int t = 0; t < 4; ++t)
+            TEST_CHECK(smallest <= planner.EstimateIndexMemory(id[t]));
+        TEST_CHECK(planner.GetTableNumber(planner.GetRoot()) == 0);
+
+        auto index = planner.Build();
+        TEST_CHECK(index != nullptr);
+        std::map<std::vector<int64_t>, int64_t> results;
+        std::vector<int64_t> out;
+        for (weight_t i = 0; i < index->GetTotal(); ++i) {
+            index->GetJoinNumber(i, out);
+            std::vector<int64_t> result(4);
+            for (int t = 0; t < 4; ++t)
+                result[t] = out[planner.GetTableNumber(id[t])];
+            ++results[result];
+        }
+        TEST_CHECK(results == truth);
+    }
+
+    // A - B - C - A is cyclic
+    {
+        JefastPlanner planner;
+        for (int t = 0; t < 3; ++t)
+            planner.AddTable(T[t]);
+        planner.AddJoinPredicate(0, 1, 1, 0);
+        planner.AddJoinPredicate(1, 1, 2, 0);
+        planner.AddJoinPredicate(2, 1, 0, 0);
+        TEST_CHECK(!planner.Plan());
+        TEST_CHECK(planner.Build() == nullptr);
+    }
+
+    // C is not joined with A - B
+    {
+        JefastPlanner planner;
+        for (int t = 0; t < 3; ++t)
+            planner.AddTable(T[t]);
+        planner.AddJoinPredicate(0, 1, 1, 0);
+        TEST_CHECK(!planner.Plan());
+    }
+
+    // A and B join on both of their columns
+    {
+        JefastPlanner planner;
+        planner.AddTable(T[0]);
+        planner.AddTable(T[1]);
+        planner.AddJoinPredicate(0, 0, 1, 0);
+        planner.AddJoinPredicate(0, 1, 1, 1);
+        TEST_CHECK(!planner.Plan());
+    }
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,104 @@
+// JefastBuilder::SetPrimaryKeyDetection() scans the join column of a table
+// to find out whether it is unique.  The level signatures of the level cache
+// and the levels both asked for every table, and each call scanned the
+// column again.  A build must scan each column once, and still find the
+// same primary key levels.
+
+#include "test_util.h"
+#include "database/jefastBuilder.h"
+#include "database/jefastIndex.h"
+#include "database/jefastLevelCache.h"
+
+// a table counting the reads of its columns
+class CountingTable : public TableGeneric_encap
+{
+public:
+    CountingTable(std::shared_ptr<TableGenericBase> table) : TableGeneric_encap(table), m_reads(0) {}
+
+    const std::vector<jfkey_t>::iterator get_key_iterator(int column)
+    {
+        ++m_reads;
+        return TableGeneric_encap::get_key_iterator(column);
+    }
+
+    int m_reads;
+};
+
+typedef std::map<std::vector<int64_t>, int64_t> weighted_t;
+
+// how many join numbers map to each join result
+static weighted_t enumerate(jefastIndexBase &index, size_t tables)
+{
+    weighted_t results;
+    std::vector<int64_t> out;
+    for (weight_t i = 0; i < index.GetTotal(); ++i) {
+        index.GetJoinNumber(i, out);
+        ++results[std::vector<int64_t>(out.begin(), out.begin() + tables)];
+    }
+    return results;
+}
+
+int main()
+{
+    // T0(x, y) - T1(y, z) - T2(z, w) - T3(w, v), T2.z and T3.w are unique
+    const int tables = 4;
+    const int64_t rows = 30;
+    std::vector<std::vector<std::pair<int64_t, int64_t> > > data(tables);
+    for (int64_t i = 0; i < rows; ++i) {
+        data[0].push_back({ 0, i % 10 });
+        data[1].push_back({ i % 10, i });
+        data[2].push_back({ i, i % 7 });
+        data[3].push_back({ i, 0 });
+    }
+
+    std::vector<std::shared_ptr<CountingTable> > T;
+    for (int t = 0; t < tables; ++t)
+        T.push_back(std::make_shared<CountingTable>(generic_table("primary_key_detection_" + std::to_string(t), data[t],
+            t == 0 ? 2 : 1, t + 1 < tables ? 2 : 1)));
+
+    // the column reads of a linear and a fork build of the chain, and the
+    // join results they index
+    auto build = [&](bool detect, bool fork, std::vector<int> &reads, weighted_t &results) {
+        for (auto &table : T)
+            table->m_reads = 0;
+        JefastBuilder builder;
+        builder.SetLevelCache(std::make_shared<JefastLevelCache>());
+        builder.SetPrimaryKeyDetection(detect);
+        std::shared_ptr<jefastIndexBase> index;
+        if (fork) {
+            builder.AddTableToFork(T[0], -1, -1, -1);
+            for (int t = 1; t < tables; ++t)
+                builder.AddTableToFork(T[t], 0, 1, t - 1);
+            index = builder.BuildFork();
+        } else {
+            builder.AppendTable(T[0], -1, 1, 0);
+            for (int t = 1; t < tables; ++t)
+                builder.AppendTable(T[t], 0, t + 1 < tables ? 1 : -1, t);
+            index = builder.Build();
+        }
+        TEST_CHECK(index != nullptr);
+        reads.clear();
+        for (auto &table : T)
+            reads.push_back(table->m_reads);
+        results = enumerate(*index, tables);
+    };
+
+    for (int fork = 0; fork < 2; ++fork) {
+        std::vector<int> plain_reads, detect_reads;
+        weighted_t plain, detected;
+        build(false, fork == 1, plain_reads, plain);
+        build(true, fork == 1, detect_reads, detected);
+        TEST_CHECK(!plain.empty());
+        TEST_CHECK(detected == plain);
+
+        // the start level joins T0 with T1 and is never a primary key
+        // level, the tables below it are scanned once
+        for (int t = 0; t < tables; ++t) {
+            std::cout << "table " << t << " reads " << plain_reads[t] << " " << detect_reads[t] << std::endl;
+            TEST_CHECK(detect_reads[t] - plain_reads[t] == (t >= 2 ? 1 : 0));
+        }
+    }
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,90 @@
+// JefastRangeEnumerator seeks to a join number once and then steps to the
+// next ones odometer-style.  It must report the same join results in the
+// same order as GetJoinNumber(), for linear and fork indexes and with
+// primary key levels, and EnumerateJoinParallel() must visit every join
+// result exactly once whatever the number of threads.
+
+#include "test_util.h"
+#include "database/jefastBuilder.h"
+#include "database/jefastIndex.h"
+#include "database/jefastRangeEnumerator.h"
+
+int main()
+{
+    const int rows = 20;
+    // T0(x, y) - T1(y, z) - T2(z, w) - T3(w, v), the fork has T3 below T1.
+    // T3.w is unique.
+    std::vector<std::shared_ptr<Int64CSVTable> > T;
+    for (int t = 0; t < 3; ++t)
+        T.push_back(random_table(rows, 2, 5, 101 + t));
+    {
+        std::vector<std::vector<double> > data;
+        for (int i = 0; i < 5; ++i)
+            data.push_back({ double(i), double(i * 7 % 5) });
+        T.push_back(std::make_shared<Int64CSVTable>());
+        T.back()->load(data, 2);
+    }
+
+    for (int fork = 0; fork < 2; ++fork) {
+        for (int detect = 0; detect < 2; ++detect) {
+            JefastBuilder builder;
+            builder.SetPrimaryKeyDetection(detect == 1);
+            std::shared_ptr<jefastIndexLinear> linear;
+            std::shared_ptr<jefastIndexFork> forked;
+            if (fork) {
+                builder.AddTableToFork(T[0], -1, -1, -1);
+                builder.AddTableToFork(T[1], 0, 1, 0);
+                builder.AddTableToFork(T[2], 0, 1, 1);
+                builder.AddTableToFork(T[3], 0, 0, 1);
+                forked = builder.BuildFork();
+                TEST_CHECK(forked != nullptr);
+            } else {
+                builder.AppendTable(T[0], -1, 1, 0);
+                builder.AppendTable(T[1], 0, 1, 1);
+                builder.AppendTable(T[2], 0, 1, 2);
+                builder.AppendTable(T[3], 0, -1, 3);
+                linear = builder.Build();
+                TEST_CHECK(linear != nullptr);
+            }
+            jefastIndexBase &index = fork ? (jefastIndexBase &) *forked : (jefastIndexBase &) *linear;
+            const weight_t total = index.GetTotal();
+            TEST_CHECK(total > 0);
+
+            std::vector<std::vector<int64_t> > truth(total);
+            for (weight_t i = 0; i < total; ++i)
+                index.GetJoinNumber(i, truth[i]);
+
+            // step from a few starting points to the end
+            for (weight_t start : { (weight_t) 0, total / 3, total - 1 }) {
+                std::unique_ptr<JefastRangeEnumerator> enumerator(fork
+                    ? new JefastRangeEnumerator(*forked) : new JefastRangeEnumerator(*linear));
+                TEST_CHECK(enumerator->GetTotal() == total);
+                enumerator->Seek(start);
+                for (weight_t i = start; i < total; ++i) {
+                    TEST_CHECK(enumerator->getRecord() == truth[i]);
+                    TEST_CHECK(enumerator->Step() == (i + 1 < total));
+                }
+            }
+
+            for (int threads : { 1, 3, 7, (int) total + 2 }) {
+                std::vector<std::vector<std::vector<int64_t> > > visited(threads);
+                auto visit = [&visited](int thread_id, const std::vector<int64_t> &record) {
+                    visited[thread_id].push_back(record);
+                };
+                if (fork)
+                    EnumerateJoinParallel(*forked, threads, visit);
+                else
+                    EnumerateJoinParallel(*linear, threads, visit);
+
+                // the ranges of the threads follow each other
+                std::vector<std::vector<int64_t> > all;
+                for (auto &v : visited)
+                    all.insert(all.end(), v.begin(), v.end());
+                TEST_CHECK(all == truth);
+            }
+        }
+    }
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
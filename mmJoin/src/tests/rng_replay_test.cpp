@@ -0,0 +1,107 @@
+// Every walk of DynamicIndex draws its random numbers from a CounterRng,
+// the warmup from streams of the seed and sample_join() from the generator
+// it is given.  Two indexes with the same seed and the same calls must draw
+// the same walks, also when several walkers take turns, and
+// different walkers of a seed must draw different ones.
+
+#include "test_util.h"
+#include "database/DynamicIndex.h"
+
+static std::shared_ptr<DynamicIndex> build(const std::vector<std::shared_ptr<TableGeneric> > &tables, uint64_t seed)
+{
+    auto index = std::make_shared<DynamicIndex>(tables.size());
+    for (size_t i = 0; i < tables.size(); ++i)
+        index->add_Table(i, tables[i], 100);
+    index->seed(seed);
+    TEST_CHECK(index->initialize(2) == 0);
+    index->warmup(1);
+    return index;
+}
+
+// the outcome and the record ids of `walks` walks
+static std::vector<std::vector<int> > draw(DynamicIndex &index, CounterRng &rng, int walks)
+{
+    std::vector<std::vector<int> > out;
+    std::vector<int> sample(3);
+    for (int i = 0; i < walks; ++i) {
+        std::fill(sample.begin(), sample.end(), -1);
+        bool accepted = index.sample_join(sample, rng);
+        out.push_back(sample);
+        out.back().push_back(accepted);
+    }
+    return out;
+}
+
+int main()
+{
+    // the generator is a pure function of seed, stream and position
+    {
+        CounterRng a(7, 3), b(7, 3), other_stream(7, 4), other_seed(8, 3);
+        TEST_CHECK(a.position() == 0);
+        std::vector<uint64_t> first;
+        for (int i = 0; i < 10; ++i)
+            first.push_back(a());
+        TEST_CHECK(a.position() == 10);
+        for (int i = 0; i < 10; ++i)
+            TEST_CHECK(b() == first[i]);
+        TEST_CHECK(other_stream() != first[0] && other_seed() != first[0]);
+
+        CounterRng skipped(7, 3);
+        skipped.discard(4);
+        TEST_CHECK(skipped.position() == 4);
+        TEST_CHECK(skipped() == first[4]);
+    }
+
+    // A(y) - B(y, z) - C(z)
+    std::mt19937 gen(31);
+    std::vector<std::pair<int64_t, int64_t> > a(40), b(40), c(40);
+    for (auto &row : a)
+        row = { 0, gen() % 8 };
+    for (auto &row : b)
+        row = { gen() % 8, gen() % 8 };
+    for (auto &row : c)
+        row = { gen() % 8, 0 };
+    std::vector<std::shared_ptr<TableGeneric> > tables = {
+        generic_table("rng_replay_a", a, 2, 2),
+        generic_table("rng_replay_b", b, 1, 2),
+        generic_table("rng_replay_c", c, 1, 1),
+    };
+
+    // the same calls in the same order
+    auto first = build(tables, 17);
+    auto second = build(tables, 17);
+    CounterRng rng1 = first->walker_rng(0), rng2 = second->walker_rng(0);
+    auto walks = draw(*first, rng1, 500);
+    TEST_CHECK(draw(*second, rng2, 500) == walks);
+    TEST_CHECK(rng1.position() == rng2.position() && rng1.position() > 0);
+
+    // the generator of the index
+    std::vector<int> sample1(3), sample2(3);
+    for (int i = 0; i < 200; ++i) {
+        TEST_CHECK(first->sample_join(sample1) == second->sample_join(sample2));
+        TEST_CHECK(sample1 == sample2);
+    }
+
+    // two walkers interleaved the same way
+    {
+        auto one = build(tables, 23);
+        auto other = build(tables, 23);
+        CounterRng w0 = one->walker_rng(0), w1 = one->walker_rng(1);
+        CounterRng v0 = other->walker_rng(0), v1 = other->walker_rng(1);
+        for (int i = 0; i < 100; ++i) {
+            TEST_CHECK(draw(*one, w0, 1 + i % 3) == draw(*other, v0, 1 + i % 3));
+            TEST_CHECK(draw(*one, w1, 2) == draw(*other, v1, 2));
+        }
+    }
+
+    // another walker or seed draws other walks
+    auto third = build(tables, 17);
+    CounterRng rng3 = third->walker_rng(1);
+    TEST_CHECK(draw(*third, rng3, 500) != walks);
+    auto fourth = build(tables, 18);
+    CounterRng rng4 = fourth->walker_rng(0);
+    TEST_CHECK(draw(*fourth, rng4, 500) != walks);
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,90 @@
+// The semi-join reduction (JefastBuilder::SetSemiJoinReduction()) drops the
+// rows which are in no join result before the levels are built.  It walks
+// the join tree of JefastBuilder::join_tree(), so a linear join and a fork
+// whose children join different columns of their parent must still index
+// exactly their join results, with and without row weights.
+
+#include "test_util.h"
+#include "database/jefastBuilder.h"
+#include "database/jefastIndex.h"
+
+typedef std::map<std::vector<int64_t>, int64_t> weighted_t;
+
+// how many join numbers map to each join result
+static weighted_t enumerate(jefastIndexBase &index, size_t tables)
+{
+    weighted_t results;
+    std::vector<int64_t> out;
+    for (weight_t i = 0; i < index.GetTotal(); ++i) {
+        index.GetJoinNumber(i, out);
+        ++results[std::vector<int64_t>(out.begin(), out.begin() + tables)];
+    }
+    return results;
+}
+
+int main()
+{
+    const int rows = 12;
+    std::vector<std::shared_ptr<Int64CSVTable> > T;
+    for (int t = 0; t < 4; ++t)
+        T.push_back(random_table(rows, 2, 8, 61 + t));
+    auto weight = [](int64_t row) -> weight_t { return row % 3; };
+    auto get = [&](int t, int64_t row, int column) { return T[t]->get_int64(row, column); };
+
+    // T0(x, y) - T1(y, z) - T2(z, w) - T3(w, v), and the same rows as the
+    // fork T0 with the children T1 on T0.y and T3 on T0.x, and T2 below T1
+    weighted_t chain, fork, chain_weighted, fork_weighted;
+    std::vector<int64_t> r(4);
+    for (r[0] = 0; r[0] < rows; ++r[0])
+        for (r[1] = 0; r[1] < rows; ++r[1])
+            for (r[2] = 0; r[2] < rows; ++r[2])
+                for (r[3] = 0; r[3] < rows; ++r[3]) {
+                    bool t01 = get(0, r[0], 1) == get(1, r[1], 0);
+                    bool t12 = get(1, r[1], 1) == get(2, r[2], 0);
+                    int64_t w = weight(r[2]);
+                    if (t01 && t12 && get(2, r[2], 1) == get(3, r[3], 0)) {
+                        chain[r] = 1;
+                        if (w)
+                            chain_weighted[r] = w;
+                    }
+                    if (t01 && t12 && get(0, r[0], 0) == get(3, r[3], 1)) {
+                        fork[r] = 1;
+                        if (w)
+                            fork_weighted[r] = w;
+                    }
+                }
+    TEST_CHECK(!chain.empty() && !fork.empty());
+
+    for (int weighted = 0; weighted < 2; ++weighted) {
+        for (int reduce = 0; reduce < 2; ++reduce) {
+            JefastBuilder builder;
+            builder.SetSemiJoinReduction(reduce == 1);
+            builder.AppendTable(T[0], -1, 1, 0);
+            builder.AppendTable(T[1], 0, 1, 1);
+            builder.AppendTable(T[2], 0, 1, 2);
+            builder.AppendTable(T[3], 0, -1, 3);
+            if (weighted)
+                builder.SetRowWeight(2, weight);
+            auto index = builder.Build();
+            TEST_CHECK(index != nullptr);
+            TEST_CHECK(enumerate(*index, 4) == (weighted ? chain_weighted : chain));
+        }
+
+        for (int reduce = 0; reduce < 2; ++reduce) {
+            JefastBuilder builder;
+            builder.SetSemiJoinReduction(reduce == 1);
+            builder.AddTableToFork(T[0], -1, -1, -1);
+            builder.AddTableToFork(T[1], 0, 1, 0);
+            builder.AddTableToFork(T[2], 0, 1, 1);
+            builder.AddTableToFork(T[3], 1, 0, 0);
+            if (weighted)
+                builder.SetRowWeight(2, weight);
+            auto index = builder.BuildFork();
+            TEST_CHECK(index != nullptr);
+            TEST_CHECK(enumerate(*index, 4) == (weighted ? fork_weighted : fork));
+        }
+    }
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
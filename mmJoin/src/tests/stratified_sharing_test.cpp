@@ -0,0 +1,110 @@
+// BuildStratified() builds the levels below the grouping table once and
+// shares them between the strata through the level cache.  Checks that the
+// strata reuse those levels and still sample their own join results, and
+// that Insert() and Delete() throw instead of changing the shared levels.
+
+#include <set>
+
+#include "test_util.h"
+#include "database/jefastBuilder.h"
+#include "database/jefastLevelCache.h"
+#include "database/jefastStratifiedIndex.h"
+
+typedef std::map<int64_t, std::set<std::vector<int64_t> > > strata_t;
+
+// every stratum of `index` has the join results of `truth` with its key
+static void check_strata(jefastStratifiedIndex &index, strata_t &truth)
+{
+    TEST_CHECK(index.GetNumberOfStrata() == truth.size());
+    std::vector<std::vector<int64_t> > samples;
+    for (size_t h = 0; h < index.GetNumberOfStrata(); ++h) {
+        auto &results = truth[index.GetStratumKey(h)];
+        TEST_CHECK((size_t) index.GetStratumTotal(h) == results.size());
+        if (results.empty())
+            continue;
+        samples.clear();
+        index.GetRandomJoins(h, 200, samples);
+        for (auto &s : samples) {
+            // a fork index has one more entry than tables
+            s.resize(results.begin()->size());
+            TEST_CHECK(results.count(s) == 1);
+        }
+    }
+}
+
+int main()
+{
+    const int rows = 20;
+    auto A = random_table(rows, 2, 4, 21);
+    auto B = random_table(rows, 2, 4, 22);
+    auto C = random_table(rows, 2, 4, 23);
+    auto D = random_table(rows, 2, 4, 24);
+    auto stratum = [](int64_t row) -> int64_t { return row % 3; };
+
+    // A(x, y) - B(y, z) - C(z, w) - D(w, v), stratified on the rows of B:
+    // levels 1 (B-C) and 2 (C-D) are shared, level 0 is built per stratum
+    {
+        strata_t truth;
+        for (int b = 0; b < rows; ++b)
+            truth[stratum(b)];
+        for (int a = 0; a < rows; ++a)
+            for (int b = 0; b < rows; ++b)
+                for (int c = 0; c < rows; ++c)
+                    for (int d = 0; d < rows; ++d)
+                        if (A->get_int64(a, 1) == B->get_int64(b, 0) && B->get_int64(b, 1) == C->get_int64(c, 0)
+                            && C->get_int64(c, 1) == D->get_int64(d, 0))
+                            truth[stratum(b)].insert({ a, b, c, d });
+
+        auto cache = std::make_shared<JefastLevelCache>();
+        JefastBuilder builder;
+        builder.SetLevelCache(cache);
+        builder.AppendTable(A, -1, 1, 0);
+        builder.AppendTable(B, 0, 1, 1);
+        builder.AppendTable(C, 0, 1, 2);
+        builder.AppendTable(D, 0, -1, 3);
+        auto index = builder.BuildStratified(1, stratum);
+        TEST_CHECK(index != nullptr);
+        TEST_CHECK(cache->GetHits() == 2 * (truth.size() - 1));
+        check_strata(*index, truth);
+
+        for (size_t h = 0; h < index->GetNumberOfStrata(); ++h) {
+            auto linear = std::dynamic_pointer_cast<jefastIndexLinear>(index->GetStratumIndex(h));
+            TEST_CHECK(linear != nullptr);
+            bool thrown = false;
+            try {
+                linear->Delete(3, 0);
+            } catch (const char *) {
+                thrown = true;
+            }
+            TEST_CHECK(thrown);
+        }
+        check_strata(*index, truth);
+    }
+
+    // A(x, y) with children B(x, z) and C(y, w), stratified on the rows of
+    // A: only the virtual level is built per stratum
+    {
+        strata_t truth;
+        for (int a = 0; a < rows; ++a)
+            truth[stratum(a)];
+        for (int a = 0; a < rows; ++a)
+            for (int b = 0; b < rows; ++b)
+                for (int c = 0; c < rows; ++c)
+                    if (A->get_int64(a, 0) == B->get_int64(b, 0) && A->get_int64(a, 1) == C->get_int64(c, 0))
+                        truth[stratum(a)].insert({ a, b, c });
+
+        auto cache = std::make_shared<JefastLevelCache>();
+        JefastBuilder builder;
+        builder.SetLevelCache(cache);
+        builder.AddTableToFork(A, -1, -1, -1);
+        builder.AddTableToFork(B, 0, 0, 0);
+        builder.AddTableToFork(C, 0, 1, 0);
+        auto index = builder.BuildStratified(0, stratum);
+        TEST_CHECK(index != nullptr);
+        TEST_CHECK(cache->GetHits() == 2 * (truth.size() - 1));
+        check_strata(*index, truth);
+    }
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
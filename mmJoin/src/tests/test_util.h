@@ -0,0 +1,69 @@
+// Small helpers shared by the regression tests: random tables, a check
+// macro which fails the test and a chi-square statistic.
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "database/Int64CSVTable.h"
+#include "database/TableGeneric.h"
+
+#define TEST_CHECK(x) do { \
+        if (!(x)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #x << std::endl; \
+            std::exit(1); \
+        } \
+    } while (0)
+
+// a table of `rows` rows of `columns` values drawn from 0 .. domain - 1
+inline std::shared_ptr<Int64CSVTable> random_table(int rows, int columns, int domain, unsigned seed)
+{
+    std::mt19937 gen(seed);
+    std::vector<std::vector<double> > data(rows, std::vector<double>(columns));
+    for (auto &row : data)
+        for (auto &value : row)
+            value = gen() % domain;
+    auto table = std::make_shared<Int64CSVTable>();
+    table->load(data, columns);
+    return table;
+}
+
+// a TableGeneric of the (x, y) rows, which are written to `file` first.
+// column1 and column2 pick the columns as for the TableGeneric constructor:
+// 2, 2 for the first table of a chain, 1, 2 for the middle ones and 1, 1
+// for the last one.
+inline std::shared_ptr<TableGeneric> generic_table(const std::string &file, const std::vector<std::pair<int64_t, int64_t> > &rows,
+    int column1, int column2)
+{
+    {
+        std::ofstream out(file, std::ios::trunc);
+        for (auto &row : rows)
+            out << row.first << "|" << row.second << "\n";
+    }
+    auto table = std::make_shared<TableGeneric>(file, '|', column1, column2);
+    table->Build_indexes();
+    return table;
+}
+
+// the chi-square statistic of observed counts against a uniform
+// distribution over `categories` values
+template<typename Key>
+double chi_square_uniform(const std::map<Key, int64_t> &counts, size_t categories)
+{
+    int64_t total = 0;
+    for (auto &c : counts)
+        total += c.second;
+    double expected = (double) total / categories;
+    double chi2 = (categories - counts.size()) * expected;
+    for (auto &c : counts)
+        chi2 += (c.second - expected) * (c.second - expected) / expected;
+    return chi2;
+}
@@ -0,0 +1,95 @@
+// Build() and BuildFork() keep the weights of the index in weight_t when a
+// bound on them fits and fall back to wide_weight_t otherwise.  Checks that
+// a join of more than 2^64 results gets an exact wide index, and that a
+// small join still gets a weight_t one.
+
+#include <stdexcept>
+
+#include "test_util.h"
+#include "database/jefastBuilder.h"
+#include "database/jefastIndex.h"
+#include "database/jefastRangeEnumerator.h"
+
+// every join result of `tables` tables of `rows` rows with one join key
+static void check_samples(jefastIndexBase &index, int tables, int rows)
+{
+    std::vector<int64_t> sample;
+    for (int i = 0; i < 200; ++i) {
+        index.GetRandomJoin(sample);
+        TEST_CHECK(sample.size() >= (size_t) tables);
+        for (int t = 0; t < tables; ++t)
+            TEST_CHECK(sample[t] >= 0 && sample[t] < rows);
+    }
+}
+
+template <typename F>
+static bool throws_overflow(F f)
+{
+    try {
+        f();
+    } catch (std::overflow_error &) {
+        return true;
+    }
+    return false;
+}
+
+int main()
+{
+    // a wide index only throws if weight_t is narrower than its weights
+    const bool narrow = sizeof(weight_t) < sizeof(wide_weight_t);
+
+    // every row joins with every row, so the join has rows^tables results
+    const int tables = 6;
+    const int rows = 2000;
+    std::vector<std::shared_ptr<Int64CSVTable> > T;
+    for (int t = 0; t < tables; ++t)
+        T.push_back(random_table(rows, 2, 1, 31 + t));
+    wide_weight_t expected = 1;
+    for (int t = 0; t < tables; ++t)
+        expected *= rows;
+
+    // T0(x, y) - T1(y, z) - ... - T5(w, v)
+    {
+        JefastBuilder builder;
+        builder.AppendTable(T[0], -1, 1, 0);
+        for (int t = 1; t < tables; ++t)
+            builder.AppendTable(T[t], 0, t + 1 < tables ? 1 : -1, t);
+        auto index = builder.Build();
+        TEST_CHECK(index != nullptr);
+        TEST_CHECK(std::dynamic_pointer_cast<jefastIndexLinearT<wide_weight_t> >(index) != nullptr);
+        TEST_CHECK(index->GetWideTotal() == expected);
+        TEST_CHECK(throws_overflow([&] { index->GetTotal(); }) == narrow);
+        check_samples(*index, tables, rows);
+        TEST_CHECK(throws_overflow([&] { JefastRangeEnumerator enumerator(*index); }) == narrow);
+    }
+
+    // T0(x, y) with the children T1(x, z) ... T5(x, v)
+    {
+        JefastBuilder builder;
+        builder.AddTableToFork(T[0], -1, -1, -1);
+        for (int t = 1; t < tables; ++t)
+            builder.AddTableToFork(T[t], 0, 0, 0);
+        auto index = builder.BuildFork();
+        TEST_CHECK(index != nullptr);
+        TEST_CHECK(std::dynamic_pointer_cast<jefastIndexForkT<wide_weight_t> >(index) != nullptr);
+        TEST_CHECK(index->GetWideTotal() == expected);
+        TEST_CHECK(throws_overflow([&] { index->GetTotal(); }) == narrow);
+        check_samples(*index, tables, rows);
+    }
+
+    // a small join fits in weight_t
+    {
+        auto A = random_table(40, 2, 6, 41);
+        auto B = random_table(40, 2, 6, 42);
+        JefastBuilder builder;
+        builder.AppendTable(A, -1, 1, 0);
+        builder.AppendTable(B, 0, -1, 1);
+        auto index = builder.Build();
+        TEST_CHECK(index != nullptr);
+        TEST_CHECK(std::dynamic_pointer_cast<jefastIndexLinearT<weight_t> >(index) != nullptr);
+        TEST_CHECK((wide_weight_t) index->GetTotal() == index->GetWideTotal());
+    }
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,113 @@
+// GetRandomJoinsWithoutReplacement() draws distinct join numbers.  With row
+// weights a join result covers as many join numbers as its weight, so
+// drawing every join number must return each join result exactly that many
+// times.  Without row weights, or with the 0/1 weights masking the strata
+// of a jefastStratifiedIndex, the join results drawn are distinct.
+
+#include "test_util.h"
+#include "database/jefastBuilder.h"
+#include "database/jefastIndex.h"
+#include "database/jefastStratifiedIndex.h"
+
+typedef std::map<std::vector<int64_t>, int64_t> weighted_t;
+
+// how many times each join result was drawn
+static weighted_t draw(jefastIndexBase &index, size_t count, size_t tables)
+{
+    std::vector<std::vector<int64_t> > out;
+    index.GetRandomJoinsWithoutReplacement(count, out);
+    TEST_CHECK(out.size() == std::min<size_t>(count, (size_t) index.GetTotal()));
+    weighted_t results;
+    for (auto &o : out)
+        ++results[std::vector<int64_t>(o.begin(), o.begin() + tables)];
+    return results;
+}
+
+int main()
+{
+    const int tables = 3;
+    const int rows = 15;
+    std::vector<std::shared_ptr<Int64CSVTable> > T;
+    for (int t = 0; t < tables; ++t)
+        T.push_back(random_table(rows, 2, 4, 81 + t));
+    auto row_weight = [](int64_t row) -> weight_t { return row % 3; };
+
+    // T0(x, y) - T1(y, z) - T2(z, w), weighted by the rows of T1
+    weighted_t plain, weighted;
+    std::vector<int64_t> r(tables);
+    for (r[0] = 0; r[0] < rows; ++r[0])
+        for (r[1] = 0; r[1] < rows; ++r[1])
+            for (r[2] = 0; r[2] < rows; ++r[2]) {
+                if (T[0]->get_int64(r[0], 1) != T[1]->get_int64(r[1], 0)
+                    || T[1]->get_int64(r[1], 1) != T[2]->get_int64(r[2], 0))
+                    continue;
+                plain[r] = 1;
+                if (row_weight(r[1]) != 0)
+                    weighted[r] = row_weight(r[1]);
+            }
+    TEST_CHECK(!weighted.empty());
+
+    for (int fork = 0; fork < 2; ++fork) {
+        for (int weights = 0; weights < 2; ++weights) {
+            JefastBuilder builder;
+            std::shared_ptr<jefastIndexBase> index;
+            if (fork) {
+                builder.AddTableToFork(T[0], -1, -1, -1);
+                builder.AddTableToFork(T[1], 0, 1, 0);
+                builder.AddTableToFork(T[2], 0, 1, 1);
+                if (weights)
+                    builder.SetRowWeight(1, row_weight);
+                index = builder.BuildFork();
+            } else {
+                builder.AppendTable(T[0], -1, 1, 0);
+                builder.AppendTable(T[1], 0, 1, 1);
+                builder.AppendTable(T[2], 0, -1, 2);
+                if (weights)
+                    builder.SetRowWeight(1, row_weight);
+                index = builder.Build();
+            }
+            TEST_CHECK(index != nullptr);
+
+            // every join number, and more than there are
+            const weighted_t &truth = weights ? weighted : plain;
+            TEST_CHECK(draw(*index, (size_t) index->GetTotal() + 10, tables) == truth);
+
+            // part of them
+            weighted_t half = draw(*index, (size_t) index->GetTotal() / 2, tables);
+            for (auto &result : half)
+                TEST_CHECK(result.second <= truth.at(result.first));
+            if (!weights) {
+                for (auto &result : half)
+                    TEST_CHECK(result.second == 1);
+            }
+        }
+
+        // the strata by T1.z mask the rows with 0/1 row weights
+        JefastBuilder builder;
+        if (fork) {
+            builder.AddTableToFork(T[0], -1, -1, -1);
+            builder.AddTableToFork(T[1], 0, 1, 0);
+            builder.AddTableToFork(T[2], 0, 1, 1);
+        } else {
+            builder.AppendTable(T[0], -1, 1, 0);
+            builder.AppendTable(T[1], 0, 1, 1);
+            builder.AppendTable(T[2], 0, -1, 2);
+        }
+        auto strata = builder.BuildStratified(1, [&](int64_t row) { return T[1]->get_int64(row, 1); });
+        TEST_CHECK(strata != nullptr && strata->GetNumberOfStrata() > 1);
+        size_t drawn = 0;
+        for (size_t h = 0; h < strata->GetNumberOfStrata(); ++h) {
+            auto &index = *strata->GetStratumIndex(h);
+            weighted_t half = draw(index, (size_t) index.GetTotal() / 2 + 1, tables);
+            for (auto &result : half) {
+                TEST_CHECK(result.second == 1 && plain.count(result.first) == 1);
+                TEST_CHECK(T[1]->get_int64(result.first[1], 1) == strata->GetStratumKey(h));
+            }
+            drawn += draw(index, (size_t) index.GetTotal(), tables).size();
+        }
+        TEST_CHECK(drawn == plain.size());
+    }
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
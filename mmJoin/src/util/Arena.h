@@ -0,0 +1,130 @@
+// A bump pointer arena and an allocator for std containers on top of it.
+//
+// Arena hands out memory from large blocks and frees it all at once, when it
+// is destroyed.  deallocate() is a no-op, so objects which are created once
+// and live as long as their owner (e.g. the vertexes of a DynamicLevel) cost
+// a pointer increment each.  An Arena is not thread safe.
+//
+// ArenaAllocator<T> allocates from an arena, or from the heap if it was made
+// without one, so containers using it work with and without an arena.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <vector>
+
+class Arena {
+public:
+    explicit Arena(size_t block_size = 64 * 1024)
+        : m_block_size{ block_size }
+        , m_next{ nullptr }
+        , m_end{ nullptr }
+        , m_allocated{ 0 }
+    {}
+
+    Arena(const Arena&) = delete;
+    Arena &operator=(const Arena&) = delete;
+
+    void *allocate(size_t bytes, size_t alignment = alignof(std::max_align_t))
+    {
+        uintptr_t p = ((uintptr_t) m_next + alignment - 1) & ~(uintptr_t) (alignment - 1);
+        if (m_next == nullptr || p + bytes > (uintptr_t) m_end) {
+            // a large request gets a block of its own, so the current one
+            // keeps its free space
+            if (bytes + alignment > m_block_size / 4)
+                return new_block(bytes + alignment, alignment, bytes, false);
+            return new_block(m_block_size, alignment, bytes, true);
+        }
+        m_next = (char*) (p + bytes);
+        m_allocated += bytes;
+        return (void*) p;
+    }
+
+    // bytes handed out so far
+    size_t allocated() const {
+        return m_allocated;
+    }
+
+    // bytes reserved from the heap
+    size_t reserved() const {
+        size_t total = 0;
+        for (auto &b : m_blocks)
+            total += b.size;
+        return total;
+    }
+
+private:
+    struct block_t {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    // a block of size bytes with `bytes` of it handed out
+    void *new_block(size_t size, size_t alignment, size_t bytes, bool make_current)
+    {
+        m_blocks.push_back(block_t{ std::unique_ptr<char[]>(new char[size]), size });
+        char *data = m_blocks.back().data.get();
+        uintptr_t p = ((uintptr_t) data + alignment - 1) & ~(uintptr_t) (alignment - 1);
+        if (make_current) {
+            m_next = (char*) (p + bytes);
+            m_end = data + size;
+        }
+        m_allocated += bytes;
+        return (void*) p;
+    }
+
+    size_t m_block_size;
+    char *m_next;
+    char *m_end;
+    size_t m_allocated;
+    std::vector<block_t> m_blocks;
+};
+
+template<typename T>
+class ArenaAllocator {
+public:
+    typedef T value_type;
+
+    ArenaAllocator(Arena *arena = nullptr) noexcept
+        : m_arena{ arena }
+    {}
+
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U> &other) noexcept
+        : m_arena{ other.arena() }
+    {}
+
+    T *allocate(size_t n)
+    {
+        if (m_arena == nullptr)
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        return static_cast<T*>(m_arena->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *p, size_t)
+    {
+        if (m_arena == nullptr)
+            ::operator delete(p);
+    }
+
+    Arena *arena() const {
+        return m_arena;
+    }
+
+private:
+    Arena *m_arena;
+};
+
+template<typename T, typename U>
+bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b)
+{
+    return a.arena() == b.arena();
+}
+
+template<typename T, typename U>
+bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b)
+{
+    return !(a == b);
+}
@@ -0,0 +1,46 @@
+// Reads and writes trivially copyable values and vectors of them as raw
+// bytes, in the byte order of the machine.  The readers return false if the
+// stream ends early.
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <type_traits>
+#include <vector>
+
+template<typename T>
+void write_binary(std::ostream &out, const T &value)
+{
+    static_assert(std::is_trivially_copyable<T>::value, "write_binary() needs a trivially copyable type");
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template<typename T>
+bool read_binary(std::istream &in, T &value)
+{
+    static_assert(std::is_trivially_copyable<T>::value, "read_binary() needs a trivially copyable type");
+    return (bool) in.read(reinterpret_cast<char*>(&value), sizeof(T));
+}
+
+// the length, then the elements
+template<typename T, typename A>
+void write_binary(std::ostream &out, const std::vector<T, A> &values)
+{
+    write_binary(out, (uint64_t) values.size());
+    if (!values.empty())
+        out.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+}
+
+// reads at most max_size elements, a longer vector is an error
+template<typename T, typename A>
+bool read_binary(std::istream &in, std::vector<T, A> &values, uint64_t max_size)
+{
+    uint64_t size;
+    if (!read_binary(in, size) || size > max_size)
+        return false;
+    values.resize(size);
+    if (size == 0)
+        return true;
+    return (bool) in.read(reinterpret_cast<char*>(values.data()), size * sizeof(T));
+}
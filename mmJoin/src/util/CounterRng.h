@@ -0,0 +1,56 @@
+// A small counter-based random number generator.
+//
+// The n-th number of a stream is a hash of n (the SplitMix64 finalizer
+// applied to key + n * gamma), so the generator is two words of state, can
+// skip ahead in O(1) with discard() and any number of streams can be drawn
+// from one seed without sharing state: stream s of seed x is independent of
+// every other stream of x.  It is a UniformRandomBitGenerator and can be
+// used with the std distributions.
+#pragma once
+
+#include <cstdint>
+#include <limits>
+
+class CounterRng {
+public:
+    typedef uint64_t result_type;
+
+    explicit CounterRng(uint64_t seed = 0, uint64_t stream = 0)
+        : m_key{ mix(seed ^ mix(stream)) }
+        , m_gamma{ mix(stream + 0x9E3779B97F4A7C15ull) | 1 }
+        , m_counter{ 0 }
+    {}
+
+    static constexpr result_type min() {
+        return 0;
+    }
+
+    static constexpr result_type max() {
+        return std::numeric_limits<result_type>::max();
+    }
+
+    result_type operator()() {
+        return mix(m_key + (++m_counter) * m_gamma);
+    }
+
+    // skip the next n numbers
+    void discard(uint64_t n) {
+        m_counter += n;
+    }
+
+    // how many numbers have been drawn (or skipped) so far
+    uint64_t position() const {
+        return m_counter;
+    }
+
+private:
+    static uint64_t mix(uint64_t z) {
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    uint64_t m_key;
+    uint64_t m_gamma;
+    uint64_t m_counter;
+};
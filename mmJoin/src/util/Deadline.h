@@ -0,0 +1,93 @@
+// A wall clock deadline for sampling loops, what such a loop reports and the
+// loop itself.
+//
+// expired() reads the clock only every check_every calls, so a loop can ask
+// after every sample: with the clock read amortized over several samples the
+// check costs about as much as an integer increment.  The loop can overrun
+// the deadline by up to check_every - 1 samples.
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+class Deadline {
+public:
+    typedef std::chrono::steady_clock clock;
+
+    explicit Deadline(clock::time_point at, unsigned check_every = 16)
+        : m_start{ clock::now() }
+        , m_at{ at }
+        , m_check_every{ check_every < 1 ? 1 : check_every }
+        // the first call checks, so a deadline in the past stops at once
+        , m_calls{ m_check_every - 1 }
+        , m_expired{ false }
+    {}
+
+    // a deadline `budget` from now
+    explicit Deadline(clock::duration budget, unsigned check_every = 16)
+        : Deadline(clock::now() + budget, check_every)
+    {}
+
+    bool expired()
+    {
+        if (m_expired)
+            return true;
+        if (++m_calls < m_check_every)
+            return false;
+        m_calls = 0;
+        m_expired = clock::now() >= m_at;
+        return m_expired;
+    }
+
+    // seconds since the deadline was made
+    double elapsed() const
+    {
+        return std::chrono::duration<double>(clock::now() - m_start).count();
+    }
+
+private:
+    clock::time_point m_start;
+    clock::time_point m_at;
+    unsigned m_check_every;
+    unsigned m_calls;
+    bool m_expired;
+};
+
+// the outcome of a deadline bounded sampling call
+struct SampleReport {
+    // samples tried (walks, for the samplers which reject)
+    uint64_t attempts = 0;
+    uint64_t accepted = 0;
+    double seconds = 0.0;
+    // true if the deadline stopped the call before it had enough samples
+    bool expired = false;
+
+    double acceptance_rate() const
+    {
+        return attempts == 0 ? 0.0 : (double) accepted / attempts;
+    }
+};
+
+// Append samples to output until there are max_samples new ones or the
+// deadline expires.  draw(sample) draws one sample into `sample` and returns
+// true if it is accepted; `sample` starts as a copy of the last argument.
+template <typename Sample, typename Draw>
+SampleReport sample_until_deadline(Deadline &deadline, std::vector<Sample> &output, size_t max_samples, Draw draw, Sample sample = Sample())
+{
+    SampleReport report;
+    while (report.accepted < max_samples) {
+        if (deadline.expired()) {
+            report.expired = true;
+            break;
+        }
+        ++report.attempts;
+        if (draw(sample)) {
+            output.push_back(sample);
+            ++report.accepted;
+        }
+    }
+    report.seconds = deadline.elapsed();
+    return report;
+}
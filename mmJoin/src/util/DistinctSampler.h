@@ -0,0 +1,74 @@
+// Draws distinct integers uniformly at random from [0, total).  Used to sample
+// join results without replacement, since a join index maps [0, GetTotal())
+// one to one onto the join results.
+#pragma once
+
+#include <vector>
+#include <unordered_set>
+#include <random>
+#include <algorithm>
+#include <cstdint>
+
+namespace DistinctSampler
+{
+    // when at least 1/dense_fraction of the range is requested we scan the
+    // range sequentially instead of hashing the selected values.
+    constexpr size_t dense_fraction = 4;
+
+    // hash for 64 and 128 bit integers (std::hash has no 128 bit version)
+    template <typename Int>
+    struct wide_hash {
+        size_t operator()(Int v) const {
+            uint64_t x = (uint64_t) v ^ (uint64_t) (v >> 32 >> 32);
+            return (size_t) (x * 0x9E3779B97F4A7C15ull);
+        }
+    };
+
+    // Returns min(count, total) distinct values of [0, total) in random order.
+    // Floyd's algorithm is used for sparse requests.  For dense requests we use
+    // selection sampling (Knuth's algorithm S), which is linear in total, which
+    // in turn is at most dense_fraction * count.  Either way the cost is O(count).
+    template <typename Int, typename Generator>
+    std::vector<Int> sample(Int total, size_t count, Generator &gen)
+    {
+        std::vector<Int> result;
+        if (total <= 0 || count == 0)
+            return result;
+
+        if ((Int) count >= total) {
+            count = (size_t) total;
+        }
+        result.reserve(count);
+
+        if ((Int) count * (Int) dense_fraction >= total) {
+            std::uniform_real_distribution<double> coin(0.0, 1.0);
+            size_t needed = count;
+            for (Int i = 0; needed > 0; ++i) {
+                // select i with probability needed / (remaining values)
+                if (coin(gen) * (double) (total - i) < (double) needed) {
+                    result.push_back(i);
+                    --needed;
+                }
+            }
+        }
+        else {
+            std::unordered_set<Int, wide_hash<Int> > chosen;
+            chosen.reserve(count);
+            for (Int j = total - (Int) count; j < total; ++j) {
+                std::uniform_int_distribution<Int> dist(0, j);
+                Int t = dist(gen);
+                if (!chosen.insert(t).second) {
+                    chosen.insert(j);
+                    result.push_back(j);
+                }
+                else {
+                    result.push_back(t);
+                }
+            }
+        }
+
+        // both methods leave some order bias (selection sampling is sorted)
+        std::shuffle(result.begin(), result.end(), gen);
+        return result;
+    }
+}
@@ -1,176 +1,543 @@
+// A prefix sum tree over non-negative weights for weighted selection, laid
+// out for the cache.
+//
+// Instead of the binary tree of the classic Fenwick tree (see
+// StatelessFenwickTree.h), where every step of a search is a likely cache
+// miss on a large tree, this is a B-ary tree of nodes of one cache line:
+// 8 lanes of int64_t or 16 of int32_t.  Lane j of a leaf holds the inclusive
+// prefix sum of the first j + 1 weights of the node, lane j of an inner node
+// the inclusive prefix sum of the totals of its first j + 1 children.  A
+// search reads one node per level, log_B(n) cache lines instead of log_2(n),
+// and picks the child by comparing all lanes of the node at once.  An update
+// adds to the lanes from the updated child on, one node per level.  Both
+// are SIMD with AVX2 (build with -mavx2 or -march=native), plain loops the
+// compiler may vectorize otherwise.
+//
+// The levels of a tree much larger than the cache are on different pages,
+// so there an update costs a TLB miss per level, while the update path of
+// the binary tree stays close to the leaf: for millions of weights updates
+// are slower than StatelessFenwickTree::update_add_value(), searches still
+// faster (see fenwick_benchmark.cpp).
+//
+// The levels are stored root first.  A tree of at most B weights is just
+// its root, of exactly size() lanes, so small trees take no more space than
+// the weights; larger trees pad the root to a full node and align the nodes
+// to cache lines, which costs up to B - 1 lanes of slack.
+//
+// The sums must fit in T.  Not thread safe.
 #pragma once
-#include <vector>
+
 #include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "cpp_macros.h"
+
+// Searching and updating one full node of FenwickTree<T>.  The generic
+// versions are branch free loops over the lanes.
+template<typename T>
+struct FenwickNode {
+    static constexpr size_t bytes = 64;
+    static constexpr size_t lanes = bytes / sizeof(T);
+
+    // the number of lanes <= value
+    static size_t count_not_greater(const T *node, T value)
+    {
+        size_t count = 0;
+        for (size_t j = 0; j < lanes; ++j)
+            count += node[j] <= value;
+        return count;
+    }
+
+    // add delta to the lanes from `first` on
+    static void add_from(T *node, size_t first, T delta)
+    {
+        for (size_t j = first; j < lanes; ++j)
+            node[j] += delta;
+    }
+};
+
+#if defined(__AVX2__)
+template<>
+inline size_t FenwickNode<int64_t>::count_not_greater(const int64_t *node, int64_t value)
+{
+    const __m256i v = _mm256_set1_epi64x(value);
+    __m256i a = _mm256_cmpgt_epi64(_mm256_loadu_si256((const __m256i*) node), v);
+    __m256i b = _mm256_cmpgt_epi64(_mm256_loadu_si256((const __m256i*) (node + 4)), v);
+    int greater = _mm256_movemask_pd(_mm256_castsi256_pd(a)) | (_mm256_movemask_pd(_mm256_castsi256_pd(b)) << 4);
+    return lanes - __builtin_popcount(greater);
+}
 
-// the code for this implementation is based on the topcoder tutorial.
-// https://www.topcoder.com/community/data-science/data-science-tutorials/binary-indexed-trees/
+template<>
+inline void FenwickNode<int64_t>::add_from(int64_t *node, size_t first, int64_t delta)
+{
+    const __m256i d = _mm256_set1_epi64x(delta);
+    const __m256i f = _mm256_set1_epi64x((int64_t) first - 1);
+    const __m256i lo = _mm256_setr_epi64x(0, 1, 2, 3);
+    const __m256i hi = _mm256_setr_epi64x(4, 5, 6, 7);
+    __m256i *p = (__m256i*) node;
+    __m256i a = _mm256_loadu_si256(p);
+    __m256i b = _mm256_loadu_si256(p + 1);
+    a = _mm256_add_epi64(a, _mm256_and_si256(_mm256_cmpgt_epi64(lo, f), d));
+    b = _mm256_add_epi64(b, _mm256_and_si256(_mm256_cmpgt_epi64(hi, f), d));
+    _mm256_storeu_si256(p, a);
+    _mm256_storeu_si256(p + 1, b);
+}
+
+template<>
+inline size_t FenwickNode<int32_t>::count_not_greater(const int32_t *node, int32_t value)
+{
+    const __m256i v = _mm256_set1_epi32(value);
+    __m256i a = _mm256_cmpgt_epi32(_mm256_loadu_si256((const __m256i*) node), v);
+    __m256i b = _mm256_cmpgt_epi32(_mm256_loadu_si256((const __m256i*) (node + 8)), v);
+    int greater = _mm256_movemask_ps(_mm256_castsi256_ps(a)) | (_mm256_movemask_ps(_mm256_castsi256_ps(b)) << 8);
+    return lanes - __builtin_popcount(greater);
+}
+
+template<>
+inline void FenwickNode<int32_t>::add_from(int32_t *node, size_t first, int32_t delta)
+{
+    const __m256i d = _mm256_set1_epi32(delta);
+    const __m256i f = _mm256_set1_epi32((int32_t) first - 1);
+    const __m256i lo = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i hi = _mm256_setr_epi32(8, 9, 10, 11, 12, 13, 14, 15);
+    __m256i *p = (__m256i*) node;
+    __m256i a = _mm256_loadu_si256(p);
+    __m256i b = _mm256_loadu_si256(p + 1);
+    a = _mm256_add_epi32(a, _mm256_and_si256(_mm256_cmpgt_epi32(lo, f), d));
+    b = _mm256_add_epi32(b, _mm256_and_si256(_mm256_cmpgt_epi32(hi, f), d));
+    _mm256_storeu_si256(p, a);
+    _mm256_storeu_si256(p + 1, b);
+}
+#endif
+
+template<typename T, typename Alloc = std::allocator<T> >
 class FenwickTree
 {
-private:
-    int64_t *data_base;
-    uint32_t m_size;
-    std::vector<int64_t> m_tree;
-    uint32_t m_mask;
 public:
-    FenwickTree(int size)
+    typedef T value_type;
+    typedef Alloc allocator_type;
+    typedef FenwickNode<T> node;
+
+    static constexpr size_t lanes = node::lanes;
+
+    explicit FenwickTree(const Alloc &alloc = Alloc())
+        : m_data(alloc)
+        , m_offset{ 0 }
+        , m_size{ 0 }
+        , m_height{ 0 }
+    {}
+
+    // count weights of `value` each
+    FenwickTree(size_t count, T value, const Alloc &alloc = Alloc())
+        : FenwickTree(alloc)
     {
-        m_tree.resize(size + 1);
-        m_mask = 1 << log2(m_tree.size());
-        m_tree = std::move(pre_tree);
-        m_tree.resize(m_tree.size() + 1);
-        m_mask = 1 << log2(m_tree.size());
+        assign(count, value);
+    }
 
-        std::vector<int64_t> sums;
-        sums.resize(log2(m_tree.size()) + 1);
+    FenwickTree(const FenwickTree &other)
+        : m_data(other.m_data)
+        , m_offset{ other.m_offset }
+        , m_size{ other.m_size }
+        , m_height{ other.m_height }
+    {
+        realign(other.m_offset);
+    }
 
-        for (int i = 0; i < m_tree.size(); ++i)
-        {
+    FenwickTree(FenwickTree &&other)
+        : m_data(std::move(other.m_data))
+        , m_offset{ other.m_offset }
+        , m_size{ other.m_size }
+        , m_height{ other.m_height }
+    {
+        realign(other.m_offset);
+        other.clear();
+    }
 
-            int index = log2(i&(-i));
-            int64_t value = m_tree[i];
-            m_tree[i] = sums[index];
+    FenwickTree &operator=(const FenwickTree &other)
+    {
+        if (this != &other) {
+            m_data = other.m_data;
+            m_size = other.m_size;
+            m_height = other.m_height;
+            realign(other.m_offset);
+        }
+        return *this;
+    }
 
-            std::fill(sums.begin(), sums.begin() + index + 1, 0);
-            std::transform(sums.begin(), sums.end(), sums.begin(), [value](int v) { return value + v;});
+    FenwickTree &operator=(FenwickTree &&other)
+    {
+        if (this != &other) {
+            m_data = std::move(other.m_data);
+            m_size = other.m_size;
+            m_height = other.m_height;
+            realign(other.m_offset);
+            other.clear();
         }
+        return *this;
+    }
 
-        //m_tree.back() = sums.back();
+    // Replace the weights by count weights of `value`.
+    void assign(size_t count, T value)
+    {
+        reshape(count);
+        if (count == 0)
+            return;
+        T *leaves = level(0);
+        size_t leaf_lanes = m_height == 1 ? m_size : leaf_nodes() * lanes;
+        std::fill(leaves, leaves + count, value);
+        std::fill(leaves + count, leaves + leaf_lanes, 0);
+        build_leaves();
+        build_upper();
+    }
 
+    // Replace the weights by values[0 .. count - 1].
+    void assign(const T *values, size_t count)
+    {
+        reshape(count);
+        if (count == 0)
+            return;
+        T *leaves = level(0);
+        size_t leaf_lanes = m_height == 1 ? m_size : leaf_nodes() * lanes;
+        std::copy(values, values + count, leaves);
+        std::fill(leaves + count, leaves + leaf_lanes, 0);
+        build_leaves();
+        build_upper();
+    }
+
+    void clear()
+    {
+        m_data.clear();
+        m_offset = 0;
+        m_size = 0;
+        m_height = 0;
     }
 
-    ~FenwickTree()
-    {};
+    size_t size() const {
+        return m_size;
+    }
+
+    bool empty() const {
+        return m_size == 0;
+    }
 
-    // read the cumulative frequency at idx
-    int64_t read(int idx) {
-        int64_t sum = 0;
-        while (idx > 0) {
-            sum += m_tree[idx];
-            idx -= (idx & -idx);
+    // the sum of all weights
+    T total() const
+    {
+        if (m_size == 0)
+            return 0;
+        return level(m_height - 1)[root_width() - 1];
+    }
+
+    // the weight at idx
+    T get(size_t idx) const
+    {
+        assert(idx < m_size);
+        const T *leaf = level(0) + (idx & ~(lanes - 1));
+        size_t lane = idx & (lanes - 1);
+        return lane == 0 ? leaf[0] : leaf[lane] - leaf[lane - 1];
+    }
+
+    // the sum of the weights before idx, idx <= size()
+    T prefix(size_t idx) const
+    {
+        assert(idx <= m_size);
+        if (idx == m_size)
+            return total();
+
+        T sum = 0;
+        const T *p = level(0);
+        for (unsigned l = 0; l < m_height; ++l) {
+            size_t lane = (idx >> (shift * l)) & (lanes - 1);
+            if (lane != 0)
+                sum += p[(idx >> (shift * (l + 1))) * lanes + lane - 1];
+            if (l + 1 < m_height)
+                p -= level_lanes(l + 1);
         }
         return sum;
-    };
+    }
 
-    // change the frequency at some position and update tree
-    void update(int idx, int val) {
-        while (idx <= m_tree.size()) {
-            m_tree[idx] += val;
-            idx += (idx & -idx);
+    // add delta to the weight at idx
+    void add(size_t idx, T delta)
+    {
+        assert(idx < m_size);
+        if (delta == 0)
+            return;
+        if (m_height == 1) {
+            T *root = level(0);
+            for (size_t j = idx; j < m_size; ++j)
+                root[j] += delta;
+            return;
+        }
+        // the nodes to update are known up front, fetch them all before
+        // writing to any so the cache misses overlap
+        T *nodes_to_update[max_height];
+        T *p = level(0);
+        for (unsigned l = 0; l < m_height; ++l) {
+            nodes_to_update[l] = p + (idx >> (shift * (l + 1))) * lanes;
+            prefetch_for_write(nodes_to_update[l]);
+            if (l + 1 < m_height)
+                p -= level_lanes(l + 1);
         }
+        for (unsigned l = 0; l < m_height; ++l)
+            node::add_from(nodes_to_update[l], (idx >> (shift * l)) & (lanes - 1), delta);
     }
 
-    // read the frequency at idx
-    int64_t readSingle(int idx) {
-        int64_t sum = m_tree[idx];
-        if (idx > 0) {
-            int z = idx - (idx & -idx);
-            --idx;
-            while (idx != z) {
-                sum -= m_tree[idx];
-                idx -= (idx & -idx);
-            }
-        }
-        return sum;
-    };
-
-    // scale the entire tree by a constant factor
-    void scale_up(int c) {
-        for (int i = 1; i <= m_tree.size(); ++i)
-            update(-(c - 1) * readSingle(i) / c, i);
-    };
-
-    // scale the entire tree by a constant factor
-    void scale_down(int c) {
-        for (int i = 1; i <= m_tree.size(); ++i)
-            m_tree[i] = m_tree[i] / c;
-    };
-
-    size_t find(int64_t &cumFre) {
-        int idx = 0; // this var is result of function
-        uint32_t bitMask{ m_mask };
-
-        while ((bitMask != 0) && (idx < m_tree.size())) { // nobody likes overflow :)
-            int tIdx = idx + bitMask;
-            if (cumFre == m_tree[tIdx]) // if it is equal, we just return idx
-                return tIdx;
-            else if (cumFre > m_tree[tIdx]) {
-                // if tree frequency "can fit" into cumFree,
-                // then include it
-                idx = tIdx; // update index
-                cumFre -= m_tree[tIdx]; // set frequency for next loop
-            }
-            bitMask >>= 1; // half current interval
+    // set the weight at idx, returns the old weight
+    T set(size_t idx, T value)
+    {
+        T old = get(idx);
+        add(idx, value - old);
+        return old;
+    }
+
+    // Find the weight which covers cumFreq: the largest idx < size() with
+    // prefix(idx) <= cumFreq, which is the last index if cumFreq >= total().
+    // cumFreq becomes cumFreq - prefix(idx), the offset into the weight.
+    // Like StatelessFenwickTree::findG_mod().  The tree must not be empty.
+    size_t find(T &cumFreq) const
+    {
+        assert(m_size > 0);
+        if (cumFreq >= total()) {
+            size_t idx = m_size - 1;
+            cumFreq -= prefix(idx);
+            return idx;
         }
 
-        //if (cumFre != 0) // maybe given cumulative frequency doesn't exist
-        //        return -1;
-        //else
-        return idx;
-    };
-
-    // if the tree has more than one index with the same
-    // cumulative frequency, this procedure will return
-    // the greatest one
-    int findG(int64_t &cumFre) {
-        int idx = 0;
-        uint32_t bitMask{ m_mask };
-
-        while ((bitMask != 0) && (idx < m_tree.size())) {
-            int tIdx = idx + bitMask;
-            if (cumFre >= m_tree[tIdx]) {
-                // if current cumulative frequency is equal to cumFre,
-                // we are still looking for higher index (if exists)
-                idx = tIdx;
-                cumFre -= m_tree[tIdx];
-            }
-            bitMask >>= 1;
+        // the levels follow each other from the root down
+        const T *base = m_data.data() + m_offset;
+        const T *p = base;
+        size_t offset = 0;
+        size_t count = m_height == 1 && m_size < lanes
+            ? count_partial(p, m_size, cumFreq)
+            : node::count_not_greater(p, cumFreq);
+        size_t idx = 0;
+        for (unsigned l = m_height - 1; ; --l) {
+            if (count != 0)
+                cumFreq -= p[count - 1];
+            idx = idx * lanes + count;
+            if (l == 0)
+                return idx;
+            offset += level_lanes(l);
+            p = base + offset + idx * lanes;
+            count = node::count_not_greater(p, cumFreq);
         }
-        return idx;
-    };
+    }
 
-    // if the tree has more than one index with the same
-    // cumulative frequency, this procedure will return
-    // the greatest one
-    int findL(int64_t &cumFre) {
-        // TODO optimize search for lower bound
-        //int64_t cumFre1{ cumFre - 1 };
-        int64_t cumFreT{ cumFre };
-        //int retVal1 = findG(cumFre1);
-        int retVal = findG(cumFreT);
-        int64_t cumFre1{ cumFre - cumFreT - 1 };
-        int retVal1 = findG(cumFre1);
+    // Multiply every weight by c.
+    void multiply(T c)
+    {
+        T *p = m_data.data() + m_offset;
+        size_t n = used_lanes();
+        for (size_t i = 0; i < n; ++i)
+            p[i] *= c;
+    }
 
-        cumFre = cumFreT;
+    // Divide every weight by c, rounding down.
+    void divide(T c)
+    {
+        if (m_size == 0)
+            return;
+        T *leaves = level(0);
+        size_t nodes = m_height == 1 ? 1 : leaf_nodes();
+        size_t width = m_height == 1 ? m_size : lanes;
+        for (size_t k = 0; k < nodes; ++k) {
+            T *leaf = leaves + k * width;
+            for (size_t j = width - 1; j > 0; --j)
+                leaf[j] -= leaf[j - 1];
+        }
+        size_t leaf_lanes = nodes * width;
+        for (size_t i = 0; i < leaf_lanes; ++i)
+            leaves[i] /= c;
+        build_leaves();
+        build_upper();
+    }
 
-        // if they are not equal, increase by one.
-        return retVal1 + (retVal1 != retVal);
-    };
+    // copy the weights to out[0 .. size() - 1]
+    void read_values(T *out) const
+    {
+        if (m_size == 0)
+            return;
+        const T *leaves = level(0);
+        for (size_t i = 0; i < m_size; ++i) {
+            size_t lane = i & (lanes - 1);
+            out[i] = lane == 0 ? leaves[i] : leaves[i] - leaves[i - 1];
+        }
+    }
 
-    size_t size()
+    std::vector<T> values() const
     {
-        return m_tree.size();
+        std::vector<T> out(m_size);
+        if (m_size != 0)
+            read_values(out.data());
+        return out;
     }
-    int64_t get_value(size_t idx)
+
+    // hint that the tree is about to be searched: fetch the root
+    void prefetch() const
     {
-        return m_tree[idx];
+        if (m_size != 0)
+            prefetch_for_read(level(m_height - 1));
+    }
+
+    // bytes of the nodes, with the alignment slack
+    size_t memory() const {
+        return m_data.capacity() * sizeof(T);
     }
+
 private:
-    int log2(int32_t v)
+    static constexpr unsigned shift = lanes == 8 ? 3 : lanes == 16 ? 4 : lanes == 4 ? 2 : 1;
+    static_assert((size_t(1) << shift) == lanes, "FenwickTree needs a power of two lanes per node");
+    // enough levels for any size_t size
+    static constexpr unsigned max_height = (sizeof(size_t) * 8 + shift - 1) / shift;
+
+    // the number of nodes of level l, where level 0 are the leaves
+    size_t nodes(unsigned l) const {
+        return ((m_size - 1) >> (shift * (l + 1))) + 1;
+    }
+
+    size_t leaf_nodes() const {
+        return nodes(0);
+    }
+
+    // the used lanes of the root
+    size_t root_width() const {
+        return ((m_size - 1) >> (shift * (m_height - 1))) + 1;
+    }
+
+    size_t used_lanes() const
+    {
+        if (m_size == 0)
+            return 0;
+        if (m_height == 1)
+            return m_size;
+        size_t n = lanes;
+        for (unsigned l = 0; l + 1 < m_height; ++l)
+            n += nodes(l) * lanes;
+        return n;
+    }
+
+    // the first lane of level l.  The root is first, then every level
+    // below it.
+    T *level(unsigned l) {
+        return m_data.data() + m_offset + level_offset(l);
+    }
+
+    const T *level(unsigned l) const {
+        return m_data.data() + m_offset + level_offset(l);
+    }
+
+    // the lanes of level l
+    size_t level_lanes(unsigned l) const {
+        return l + 1 == m_height ? lanes : nodes(l) * lanes;
+    }
+
+    size_t level_offset(unsigned l) const
     {
-        int r;      // result goes here
+        if (l + 1 == m_height)
+            return 0;
+        size_t offset = lanes;
+        for (unsigned k = m_height - 2; k > l; --k)
+            offset += nodes(k) * lanes;
+        return offset;
+    }
 
-        static const int MultiplyDeBruijnBitPosition[32] =
-        {
-            0, 9, 1, 10, 13, 21, 2, 29, 11, 14, 16, 18, 22, 25, 3, 30,
-            8, 12, 20, 28, 15, 17, 24, 7, 19, 27, 23, 6, 26, 5, 4, 31
-        };
+    static size_t count_partial(const T *p, size_t width, T value)
+    {
+        size_t count = 0;
+        for (size_t j = 0; j < width; ++j)
+            count += p[j] <= value;
+        return count;
+    }
 
-        v |= v >> 1; // first round down to one less than a power of 2 
-        v |= v >> 2;
-        v |= v >> 4;
-        v |= v >> 8;
-        v |= v >> 16;
+    // size the storage for count weights, their values are undefined
+    void reshape(size_t count)
+    {
+        m_size = count;
+        m_height = 0;
+        if (count == 0) {
+            m_data.clear();
+            m_offset = 0;
+            return;
+        }
+        m_height = 1;
+        while (((count - 1) >> (shift * m_height)) != 0)
+            ++m_height;
 
-        return MultiplyDeBruijnBitPosition[(uint32_t)(v * 0x07C4ACDDU) >> 27];
+        if (m_height == 1) {
+            m_data.resize(count);
+            m_offset = 0;
+            return;
+        }
+        // slack to align the first lane to a cache line
+        m_data.resize(used_lanes() + lanes - 1);
+        m_offset = aligned_offset();
+    }
+
+    size_t aligned_offset() const
+    {
+        if (m_height <= 1)
+            return 0;
+        uintptr_t p = (uintptr_t) m_data.data();
+        uintptr_t aligned = (p + node::bytes - 1) & ~(uintptr_t) (node::bytes - 1);
+        return (aligned - p) / sizeof(T);
     }
+
+    // The nodes were copied into m_data at old_offset, move them to the
+    // aligned offset of the new storage.
+    void realign(size_t old_offset)
+    {
+        m_offset = aligned_offset();
+        if (m_offset != old_offset)
+            std::memmove(m_data.data() + m_offset, m_data.data() + old_offset, used_lanes() * sizeof(T));
+    }
+
+    // turn the weights in the leaves into prefix sums within each leaf
+    void build_leaves()
+    {
+        T *leaves = level(0);
+        size_t nodes = m_height == 1 ? 1 : leaf_nodes();
+        size_t width = m_height == 1 ? m_size : lanes;
+        for (size_t k = 0; k < nodes; ++k) {
+            T *leaf = leaves + k * width;
+            for (size_t j = 1; j < width; ++j)
+                leaf[j] += leaf[j - 1];
+        }
+    }
+
+    // fill the inner nodes from the leaves
+    void build_upper()
+    {
+        for (unsigned l = 1; l < m_height; ++l) {
+            const T *children = level(l - 1);
+            size_t child_count = nodes(l - 1);
+            T *parents = level(l);
+            size_t parent_lanes = (l + 1 == m_height) ? lanes : nodes(l) * lanes;
+            T sum = 0;
+            for (size_t i = 0; i < parent_lanes; ++i) {
+                if ((i & (lanes - 1)) == 0)
+                    sum = 0;
+                if (i < child_count)
+                    sum += children[i * lanes + lanes - 1];
+                parents[i] = sum;
+            }
+        }
+    }
+
+    std::vector<T, Alloc> m_data;
+    // the first lane of the tree in m_data
+    size_t m_offset;
+    size_t m_size;
+    unsigned m_height;
 };
+
+typedef FenwickTree<int32_t> FenwickTree32;
+typedef FenwickTree<int64_t> FenwickTree64;
@@ -25,24 +25,22 @@ uint32_t StatelessFenwickTree::log2(int32_t v)
 
 void StatelessFenwickTree::initialize(int64_t *data_start, size_t size)
 {
-    std::vector<int64_t> sums;
-    sums.resize(log2(size) + 1, 0);
-
-    for (int i = 0; i < size; ++i) {
-        int index = StatelessFenwickTree::log2(i&(-i));
-        int64_t value = data_start[i];
-
+    // shift the values one up, the tree keeps data[0 .. size - 2] at
+    // 1 .. size - 1, then add every node into its parent.  Linear rather
+    // than a log factor per value.
+    for (size_t i = size; i-- > 0;) {
         // we only support doing prefix sum of positive numbers
-        assert(value > 0);
-
-        data_start[i] = sums[index];
-
-        // if we are taking a sum of positive numbers we should always output
-        // something greater then or equal to zero.
-        assert(data_start[i] >= 0);
+        assert(data_start[i] > 0);
+        if (i > 0)
+            data_start[i] = data_start[i - 1];
+    }
+    if (size > 0)
+        data_start[0] = 0;
 
-        std::fill(sums.begin(), sums.begin() + index + 1, 0);
-        std::transform(sums.begin(), sums.end(), sums.begin(), [value](int64_t v) { return value + v;});
+    for (size_t i = 1; i < size; ++i) {
+        size_t parent = i + (i & -i);
+        if (parent < size)
+            data_start[parent] += data_start[i];
     }
 }
 
@@ -81,12 +79,26 @@ void StatelessFenwickTree::update_add_value(int64_t *data_start, size_t size, si
 }
 
 void StatelessFenwickTree::scale_up(int64_t *data_start, size_t size, int64_t value) {
-    for (int i = 1; i < size; ++i)
-        StatelessFenwickTree::update_add_value(data_start, size, i, -(value - 1) * StatelessFenwickTree::readSingle_value(data_start, i) / value);
+    // take the tree apart into the frequencies, the inverse of the second
+    // loop of initialize(), scale them in one pass and build it again.
+    // The same result as adjusting every frequency with update_add_value(),
+    // in linear time.
+    for (size_t i = size; i-- > 1;) {
+        size_t parent = i + (i & -i);
+        if (parent < size)
+            data_start[parent] -= data_start[i];
+    }
+    for (size_t i = 1; i < size; ++i)
+        data_start[i] -= (value - 1) * data_start[i] / value;
+    for (size_t i = 1; i < size; ++i) {
+        size_t parent = i + (i & -i);
+        if (parent < size)
+            data_start[parent] += data_start[i];
+    }
 }
 
 void StatelessFenwickTree::scale_down(int64_t *data_start, size_t size, int64_t value) {
-    for (int i = 1; i < size; ++i)
+    for (size_t i = 1; i < size; ++i)
         data_start[i] = data_start[i] / value;
 }
 
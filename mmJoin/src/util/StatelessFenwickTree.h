@@ -3,6 +3,9 @@
 // The code for this implementation is based on the topcode tutorial
 //
 // all state needed to perform an algorithm are provided in the function call
+//
+// FenwickTree.h has a tree laid out for the cache, faster on large weight
+// sets.
 
 
 #pragma once
@@ -7,4 +7,13 @@
 #define if_constexpr if
 #endif
 
+// hint that *addr will be read soon, or written
+#if defined(__GNUC__) || defined(__clang__)
+#define prefetch_for_read(addr) __builtin_prefetch((addr), 0, 3)
+#define prefetch_for_write(addr) __builtin_prefetch((addr), 1, 3)
+#else
+#define prefetch_for_read(addr) ((void) (addr))
+#define prefetch_for_write(addr) ((void) (addr))
+#endif
+
 #endif // UTIL_CPP_MACROS_H